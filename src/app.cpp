@@ -21,6 +21,7 @@
 #include "app.h"
 
 #include "app/app_options.h"
+#include "app/batch_converter.h"
 #include "app/check_update.h"
 #include "app/color_utils.h"
 #include "app/data_recovery.h"
@@ -55,6 +56,7 @@
 #include "ui/gui.h"
 #include "ui/intern.h"
 #include "ui_context.h"
+#include "undoers/stored_data.h"
 #include "util/boundary.h"
 #include "util/render.h"
 #include "widgets/color_bar.h"
@@ -109,6 +111,7 @@ App::App(int argc, const char* argv[])
   , m_legacy(NULL)
   , m_isGui(false)
   , m_isShell(false)
+  , m_threads(0)
 {
   ASSERT(m_instance == NULL);
   m_instance = this;
@@ -120,6 +123,8 @@ App::App(int argc, const char* argv[])
   m_isShell = options.startShell();
   m_legacy = new LegacyModules(isGui() ? REQUIRE_INTERFACE: 0);
   m_files = options.files();
+  m_saveAsPattern = options.saveAsPattern();
+  m_threads = options.threads();
 
   // Register well-known image file types.
   FileFormatsManager::instance().registerAllFormats();
@@ -130,6 +135,10 @@ App::App(int argc, const char* argv[])
   // Load RenderEngine configuration
   RenderEngine::loadConfig();
 
+  // Memory for compressed undo data (the rest goes to a temporary file)
+  undoers::StoredData::setMemoryLimit
+    ((size_t)MID(1, get_config_int("Options", "UndoMemoryLimit", 16), 9999)*1024*1024);
+
   // Default palette.
   if (!options.paletteFileName().empty()) {
     const char* palFile = options.paletteFileName().c_str();
@@ -172,6 +181,19 @@ int App::run()
   // Set background mode for non-GUI modes
   set_display_switch_mode(SWITCH_BACKGROUND);
 
+  // Convert all files in batch mode (without the GUI and without
+  // adding the documents to the context).
+  if (!m_saveAsPattern.empty()) {
+    app::BatchConverter converter(m_saveAsPattern, m_threads);
+    for (FileList::iterator
+           it  = m_files.begin(),
+           end = m_files.end();
+         it != end; ++it)
+      converter.addFiles(*it);
+
+    return (converter.convertAll(std::cout) == 0 ? 0: 1);
+  }
+
   // Procress options
   PRINTF("Processing options...\n");
 
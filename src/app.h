@@ -81,6 +81,8 @@ private:
   bool m_isShell;
   UniquePtr<MainWindow> m_mainWindow;
   FileList m_files;
+  std::string m_saveAsPattern;
+  int m_threads;
 };
 
 void app_refresh_screen();
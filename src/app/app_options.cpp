@@ -22,6 +22,7 @@
 
 #include "base/path.h"
 
+#include <cstdlib>
 #include <iostream>
 
 namespace app {
@@ -33,10 +34,13 @@ AppOptions::AppOptions(int argc, const char* argv[])
   , m_startUI(true)
   , m_startShell(false)
   , m_verbose(false)
+  , m_threads(0)
 {
   Option& palette = m_po.add("palette").requiresValue("GFXFILE").description("Use a specific palette by default");
   Option& shell = m_po.add("shell").description("Start an interactive console to execute scripts");
   Option& batch = m_po.add("batch").description("Do not start the UI");
+  Option& saveAs = m_po.add("save-as").requiresValue("OUTPUT").description("Convert FILES (wildcards allowed) to OUTPUT without UI.\nOUTPUT can contain {path}, {name} and {title}\nof each file, e.g. \"{path}/{title}.png\"");
+  Option& threads = m_po.add("threads").requiresValue("N").description("Number of files to convert in parallel\n(by default one for each CPU)");
   Option& verbose = m_po.add("verbose").description("Explain what is being done (in stderr or a log file)");
   Option& help = m_po.add("help").mnemonic('?').description("Display this help and exits");
   Option& version = m_po.add("version").description("Output version information and exit");
@@ -47,6 +51,8 @@ AppOptions::AppOptions(int argc, const char* argv[])
     m_verbose = verbose.enabled();
     m_paletteFileName = palette.value();
     m_startShell = shell.enabled();
+    m_saveAsPattern = saveAs.value();
+    m_threads = std::atoi(threads.value().c_str());
 
     if (help.enabled()) {
       showHelp();
@@ -57,7 +63,7 @@ AppOptions::AppOptions(int argc, const char* argv[])
       m_startUI = false;
     }
 
-    if (shell.enabled() || batch.enabled()) {
+    if (shell.enabled() || batch.enabled() || saveAs.enabled()) {
       m_startUI = false;
     }
   }
@@ -37,6 +37,11 @@ public:
 
   const std::string& paletteFileName() const { return m_paletteFileName; }
 
+  // Output file name pattern to convert all files in batch mode (see
+  // BatchConverter), or an empty string to open the files.
+  const std::string& saveAsPattern() const { return m_saveAsPattern; }
+  int threads() const { return m_threads; }
+
   const base::ProgramOptions::ValueList& files() const {
     return m_po.values();
   }
@@ -51,6 +56,8 @@ private:
   bool m_startShell;
   bool m_verbose;
   std::string m_paletteFileName;
+  std::string m_saveAsPattern;
+  int m_threads;
 };
 
 }
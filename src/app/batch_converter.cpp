@@ -0,0 +1,349 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "config.h"
+
+#include "app/batch_converter.h"
+
+#include "base/chrono.h"
+#include "base/fs.h"
+#include "base/path.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+#include "base/thread_pool.h"
+#include "base/unique_ptr.h"
+#include "document.h"
+#include "file/file.h"
+
+#include <allegro/file.h>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+namespace app {
+
+namespace {
+
+int add_matched_file(const char* filename, int attrib, void* param)
+{
+  static_cast<std::vector<std::string>*>(param)->push_back(filename);
+  return 0;
+}
+
+void replace_all(std::string& str, const std::string& from, const std::string& to)
+{
+  std::string::size_type pos = 0;
+  while ((pos = str.find(from, pos)) != std::string::npos) {
+    str.replace(pos, from.size(), to);
+    pos += to.size();
+  }
+}
+
+// Removes the trailing new lines of FileOp error messages.
+std::string trim_error(std::string error)
+{
+  while (!error.empty() && (error[error.size()-1] == '\n' ||
+                            error[error.size()-1] == '\r'))
+    error.erase(error.size()-1);
+  return error;
+}
+
+// Maximum number of documents loaded (or being loaded) for each
+// worker thread which are waiting to be saved.
+const int kDocumentsPerThread = 2;
+
+} // anonymous namespace
+
+class BatchConverter::LoadTask
+{
+public:
+  LoadTask(BatchConverter* converter, Item* item)
+    : m_converter(converter), m_item(item) { }
+
+  void operator()() {
+    m_converter->loadItem(m_item);
+  }
+
+private:
+  BatchConverter* m_converter;
+  Item* m_item;
+};
+
+class BatchConverter::SaveTask
+{
+public:
+  SaveTask(BatchConverter* converter, Item* item, std::ostream* os)
+    : m_converter(converter), m_item(item), m_os(os) { }
+
+  void operator()() {
+    m_converter->saveItem(m_item, m_os);
+  }
+
+private:
+  BatchConverter* m_converter;
+  Item* m_item;
+  std::ostream* m_os;
+};
+
+BatchConverter::BatchConverter(const std::string& outputPattern, int threads)
+  : m_outputPattern(outputPattern)
+  , m_threads(threads)
+  , m_fileOpFlags(0)
+  , m_inFlight(0)
+{
+}
+
+void BatchConverter::addFiles(const std::string& pattern)
+{
+  std::vector<std::string> files;
+  for_each_file_ex(pattern.c_str(), 0, FA_DIREC, add_matched_file, &files);
+
+  // If nothing matches, the file is added anyway so the "File not
+  // found" error is reported in convertAll().
+  if (files.empty())
+    files.push_back(pattern);
+  else
+    std::sort(files.begin(), files.end());
+
+  for (size_t i=0; i<files.size(); ++i) {
+    Item item;
+    item.input = files[i];
+    item.output = getOutputFileName(files[i]);
+    item.time = 0.0;
+    item.document = NULL;
+    item.fop = NULL;
+    m_items.push_back(item);
+  }
+}
+
+std::string BatchConverter::getOutputFileName(const std::string& input) const
+{
+  std::string path = base::get_file_path(input);
+  if (path.empty())
+    path = ".";
+
+  std::string output = m_outputPattern;
+  replace_all(output, "{path}", path);
+  replace_all(output, "{name}", base::get_file_name(input));
+  replace_all(output, "{title}", base::get_file_title(input));
+  return output;
+}
+
+int BatchConverter::convertAll(std::ostream& os)
+{
+  base::Chrono chrono;
+
+  if (!m_items.empty()) {
+    int threads = (m_threads > 0 ? m_threads: base::thread::hardware_concurrency());
+    base::thread_pool pool(MIN(threads, (int)m_items.size()));
+
+    // If several files are converted at the same time, the FileOps
+    // don't create their own threads (the pool already uses all
+    // threads we want).
+    m_fileOpFlags = (pool.size() > 1 ? FILE_LOAD_SINGLE_THREAD |
+                                       FILE_SAVE_SINGLE_THREAD: 0);
+
+    // Only a few documents per thread are kept in memory at the same
+    // time: a new file is loaded when a document is saved (or
+    // discarded because it cannot be saved).
+    m_inFlight = 0;
+    const int maxInFlight = kDocumentsPerThread * pool.size();
+    size_t nextLoad = 0;
+
+    // Prepare the save operations of loaded documents in this thread
+    // and save them in the pool.
+    for (size_t i=0; i<m_items.size(); ) {
+      Item* item = NULL;
+      int loads;
+      {
+        ScopedLock lock(m_mutex);
+        while (m_loaded.empty() &&
+               (m_inFlight >= maxInFlight || nextLoad == m_items.size()))
+          m_itemChanged.wait(lock);
+
+        if (!m_loaded.empty()) {
+          item = m_loaded.front();
+          m_loaded.pop_front();
+        }
+
+        loads = MIN(maxInFlight - m_inFlight, (int)(m_items.size() - nextLoad));
+        m_inFlight += loads;
+      }
+
+      for (; loads > 0; --loads)
+        pool.execute(LoadTask(this, &m_items[nextLoad++]));
+
+      if (!item)
+        continue;
+
+      ++i;
+
+      if (item->document)
+        prepareSave(item);
+
+      if (item->fop)
+        pool.execute(SaveTask(this, item, &os));
+      else {
+        reportItem(item, &os);
+        releaseItem();
+      }
+    }
+
+    pool.wait_all();
+  }
+
+  int errors = 0;
+  for (size_t i=0; i<m_items.size(); ++i)
+    if (!m_items[i].error.empty())
+      ++errors;
+
+  char buf[256];
+  std::sprintf(buf, "%d file(s) converted, %d error(s), %.3f s\n",
+               (int)m_items.size() - errors, errors, chrono.elapsed());
+  os << buf << std::flush;
+
+  return errors;
+}
+
+void BatchConverter::loadItem(Item* item)
+{
+  base::Chrono chrono;
+
+  try {
+    FileOp* fop = fop_to_load_document(item->input.c_str(),
+                                       FILE_LOAD_SEQUENCE_NONE |
+                                       (m_fileOpFlags & FILE_LOAD_SINGLE_THREAD));
+    if (fop) {
+      fop_operate(fop, NULL);
+      fop_done(fop);
+      fop_post_load(fop);
+
+      item->document = fop->document;
+      if (!item->document)
+        item->error = trim_error(fop->has_error() ? fop->error: "Cannot load the file");
+      fop_free(fop);
+    }
+    else
+      item->error = "Cannot load the file";
+  }
+  catch (const std::exception& e) {
+    item->error = e.what();
+  }
+  catch (...) {
+    item->error = "Unknown error";
+  }
+
+  item->time += chrono.elapsed();
+
+  ScopedLock lock(m_mutex);
+  m_loaded.push_back(item);
+  m_itemChanged.notifyOne();
+}
+
+void BatchConverter::prepareSave(Item* item)
+{
+  base::Chrono chrono;
+  UniquePtr<Document> document(item->document);
+  item->document = NULL;
+
+  try {
+    // Save the document with the new file name
+    makeDirectories(base::get_file_path(item->output));
+    document->setFilename(item->output.c_str());
+
+    item->fop = fop_to_save_document(document,
+                                     m_fileOpFlags & FILE_SAVE_SINGLE_THREAD);
+    if (item->fop)
+      item->document = document.release();
+    else
+      item->error = "Cannot save the file";
+  }
+  catch (const std::exception& e) {
+    item->error = e.what();
+  }
+  catch (...) {
+    item->error = "Unknown error";
+  }
+
+  item->time += chrono.elapsed();
+}
+
+void BatchConverter::saveItem(Item* item, std::ostream* os)
+{
+  base::Chrono chrono;
+  UniquePtr<Document> document(item->document);
+  FileOp* fop = item->fop;
+  item->document = NULL;
+  item->fop = NULL;
+
+  try {
+    if (!fop->has_error())
+      fop_operate(fop, NULL);
+    fop_done(fop);
+
+    if (fop->has_error())
+      item->error = trim_error(fop->error);
+  }
+  catch (const std::exception& e) {
+    item->error = e.what();
+  }
+  catch (...) {
+    item->error = "Unknown error";
+  }
+  fop_free(fop);
+
+  item->time += chrono.elapsed();
+  reportItem(item, os);
+  releaseItem();
+}
+
+void BatchConverter::releaseItem()
+{
+  ScopedLock lock(m_mutex);
+  --m_inFlight;
+  m_itemChanged.notifyOne();
+}
+
+void BatchConverter::reportItem(Item* item, std::ostream* os)
+{
+  char buf[64];
+  std::sprintf(buf, " (%.3f s)\n", item->time);
+
+  ScopedLock lock(m_mutex);
+  if (item->error.empty())
+    *os << "OK    " << item->input << " -> " << item->output << buf;
+  else
+    *os << "ERROR " << item->input << ": " << item->error << buf;
+  *os << std::flush;
+}
+
+void BatchConverter::makeDirectories(const std::string& path)
+{
+  if (path.empty())
+    return;
+
+  std::vector<std::string> dirs;
+  for (std::string dir = base::remove_path_separator(path);
+       !dir.empty() && !base::directory_exists(dir);
+       dir = base::remove_path_separator(base::get_file_path(dir)))
+    dirs.push_back(dir);
+
+  for (int i=(int)dirs.size()-1; i>=0; --i)
+    base::make_directory(dirs[i]);
+}
+
+} // namespace app
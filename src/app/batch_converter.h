@@ -0,0 +1,108 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef APP_BATCH_CONVERTER_H_INCLUDED
+#define APP_BATCH_CONVERTER_H_INCLUDED
+
+#include "base/condition_variable.h"
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+
+#include <deque>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+class Document;
+struct FileOp;
+
+namespace app {
+
+  // Converts files to the format of an output file name pattern
+  // (e.g. "{path}/{title}.png") using a pool of worker threads. It
+  // loads and saves documents with the FileOp routines directly, so
+  // it doesn't need the GUI.
+  //
+  // Files are loaded and saved in the worker threads, but the save
+  // operations are prepared in the thread that calls convertAll()
+  // (because formats read their options from the configuration).
+  // When several files are converted at the same time, each FileOp
+  // uses only its worker thread. To bound the memory usage, only two
+  // documents per worker thread are loaded at the same time.
+  class BatchConverter
+  {
+  public:
+    // The "outputPattern" can contain "{path}", "{name}" and
+    // "{title}", which are replaced with the directory, the file
+    // name, and the file name without extension of each input file.
+    // If "threads" is 0, one worker thread for each CPU is used.
+    BatchConverter(const std::string& outputPattern, int threads);
+
+    // Adds all files that match the given pattern. The file name part
+    // of the pattern can contain wildcards (e.g. "sprites/*.ase").
+    void addFiles(const std::string& pattern);
+
+    int getFilesCount() const { return (int)m_items.size(); }
+
+    std::string getOutputFileName(const std::string& input) const;
+
+    // Converts all files, writing in "os" the status of each one as
+    // soon as it is converted. Returns the number of files that
+    // couldn't be converted.
+    int convertAll(std::ostream& os);
+
+  private:
+    struct Item {
+      std::string input;
+      std::string output;
+      std::string error;
+      double time;
+      Document* document;       // Loaded document (until it's saved)
+      FileOp* fop;              // Save operation
+    };
+
+    class LoadTask;
+    class SaveTask;
+
+    void loadItem(Item* item);
+    void prepareSave(Item* item);
+    void saveItem(Item* item, std::ostream* os);
+    void reportItem(Item* item, std::ostream* os);
+    void releaseItem();
+    void makeDirectories(const std::string& path);
+
+    std::string m_outputPattern;
+    int m_threads;
+    std::vector<Item> m_items;
+    int m_fileOpFlags;          // FILE_LOAD/SAVE_SINGLE_THREAD flags
+
+    // Items loaded by worker threads which are waiting their save
+    // operation (and the output of status messages). m_itemChanged is
+    // notified when an item is loaded or released (saved or
+    // discarded), and m_inFlight is the number of loaded items which
+    // weren't released yet.
+    Mutex m_mutex;
+    ConditionVariable m_itemChanged;
+    std::deque<Item*> m_loaded;
+    int m_inFlight;
+
+    DISABLE_COPYING(BatchConverter);
+  };
+
+} // namespace app
+
+#endif
@@ -0,0 +1,101 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tests/test.h"
+
+#include "app/batch_converter.h"
+#include "base/fs.h"
+#include "base/unique_ptr.h"
+#include "document.h"
+#include "file/file.h"
+#include "file/file_formats_manager.h"
+#include "raster/raster.h"
+#include "she/she.h"
+
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+using namespace app;
+
+static Image* get_first_image(Document* doc)
+{
+  Sprite* sprite = doc->getSprite();
+  LayerImage* layer = static_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+  return sprite->getStock()->getImage(layer->getCel(FrameNumber(0))->getImage());
+}
+
+TEST(BatchConverter, OutputFileName)
+{
+  BatchConverter a("{path}/{title}.png", 0);
+  EXPECT_EQ("sprites/player.png", a.getOutputFileName("sprites/player.ase"));
+  EXPECT_EQ("./player.png", a.getOutputFileName("player.ase"));
+
+  BatchConverter b("out/{title}-{title}.gif", 0);
+  EXPECT_EQ("out/walk-walk.gif", b.getOutputFileName("sprites/walk.ase"));
+
+  BatchConverter c("out/{name}.png", 0);
+  EXPECT_EQ("out/walk.ase.png", c.getOutputFileName("sprites/walk.ase"));
+}
+
+TEST(BatchConverter, ConvertSeveralFiles)
+{
+  she::ScopedHandle<she::System> system(she::CreateSystem());
+  FileFormatsManager::instance().registerAllFormats();
+  if (!base::directory_exists("batch_test"))
+    base::make_directory("batch_test");
+
+  const int kFiles = 4;
+  std::vector<char> fn(256);
+  for (int i=0; i<kFiles; ++i) {
+    UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, 32+i, 16, 256));
+    std::sprintf(&fn[0], "batch_test/sprite%d.ase", i);
+    doc->setFilename(&fn[0]);
+
+    Image* image = get_first_image(doc);
+    for (int y=0; y<image->h; y++)
+      for (int x=0; x<image->w; x++)
+        image_putpixel(image, x, y, _rgba(x*8, y*16, i*64, 255));
+
+    FileOp* fop = fop_to_save_document(doc, 0);
+    ASSERT_TRUE(fop != NULL);
+    fop_operate(fop, NULL);
+    fop_done(fop);
+    EXPECT_EQ("", fop->error);
+    fop_free(fop);
+  }
+
+  BatchConverter converter("{path}/out/{title}.png", 2);
+  converter.addFiles("batch_test/*.ase");
+  ASSERT_EQ(kFiles, converter.getFilesCount());
+
+  std::stringstream os;
+  EXPECT_EQ(0, converter.convertAll(os));
+
+  for (int i=0; i<kFiles; ++i) {
+    std::sprintf(&fn[0], "batch_test/out/sprite%d.png", i);
+    UniquePtr<Document> doc(load_document(&fn[0]));
+    ASSERT_TRUE(doc != NULL);
+    EXPECT_EQ(32+i, doc->getSprite()->getWidth());
+    EXPECT_EQ(16, doc->getSprite()->getHeight());
+
+    Image* image = get_first_image(doc);
+    for (int y=0; y<image->h; y++)
+      for (int x=0; x<image->w; x++)
+        ASSERT_EQ(_rgba(x*8, y*16, i*64, 255), image_getpixel(image, x, y));
+  }
+}
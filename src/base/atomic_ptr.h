@@ -0,0 +1,47 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#ifndef BASE_ATOMIC_PTR_H_INCLUDED
+#define BASE_ATOMIC_PTR_H_INCLUDED
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+namespace base {
+
+  // Reads a pointer that is published by other thread with
+  // store_release(). If the pointer is not NULL, everything that
+  // the other thread wrote before publishing it is visible.
+  template<typename T>
+  inline T* load_acquire(T* const* ptr)
+  {
+#ifdef _MSC_VER
+    // Volatile accesses have acquire/release semantics in MSVC
+    T* value = *static_cast<T* const volatile*>(ptr);
+    _ReadWriteBarrier();
+    return value;
+#else
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+  }
+
+  // Publishes a pointer to be read with load_acquire() from other
+  // threads.
+  template<typename T>
+  inline void store_release(T** ptr, T* value)
+  {
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+    *static_cast<T* volatile*>(ptr) = value;
+#else
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#endif
+  }
+
+} // namespace base
+
+#endif
@@ -0,0 +1,50 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include "config.h"
+
+#include "base/condition_variable.h"
+
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+
+#ifdef WIN32
+  #include "base/mutex_win32.h"
+  #include "base/condition_variable_win32.h"
+#else
+  #include "base/mutex_pthread.h"
+  #include "base/condition_variable_pthread.h"
+#endif
+
+ConditionVariable::ConditionVariable()
+  : m_impl(new ConditionVariableImpl)
+{
+}
+
+ConditionVariable::~ConditionVariable()
+{
+  delete m_impl;
+}
+
+void ConditionVariable::wait(ScopedLock& lock)
+{
+  m_impl->wait(lock.getMutex().m_impl);
+}
+
+bool ConditionVariable::waitFor(ScopedLock& lock, double seconds)
+{
+  return m_impl->waitFor(lock.getMutex().m_impl, seconds);
+}
+
+void ConditionVariable::notifyOne()
+{
+  m_impl->notifyOne();
+}
+
+void ConditionVariable::notifyAll()
+{
+  m_impl->notifyAll();
+}
@@ -0,0 +1,42 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#ifndef BASE_CONDITION_VARIABLE_H_INCLUDED
+#define BASE_CONDITION_VARIABLE_H_INCLUDED
+
+#include "base/disable_copying.h"
+
+class ScopedLock;
+
+// Lets threads wait until other thread notifies them that some
+// shared state (protected by a Mutex) has changed.
+class ConditionVariable
+{
+public:
+  ConditionVariable();
+  ~ConditionVariable();
+
+  // Atomically unlocks the mutex of the given lock and blocks the
+  // current thread until notifyOne() or notifyAll() is called. The
+  // mutex is locked again before returning. Spurious wake-ups are
+  // possible, so always check the waited condition in a loop.
+  void wait(ScopedLock& lock);
+
+  // Like wait() but returns false if the given number of seconds
+  // elapsed without receiving a notification.
+  bool waitFor(ScopedLock& lock, double seconds);
+
+  void notifyOne();
+  void notifyAll();
+
+private:
+  class ConditionVariableImpl;
+  ConditionVariableImpl* m_impl;
+
+  DISABLE_COPYING(ConditionVariable);
+};
+
+#endif
@@ -0,0 +1,55 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#ifndef BASE_CONDITION_VARIABLE_PTHREAD_H_INCLUDED
+#define BASE_CONDITION_VARIABLE_PTHREAD_H_INCLUDED
+
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+
+class ConditionVariable::ConditionVariableImpl
+{
+public:
+
+  ConditionVariableImpl() {
+    pthread_cond_init(&m_handle, NULL);
+  }
+
+  ~ConditionVariableImpl() {
+    pthread_cond_destroy(&m_handle);
+  }
+
+  void wait(Mutex::MutexImpl* mutex) {
+    pthread_cond_wait(&m_handle, mutex->native_handle());
+  }
+
+  bool waitFor(Mutex::MutexImpl* mutex, double seconds) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    long usecs = now.tv_usec + long((seconds - long(seconds)) * 1000000.0);
+    struct timespec deadline;
+    deadline.tv_sec = now.tv_sec + long(seconds) + usecs / 1000000;
+    deadline.tv_nsec = (usecs % 1000000) * 1000;
+
+    return (pthread_cond_timedwait(&m_handle, mutex->native_handle(), &deadline) != ETIMEDOUT);
+  }
+
+  void notifyOne() {
+    pthread_cond_signal(&m_handle);
+  }
+
+  void notifyAll() {
+    pthread_cond_broadcast(&m_handle);
+  }
+
+private:
+  pthread_cond_t m_handle;
+
+};
+
+#endif
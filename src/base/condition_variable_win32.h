@@ -0,0 +1,46 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#ifndef BASE_CONDITION_VARIABLE_WIN32_H_INCLUDED
+#define BASE_CONDITION_VARIABLE_WIN32_H_INCLUDED
+
+#include <windows.h>
+
+class ConditionVariable::ConditionVariableImpl
+{
+public:
+
+  ConditionVariableImpl() {
+    InitializeConditionVariable(&m_handle);
+  }
+
+  ~ConditionVariableImpl() {
+    // Win32 condition variables don't need to be deleted.
+  }
+
+  void wait(Mutex::MutexImpl* mutex) {
+    SleepConditionVariableCS(&m_handle, mutex->native_handle(), INFINITE);
+  }
+
+  bool waitFor(Mutex::MutexImpl* mutex, double seconds) {
+    return SleepConditionVariableCS(&m_handle, mutex->native_handle(),
+                                    DWORD(seconds * 1000.0)) ? true: false;
+  }
+
+  void notifyOne() {
+    WakeConditionVariable(&m_handle);
+  }
+
+  void notifyAll() {
+    WakeAllConditionVariable(&m_handle);
+  }
+
+private:
+  CONDITION_VARIABLE m_handle;
+
+};
+
+#endif
@@ -0,0 +1,92 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include "config.h"
+
+#include "base/cpu_info.h"
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  #include <intrin.h>
+  #define CPU_INFO_X86
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+  #include <cpuid.h>
+  #define CPU_INFO_X86
+#endif
+
+namespace {
+
+#ifdef CPU_INFO_X86
+
+  void cpuid(int leaf, int subleaf, unsigned int regs[4])
+  {
+#ifdef _MSC_VER
+    __cpuidex((int*)regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+  }
+
+  // Returns the XCR0 register (state components enabled by the OS).
+  unsigned int xgetbv0()
+  {
+#ifdef _MSC_VER
+    return (unsigned int)_xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return eax;
+#endif
+  }
+
+  unsigned int max_leaf()
+  {
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    return regs[0];
+  }
+
+#endif
+
+}
+
+namespace base {
+
+bool cpu_has_sse2()
+{
+#ifdef CPU_INFO_X86
+  unsigned int regs[4];
+  if (max_leaf() < 1)
+    return false;
+
+  cpuid(1, 0, regs);
+  return (regs[3] & (1 << 26)) ? true: false; // EDX.SSE2
+#else
+  return false;
+#endif
+}
+
+bool cpu_has_avx2()
+{
+#ifdef CPU_INFO_X86
+  unsigned int regs[4];
+  if (max_leaf() < 7)
+    return false;
+
+  // The OS must save the YMM registers (OSXSAVE and XCR0 bits 1-2)
+  cpuid(1, 0, regs);
+  if ((regs[2] & (1 << 27)) == 0 ||             // ECX.OSXSAVE
+      (regs[2] & (1 << 28)) == 0 ||             // ECX.AVX
+      (xgetbv0() & 6) != 6)
+    return false;
+
+  cpuid(7, 0, regs);
+  return (regs[1] & (1 << 5)) ? true: false;    // EBX.AVX2
+#else
+  return false;
+#endif
+}
+
+} // namespace base
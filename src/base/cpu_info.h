@@ -0,0 +1,20 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#ifndef BASE_CPU_INFO_H_INCLUDED
+#define BASE_CPU_INFO_H_INCLUDED
+
+namespace base {
+
+  // Returns true if the CPU (and the operating system) can execute
+  // the given set of instructions. They always return false in non
+  // x86/x86-64 platforms.
+  bool cpu_has_sse2();
+  bool cpu_has_avx2();
+
+}
+
+#endif
@@ -9,14 +9,30 @@
 
 #include "base/string.h"
 
+#include <ctime>
+#include <vector>
+
 namespace base {
 
   bool file_exists(const string& path);
   bool directory_exists(const string& path);
 
+  // Returns the last modification time of the given file (or 0 if it
+  // doesn't exist).
+  time_t get_file_time(const string& path);
+
+  // Changes the modification time of the given file.
+  void set_file_time(const string& path, time_t time);
+
+  // Adds to "files" the names (without the path) of the regular files
+  // inside the given directory.
+  void list_files(const string& path, std::vector<string>& files);
+
   void make_directory(const string& path);
   void remove_directory(const string& path);
 
+  void delete_file(const string& path);
+
   string get_temp_path();
 
 }
@@ -6,6 +6,8 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdexcept>
@@ -24,6 +26,35 @@ bool directory_exists(const string& path)
   return (stat(path.c_str(), &sts) == 0 && S_ISDIR(sts.st_mode)) ? true: false;
 }
 
+time_t get_file_time(const string& path)
+{
+  struct stat sts;
+  return (stat(path.c_str(), &sts) == 0) ? sts.st_mtime: 0;
+}
+
+void set_file_time(const string& path, time_t time)
+{
+  struct utimbuf times;
+  times.actime = time;
+  times.modtime = time;
+  utime(path.c_str(), &times);
+}
+
+void list_files(const string& path, std::vector<string>& files)
+{
+  DIR* dir = opendir(path.c_str());
+  if (!dir)
+    return;
+
+  while (dirent* entry = readdir(dir)) {
+    string filename = entry->d_name;
+    if (file_exists(path + "/" + filename))
+      files.push_back(filename);
+  }
+
+  closedir(dir);
+}
+
 void make_directory(const string& path)
 {
   int result = mkdir(path.c_str(), 0777);
@@ -42,6 +73,15 @@ void remove_directory(const string& path)
   }
 }
 
+void delete_file(const string& path)
+{
+  int result = unlink(path.c_str());
+  if (result != 0) {
+    // TODO add errno into the exception
+    throw std::runtime_error("Error deleting file");
+  }
+}
+
 string get_temp_path()
 {
   char* tmpdir = getenv("TMPDIR");
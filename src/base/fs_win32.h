@@ -27,6 +27,54 @@ bool directory_exists(const string& path)
           ((attr & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY));
 }
 
+time_t get_file_time(const string& path)
+{
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!::GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data))
+    return 0;
+
+  // From 100-nanosecond intervals since January 1, 1601 to seconds
+  // since January 1, 1970.
+  ULARGE_INTEGER t;
+  t.LowPart = data.ftLastWriteTime.dwLowDateTime;
+  t.HighPart = data.ftLastWriteTime.dwHighDateTime;
+  return time_t(t.QuadPart / 10000000 - 11644473600LL);
+}
+
+void set_file_time(const string& path, time_t time)
+{
+  HANDLE handle = ::CreateFile(path.c_str(), FILE_WRITE_ATTRIBUTES,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE)
+    return;
+
+  // Inverse conversion of get_file_time()
+  ULARGE_INTEGER t;
+  t.QuadPart = (ULONGLONG(time) + 11644473600LL) * 10000000;
+
+  FILETIME ft;
+  ft.dwLowDateTime = t.LowPart;
+  ft.dwHighDateTime = t.HighPart;
+  ::SetFileTime(handle, NULL, &ft, &ft);
+  ::CloseHandle(handle);
+}
+
+void list_files(const string& path, std::vector<string>& files)
+{
+  WIN32_FIND_DATA data;
+  HANDLE handle = ::FindFirstFile((path + "\\*").c_str(), &data);
+  if (handle == INVALID_HANDLE_VALUE)
+    return;
+
+  do {
+    if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+      files.push_back(data.cFileName);
+  } while (::FindNextFile(handle, &data));
+
+  ::FindClose(handle);
+}
+
 void make_directory(const string& path)
 {
   BOOL result = ::CreateDirectory(path.c_str(), NULL);
@@ -45,6 +93,15 @@ void remove_directory(const string& path)
   }
 }
 
+void delete_file(const string& path)
+{
+  BOOL result = ::DeleteFile(path.c_str());
+  if (result == 0) {
+    // TODO add GetLastError() value into the exception
+    throw std::runtime_error("Error deleting file");
+  }
+}
+
 string get_temp_path()
 {
   TCHAR buffer[MAX_PATH+1];
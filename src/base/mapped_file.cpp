@@ -0,0 +1,57 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include "config.h"
+
+#include "base/mapped_file.h"
+
+#include <vector>
+
+#ifdef _WIN32
+  #include "base/mapped_file_win32.h"
+#else
+  #include "base/mapped_file_unix.h"
+#endif
+
+namespace base {
+
+MappedFile::MappedFile()
+  : m_impl(new MappedFileImpl)
+{
+}
+
+MappedFile::~MappedFile()
+{
+  delete m_impl;
+}
+
+bool MappedFile::open(const string& path)
+{
+  m_impl->close();
+  return m_impl->open(path);
+}
+
+void MappedFile::close()
+{
+  m_impl->close();
+}
+
+const uint8_t* MappedFile::data() const
+{
+  return m_impl->data();
+}
+
+size_t MappedFile::size() const
+{
+  return m_impl->size();
+}
+
+bool MappedFile::isMapped() const
+{
+  return m_impl->isMapped();
+}
+
+} // namespace base
@@ -0,0 +1,46 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#ifndef BASE_MAPPED_FILE_H_INCLUDED
+#define BASE_MAPPED_FILE_H_INCLUDED
+
+#include "base/disable_copying.h"
+#include "base/string.h"
+
+#include <cstddef>
+
+namespace base {
+
+  // Read-only access to the whole content of a file. The file is
+  // mapped in memory when it's possible (so pages are loaded by the
+  // OS as they are accessed), in other case the file is read in a
+  // memory buffer.
+  class MappedFile {
+  public:
+    MappedFile();
+    ~MappedFile();
+
+    // Returns false if the file cannot be opened.
+    bool open(const string& path);
+    void close();
+
+    // Returns NULL if the file is empty (or it isn't open).
+    const uint8_t* data() const;
+    size_t size() const;
+
+    // Returns true if the content wasn't copied in a buffer.
+    bool isMapped() const;
+
+  private:
+    class MappedFileImpl;
+    MappedFileImpl* m_impl;
+
+    DISABLE_COPYING(MappedFile);
+  };
+
+} // namespace base
+
+#endif
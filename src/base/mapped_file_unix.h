@@ -0,0 +1,97 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace base {
+
+class MappedFile::MappedFileImpl
+{
+public:
+  MappedFileImpl() : m_mapping(NULL), m_size(0) {
+  }
+
+  ~MappedFileImpl() {
+    close();
+  }
+
+  bool open(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat sts;
+    if (fstat(fd, &sts) != 0 || !S_ISREG(sts.st_mode)) {
+      ::close(fd);
+      return false;
+    }
+
+    m_size = sts.st_size;
+    if (m_size > 0) {
+      void* ptr = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        m_mapping = ptr;
+#ifdef MADV_SEQUENTIAL
+        madvise(ptr, m_size, MADV_SEQUENTIAL);
+#endif
+      }
+      // Read the whole file in a buffer (e.g. the file system
+      // doesn't support mmap()).
+      else {
+        m_buffer.resize(m_size);
+        size_t pos = 0;
+        while (pos < m_size) {
+          ssize_t bytes = ::read(fd, &m_buffer[pos], m_size-pos);
+          if (bytes <= 0)
+            break;
+          pos += bytes;
+        }
+        m_buffer.resize(pos);
+        m_size = pos;
+      }
+    }
+
+    ::close(fd);
+    return true;
+  }
+
+  void close() {
+    if (m_mapping) {
+      munmap(m_mapping, m_size);
+      m_mapping = NULL;
+    }
+    m_buffer.clear();
+    m_size = 0;
+  }
+
+  const uint8_t* data() const {
+    if (m_mapping)
+      return (const uint8_t*)m_mapping;
+    else if (!m_buffer.empty())
+      return &m_buffer[0];
+    else
+      return NULL;
+  }
+
+  size_t size() const {
+    return m_size;
+  }
+
+  bool isMapped() const {
+    return (m_mapping != NULL);
+  }
+
+private:
+  void* m_mapping;
+  size_t m_size;
+  std::vector<uint8_t> m_buffer;
+};
+
+} // namespace base
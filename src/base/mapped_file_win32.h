@@ -0,0 +1,93 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include <windows.h>
+
+namespace base {
+
+class MappedFile::MappedFileImpl
+{
+public:
+  MappedFileImpl() : m_mapping(NULL), m_size(0) {
+  }
+
+  ~MappedFileImpl() {
+    close();
+  }
+
+  bool open(const string& path) {
+    HANDLE file = ::CreateFile(path.c_str(),
+                               GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+      return false;
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(file, &size)) {
+      ::CloseHandle(file);
+      return false;
+    }
+
+    m_size = (size_t)size.QuadPart;
+    if (m_size > 0) {
+      HANDLE mapping = ::CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (mapping) {
+        m_mapping = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        ::CloseHandle(mapping);
+      }
+
+      // Read the whole file in a buffer if it cannot be mapped.
+      if (!m_mapping) {
+        m_buffer.resize(m_size);
+        size_t pos = 0;
+        while (pos < m_size) {
+          DWORD bytes = 0;
+          if (!::ReadFile(file, &m_buffer[pos], (DWORD)(m_size-pos), &bytes, NULL) || bytes == 0)
+            break;
+          pos += bytes;
+        }
+        m_buffer.resize(pos);
+        m_size = pos;
+      }
+    }
+
+    ::CloseHandle(file);
+    return true;
+  }
+
+  void close() {
+    if (m_mapping) {
+      ::UnmapViewOfFile(m_mapping);
+      m_mapping = NULL;
+    }
+    m_buffer.clear();
+    m_size = 0;
+  }
+
+  const uint8_t* data() const {
+    if (m_mapping)
+      return (const uint8_t*)m_mapping;
+    else if (!m_buffer.empty())
+      return &m_buffer[0];
+    else
+      return NULL;
+  }
+
+  size_t size() const {
+    return m_size;
+  }
+
+  bool isMapped() const {
+    return (m_mapping != NULL);
+  }
+
+private:
+  void* m_mapping;
+  size_t m_size;
+  std::vector<uint8_t> m_buffer;
+};
+
+} // namespace base
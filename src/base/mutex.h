@@ -20,6 +20,8 @@ public:
   void unlock();
 
 private:
+  friend class ConditionVariable;
+
   class MutexImpl;
   MutexImpl* m_impl;
 
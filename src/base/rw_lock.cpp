@@ -0,0 +1,204 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include "config.h"
+
+#include "base/rw_lock.h"
+
+#include "base/chrono.h"
+#include "base/scoped_lock.h"
+
+#include <cassert>
+#include <cstring>
+
+RWLock::RWLock()
+  : m_readers(0)
+  , m_writer(false)
+  , m_writerThread((base::thread::native_handle_type)0)
+  , m_waitingWriters(0)
+  , m_upgrading(false)
+{
+  std::memset(&m_stats, 0, sizeof(m_stats));
+}
+
+RWLock::~RWLock()
+{
+  assert(m_readers == 0);
+  assert(!m_writer);
+}
+
+bool RWLock::lock(LockType type, int timeout)
+{
+  ScopedLock lock(m_mutex);
+  base::thread::native_handle_type thread = base::this_thread::native_handle();
+
+  // A thread that is already reading doesn't wait for writers (they
+  // are waiting for it)
+  if (type == ReadLock && m_threadReaders.find(thread) != m_threadReaders.end()) {
+    ++m_readers;
+    ++m_threadReaders[thread];
+    ++m_stats.readLocks;
+    return true;
+  }
+
+  if (type == WriteLock)
+    ++m_waitingWriters;
+
+  bool locked = waitUntilCanLock(lock, type, timeout, 0);
+
+  if (type == WriteLock) {
+    --m_waitingWriters;
+
+    // Readers waiting for this writer can continue
+    if (!locked)
+      m_cond.notifyAll();
+  }
+
+  if (locked) {
+    if (type == ReadLock) {
+      ++m_readers;
+      ++m_threadReaders[thread];
+      ++m_stats.readLocks;
+    }
+    else {
+      m_writer = true;
+      m_writerThread = thread;
+      ++m_stats.writeLocks;
+    }
+  }
+
+  return locked;
+}
+
+bool RWLock::upgradeToWrite(int timeout)
+{
+  ScopedLock lock(m_mutex);
+
+  assert(m_readers > 0);
+  assert(!m_writer);
+
+  // Other read lock of this thread would never be released
+  base::thread::native_handle_type thread = base::this_thread::native_handle();
+  ThreadReaders::iterator it = m_threadReaders.find(thread);
+  if (m_upgrading || (it != m_threadReaders.end() && it->second > 1)) {
+    ++m_stats.failures;
+    return false;
+  }
+
+  // We are one of the readers, so we wait for the rest of them
+  ++m_waitingWriters;
+  m_upgrading = true;
+
+  bool locked = waitUntilCanLock(lock, WriteLock, timeout, 1);
+
+  m_upgrading = false;
+  --m_waitingWriters;
+
+  if (locked) {
+    m_readers = 0;
+    m_threadReaders.clear();
+    m_writer = true;
+    m_writerThread = thread;
+    ++m_stats.writeLocks;
+  }
+  else
+    m_cond.notifyAll();
+
+  return locked;
+}
+
+void RWLock::downgradeToRead()
+{
+  ScopedLock lock(m_mutex);
+
+  assert(m_writer);
+  assert(m_readers == 0);
+  assert(m_writerThread == base::this_thread::native_handle());
+
+  m_writer = false;
+  m_readers = 1;
+  m_threadReaders[m_writerThread] = 1;
+  m_cond.notifyAll();
+}
+
+void RWLock::unlock()
+{
+  ScopedLock lock(m_mutex);
+
+  if (m_writer) {
+    assert(m_writerThread == base::this_thread::native_handle());
+    m_writer = false;
+  }
+  else {
+    // The read lock must be released by the thread that acquired it
+    ThreadReaders::iterator it = m_threadReaders.find(base::this_thread::native_handle());
+    assert(it != m_threadReaders.end());
+    if (it == m_threadReaders.end())
+      return;
+
+    assert(m_readers > 0);
+    --m_readers;
+    if (--it->second == 0)
+      m_threadReaders.erase(it);
+  }
+
+  m_cond.notifyAll();
+}
+
+RWLock::Stats RWLock::getStats() const
+{
+  ScopedLock lock(m_mutex);
+  return m_stats;
+}
+
+// "ownReaders" is the number of read locks that the caller has (a
+// writer can lock when all the other readers have finished).
+bool RWLock::canLock(LockType type, int ownReaders) const
+{
+  // New readers wait for the waiting writers (writer preference)
+  if (type == ReadLock)
+    return (!m_writer && m_waitingWriters == 0);
+  else
+    return (!m_writer && m_readers == ownReaders);
+}
+
+// The caller must be counted in m_waitingWriters if it wants to write.
+bool RWLock::waitUntilCanLock(ScopedLock& lock, LockType type, int timeout, int ownReaders)
+{
+  if (canLock(type, ownReaders))
+    return true;
+
+  if (timeout == 0) {
+    ++m_stats.failures;
+    return false;
+  }
+
+  base::Chrono chrono;
+  for (;;) {
+    if (timeout < 0)
+      m_cond.wait(lock);
+    else {
+      double left = timeout/1000.0 - chrono.elapsed();
+      if (left > 0.0)
+        m_cond.waitFor(lock, left);
+    }
+
+    if (canLock(type, ownReaders))
+      break;
+
+    if (timeout >= 0 && chrono.elapsed() >= timeout/1000.0) {
+      ++m_stats.failures;
+      return false;
+    }
+  }
+
+  double elapsed = chrono.elapsed();
+  ++m_stats.waits;
+  m_stats.waitTime += elapsed;
+  if (m_stats.maxWaitTime < elapsed)
+    m_stats.maxWaitTime = elapsed;
+  return true;
+}
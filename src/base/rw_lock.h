@@ -0,0 +1,90 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#ifndef BASE_RW_LOCK_H_INCLUDED
+#define BASE_RW_LOCK_H_INCLUDED
+
+#include "base/condition_variable.h"
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+#include "base/thread.h"
+
+#include <map>
+
+class ScopedLock;
+
+// A readers/writer lock: several threads can read at the same time,
+// or just one thread can write. Writers have preference: when a
+// writer is waiting, new readers wait until it finishes, so writers
+// are not starved by a continuous flow of readers. A thread that
+// already has a read lock can lock it again for reading without
+// waiting (even if there are writers waiting).
+//
+// All "timeout" arguments are in milliseconds: zero means "try to
+// lock and return immediately", and a negative value means "wait
+// forever".
+class RWLock
+{
+public:
+  enum LockType {
+    ReadLock,
+    WriteLock
+  };
+
+  // Contention information (to know if threads are waiting for each
+  // other too much).
+  struct Stats {
+    int readLocks;              // Successful read locks
+    int writeLocks;             // Successful write locks (including upgrades)
+    int waits;                  // Successful locks that had to wait
+    int failures;               // Locks that couldn't be acquired (timeout)
+    double waitTime;            // Total time waiting (seconds)
+    double maxWaitTime;         // Longest wait (seconds)
+  };
+
+  RWLock();
+  ~RWLock();
+
+  // Returns true if the lock was acquired before the timeout.
+  bool lock(LockType type, int timeout);
+
+  // Converts a read lock (acquired by the caller) to a write lock,
+  // waiting until all other readers unlock. It fails (returning
+  // false and keeping the read lock) if the timeout is reached, if
+  // the caller has more than one read lock, or if other reader is
+  // already waiting to upgrade its lock (they would wait each other
+  // forever).
+  bool upgradeToWrite(int timeout);
+
+  // Converts a write lock to a read lock without releasing it.
+  void downgradeToRead();
+
+  // Releases a read or write lock. It must be called from the same
+  // thread that acquired the lock.
+  void unlock();
+
+  Stats getStats() const;
+
+private:
+  typedef std::map<base::thread::native_handle_type, int> ThreadReaders;
+
+  bool canLock(LockType type, int ownReaders) const;
+  bool waitUntilCanLock(ScopedLock& lock, LockType type, int timeout, int ownReaders);
+
+  mutable Mutex m_mutex;
+  ConditionVariable m_cond;
+  int m_readers;                // Number of read locks
+  ThreadReaders m_threadReaders; // Number of read locks of each thread
+  bool m_writer;                // True if a thread is writing
+  base::thread::native_handle_type m_writerThread; // Thread that is writing
+  int m_waitingWriters;         // Writers (or upgraders) waiting
+  bool m_upgrading;             // True if a reader is waiting to upgrade
+  Stats m_stats;
+
+  DISABLE_COPYING(RWLock);
+};
+
+#endif
@@ -0,0 +1,188 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/rw_lock.h"
+#include "base/thread.h"
+
+using namespace base;
+
+// Reads for 50 milliseconds.
+void read_for_a_while(RWLock* rwlock, volatile bool* locked)
+{
+  *locked = rwlock->lock(RWLock::ReadLock, -1);
+  this_thread::sleep_for(0.05);
+  if (*locked)
+    rwlock->unlock();
+}
+
+// Tries to read and releases the lock immediately.
+void try_read_and_unlock(RWLock* rwlock, bool* locked)
+{
+  *locked = rwlock->lock(RWLock::ReadLock, 0);
+  if (*locked)
+    rwlock->unlock();
+}
+
+// Returns true if a new thread can read (this thread could be
+// reading already, so it can always read).
+bool other_thread_can_read(RWLock* rwlock)
+{
+  bool locked = false;
+  thread t(&try_read_and_unlock, rwlock, &locked);
+  t.join();
+  return locked;
+}
+
+// Waits until a writer is waiting (then new readers cannot lock the
+// RWLock). Returns false if it takes too long.
+bool wait_waiting_writer(RWLock* rwlock)
+{
+  int tries = 0;
+  while (other_thread_can_read(rwlock)) {
+    if (++tries == 5000)
+      return false;
+    this_thread::sleep_for(0.001);
+  }
+  return true;
+}
+
+// Waits to write and releases the lock immediately.
+void write_and_unlock(RWLock* rwlock, bool* locked)
+{
+  *locked = rwlock->lock(RWLock::WriteLock, -1);
+  if (*locked)
+    rwlock->unlock();
+}
+
+TEST(RWLock, ReadersShareTheLock)
+{
+  RWLock rwlock;
+
+  EXPECT_TRUE(rwlock.lock(RWLock::ReadLock, 0));
+  EXPECT_TRUE(rwlock.lock(RWLock::ReadLock, 0));
+  EXPECT_FALSE(rwlock.lock(RWLock::WriteLock, 0));
+  rwlock.unlock();
+  EXPECT_FALSE(rwlock.lock(RWLock::WriteLock, 0));
+  rwlock.unlock();
+
+  EXPECT_TRUE(rwlock.lock(RWLock::WriteLock, 0));
+  EXPECT_FALSE(rwlock.lock(RWLock::ReadLock, 0));
+  EXPECT_FALSE(rwlock.lock(RWLock::WriteLock, 0));
+  rwlock.unlock();
+
+  RWLock::Stats stats = rwlock.getStats();
+  EXPECT_EQ(2, stats.readLocks);
+  EXPECT_EQ(1, stats.writeLocks);
+  EXPECT_EQ(4, stats.failures);
+  EXPECT_EQ(0, stats.waits);
+}
+
+TEST(RWLock, WriterWaitsForReaders)
+{
+  RWLock rwlock;
+
+  // Other thread reads for 50 milliseconds
+  volatile bool locked = false;
+  thread t(&read_for_a_while, &rwlock, &locked);
+  while (!locked)
+    this_thread::sleep_for(0.001);
+
+  EXPECT_TRUE(rwlock.lock(RWLock::WriteLock, 10000));
+  rwlock.unlock();
+  t.join();
+
+  RWLock::Stats stats = rwlock.getStats();
+  EXPECT_EQ(1, stats.waits);
+  EXPECT_LT(0.0, stats.waitTime);
+}
+
+TEST(RWLock, Timeout)
+{
+  RWLock rwlock;
+
+  EXPECT_TRUE(rwlock.lock(RWLock::ReadLock, 0));
+  EXPECT_FALSE(rwlock.lock(RWLock::WriteLock, 20));
+
+  // The failed writer doesn't block new readers
+  EXPECT_TRUE(other_thread_can_read(&rwlock));
+  rwlock.unlock();
+
+  EXPECT_EQ(1, rwlock.getStats().failures);
+}
+
+TEST(RWLock, WritersHavePreference)
+{
+  RWLock rwlock;
+  bool locked = false;
+
+  EXPECT_TRUE(rwlock.lock(RWLock::ReadLock, 0));
+  thread t(&write_and_unlock, &rwlock, &locked);
+
+  // Wait until the writer thread is waiting
+  EXPECT_TRUE(wait_waiting_writer(&rwlock));
+
+  rwlock.unlock();
+  t.join();
+  EXPECT_TRUE(locked);
+
+  EXPECT_TRUE(rwlock.lock(RWLock::ReadLock, 0));
+  rwlock.unlock();
+}
+
+TEST(RWLock, UpgradeAndDowngrade)
+{
+  RWLock rwlock;
+
+  EXPECT_TRUE(rwlock.lock(RWLock::ReadLock, 0));
+  EXPECT_TRUE(rwlock.upgradeToWrite(0));
+  EXPECT_FALSE(rwlock.lock(RWLock::ReadLock, 0));
+  rwlock.downgradeToRead();
+
+  // Two readers, we've to wait the other one
+  volatile bool locked = false;
+  thread t(&read_for_a_while, &rwlock, &locked);
+  while (!locked)
+    this_thread::sleep_for(0.001);
+
+  EXPECT_FALSE(rwlock.upgradeToWrite(0));
+  EXPECT_TRUE(rwlock.upgradeToWrite(10000));
+  t.join();
+
+  rwlock.unlock();
+  EXPECT_TRUE(rwlock.lock(RWLock::WriteLock, 0));
+  rwlock.unlock();
+}
+
+TEST(RWLock, NestedReadLocks)
+{
+  RWLock rwlock;
+  bool locked = false;
+
+  EXPECT_TRUE(rwlock.lock(RWLock::ReadLock, 0));
+  thread t(&write_and_unlock, &rwlock, &locked);
+
+  EXPECT_TRUE(wait_waiting_writer(&rwlock));
+
+  // This thread is already reading, so it doesn't wait for the writer
+  EXPECT_TRUE(rwlock.lock(RWLock::ReadLock, 0));
+
+  // It cannot upgrade its lock (the other read lock would never be
+  // released), even with a long timeout
+  EXPECT_FALSE(rwlock.upgradeToWrite(-1));
+
+  rwlock.unlock();
+  rwlock.unlock();
+  t.join();
+  EXPECT_TRUE(locked);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
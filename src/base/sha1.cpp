@@ -51,6 +51,27 @@ Sha1 Sha1::calculateFromFile(const std::string& fileName)
   return Sha1(digest);
 }
 
+// Calculates the SHA1 of the given memory block.
+Sha1 Sha1::calculateFromData(const void* data, size_t size)
+{
+  SHA1Context sha;
+  SHA1Reset(&sha);
+
+  // SHA1Input() receives the length as an "unsigned int"
+  const uint8_t* ptr = (const uint8_t*)data;
+  while (size > 0) {
+    unsigned int len = (size < 0x10000000 ? size: 0x10000000);
+    SHA1Input(&sha, ptr, len);
+    ptr += len;
+    size -= len;
+  }
+
+  std::vector<uint8_t> digest(HashSize);
+  SHA1Result(&sha, &digest[0]);
+
+  return Sha1(digest);
+}
+
 bool Sha1::operator==(const Sha1& other) const
 {
   return m_digest == other.m_digest;
@@ -61,4 +82,9 @@ bool Sha1::operator!=(const Sha1& other) const
   return m_digest != other.m_digest;
 }
 
+bool Sha1::operator<(const Sha1& other) const
+{
+  return m_digest < other.m_digest;
+}
+
 } // namespace base
@@ -24,9 +24,15 @@ namespace base {
     // Calculates the SHA1 of the given file.
     static Sha1 calculateFromFile(const std::string& fileName);
 
+    // Calculates the SHA1 of the given memory block.
+    static Sha1 calculateFromData(const void* data, size_t size);
+
     bool operator==(const Sha1& other) const;
     bool operator!=(const Sha1& other) const;
 
+    // To use Sha1 as a key of std::map.
+    bool operator<(const Sha1& other) const;
+
     uint8_t operator[](int index) const {
       return m_digest[index];
     }
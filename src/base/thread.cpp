@@ -87,6 +87,23 @@ base::thread::native_handle_type base::thread::native_handle()
   return m_native_handle;
 }
 
+// static
+int base::thread::hardware_concurrency()
+{
+#ifdef WIN32
+
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return (info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors: 1);
+
+#else
+
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0 ? (int)n: 1);
+
+#endif
+}
+
 void base::thread::launch_thread(func_wrapper* f)
 {
   m_native_handle = (native_handle_type)0;
@@ -138,6 +155,19 @@ void base::this_thread::yield()
 #endif
 }
 
+base::thread::native_handle_type base::this_thread::native_handle()
+{
+#ifdef WIN32
+
+  return (thread::native_handle_type)::GetCurrentThreadId();
+
+#else
+
+  return (thread::native_handle_type)::pthread_self();
+
+#endif
+}
+
 void base::this_thread::sleep_for(double seconds)
 {
 #ifdef WIN32
@@ -42,6 +42,10 @@ namespace base {                // Based on C++0x threads lib
 
     native_handle_type native_handle();
 
+    // Returns the number of processors available in the system (at
+    // least 1).
+    static int hardware_concurrency();
+
     class details {
     public:
       static void thread_proxy(void* data);
@@ -90,6 +94,10 @@ namespace base {                // Based on C++0x threads lib
   {
     void yield();
     void sleep_for(double seconds);
+
+    // Returns a value that identifies the current thread (it's
+    // different for each running thread).
+    thread::native_handle_type native_handle();
   }
 
   // This class joins the thread in its destructor.
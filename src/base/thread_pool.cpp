@@ -0,0 +1,90 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include "config.h"
+
+#include "base/thread_pool.h"
+
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+
+namespace base {
+
+thread_pool::thread_pool(int num_threads)
+  : m_running(0)
+  , m_stop(false)
+{
+  if (num_threads <= 0)
+    num_threads = thread::hardware_concurrency();
+
+  m_threads.reserve(num_threads);
+  for (int i=0; i<num_threads; ++i)
+    m_threads.push_back(new thread(&thread_pool::worker_proc, this));
+}
+
+thread_pool::~thread_pool()
+{
+  wait_all();
+
+  {
+    ScopedLock lock(m_mutex);
+    m_stop = true;
+    m_work_available.notifyAll();
+  }
+
+  for (std::vector<thread*>::iterator it=m_threads.begin(), end=m_threads.end(); it!=end; ++it) {
+    (*it)->join();
+    delete *it;
+  }
+}
+
+void thread_pool::wait_all()
+{
+  ScopedLock lock(m_mutex);
+  while (!m_queue.empty() || m_running > 0)
+    m_work_done.wait(lock);
+}
+
+void thread_pool::enqueue(func_wrapper* f)
+{
+  ScopedLock lock(m_mutex);
+  m_queue.push_back(f);
+  m_work_available.notifyOne();
+}
+
+void thread_pool::worker_loop()
+{
+  ScopedLock lock(m_mutex);
+
+  for (;;) {
+    while (m_queue.empty() && !m_stop)
+      m_work_available.wait(lock);
+
+    if (m_queue.empty())        // m_stop is true
+      break;
+
+    func_wrapper* f = m_queue.front();
+    m_queue.pop_front();
+    ++m_running;
+
+    m_mutex.unlock();
+    (*f)();
+    delete f;
+    m_mutex.lock();
+
+    --m_running;
+    if (m_queue.empty() && m_running == 0)
+      m_work_done.notifyAll();
+  }
+}
+
+// static
+void thread_pool::worker_proc(thread_pool* pool)
+{
+  pool->worker_loop();
+}
+
+} // namespace base
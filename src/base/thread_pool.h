@@ -0,0 +1,81 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#ifndef BASE_THREAD_POOL_H_INCLUDED
+#define BASE_THREAD_POOL_H_INCLUDED
+
+#include "base/condition_variable.h"
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+
+#include <deque>
+#include <vector>
+
+namespace base {
+
+  class thread;
+
+  // A fixed set of worker threads which execute the queued functions
+  // in FIFO order. Functions are executed in parallel, so they must
+  // be thread-safe, and they cannot throw exceptions.
+  class thread_pool {
+  public:
+    // Creates a pool with "num_threads" workers. If "num_threads" is
+    // 0, one worker for each processor is created.
+    explicit thread_pool(int num_threads = 0);
+
+    // Waits all queued functions and stops the workers.
+    ~thread_pool();
+
+    // Returns the number of worker threads.
+    int size() const {
+      return (int)m_threads.size();
+    }
+
+    // Queues the given function to be executed by one of the workers.
+    template<class Callable>
+    void execute(const Callable& f) {
+      enqueue(new func_wrapper0<Callable>(f));
+    }
+
+    // Blocks the calling thread until all queued functions are
+    // executed. It cannot be called from inside a queued function.
+    void wait_all();
+
+  private:
+    class func_wrapper {
+    public:
+      virtual ~func_wrapper() { }
+      virtual void operator()() = 0;
+    };
+
+    template<class Callable>
+    class func_wrapper0 : public func_wrapper {
+    public:
+      Callable f;
+      func_wrapper0(const Callable& f) : f(f) { }
+      void operator()() { f(); }
+    };
+
+    void enqueue(func_wrapper* f);
+    void worker_loop();
+
+    static void worker_proc(thread_pool* pool);
+
+    std::vector<thread*> m_threads;
+    std::deque<func_wrapper*> m_queue;
+    int m_running;              // Number of functions being executed right now
+    bool m_stop;
+    Mutex m_mutex;
+    ConditionVariable m_work_available;
+    ConditionVariable m_work_done;
+
+    DISABLE_COPYING(thread_pool);
+  };
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+// ASEPRITE base library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread_pool.h"
+
+#include <vector>
+
+using namespace base;
+
+class SetItem {
+public:
+  SetItem(std::vector<int>* items, int index) : m_items(items), m_index(index) { }
+  void operator()() { (*m_items)[m_index] = m_index+1; }
+private:
+  std::vector<int>* m_items;
+  int m_index;
+};
+
+class Increment {
+public:
+  Increment(Mutex* mutex, int* counter) : m_mutex(mutex), m_counter(counter) { }
+  void operator()() {
+    ScopedLock lock(*m_mutex);
+    ++(*m_counter);
+  }
+private:
+  Mutex* m_mutex;
+  int* m_counter;
+};
+
+TEST(ThreadPool, DefaultSize)
+{
+  thread_pool pool;
+  EXPECT_LE(1, pool.size());
+}
+
+TEST(ThreadPool, ExecuteAll)
+{
+  std::vector<int> items(1000, 0);
+  thread_pool pool(4);
+  EXPECT_EQ(4, pool.size());
+
+  for (int i=0; i<(int)items.size(); ++i)
+    pool.execute(SetItem(&items, i));
+  pool.wait_all();
+
+  for (int i=0; i<(int)items.size(); ++i)
+    EXPECT_EQ(i+1, items[i]);
+}
+
+TEST(ThreadPool, ReuseAfterWait)
+{
+  Mutex mutex;
+  int counter = 0;
+  thread_pool pool(3);
+
+  for (int j=0; j<10; ++j) {
+    for (int i=0; i<100; ++i)
+      pool.execute(Increment(&mutex, &counter));
+    pool.wait_all();
+    EXPECT_EQ(100*(j+1), counter);
+  }
+}
+
+TEST(ThreadPool, DestructorWaitsPendingWork)
+{
+  Mutex mutex;
+  int counter = 0;
+  {
+    thread_pool pool(2);
+    for (int i=0; i<500; ++i)
+      pool.execute(Increment(&mutex, &counter));
+  }
+  EXPECT_EQ(500, counter);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -18,7 +18,11 @@
 
 #include "config.h"
 
+#include "app/file_selector.h"
 #include "base/bind.h"
+#include "base/path.h"
+#include "base/sha1.h"
+#include "commands/cmd_save_file.h"
 #include "commands/command.h"
 #include "commands/commands.h"
 #include "context.h"
@@ -26,6 +30,8 @@
 #include "document.h"
 #include "document_api.h"
 #include "document_undo.h"
+#include "file/file.h"
+#include "gfx/rect_packer.h"
 #include "ini_file.h"
 #include "modules/editors.h"
 #include "modules/gui.h"
@@ -36,11 +42,15 @@
 #include "raster/palette.h"
 #include "raster/sprite.h"
 #include "raster/stock.h"
+#include "tinyxml.h"
 #include "ui/gui.h"
 #include "undo_transaction.h"
 #include "widgets/editor/editor.h"
 
+#include <cstring>
+#include <fstream>
 #include <limits>
+#include <map>
 
 using namespace ui;
 
@@ -49,8 +59,18 @@ using namespace ui;
 
 class ExportSpriteSheetWindow : public Window
 {
-  enum SpriteSheetType { HorizontalStrip, VerticalStrip, Matrix };
+  enum SpriteSheetType { HorizontalStrip, VerticalStrip, Matrix, Packed };
   enum ExportAction { SaveCopyAs, SaveAs, Save, DoNotSave };
+  enum DataFormat { NoData, JsonData, XmlData };
+
+  // Where each frame of the sprite is located in the sheet.
+  struct SheetFrame {
+    gfx::Rect sheetBounds;      // Area of the sheet with the frame pixels.
+    gfx::Rect sourceBounds;     // Area of the sprite frame that was
+                                // copied in the sheet (smaller than
+                                // the sprite if it was trimmed).
+    int duration;
+  };
 
 public:
   ExportSpriteSheetWindow(Context* context)
@@ -60,6 +80,7 @@ public:
     , m_grid(4, false)
     , m_columnsLabel("Columns:")
     , m_columns(4, "4")
+    , m_dataFormatLabel("Data:")
     , m_exportActionLabel("Export Action:")
     , m_export("Export")
     , m_cancel("Cancel")
@@ -67,6 +88,11 @@ public:
     m_sheetType.addItem("Horizontal Strip");
     m_sheetType.addItem("Vertical Strip");
     m_sheetType.addItem("Matrix");
+    m_sheetType.addItem("Packed (trim and merge duplicates)");
+
+    m_dataFormat.addItem("None");
+    m_dataFormat.addItem("JSON");
+    m_dataFormat.addItem("XML");
 
     m_exportAction.addItem("Save Copy As...");
     m_exportAction.addItem("Save As...");
@@ -78,6 +104,8 @@ public:
     m_grid.addChildInCell(&m_sheetType, 3, 1, 0);
     m_grid.addChildInCell(&m_columnsLabel, 1, 1, 0);
     m_grid.addChildInCell(&m_columns, 3, 1, 0);
+    m_grid.addChildInCell(&m_dataFormatLabel, 1, 1, 0);
+    m_grid.addChildInCell(&m_dataFormat, 3, 1, 0);
     m_grid.addChildInCell(&m_exportActionLabel, 1, 1, 0);
     m_grid.addChildInCell(&m_exportAction, 3, 1, 0);
 
@@ -128,6 +156,9 @@ protected:
   {
     Sprite* sprite = m_document->getSprite();
     FrameNumber nframes = sprite->getTotalFrames();
+    gfx::Size spriteSize(sprite->getWidth(), sprite->getHeight());
+    std::vector<SheetFrame> sheetFrames(nframes);
+    UniquePtr<Image> resultImage;
     int columns;
 
     switch (m_sheetType.getSelectedItem()) {
@@ -140,29 +171,18 @@ protected:
       case Matrix:
         columns = m_columns.getTextInt();
         break;
+      case Packed:
+        columns = 0;
+        break;
     }
 
-    columns = MID(1, columns, nframes);
-
-    int sheet_w = sprite->getWidth()*columns;
-    int sheet_h = sprite->getHeight()*((nframes/columns)+((nframes%columns)>0?1:0));
-    UniquePtr<Image> resultImage(Image::create(sprite->getPixelFormat(), sheet_w, sheet_h));
-    UniquePtr<Image> tempImage(Image::create(sprite->getPixelFormat(), sprite->getWidth(), sprite->getHeight()));
-    image_clear(resultImage, 0);
-
-    int column = 0, row = 0;
-    for (FrameNumber frame(0); frame<nframes; ++frame) {
-      // TODO "tempImage" could not be necessary if we could specify
-      // destination clipping bounds in Sprite::render() function.
-      tempImage->clear(0);
-      sprite->render(tempImage, 0, 0, frame);
-      resultImage->copy(tempImage, column*sprite->getWidth(), row*sprite->getHeight());
+    if (m_sheetType.getSelectedItem() == Packed)
+      resultImage.reset(createPackedSheet(sprite, sheetFrames));
+    else
+      resultImage.reset(createGridSheet(sprite, MID(1, columns, nframes), sheetFrames));
 
-      if (++column >= columns) {
-        column = 0;
-        ++row;
-      }
-    }
+    int sheet_w = resultImage->w;
+    int sheet_h = resultImage->h;
 
     // Store the frame in the current editor so we can restore it
     // after change and restore the setTotalFrames() number.
@@ -218,16 +238,15 @@ protected:
     // back to the original sprite dimensions).
     bool undo = false;
 
+    // File name of the saved sheet image (empty if it wasn't saved)
+    // referenced from the data file.
+    std::string imageFilename;
+
     // Do the "Export Action"
     switch (m_exportAction.getSelectedItem()) {
 
       case SaveCopyAs:
-        {
-          Command* command = CommandsModule::instance()
-            ->getCommandByName(CommandId::SaveFileCopyAs);
-
-          m_context->executeCommand(command);
-        }
+        imageFilename = executeSaveCommand(CommandId::SaveFileCopyAs);
 
         // Always go back, as we are using "Save Copy As", so the user
         // wants to continue editing the original sprite.
@@ -235,12 +254,7 @@ protected:
         break;
 
       case SaveAs:
-        {
-          Command* command = CommandsModule::instance()
-            ->getCommandByName(CommandId::SaveFileAs);
-
-          m_context->executeCommand(command);
-        }
+        imageFilename = executeSaveCommand(CommandId::SaveFileAs);
 
         // If the command was cancelled, we go back to the original
         // state, if the sprite sheet was saved then we don't undo
@@ -249,12 +263,7 @@ protected:
         break;
 
       case Save:
-        {
-          Command* command = CommandsModule::instance()
-            ->getCommandByName(CommandId::SaveFile);
-
-          m_context->executeCommand(command);
-        }
+        imageFilename = executeSaveCommand(CommandId::SaveFile);
 
         // Same case as "Save As"
         undo = (m_document->isModified());
@@ -267,6 +276,11 @@ protected:
         break;
     }
 
+    // Save the position of each frame in the sheet (only if the sheet
+    // image was saved).
+    if (m_dataFormat.getSelectedItem() != NoData && !imageFilename.empty())
+      saveDataFile(imageFilename, sheetFrames, spriteSize, sheet_w, sheet_h);
+
     // Undo the sprite sheet conversion
     if (undo) {
       if (m_document->getUndo()->canUndo()) {
@@ -298,6 +312,248 @@ protected:
     closeWindow(NULL);
   }
 
+  // Puts all frames in a grid with the given number of columns.
+  static Image* createGridSheet(Sprite* sprite, int columns, std::vector<SheetFrame>& sheetFrames)
+  {
+    FrameNumber nframes = sprite->getTotalFrames();
+    int sheet_w = sprite->getWidth()*columns;
+    int sheet_h = sprite->getHeight()*((nframes/columns)+((nframes%columns)>0?1:0));
+    UniquePtr<Image> resultImage(Image::create(sprite->getPixelFormat(), sheet_w, sheet_h));
+    UniquePtr<Image> tempImage(Image::create(sprite->getPixelFormat(), sprite->getWidth(), sprite->getHeight()));
+    image_clear(resultImage, 0);
+
+    int column = 0, row = 0;
+    for (FrameNumber frame(0); frame<nframes; ++frame) {
+      // TODO "tempImage" could not be necessary if we could specify
+      // destination clipping bounds in Sprite::render() function.
+      tempImage->clear(0);
+      sprite->render(tempImage, 0, 0, frame);
+      resultImage->copy(tempImage, column*sprite->getWidth(), row*sprite->getHeight());
+
+      sheetFrames[frame].sheetBounds = gfx::Rect(column*sprite->getWidth(), row*sprite->getHeight(),
+                                                 sprite->getWidth(), sprite->getHeight());
+      sheetFrames[frame].sourceBounds = gfx::Rect(0, 0, sprite->getWidth(), sprite->getHeight());
+      sheetFrames[frame].duration = sprite->getFrameDuration(frame);
+
+      if (++column >= columns) {
+        column = 0;
+        ++row;
+      }
+    }
+
+    return resultImage.release();
+  }
+
+  // Removes the transparent borders of each frame, merges identical
+  // frames, and packs them in the smallest sheet we can find.
+  static Image* createPackedSheet(Sprite* sprite, std::vector<SheetFrame>& sheetFrames)
+  {
+    FrameNumber nframes = sprite->getTotalFrames();
+    int refpixel = sprite->getTransparentColor();
+    UniquePtr<Image> tempImage(Image::create(sprite->getPixelFormat(), sprite->getWidth(), sprite->getHeight()));
+    std::vector<Image*> images;     // Trimmed images without duplicates
+    std::vector<int> frameImages(nframes);
+    std::multimap<base::Sha1, int> hashes;
+
+    for (FrameNumber frame(0); frame<nframes; ++frame) {
+      tempImage->clear(refpixel);
+      sprite->render(tempImage, 0, 0, frame);
+
+      // Empty frames are saved as one transparent pixel.
+      gfx::Rect bounds;
+      if (!image_shrink_rect(tempImage, bounds, refpixel))
+        bounds = gfx::Rect(0, 0, 1, 1);
+
+      UniquePtr<Image> image(image_crop(tempImage, bounds.x, bounds.y, bounds.w, bounds.h, refpixel));
+      size_t size = image_line_size(image, image->w) * image->h;
+      base::Sha1 hash = base::Sha1::calculateFromData(image->dat, size);
+
+      // Look for an identical image of other frame.
+      int index = -1;
+      std::multimap<base::Sha1, int>::iterator it, end;
+      for (it=hashes.lower_bound(hash), end=hashes.upper_bound(hash); it!=end; ++it) {
+        const Image* other = images[it->second];
+        if (other->w == image->w &&
+            other->h == image->h &&
+            memcmp(other->dat, image->dat, size) == 0) {
+          index = it->second;
+          break;
+        }
+      }
+
+      if (index < 0) {
+        index = images.size();
+        images.push_back(image.release());
+        hashes.insert(std::make_pair(hash, index));
+      }
+
+      frameImages[frame] = index;
+      sheetFrames[frame].sourceBounds = bounds;
+      sheetFrames[frame].duration = sprite->getFrameDuration(frame);
+    }
+
+    std::vector<gfx::Size> sizes(images.size());
+    std::vector<gfx::Point> positions;
+    for (size_t i=0; i<images.size(); ++i)
+      sizes[i] = gfx::Size(images[i]->w, images[i]->h);
+
+    gfx::Size sheetSize = gfx::pack_rects(sizes, positions);
+    Image* resultImage = Image::create(sprite->getPixelFormat(), sheetSize.w, sheetSize.h);
+    resultImage->clear(refpixel);
+
+    for (size_t i=0; i<images.size(); ++i) {
+      resultImage->copy(images[i], positions[i].x, positions[i].y);
+      delete images[i];
+    }
+
+    for (FrameNumber frame(0); frame<nframes; ++frame)
+      sheetFrames[frame].sheetBounds = gfx::Rect(positions[frameImages[frame]],
+                                                 sizes[frameImages[frame]]);
+
+    return resultImage;
+  }
+
+  // Executes the given save command and returns the file name of the
+  // saved sheet image, or an empty string if the user cancelled the
+  // command or the file couldn't be saved.
+  std::string executeSaveCommand(const char* commandId)
+  {
+    SaveFileBaseCommand* command = static_cast<SaveFileBaseCommand*>
+      (CommandsModule::instance()->getCommandByName(commandId));
+
+    m_context->executeCommand(command);
+    return command->getSelectedFilename();
+  }
+
+  void saveDataFile(const std::string& imageFilename,
+                    const std::vector<SheetFrame>& sheetFrames,
+                    const gfx::Size& spriteSize, int sheet_w, int sheet_h)
+  {
+    bool json = (m_dataFormat.getSelectedItem() == JsonData);
+    std::string title = base::get_file_title(imageFilename);
+    std::string filename =
+      app::show_file_selector("Save Sprite Sheet Data",
+                              base::join_path(base::get_file_path(imageFilename),
+                                              title + (json ? ".json": ".xml")),
+                              json ? "json": "xml");
+    if (filename.empty())
+      return;
+
+    // Frame names
+    std::vector<std::string> names(sheetFrames.size());
+    for (size_t i=0; i<sheetFrames.size(); ++i) {
+      char buf[32];
+      sprintf(buf, " %d", (int)i);
+      names[i] = title + buf;
+    }
+
+    bool ok;
+    if (json)
+      ok = saveJsonData(filename, base::get_file_name(imageFilename), names, sheetFrames, spriteSize, sheet_w, sheet_h);
+    else
+      ok = saveXmlData(filename, base::get_file_name(imageFilename), names, sheetFrames, spriteSize, sheet_w, sheet_h);
+
+    if (!ok)
+      Alert::show("Error<<Error saving sprite sheet data file:<<%s||&OK", filename.c_str());
+  }
+
+  static std::string jsonString(const std::string& str)
+  {
+    std::string result = "\"";
+    for (std::string::const_iterator it=str.begin(); it!=str.end(); ++it) {
+      unsigned char chr = *it;
+
+      // Control characters must be escaped as \uXXXX
+      if (chr < 0x20) {
+        char buf[8];
+        sprintf(buf, "\\u%04x", chr);
+        result += buf;
+      }
+      else {
+        if (chr == '"' || chr == '\\')
+          result.push_back('\\');
+        result.push_back(chr);
+      }
+    }
+    result.push_back('"');
+    return result;
+  }
+
+  static bool saveJsonData(const std::string& filename,
+                           const std::string& imageFilename,
+                           const std::vector<std::string>& names,
+                           const std::vector<SheetFrame>& sheetFrames,
+                           const gfx::Size& spriteSize,
+                           int sheet_w, int sheet_h)
+  {
+    std::ofstream f(filename.c_str());
+    if (!f)
+      return false;
+
+    f << "{ \"frames\": [\n";
+    for (size_t i=0; i<sheetFrames.size(); ++i) {
+      const SheetFrame& sf = sheetFrames[i];
+      const gfx::Rect& fr = sf.sheetBounds;
+      const gfx::Rect& src = sf.sourceBounds;
+
+      f << "   { \"filename\": " << jsonString(names[i]) << ",\n"
+        << "     \"frame\": { \"x\": " << fr.x << ", \"y\": " << fr.y
+        << ", \"w\": " << fr.w << ", \"h\": " << fr.h << " },\n"
+        << "     \"rotated\": false,\n"
+        << "     \"trimmed\": " << (src != gfx::Rect(gfx::Point(0, 0), spriteSize) ? "true": "false") << ",\n"
+        << "     \"spriteSourceSize\": { \"x\": " << src.x << ", \"y\": " << src.y
+        << ", \"w\": " << src.w << ", \"h\": " << src.h << " },\n"
+        << "     \"sourceSize\": { \"w\": " << spriteSize.w << ", \"h\": " << spriteSize.h << " },\n"
+        << "     \"duration\": " << sf.duration << " }"
+        << (i+1 < sheetFrames.size() ? ",": "") << "\n";
+    }
+    f << " ],\n"
+      << " \"meta\": {\n"
+      << "  \"app\": " << jsonString(WEBSITE) << ",\n"
+      << "  \"version\": " << jsonString(VERSION) << ",\n"
+      << "  \"image\": " << jsonString(imageFilename) << ",\n"
+      << "  \"size\": { \"w\": " << sheet_w << ", \"h\": " << sheet_h << " }\n"
+      << " }\n"
+      << "}\n";
+
+    return f.good();
+  }
+
+  static bool saveXmlData(const std::string& filename,
+                          const std::string& imageFilename,
+                          const std::vector<std::string>& names,
+                          const std::vector<SheetFrame>& sheetFrames,
+                          const gfx::Size& spriteSize,
+                          int sheet_w, int sheet_h)
+  {
+    TiXmlDocument doc;
+    doc.LinkEndChild(new TiXmlDeclaration("1.0", "utf-8", ""));
+
+    TiXmlElement* atlas = new TiXmlElement("TextureAtlas");
+    atlas->SetAttribute("imagePath", imageFilename.c_str());
+    atlas->SetAttribute("width", sheet_w);
+    atlas->SetAttribute("height", sheet_h);
+    doc.LinkEndChild(atlas);
+
+    for (size_t i=0; i<sheetFrames.size(); ++i) {
+      const SheetFrame& sf = sheetFrames[i];
+      TiXmlElement* sprite = new TiXmlElement("sprite");
+      sprite->SetAttribute("n", names[i].c_str());
+      sprite->SetAttribute("x", sf.sheetBounds.x);
+      sprite->SetAttribute("y", sf.sheetBounds.y);
+      sprite->SetAttribute("w", sf.sheetBounds.w);
+      sprite->SetAttribute("h", sf.sheetBounds.h);
+      sprite->SetAttribute("oX", sf.sourceBounds.x);
+      sprite->SetAttribute("oY", sf.sourceBounds.y);
+      sprite->SetAttribute("oW", spriteSize.w);
+      sprite->SetAttribute("oH", spriteSize.h);
+      sprite->SetAttribute("duration", sf.duration);
+      atlas->LinkEndChild(sprite);
+    }
+
+    return doc.SaveFile(filename.c_str());
+  }
+
 private:
   Context* m_context;
   Document* m_document;
@@ -305,6 +561,8 @@ private:
   ComboBox m_sheetType;
   Label m_columnsLabel;
   Entry m_columns;
+  Label m_dataFormatLabel;
+  ComboBox m_dataFormat;
   Label m_exportActionLabel;
   ComboBox m_exportAction;
   Button m_export;
@@ -28,6 +28,7 @@
 #include "console.h"
 #include "document.h"
 #include "file/file.h"
+#include "ini_file.h"
 #include "job.h"
 #include "modules/editors.h"
 #include "modules/gui.h"
@@ -123,7 +124,13 @@ void OpenFileCommand::onExecute(Context* context)
   }
 
   if (!m_filename.empty()) {
-    UniquePtr<FileOp> fop(fop_to_load_document(m_filename.c_str(), FILE_LOAD_SEQUENCE_ASK));
+    // Cels can be decoded when they are shown for the first time
+    // (useful to open big animations quickly).
+    int flags = FILE_LOAD_SEQUENCE_ASK;
+    if (get_config_bool("Options", "LazyCelLoading", true))
+      flags |= FILE_LOAD_LAZY_CELS;
+
+    UniquePtr<FileOp> fop(fop_to_load_document(m_filename.c_str(), flags));
     bool unrecent = false;
 
     if (fop) {
@@ -23,12 +23,14 @@
 #include "app/load_widget.h"
 #include "base/bind.h"
 #include "commands/command.h"
+#include "commands/filters/filter_manager_impl.h"
 #include "context.h"
 #include "ini_file.h"
 #include "modules/editors.h"
 #include "raster/image.h"
 #include "settings/document_settings.h"
 #include "ui/gui.h"
+#include "undoers/stored_data.h"
 #include "util/render.h"
 #include "widgets/color_button.h"
 #include "widgets/editor/editor.h"
@@ -72,6 +74,8 @@ void OptionsCommand::onExecute(Context* context)
   Widget* check_smooth = app::find_widget<Widget>(window, "smooth");
   Widget* move_click2 = app::find_widget<Widget>(window, "move_click2");
   Widget* draw_click2 = app::find_widget<Widget>(window, "draw_click2");
+  Widget* multithreaded_render = app::find_widget<Widget>(window, "multithreaded_render");
+  Widget* multithreaded_filters = app::find_widget<Widget>(window, "multithreaded_filters");
   Widget* cursor_color_box = app::find_widget<Widget>(window, "cursor_color_box");
   Widget* grid_color_box = app::find_widget<Widget>(window, "grid_color_box");
   Widget* pixel_grid_color_box = app::find_widget<Widget>(window, "pixel_grid_color_box");
@@ -81,6 +85,7 @@ void OptionsCommand::onExecute(Context* context)
   Widget* checked_bg_color2_box = app::find_widget<Widget>(window, "checked_bg_color2_box");
   Button* checked_bg_reset = app::find_widget<Button>(window, "checked_bg_reset");
   Widget* undo_size_limit = app::find_widget<Widget>(window, "undo_size_limit");
+  Widget* undo_memory_limit = app::find_widget<Widget>(window, "undo_memory_limit");
   Widget* undo_goto_modified = app::find_widget<Widget>(window, "undo_goto_modified");
   Widget* button_ok = app::find_widget<Widget>(window, "button_ok");
 
@@ -112,6 +117,12 @@ void OptionsCommand::onExecute(Context* context)
   if (get_config_bool("Options", "MoveSmooth", true))
     check_smooth->setSelected(true);
 
+  if (RenderEngine::getMultithreadedRender())
+    multithreaded_render->setSelected(true);
+
+  if (FilterManagerImpl::getMultithreaded())
+    multithreaded_filters->setSelected(true);
+
   // Checked background size
   m_checked_bg->addItem("16x16");
   m_checked_bg->addItem("8x8");
@@ -135,6 +146,7 @@ void OptionsCommand::onExecute(Context* context)
 
   // Undo limit
   undo_size_limit->setTextf("%d", get_config_int("Options", "UndoSizeLimit", 8));
+  undo_memory_limit->setTextf("%d", (int)(undoers::StoredData::getMemoryLimit() / (1024*1024)));
 
   // Goto modified frame/layer on undo/redo
   if (get_config_bool("Options", "UndoGotoModified", true))
@@ -145,6 +157,7 @@ void OptionsCommand::onExecute(Context* context)
 
   if (window->getKiller() == button_ok) {
     int undo_size_limit_value;
+    int undo_memory_limit_value;
 
     Editor::set_cursor_color(cursor_color->getColor());
     docSettings->setGridColor(grid_color->getColor());
@@ -153,6 +166,8 @@ void OptionsCommand::onExecute(Context* context)
     set_config_bool("Options", "MoveSmooth", check_smooth->isSelected());
     set_config_bool("Options", "MoveClick2", move_click2->isSelected());
     set_config_bool("Options", "DrawClick2", draw_click2->isSelected());
+    RenderEngine::setMultithreadedRender(multithreaded_render->isSelected());
+    FilterManagerImpl::setMultithreaded(multithreaded_filters->isSelected());
 
     RenderEngine::setCheckedBgType((RenderEngine::CheckedBgType)m_checked_bg->getSelectedItem());
     RenderEngine::setCheckedBgZoom(m_checked_bg_zoom->isSelected());
@@ -162,6 +177,11 @@ void OptionsCommand::onExecute(Context* context)
     undo_size_limit_value = undo_size_limit->getTextInt();
     undo_size_limit_value = MID(1, undo_size_limit_value, 9999);
     set_config_int("Options", "UndoSizeLimit", undo_size_limit_value);
+
+    undo_memory_limit_value = undo_memory_limit->getTextInt();
+    undo_memory_limit_value = MID(1, undo_memory_limit_value, 9999);
+    set_config_int("Options", "UndoMemoryLimit", undo_memory_limit_value);
+    undoers::StoredData::setMemoryLimit((size_t)undo_memory_limit_value*1024*1024);
     set_config_bool("Options", "UndoGotoModified", undo_goto_modified->isSelected());
 
     // Save configuration
@@ -113,6 +113,7 @@ private:
   Button m_saveButton;
   Button m_rampButton;
   Button m_quantizeButton;
+  CheckBox m_fullPrecisionCheck;
 
   // This variable is used to avoid updating the m_hexColorEntry text
   // when the color change is generated from a
@@ -259,6 +260,7 @@ PaletteEntryEditor::PaletteEntryEditor()
   , m_saveButton("Save")
   , m_rampButton("Ramp")
   , m_quantizeButton("Quantize")
+  , m_fullPrecisionCheck("Exact")
   , m_disableHexUpdate(false)
   , m_redrawAll(false)
   , m_implantChange(false)
@@ -304,6 +306,7 @@ PaletteEntryEditor::PaletteEntryEditor()
   }
   m_bottomBox.addChild(&m_rampButton);
   m_bottomBox.addChild(&m_quantizeButton);
+  m_bottomBox.addChild(&m_fullPrecisionCheck);
 
   // Main vertical box
   m_vbox.addChild(&m_topBox);
@@ -315,6 +318,9 @@ PaletteEntryEditor::PaletteEntryEditor()
   // Hide (or show) the "More Options" depending the saved value in .cfg file
   m_bottomBox.setVisible(get_config_bool("PaletteEditor", "ShowMoreOptions", false));
 
+  // Quantize with the 8-bit colors (slower) instead of the 5-6-5 histogram
+  m_fullPrecisionCheck.setSelected(get_config_bool("PaletteEditor", "FullPrecisionQuantize", false));
+
   m_rgbButton.Click.connect(&PaletteEntryEditor::onColorTypeButtonClick, this);
   m_hsvButton.Click.connect(&PaletteEntryEditor::onColorTypeButtonClick, this);
   m_moreOptions.Click.connect(&PaletteEntryEditor::onMoreOptionsClick, this);
@@ -656,7 +662,10 @@ void PaletteEntryEditor::onQuantizeClick(Event& ev)
       return;
     }
 
-    palette = quantization::create_palette_from_rgb(sprite, reader.frame());
+    bool fullPrecision = m_fullPrecisionCheck.isSelected();
+    set_config_bool("PaletteEditor", "FullPrecisionQuantize", fullPrecision);
+
+    palette = quantization::create_palette_from_rgb(sprite, reader.frame(), fullPrecision);
   }
 
   setNewPalette(palette, "Quantize Palette");
@@ -23,7 +23,7 @@
 #include "base/bind.h"
 #include "base/thread.h"
 #include "base/unique_ptr.h"
-#include "commands/command.h"
+#include "commands/cmd_save_file.h"
 #include "console.h"
 #include "context_access.h"
 #include "file/file.h"
@@ -72,9 +72,22 @@ private:
   FileOp* m_fop;
 };
 
-static void save_document_in_background(Document* document, bool mark_as_saved)
+//////////////////////////////////////////////////////////////////////
+// SaveFileBaseCommand
+
+SaveFileBaseCommand::SaveFileBaseCommand(const char* short_name, const char* friendly_name, CommandFlags flags)
+  : Command(short_name, friendly_name, flags)
+{
+}
+
+bool SaveFileBaseCommand::onEnabled(Context* context)
+{
+  return context->checkFlags(ContextFlags::ActiveDocumentIsWritable);
+}
+
+void SaveFileBaseCommand::saveDocumentInBackground(Document* document, bool markAsSaved)
 {
-  UniquePtr<FileOp> fop(fop_to_save_document(document));
+  UniquePtr<FileOp> fop(fop_to_save_document(document, 0));
   if (!fop)
     return;
 
@@ -87,18 +100,18 @@ static void save_document_in_background(Document* document, bool mark_as_saved)
   }
   else {
     App::instance()->getRecentFiles()->addRecentFile(document->getFilename());
-    if (mark_as_saved)
+    if (markAsSaved)
       document->markAsSaved();
 
     StatusBar::instance()
       ->setStatusText(2000, "File %s, saved.",
                       get_filename(document->getFilename()));
+
+    m_selectedFilename = document->getFilename();
   }
 }
 
-/*********************************************************************/
-
-static void save_as_dialog(const ContextReader& reader, const char* dlg_title, bool mark_as_saved)
+void SaveFileBaseCommand::saveAsDialog(const ContextReader& reader, const char* dlgTitle, bool markAsSaved)
 {
   const Document* document = reader.document();
   char exts[4096];
@@ -110,7 +123,7 @@ static void save_as_dialog(const ContextReader& reader, const char* dlg_title, b
   get_writable_extensions(exts, sizeof(exts));
 
   for (;;) {
-    newfilename = app::show_file_selector(dlg_title, filename, exts);
+    newfilename = app::show_file_selector(dlgTitle, filename, exts);
     if (newfilename.empty())
       return;
 
@@ -143,7 +156,7 @@ static void save_as_dialog(const ContextReader& reader, const char* dlg_title, b
     documentWriter->setFilename(filename.c_str());
 
     // Save the document
-    save_document_in_background(documentWriter, mark_as_saved);
+    saveDocumentInBackground(documentWriter, markAsSaved);
 
     update_screen_for_document(documentWriter);
   }
@@ -152,31 +165,23 @@ static void save_as_dialog(const ContextReader& reader, const char* dlg_title, b
 //////////////////////////////////////////////////////////////////////
 // save_file
 
-class SaveFileCommand : public Command
+class SaveFileCommand : public SaveFileBaseCommand
 {
 public:
   SaveFileCommand();
   Command* clone() { return new SaveFileCommand(*this); }
 
 protected:
-  bool onEnabled(Context* context);
   void onExecute(Context* context);
 };
 
 SaveFileCommand::SaveFileCommand()
-  : Command("SaveFile",
-            "Save File",
-            CmdRecordableFlag)
+  : SaveFileBaseCommand("SaveFile",
+                        "Save File",
+                        CmdRecordableFlag)
 {
 }
 
-// Returns true if there is a current sprite to save.
-// [main thread]
-bool SaveFileCommand::onEnabled(Context* context)
-{
-  return context->checkFlags(ContextFlags::ActiveDocumentIsWritable);
-}
-
 // Saves the active document in a file.
 // [main thread]
 void SaveFileCommand::onExecute(Context* context)
@@ -184,79 +189,71 @@ void SaveFileCommand::onExecute(Context* context)
   const ContextReader reader(context);
   const Document* document(reader.document());
 
+  m_selectedFilename.clear();
+
   // If the document is associated to a file in the file-system, we can
   // save it directly without user interaction.
   if (document->isAssociatedToFile()) {
     ContextWriter writer(reader);
     Document* documentWriter = writer.document();
 
-    save_document_in_background(documentWriter, true);
+    saveDocumentInBackground(documentWriter, true);
     update_screen_for_document(documentWriter);
   }
   // If the document isn't associated to a file, we must to show the
   // save-as dialog to the user to select for first time the file-name
   // for this document.
   else {
-    save_as_dialog(reader, "Save File", true);
+    saveAsDialog(reader, "Save File", true);
   }
 }
 
 //////////////////////////////////////////////////////////////////////
 // save_file_as
 
-class SaveFileAsCommand : public Command
+class SaveFileAsCommand : public SaveFileBaseCommand
 {
 public:
   SaveFileAsCommand();
   Command* clone() { return new SaveFileAsCommand(*this); }
 
 protected:
-  bool onEnabled(Context* context);
   void onExecute(Context* context);
 };
 
 SaveFileAsCommand::SaveFileAsCommand()
-  : Command("SaveFileAs",
-            "Save File As",
-            CmdRecordableFlag)
+  : SaveFileBaseCommand("SaveFileAs",
+                        "Save File As",
+                        CmdRecordableFlag)
 {
 }
 
-bool SaveFileAsCommand::onEnabled(Context* context)
-{
-  return context->checkFlags(ContextFlags::ActiveDocumentIsWritable);
-}
-
 void SaveFileAsCommand::onExecute(Context* context)
 {
   const ContextReader reader(context);
-  save_as_dialog(reader, "Save As", true);
+
+  m_selectedFilename.clear();
+  saveAsDialog(reader, "Save As", true);
 }
 
 //////////////////////////////////////////////////////////////////////
 // save_file_copy_as
 
-class SaveFileCopyAsCommand : public Command
+class SaveFileCopyAsCommand : public SaveFileBaseCommand
 {
 public:
   SaveFileCopyAsCommand();
   Command* clone() { return new SaveFileCopyAsCommand(*this); }
 
 protected:
-  bool onEnabled(Context* context);
   void onExecute(Context* context);
 };
 
 SaveFileCopyAsCommand::SaveFileCopyAsCommand()
-  : Command("SaveFileCopyAs",
-            "Save File Copy As",
-            CmdRecordableFlag)
-{
-}
-
-bool SaveFileCopyAsCommand::onEnabled(Context* context)
+  : SaveFileBaseCommand("SaveFileCopyAs",
+                        "Save File Copy As",
+                        CmdRecordableFlag)
 {
-  return context->checkFlags(ContextFlags::ActiveDocumentIsWritable);
 }
 
 void SaveFileCopyAsCommand::onExecute(Context* context)
@@ -265,8 +262,10 @@ void SaveFileCopyAsCommand::onExecute(Context* context)
   const Document* document(reader.document());
   base::string old_filename = document->getFilename();
 
+  m_selectedFilename.clear();
+
   // show "Save As" dialog
-  save_as_dialog(reader, "Save Copy As", false);
+  saveAsDialog(reader, "Save Copy As", false);
 
   // Restore the file name.
   {
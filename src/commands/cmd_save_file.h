@@ -0,0 +1,48 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef COMMANDS_CMD_SAVE_FILE_H_INCLUDED
+#define COMMANDS_CMD_SAVE_FILE_H_INCLUDED
+
+#include "base/string.h"
+#include "commands/command.h"
+
+class ContextReader;
+class Document;
+
+// Base class of SaveFile, SaveFileAs and SaveFileCopyAs commands.
+class SaveFileBaseCommand : public Command
+{
+public:
+  SaveFileBaseCommand(const char* short_name, const char* friendly_name, CommandFlags flags);
+
+  // Returns the file name where the document was saved in the last
+  // execution of the command, or an empty string if the user
+  // cancelled the dialog or the file couldn't be saved.
+  base::string getSelectedFilename() const { return m_selectedFilename; }
+
+protected:
+  bool onEnabled(Context* context);
+
+  void saveAsDialog(const ContextReader& reader, const char* dlgTitle, bool markAsSaved);
+  void saveDocumentInBackground(Document* document, bool markAsSaved);
+
+  base::string m_selectedFilename;
+};
+
+#endif // COMMANDS_CMD_SAVE_FILE_H_INCLUDED
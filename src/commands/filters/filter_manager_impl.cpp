@@ -20,6 +20,11 @@
 
 #include "commands/filters/filter_manager_impl.h"
 
+#include "base/condition_variable.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+#include "base/thread_pool.h"
 #include "context_access.h"
 #include "filters/filter.h"
 #include "ini_file.h"
@@ -41,10 +46,160 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <new>
+#include <vector>
 
 using namespace std;
 using namespace ui;
 
+namespace {
+
+// Minimum number of rows of each band in the multithreaded mode.
+const int kMinBandRows = 16;
+
+// Maximum number of pixels of the images filtered at the same time in
+// the multithreaded mode (each one needs a copy of the image).
+const int kMaxBatchPixels = 4096*4096;
+
+// An image to be filtered in the multithreaded mode.
+struct FilterJob {
+  Image* src;
+  Image* dst;                   // Copy of "src" where the filter is applied
+  const Mask* mask;
+  int offset_x, offset_y;       // Position of the image in the sprite
+  gfx::Rect area;               // Area of the image to be modified
+  Target target;
+  int rowsDone;                 // Rows filtered (protected by BandsState::mutex)
+};
+
+// State shared by all bands (and the thread which waits them).
+struct BandsState {
+  Mutex mutex;
+  ConditionVariable bandDone;
+  int rowsDone;
+  int bandsDone;
+  volatile bool cancelled;
+  bool outOfMemory;
+
+  BandsState() : rowsDone(0), bandsDone(0), cancelled(false), outOfMemory(false) { }
+};
+
+// A FilterManager to apply the filter in a range of rows of one
+// image. Each band has its own row/mask iterators, so several bands
+// can be processed at the same time in different threads.
+class RowBand : public FilterManager
+{
+public:
+  RowBand(Filter* filter, FilterIndexedData* indexedData, PixelFormat format,
+          FilterJob* job, int beginRow, int endRow, BandsState* state)
+    : m_filter(filter)
+    , m_indexedData(indexedData)
+    , m_format(format)
+    , m_job(job)
+    , m_beginRow(beginRow)
+    , m_endRow(endRow)
+    , m_state(state)
+    , m_row(0)
+    , m_mask_address(NULL) {
+  }
+
+  // Called from a thread of the pool.
+  void operator()() {
+    try {
+      for (m_row=m_beginRow; m_row<m_endRow && !m_state->cancelled; ++m_row) {
+        applyRow();
+
+        ScopedLock lock(m_state->mutex);
+        ++m_state->rowsDone;
+        ++m_job->rowsDone;
+      }
+    }
+    catch (const std::bad_alloc&) {
+      ScopedLock lock(m_state->mutex);
+      m_state->outOfMemory = true;
+      m_state->cancelled = true;
+    }
+
+    ScopedLock lock(m_state->mutex);
+    ++m_state->bandsDone;
+    m_state->bandDone.notifyAll();
+  }
+
+  // FilterManager implementation
+  const void* getSourceAddress() {
+    return address(m_job->src);
+  }
+
+  void* getDestinationAddress() {
+    return address(m_job->dst);
+  }
+
+  int getWidth() { return m_job->area.w; }
+  Target getTarget() { return m_job->target; }
+  FilterIndexedData* getIndexedData() { return m_indexedData; }
+
+  bool skipPixel() {
+    bool skip = false;
+
+    if (m_mask_address) {
+      if (!((*m_mask_address) & (1<<m_d.rem)))
+        skip = true;
+
+      // Move to the next pixel in the mask.
+      _image_bitmap_next_bit(m_d, m_mask_address);
+    }
+
+    return skip;
+  }
+
+  const Image* getSourceImage() { return m_job->src; }
+  int getX() { return m_job->area.x; }
+  int getY() { return m_job->area.y+m_row; }
+
+private:
+  void applyRow() {
+    const Mask* mask = m_job->mask;
+
+    if ((mask) && (mask->getBitmap())) {
+      m_d = div(m_job->area.x-mask->getBounds().x+m_job->offset_x, 8);
+      m_mask_address = ((uint8_t**)mask->getBitmap()->line)
+        [m_row+m_job->area.y-mask->getBounds().y+m_job->offset_y]+m_d.quot;
+    }
+    else
+      m_mask_address = NULL;
+
+    switch (m_format) {
+      case IMAGE_RGB:       m_filter->applyToRgba(this); break;
+      case IMAGE_GRAYSCALE: m_filter->applyToGrayscale(this); break;
+      case IMAGE_INDEXED:   m_filter->applyToIndexed(this); break;
+    }
+  }
+
+  void* address(Image* image) const {
+    int x = m_job->area.x;
+    int y = m_job->area.y+m_row;
+
+    switch (m_format) {
+      case IMAGE_RGB:       return ((uint32_t**)image->line)[y]+x;
+      case IMAGE_GRAYSCALE: return ((uint16_t**)image->line)[y]+x;
+      case IMAGE_INDEXED:   return ((uint8_t**)image->line)[y]+x;
+    }
+    return NULL;
+  }
+
+  Filter* m_filter;
+  FilterIndexedData* m_indexedData;
+  PixelFormat m_format;
+  FilterJob* m_job;
+  int m_beginRow, m_endRow;
+  BandsState* m_state;
+  int m_row;
+  uint8_t* m_mask_address;
+  div_t m_d;
+};
+
+} // anonymous namespace
+
 FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   : m_context(context)
   , m_location(context->getActiveLocation())
@@ -56,6 +211,7 @@ FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   m_src = NULL;
   m_dst = NULL;
   m_row = 0;
+  m_stepRows = 0;
   m_offset_x = 0;
   m_offset_y = 0;
   m_mask = NULL;
@@ -63,6 +219,11 @@ FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   m_mask_address = NULL;
   m_targetOrig = TARGET_ALL_CHANNELS;
   m_target = TARGET_ALL_CHANNELS;
+  m_pool = NULL;
+
+  // The option is read here (in the main thread) because the filter
+  // can be applied from the background thread of FilterWorker
+  m_multithreaded = getMultithreaded();
 
   Image* image = m_location.image(&offset_x, &offset_y);
   if (image == NULL)
@@ -78,6 +239,18 @@ FilterManagerImpl::~FilterManagerImpl()
 
   if (m_dst)
     image_free(m_dst);
+
+  delete m_pool;
+}
+
+bool FilterManagerImpl::getMultithreaded()
+{
+  return get_config_bool("Options", "MultithreadedFilters", true);
+}
+
+void FilterManagerImpl::setMultithreaded(bool state)
+{
+  set_config_bool("Options", "MultithreadedFilters", state);
 }
 
 void FilterManagerImpl::setProgressDelegate(IProgressDelegate* progressDelegate)
@@ -107,6 +280,7 @@ void FilterManagerImpl::begin()
 
   m_row = 0;
   m_mask = (document->isMaskVisible() ? document->getMask(): NULL);
+  m_filter->beginFiltering();
 
   updateMask(m_mask, m_src);
 }
@@ -130,6 +304,7 @@ void FilterManagerImpl::beginForPreview()
 
   m_row = 0;
   m_mask = m_preview_mask;
+  m_filter->beginFiltering();
 
   {
     Editor* editor = current_editor;
@@ -172,6 +347,13 @@ void FilterManagerImpl::beginForPreview()
 bool FilterManagerImpl::applyStep()
 {
   if ((m_row >= 0) && (m_row < m_h)) {
+    if (m_multithreaded) {
+      m_stepRows = MIN(m_h - m_row, getThreadPool()->size() * kMinBandRows);
+      applyRowsInParallel(m_row, m_row+m_stepRows);
+      m_row += m_stepRows;
+      return true;
+    }
+
     if ((m_mask) && (m_mask->getBitmap())) {
       m_d = div(m_x-m_mask->getBounds().x+m_offset_x, 8);
       m_mask_address = ((uint8_t**)m_mask->getBitmap()->line)[m_row+m_y-m_mask->getBounds().y+m_offset_y]+m_d.quot;
@@ -185,6 +367,7 @@ bool FilterManagerImpl::applyStep()
       case IMAGE_INDEXED:   m_filter->applyToIndexed(this); break;
     }
     ++m_row;
+    m_stepRows = 1;
 
     return true;
   }
@@ -201,7 +384,7 @@ void FilterManagerImpl::apply()
   while (!cancelled && applyStep()) {
     if (m_progressDelegate) {
       // Report progress.
-      m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_h);
+      m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * m_row / m_h);
 
       // Does the user cancelled the whole process?
       cancelled = m_progressDelegate->isCancelled();
@@ -240,6 +423,12 @@ void FilterManagerImpl::applyToTarget()
   ContextWriter writer(reader);
   UndoTransaction undo(writer.context(), m_filter->getName(), undo::ModifyDocument);
 
+  if (m_multithreaded) {
+    applyToImagesInParallel(images, undo);
+    undo.commit();
+    return;
+  }
+
   m_progressBase = 0.0f;
   m_progressWidth = 1.0f / images.size();
 
@@ -260,6 +449,168 @@ void FilterManagerImpl::applyToTarget()
   undo.commit();
 }
 
+// Applies the filter to several images at the same time, splitting
+// each image in bands of rows. The images are processed in batches
+// (limited by kMaxBatchPixels), because each one needs a copy. As in
+// the single-threaded mode, if the process is cancelled the images
+// which were completely filtered are kept, and the others are not
+// modified.
+void FilterManagerImpl::applyToImagesInParallel(ImagesCollector& images, UndoTransaction& undo)
+{
+  Document* document = m_location.document();
+  const Mask* mask = (document->isMaskVisible() ? document->getMask(): NULL);
+  PixelFormat format = getPixelFormat();
+  std::vector<FilterJob> jobs;
+  int totalRows = 0;
+  BandsState state;
+
+  // Same checks of init() and begin() for all images before
+  // modifying any of them.
+  for (ImagesCollector::ItemsIterator it = images.begin(); it != images.end(); ++it) {
+    FilterJob job;
+    job.src = it->image();
+    job.dst = NULL;
+    job.mask = mask;
+    job.offset_x = it->cel()->getX();
+    job.offset_y = it->cel()->getY();
+    job.rowsDone = 0;
+
+    if (!calcMaskArea(document->getMask(), job.src, job.offset_x, job.offset_y, job.area))
+      throw InvalidAreaException();
+
+    if (!calcMaskArea(mask, job.src, job.offset_x, job.offset_y, job.area))
+      continue;
+
+    job.target = m_targetOrig;
+    if (it->layer()->isBackground())
+      job.target &= ~TARGET_ALPHA_CHANNEL;
+
+    jobs.push_back(job);
+    totalRows += job.area.h;
+  }
+
+  // Update the palette and RgbMap here, so bands can access them
+  // without modifying them.
+  getPalette();
+  getRgbMap();
+  m_filter->beginFiltering();
+
+  base::thread_pool* pool = getThreadPool();
+  int nthreads = pool->size();
+  int begin = 0;
+
+  while (begin < (int)jobs.size() && !state.cancelled) {
+    int end = begin;
+    int pixels = 0;
+    int nbands = 0;
+
+    try {
+      // Create the copies of the next batch of images
+      while (end < (int)jobs.size() &&
+             (end == begin || pixels + jobs[end].src->w*jobs[end].src->h <= kMaxBatchPixels)) {
+        FilterJob& job = jobs[end++];
+        job.dst = image_crop(job.src, 0, 0, job.src->w, job.src->h, 0);
+        pixels += job.src->w*job.src->h;
+      }
+
+      for (int i=begin; i<end; ++i) {
+        int h = jobs[i].area.h;
+        int bandRows = MAX(kMinBandRows, (h+nthreads-1) / nthreads);
+
+        for (int row=0; row<h; row+=bandRows, ++nbands)
+          pool->execute(RowBand(m_filter, this, format, &jobs[i],
+                                row, MIN(h, row+bandRows), &state));
+      }
+
+      // Report the progress and check if the user cancels the process
+      // meanwhile the bands are being processed.
+      {
+        ScopedLock lock(state.mutex);
+        while (state.bandsDone < nbands) {
+          state.bandDone.waitFor(lock, 0.1);
+
+          if (m_progressDelegate) {
+            m_progressDelegate->reportProgress(float(state.rowsDone) / totalRows);
+
+            if (m_progressDelegate->isCancelled())
+              state.cancelled = true;
+          }
+        }
+        state.bandsDone = 0;
+      }
+      pool->wait_all();
+
+      if (state.outOfMemory)
+        throw std::bad_alloc();
+    }
+    catch (...) {
+      for (int i=begin; i<end; ++i)
+        image_free(jobs[i].dst);
+      throw;
+    }
+
+    for (int i=begin; i<end; ++i) {
+      FilterJob& job = jobs[i];
+
+      if (job.rowsDone == job.area.h) {
+        // Undo stuff
+        if (undo.isEnabled())
+          undo.pushUndoer(new undoers::ImageArea(undo.getObjects(), job.src,
+                                                 job.area.x, job.area.y,
+                                                 job.area.w, job.area.h));
+
+        // Copy "dst" to "src"
+        image_copy(job.src, job.dst, 0, 0);
+      }
+
+      image_free(job.dst);
+      job.dst = NULL;
+    }
+
+    begin = end;
+  }
+}
+
+// Applies the filter to the given rows of the current image (from
+// m_src to m_dst) using several threads.
+void FilterManagerImpl::applyRowsInParallel(int beginRow, int endRow)
+{
+  FilterJob job;
+  job.src = m_src;
+  job.dst = m_dst;
+  job.mask = m_mask;
+  job.offset_x = m_offset_x;
+  job.offset_y = m_offset_y;
+  job.area = gfx::Rect(m_x, m_y, m_w, m_h);
+  job.target = m_target;
+  job.rowsDone = 0;
+
+  // Update the palette and RgbMap here, so bands can access them
+  // without modifying them.
+  getPalette();
+  getRgbMap();
+
+  base::thread_pool* pool = getThreadPool();
+  BandsState state;
+  int rows = endRow - beginRow;
+  int bandRows = MAX(kMinBandRows, (rows+pool->size()-1) / pool->size());
+
+  for (int row=beginRow; row<endRow; row+=bandRows)
+    pool->execute(RowBand(m_filter, this, getPixelFormat(), &job,
+                          row, MIN(endRow, row+bandRows), &state));
+  pool->wait_all();
+
+  if (state.outOfMemory)
+    throw std::bad_alloc();
+}
+
+base::thread_pool* FilterManagerImpl::getThreadPool()
+{
+  if (!m_pool)
+    m_pool = new base::thread_pool(base::thread::hardware_concurrency());
+  return m_pool;
+}
+
 void FilterManagerImpl::flush()
 {
   if (m_row >= 0) {
@@ -267,10 +618,10 @@ void FilterManagerImpl::flush()
 
     Editor* editor = current_editor;
     editor->editorToScreen(m_x+m_offset_x,
-                           m_y+m_offset_y+m_row-1,
+                           m_y+m_offset_y+m_row-m_stepRows,
                            &rect.x, &rect.y);
     rect.w = (m_w << editor->getZoom());
-    rect.h = (1 << editor->getZoom());
+    rect.h = (m_stepRows << editor->getZoom());
 
     gfx::Region reg1(rect);
     gfx::Region reg2;
@@ -365,12 +716,25 @@ void FilterManagerImpl::applyToImage(Layer* layer, Image* image, int x, int y)
 }
 
 bool FilterManagerImpl::updateMask(Mask* mask, const Image* image)
+{
+  gfx::Rect area;
+  bool result = calcMaskArea(mask, image, m_offset_x, m_offset_y, area);
+
+  m_x = area.x;
+  m_y = area.y;
+  m_w = area.w;
+  m_h = area.h;
+  return result;
+}
+
+bool FilterManagerImpl::calcMaskArea(const Mask* mask, const Image* image,
+                                     int offset_x, int offset_y, gfx::Rect& area)
 {
   int x, y, w, h;
 
   if ((mask) && (mask->getBitmap())) {
-    x = mask->getBounds().x - m_offset_x;
-    y = mask->getBounds().y - m_offset_y;
+    x = mask->getBounds().x - offset_x;
+    y = mask->getBounds().y - offset_y;
     w = mask->getBounds().w;
     h = mask->getBounds().h;
 
@@ -398,17 +762,11 @@ bool FilterManagerImpl::updateMask(Mask* mask, const Image* image)
   }
 
   if ((w < 1) || (h < 1)) {
-    m_x = 0;
-    m_y = 0;
-    m_w = 0;
-    m_h = 0;
+    area = gfx::Rect(0, 0, 0, 0);
     return false;
   }
   else {
-    m_x = x;
-    m_y = y;
-    m_w = w;
-    m_h = h;
+    area = gfx::Rect(x, y, w, h);
     return true;
   }
 }
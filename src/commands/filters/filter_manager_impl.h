@@ -22,6 +22,7 @@
 #include "base/exception.h"
 #include "base/exception.h"
 #include "document_location.h"
+#include "gfx/rect.h"
 #include "filters/filter_indexed_data.h"
 #include "filters/filter_manager.h"
 #include "raster/pixel_format.h"
@@ -33,9 +34,15 @@ class Context;
 class Document;
 class Filter;
 class Image;
+class ImagesCollector;
 class Layer;
 class Mask;
 class Sprite;
+class UndoTransaction;
+
+namespace base {
+  class thread_pool;
+}
 
 class InvalidAreaException : public base::Exception
 {
@@ -72,6 +79,13 @@ public:
   FilterManagerImpl(Context* context, Filter* filter);
   ~FilterManagerImpl();
 
+  // Multithreaded mode: applyToTarget() processes several images and
+  // row bands of each image at the same time, and each applyStep()
+  // of the preview filters several rows in parallel. It's the
+  // "Multithreaded Filters" check box of the Options dialog.
+  static bool getMultithreaded();
+  static void setMultithreaded(bool state);
+
   void setProgressDelegate(IProgressDelegate* progressDelegate);
 
   PixelFormat getPixelFormat() const;
@@ -110,14 +124,23 @@ private:
   void init(const Layer* layer, Image* image, int offset_x, int offset_y);
   void apply();
   void applyToImage(Layer* layer, Image* image, int x, int y);
+  void applyToImagesInParallel(ImagesCollector& images, UndoTransaction& undo);
+  void applyRowsInParallel(int beginRow, int endRow);
+  base::thread_pool* getThreadPool();
   bool updateMask(Mask* mask, const Image* image);
 
+  // Calculates the area of "image" (placed in offset_x/y) to be
+  // modified using the given mask. Returns false if it's empty.
+  static bool calcMaskArea(const Mask* mask, const Image* image,
+                           int offset_x, int offset_y, gfx::Rect& area);
+
   Context* m_context;
   DocumentLocation m_location;
   Filter* m_filter;
   Image* m_src;
   Image* m_dst;
   int m_row;
+  int m_stepRows;               // Rows filtered in the last applyStep()
   int m_x, m_y, m_w, m_h;
   int m_offset_x, m_offset_y;
   Mask* m_mask;
@@ -126,6 +149,8 @@ private:
   div_t m_d;
   Target m_targetOrig;          // Original targets
   Target m_target;              // Filtered targets
+  bool m_multithreaded;         // "Multithreaded Filters" option when the filter was created
+  base::thread_pool* m_pool;    // Threads of the multithreaded mode (created when it's needed)
 
   // Hooks
   float m_progressBase;
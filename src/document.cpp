@@ -16,13 +16,13 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+// #define REPORT_LOCK_STATS
+
 #include "config.h"
 
 #include "document.h"
 
 #include "base/memory.h"
-#include "base/mutex.h"
-#include "base/scoped_lock.h"
 #include "base/unique_ptr.h"
 #include "document_api.h"
 #include "document_event.h"
@@ -47,9 +47,6 @@ Document::Document(Sprite* sprite)
   , m_undo(new DocumentUndo)
   , m_filename("Sprite")
   , m_associated_to_file(false)
-  , m_mutex(new Mutex)
-  , m_write_lock(false)
-  , m_read_locks(0)
     // Information about the file format used to load/save this document
   , m_format_options(NULL)
     // Extra cel
@@ -74,6 +71,14 @@ Document::~Document()
     base_free(m_bound.seg);
 
   destroyExtraCel();
+
+#ifdef REPORT_LOCK_STATS
+  RWLock::Stats stats = m_rwlock.getStats();
+  if (stats.waits > 0 || stats.failures > 0)
+    PRINTF("Document \"%s\" locks: %d waits (%.3f s, max %.3f s), %d failed\n",
+           m_filename.c_str(), stats.waits, stats.waitTime, stats.maxWaitTime,
+           stats.failures);
+#endif
 }
 
 DocumentApi Document::getApi(undo::UndoersCollector* undoers)
@@ -501,72 +506,28 @@ Document* Document::duplicate(DuplicateType type) const
 //////////////////////////////////////////////////////////////////////
 // Multi-threading ("sprite wrappers" use this)
 
-bool Document::lock(LockType lockType)
+bool Document::lock(LockType lockType, int timeout)
 {
-  ScopedLock lock(*m_mutex);
-
-  switch (lockType) {
-
-    case ReadLock:
-      // If no body is writting the sprite...
-      if (!m_write_lock) {
-        // We can read it
-        ++m_read_locks;
-        return true;
-      }
-      break;
-
-    case WriteLock:
-      // If no body is reading and writting...
-      if (m_read_locks == 0 && !m_write_lock) {
-        // We can start writting the sprite...
-        m_write_lock = true;
-        return true;
-      }
-      break;
-
-  }
-
-  return false;
+  return m_rwlock.lock(lockType == ReadLock ? RWLock::ReadLock:
+                                              RWLock::WriteLock, timeout);
 }
 
-bool Document::lockToWrite()
+bool Document::lockToWrite(int timeout)
 {
-  ScopedLock lock(*m_mutex);
-
-  // this only is possible if there are just one reader
-  if (m_read_locks == 1) {
-    ASSERT(!m_write_lock);
-    m_read_locks = 0;
-    m_write_lock = true;
-    return true;
-  }
-  else
-    return false;
+  return m_rwlock.upgradeToWrite(timeout);
 }
 
 void Document::unlockToRead()
 {
-  ScopedLock lock(*m_mutex);
-
-  ASSERT(m_read_locks == 0);
-  ASSERT(m_write_lock);
-
-  m_write_lock = false;
-  m_read_locks = 1;
+  m_rwlock.downgradeToRead();
 }
 
 void Document::unlock()
 {
-  ScopedLock lock(*m_mutex);
+  m_rwlock.unlock();
+}
 
-  if (m_write_lock) {
-    m_write_lock = false;
-  }
-  else if (m_read_locks > 0) {
-    --m_read_locks;
-  }
-  else {
-    ASSERT(false);
-  }
+RWLock::Stats Document::getLockStats() const
+{
+  return m_rwlock.getStats();
 }
@@ -20,6 +20,7 @@
 #define DOCUMENT_H_INCLUDED
 
 #include "base/disable_copying.h"
+#include "base/rw_lock.h"
 #include "base/shared_ptr.h"
 #include "base/unique_ptr.h"
 #include "document_id.h"
@@ -38,7 +39,6 @@ class FormatOptions;
 class Image;
 class Layer;
 class Mask;
-class Mutex;
 class Sprite;
 struct _BoundSeg;
 
@@ -164,12 +164,15 @@ public:
   // Multi-threading ("sprite wrappers" use this)
 
   // Locks the sprite to read or write on it, returning true if the
-  // sprite can be accessed in the desired mode.
-  bool lock(LockType lockType);
+  // sprite can be accessed in the desired mode. It waits at most
+  // "timeout" milliseconds for other threads (zero means don't wait,
+  // negative means wait forever).
+  bool lock(LockType lockType, int timeout = 0);
 
   // If you've locked the sprite to read, using this method you can
-  // raise your access level to write it.
-  bool lockToWrite();
+  // raise your access level to write it (waiting until other readers
+  // unlock the sprite).
+  bool lockToWrite(int timeout = 0);
 
   // If you've locked the sprite to write, using this method you can
   // your access level to only read it.
@@ -177,6 +180,9 @@ public:
 
   void unlock();
 
+  // Returns information about threads waiting for this document.
+  RWLock::Stats getLockStats() const;
+
 private:
   // Unique identifier for this document (it is assigned by Documents class).
   DocumentId m_id;
@@ -199,14 +205,8 @@ private:
     _BoundSeg* seg;
   } m_bound;
 
-  // Mutex to modify the 'locked' flag.
-  Mutex* m_mutex;
-
-  // True if some thread is writing the sprite.
-  bool m_write_lock;
-
-  // Greater than zero when one or more threads are reading the sprite.
-  int m_read_locks;
+  // Readers/writer lock to access the sprite from several threads.
+  RWLock m_rwlock;
 
   // Data to save the file in the same format that it was loaded
   SharedPtr<FormatOptions> m_format_options;
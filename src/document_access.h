@@ -40,6 +40,14 @@ public:
 class DocumentAccess
 {
 public:
+  // Milliseconds that DocumentReader/Writer wait for other threads
+  // before throwing LockedDocumentException. By default they don't
+  // wait, because they are used from the GUI thread (which can
+  // already have the document locked, e.g. while a job is running).
+  // Code that can wait for a background task must give its own
+  // timeout.
+  enum { DefaultLockTimeout = 0 };
+
   DocumentAccess() : m_document(NULL) { }
   DocumentAccess(const DocumentAccess& copy) : m_document(copy.m_document) { }
   explicit DocumentAccess(Document* document) : m_document(document) { }
@@ -72,7 +80,7 @@ protected:
 
 // Class to view the document's state. Its constructor request a
 // reader-lock of the document, or throws an exception in case that
-// the lock cannot be obtained.
+// the lock cannot be obtained in the given time.
 class DocumentReader : public DocumentAccess
 {
 public:
@@ -81,17 +89,17 @@ public:
   {
   }
 
-  explicit DocumentReader(Document* document)
+  explicit DocumentReader(Document* document, int timeout = DefaultLockTimeout)
     : DocumentAccess(document)
   {
-    if (m_document && !m_document->lock(Document::ReadLock))
+    if (m_document && !m_document->lock(Document::ReadLock, timeout))
       throw LockedDocumentException();
   }
 
   explicit DocumentReader(const DocumentReader& copy)
     : DocumentAccess(copy)
   {
-    if (m_document && !m_document->lock(Document::ReadLock))
+    if (m_document && !m_document->lock(Document::ReadLock, DefaultLockTimeout))
       throw LockedDocumentException();
   }
 
@@ -104,7 +112,7 @@ public:
     DocumentAccess::operator=(copy);
 
     // relock the document
-    if (m_document && !m_document->lock(Document::ReadLock))
+    if (m_document && !m_document->lock(Document::ReadLock, DefaultLockTimeout))
       throw LockedDocumentException();
 
     return *this;
@@ -121,7 +129,7 @@ public:
 
 // Class to modify the document's state. Its constructor request a
 // writer-lock of the document, or throws an exception in case that
-// the lock cannot be obtained. Also, it contains a special
+// the lock cannot be obtained in the given time. Also, it contains a special
 // constructor that receives a DocumentReader, to elevate the
 // reader-lock to writer-lock.
 class DocumentWriter : public DocumentAccess
@@ -134,13 +142,13 @@ public:
   {
   }
 
-  explicit DocumentWriter(Document* document)
+  explicit DocumentWriter(Document* document, int timeout = DefaultLockTimeout)
     : DocumentAccess(document)
     , m_from_reader(false)
     , m_locked(false)
   {
     if (m_document) {
-      if (!m_document->lock(Document::WriteLock))
+      if (!m_document->lock(Document::WriteLock, timeout))
         throw LockedDocumentException();
 
       m_locked = true;
@@ -149,13 +157,13 @@ public:
 
   // Constructor that can be used to elevate the given reader-lock to
   // writer permission.
-  explicit DocumentWriter(const DocumentReader& document)
+  explicit DocumentWriter(const DocumentReader& document, int timeout = DefaultLockTimeout)
     : DocumentAccess(document)
     , m_from_reader(true)
     , m_locked(false)
   {
     if (m_document) {
-      if (!m_document->lockToWrite())
+      if (!m_document->lockToWrite(timeout))
         throw LockedDocumentException();
 
       m_locked = true;
@@ -176,7 +184,7 @@ public:
     if (m_document) {
       m_from_reader = true;
 
-      if (!m_document->lockToWrite())
+      if (!m_document->lockToWrite(DefaultLockTimeout))
         throw LockedDocumentException();
 
       m_locked = true;
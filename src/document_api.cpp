@@ -235,7 +235,7 @@ void DocumentApi::addFrameForLayer(Layer* layer, FrameNumber frame)
       for (FrameNumber c=sprite->getLastFrame(); c>=frame; --c) {
         Cel* cel = static_cast<LayerImage*>(layer)->getCel(c);
         if (cel)
-          setCelFramePosition(sprite, cel, cel->getFrame().next());
+          setCelFramePosition(static_cast<LayerImage*>(layer), cel, cel->getFrame().next());
       }
 
       copyPreviousFrame(layer, frame);
@@ -326,7 +326,7 @@ void DocumentApi::removeFrameOfLayer(Layer* layer, FrameNumber frame)
 
       for (++frame; frame<sprite->getTotalFrames(); ++frame)
         if (Cel* cel = static_cast<LayerImage*>(layer)->getCel(frame))
-          setCelFramePosition(sprite, cel, cel->getFrame().previous());
+          setCelFramePosition(static_cast<LayerImage*>(layer), cel, cel->getFrame().previous());
       break;
 
     case GFXOBJ_LAYER_FOLDER: {
@@ -458,7 +458,7 @@ void DocumentApi::moveFrameBeforeLayer(Layer* layer, FrameNumber frame, FrameNum
         }
 
         if (cel->getFrame() != newFrame)
-          setCelFramePosition(layer->getSprite(), cel, newFrame);
+          setCelFramePosition(static_cast<LayerImage*>(layer), cel, newFrame);
       }
       break;
     }
@@ -534,19 +534,21 @@ void DocumentApi::removeCel(LayerImage* layer, Cel* cel)
   delete cel;
 }
 
-void DocumentApi::setCelFramePosition(Sprite* sprite, Cel* cel, FrameNumber frame)
+void DocumentApi::setCelFramePosition(LayerImage* layer, Cel* cel, FrameNumber frame)
 {
+  ASSERT(layer);
   ASSERT(cel);
   ASSERT(frame >= 0);
 
   DocumentUndo* undo = m_document->getUndo();
   if (undo->isEnabled())
-    m_undoers->pushUndoer(new undoers::SetCelFrame(getObjects(), cel));
+    m_undoers->pushUndoer(new undoers::SetCelFrame(getObjects(), layer, cel));
 
-  cel->setFrame(frame);
+  layer->moveCel(cel, frame);
 
   DocumentEvent ev(m_document);
-  ev.sprite(sprite);
+  ev.sprite(layer->getSprite());
+  ev.layer(layer);
   ev.cel(cel);
   ev.frame(frame);
   m_document->notifyObservers<DocumentEvent&>(&DocumentObserver::onCelFrameChanged, ev);
@@ -68,7 +68,7 @@ public:
   // Cels API
   void addCel(LayerImage* layer, Cel* cel);
   void removeCel(LayerImage* layer, Cel* cel);
-  void setCelFramePosition(Sprite* sprite, Cel* cel, FrameNumber frame);
+  void setCelFramePosition(LayerImage* layer, Cel* cel, FrameNumber frame);
   void setCelPosition(Sprite* sprite, Cel* cel, int x, int y);
   void cropCel(Sprite* sprite, Cel* cel, int x, int y, int w, int h, int bgcolor);
 
@@ -18,16 +18,31 @@
 
 #include "config.h"
 
+#include "base/compiler_specific.h"
 #include "base/exception.h"
+#include "base/mapped_file.h"
+#include "base/mutex.h"
+#include "base/sha1.h"
+#include "base/scoped_lock.h"
+#include "base/shared_ptr.h"
+#include "base/thread.h"
+#include "base/thread_pool.h"
+#include "base/unique_ptr.h"
 #include "document.h"
 #include "file/file.h"
 #include "file/file_format.h"
 #include "file/file_handle.h"
 #include "file/format_options.h"
+#include "ini_file.h"
+#include "raster/quantization.h"
 #include "raster/raster.h"
 #include "zlib.h"
 
+#include <algorithm>
+#include <map>
 #include <stdio.h>
+#include <string>
+#include <vector>
 
 #define ASE_FILE_MAGIC                  0xA5E0
 #define ASE_FILE_FRAME_MAGIC            0xF1FA
@@ -38,10 +53,14 @@
 #define ASE_FILE_CHUNK_CEL              0x2005
 #define ASE_FILE_CHUNK_MASK             0x2016
 #define ASE_FILE_CHUNK_PATH             0x2017
+#define ASE_FILE_CHUNK_THUMBNAIL        0x2018
 
 #define ASE_FILE_RAW_CEL                0
 #define ASE_FILE_LINK_CEL               1
 #define ASE_FILE_COMPRESSED_CEL         2
+#define ASE_FILE_COPIED_CEL             3
+
+#define ASE_FILE_THUMBNAIL_SIZE         128
 
 typedef struct ASE_Header
 {
@@ -70,42 +89,593 @@ typedef struct ASE_FrameHeader
   uint16_t duration;
 } ASE_FrameHeader;
 
-// TODO Warning: the writing routines aren't thread-safe
-static ASE_FrameHeader *current_frame_header = NULL;
-static int chunk_type;
-static int chunk_start;
+class AseInput;
+class CelsCompressor;
+class CompressedCels;
 
-static bool ase_file_read_header(FILE* f, ASE_Header* header);
+static bool ase_file_read_header(AseInput* f, ASE_Header* header);
 static void ase_file_prepare_header(FILE* f, ASE_Header* header, const Sprite* sprite);
 static void ase_file_write_header(FILE* f, ASE_Header* header);
 
-static void ase_file_read_frame_header(FILE *f, ASE_FrameHeader *frame_header);
+static void ase_file_read_frame_header(AseInput* f, ASE_FrameHeader *frame_header);
 static void ase_file_prepare_frame_header(FILE *f, ASE_FrameHeader *frame_header);
 static void ase_file_write_frame_header(FILE *f, ASE_FrameHeader *frame_header);
 
-static void ase_file_write_layers(FILE *f, Layer *layer);
-static void ase_file_write_cels(FILE *f, Sprite *sprite, Layer *layer, FrameNumber frame);
+static void ase_file_write_layers(FILE *f, ASE_FrameHeader *frame_header, Layer *layer);
+static void ase_file_write_cels(FILE *f, ASE_FrameHeader *frame_header, Sprite *sprite, Layer *layer, FrameNumber frame, const CelsCompressor* compressor);
 
-static void ase_file_read_padding(FILE *f, int bytes);
+static void ase_file_read_padding(AseInput* f, int bytes);
 static void ase_file_write_padding(FILE *f, int bytes);
-static std::string ase_file_read_string(FILE *f);
+static std::string ase_file_read_string(AseInput* f);
 static void ase_file_write_string(FILE *f, const std::string& string);
 
-static void ase_file_write_start_chunk(FILE *f, int type);
-static void ase_file_write_close_chunk(FILE *f);
+static int ase_file_write_start_chunk(FILE *f, ASE_FrameHeader *frame_header, int type);
+static void ase_file_write_close_chunk(FILE *f, int chunk_type, int chunk_start);
+
+static Palette *ase_file_read_color_chunk(AseInput* f, Sprite *sprite, FrameNumber frame);
+static Palette *ase_file_read_color2_chunk(AseInput* f, Sprite *sprite, FrameNumber frame);
+static void ase_file_write_color2_chunk(FILE *f, ASE_FrameHeader *frame_header, Palette *pal);
+static Layer *ase_file_read_layer_chunk(AseInput* f, Sprite *sprite, Layer **previous_layer, int *current_level);
+static void ase_file_write_layer_chunk(FILE *f, ASE_FrameHeader *frame_header, Layer *layer);
+static Cel *ase_file_read_cel_chunk(AseInput* f, Sprite *sprite, FrameNumber frame, PixelFormat pixelFormat, FileOp *fop, CompressedCels *cels, size_t chunk_end);
+static void ase_file_write_cel_chunk(FILE *f, ASE_FrameHeader *frame_header, Cel *cel, LayerImage *layer, Sprite *sprite, const CelsCompressor* compressor);
+static Mask *ase_file_read_mask_chunk(AseInput* f);
+static void ase_file_write_mask_chunk(FILE *f, ASE_FrameHeader *frame_header, Mask *mask);
+static Image* ase_file_read_thumbnail(AseInput* f);
+static Image* ase_file_read_thumbnail_chunk(AseInput* f, size_t chunk_end);
+static void ase_file_write_thumbnail_chunk(FILE *f, ASE_FrameHeader *frame_header, Image* thumbnail);
+static Image* ase_file_create_thumbnail(const Sprite* sprite);
+static void decompress_image(const uint8_t* data, size_t size, Image* image);
+static void check_compressed_image(const uint8_t* data, size_t size, PixelFormat format, int w, int h);
+static void compress_image(Image* image, int level, std::vector<uint8_t>& output);
+
+//////////////////////////////////////////////////////////////////////
+// Input
+//////////////////////////////////////////////////////////////////////
+
+// Reads the file from memory (the whole file is mapped with
+// base::MappedFile). As fgetc(), the read functions return EOF when
+// the end of the file is reached.
+class AseInput
+{
+public:
+  AseInput(const uint8_t* data, size_t size)
+    : m_data(data), m_size(size), m_pos(0) {
+  }
+
+  size_t tell() const { return m_pos; }
+  void seek(size_t pos) { m_pos = pos; }
+
+  int read8() {
+    if (m_pos < m_size)
+      return m_data[m_pos++];
+    else
+      return EOF;
+  }
+
+  int read16() {
+    if (m_pos+2 > m_size) {
+      m_pos = m_size;
+      return EOF;
+    }
+    const uint8_t* p = m_data+m_pos;
+    m_pos += 2;
+    return ((p[1] << 8) | p[0]);     // Little endian
+  }
+
+  long read32() {
+    if (m_pos+4 > m_size) {
+      m_pos = m_size;
+      return EOF;
+    }
+    const uint8_t* p = m_data+m_pos;
+    m_pos += 4;
+    return (((long)p[3] << 24) | ((long)p[2] << 16) | (p[1] << 8) | p[0]);
+  }
+
+  // Returns a pointer to the next "size" bytes (without copying them)
+  // and skips them. The returned block can be smaller than "size" if
+  // the end of the file is reached.
+  const uint8_t* read(size_t size, size_t* available) {
+    size_t pos = MIN(m_pos, m_size);
+    *available = MIN(size, m_size-pos);
+    m_pos = pos + *available;
+    return m_data+pos;
+  }
+
+private:
+  const uint8_t* m_data;
+  size_t m_size;
+  size_t m_pos;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Compressed Cels
+//////////////////////////////////////////////////////////////////////
+
+// Copy of the compressed pixels of a cel for lazy decoding (shared
+// with the cels linked to it).
+typedef SharedPtr<std::vector<uint8_t> > CompressedData;
+
+// Decodes a compressed cel the first time its image is used. The
+// compressed data was already checked when the file was loaded (see
+// CompressedCels::decodeAll()), so decodeImage() should not fail.
+class CompressedCelDecoder : public ImageDecoder
+{
+public:
+  CompressedCelDecoder(PixelFormat format, int w, int h, const CompressedData& data)
+    : m_format(format), m_w(w), m_h(h), m_data(data) {
+  }
+
+  Image* decodeImage() {
+    Image* image = Image::create(m_format, m_w, m_h);
+    try {
+      decompress_image(m_data->empty() ? NULL: &(*m_data)[0], m_data->size(), image);
+    }
+    catch (const std::exception& e) {
+      PRINTF("Error decoding a cel: %s\n", e.what());
+    }
+    return image;
+  }
+
+private:
+  PixelFormat m_format;
+  int m_w, m_h;
+  CompressedData m_data;
+};
+
+// Keeps the compressed cels found while the file is read, so they
+// can be decoded in parallel when the whole file was read, or
+// decoded on demand (in "lazy" mode) with a CompressedCelDecoder.
+//
+// In non-lazy mode the cels are decoded directly from the mapped
+// file. In lazy mode the compressed bytes must be copied because the
+// file is unmapped after loading it (and it can be overwritten while
+// the sprite is still open).
+class CompressedCels
+{
+public:
+  CompressedCels(bool lazy) : m_lazy(lazy) {
+  }
+
+  // Adds a new image in the stock for the given compressed pixels
+  // (the "bytes" must be valid until decodeAll() is called).
+  int addImage(Stock* stock, PixelFormat format, int w, int h, const uint8_t* bytes, size_t size) {
+    // Cels with the same compressed pixels of a previous cel (e.g.
+    // duplicated frames, see CelsCompressor) are decoded only once.
+    int original = findSameData(format, w, h, bytes, size);
+    if (original >= 0)
+      return addCopy(stock, original);
+
+    CompressedData data;
+    if (m_lazy)
+      data.reset(new std::vector<uint8_t>(bytes, bytes+size));
+
+    int index = addImage(stock, format, w, h, bytes, size, data);
+    m_bySize.insert(std::make_pair(size, index));
+    return index;
+  }
+
+  // Adds a copy of the given image (for linked and copied cels). If
+  // the image is compressed, the copy shares the same compressed data
+  // (in lazy mode), or it's created from the original one when it's
+  // decoded.
+  int addCopy(Stock* stock, int index) {
+    std::map<int, Item>::iterator it = m_items.find(index);
+    if (it != m_items.end()) {
+      Item item = it->second;
+      int copyIndex = addImage(stock, item.format, item.w, item.h, item.bytes, item.size, item.data);
+      m_items[copyIndex].copyOf = (item.copyOf >= 0 ? item.copyOf: index);
+      return copyIndex;
+    }
+    else
+      return stock->addImage(Image::createCopy(stock->getImage(index)));
+  }
+
+  // Decodes all images in parallel. In lazy mode the images are not
+  // created, the compressed data is only checked so errors are
+  // reported when the file is loaded. Progress is reported from
+  // "progressStart" to 1.0.
+  void decodeAll(Stock* stock, FileOp* fop, double progressStart) {
+    if (m_items.empty())
+      return;
+
+    m_fop = fop;
+    m_progressStart = progressStart;
+    m_decoded = 0;
+
+    // Copies of other images aren't decoded
+    std::vector<Item*> items;
+    for (std::map<int, Item>::iterator it=m_items.begin(); it!=m_items.end(); ++it) {
+      if (it->second.copyOf < 0) {
+        if (!m_lazy)
+          it->second.image = Image::create(it->second.format, it->second.w, it->second.h);
+        items.push_back(&it->second);
+      }
+    }
+    m_toDecode = items.size();
+
+    int threads = (fop->single_thread ? 1: MIN(base::thread::hardware_concurrency(), (int)items.size()));
+    if (threads <= 1) {
+      for (size_t i=0; i<items.size(); ++i)
+        decodeItem(items[i]);
+    }
+    else {
+      base::thread_pool pool(threads);
+      for (size_t i=0; i<items.size(); ++i)
+        pool.execute(DecodeTask(this, items[i]));
+      pool.wait_all();
+    }
+
+    if (!m_lazy) {
+      for (std::map<int, Item>::iterator it=m_items.begin(); it!=m_items.end(); ++it) {
+        if (it->second.copyOf >= 0)
+          it->second.image = Image::createCopy(m_items[it->second.copyOf].image);
+      }
+    }
+
+    // Add the images in the stock in the main thread, and report
+    // errors in the same order as the cels were found in the file.
+    for (std::map<int, Item>::iterator it=m_items.begin(); it!=m_items.end(); ++it) {
+      if (!m_lazy)
+        stock->replaceImage(it->first, it->second.image);
+      if (!it->second.error.empty())
+        fop_error(fop, "%s\n", it->second.error.c_str());
+    }
+  }
+
+private:
+  struct Item {
+    PixelFormat format;
+    int w, h;
+    const uint8_t* bytes;
+    size_t size;
+    CompressedData data;
+    int copyOf;                 // Stock index of the original image of a linked cel
+    Image* image;
+    std::string error;
+    Item() : format(IMAGE_RGB), w(0), h(0), bytes(NULL), size(0), copyOf(-1), image(NULL) { }
+  };
+
+  class DecodeTask {
+  public:
+    DecodeTask(CompressedCels* cels, Item* item) : m_cels(cels), m_item(item) { }
+    void operator()() { m_cels->decodeItem(m_item); }
+  private:
+    CompressedCels* m_cels;
+    Item* m_item;
+  };
+
+  int addImage(Stock* stock, PixelFormat format, int w, int h,
+               const uint8_t* bytes, size_t size, const CompressedData& data) {
+    int index;
+    if (m_lazy)
+      index = stock->addPendingImage(new CompressedCelDecoder(format, w, h, data));
+    else
+      index = stock->addImage(NULL);
+
+    Item& item = m_items[index];
+    item.format = format;
+    item.w = w;
+    item.h = h;
+    item.bytes = bytes;
+    item.size = size;
+    item.data = data;
+    return index;
+  }
+
+  // Returns the stock index of a previous image with the same
+  // compressed pixels, or -1 if there is no one.
+  int findSameData(PixelFormat format, int w, int h, const uint8_t* bytes, size_t size) {
+    std::multimap<size_t, int>::iterator
+      it = m_bySize.lower_bound(size),
+      end = m_bySize.upper_bound(size);
+
+    for (; it != end; ++it) {
+      const Item& item = m_items[it->second];
+      if (item.format == format &&
+          item.w == w &&
+          item.h == h &&
+          memcmp(item.bytes, bytes, size) == 0)
+        return it->second;
+    }
+    return -1;
+  }
+
+  void decodeItem(Item* item) {
+    try {
+      if (m_lazy)
+        check_compressed_image(item->bytes, item->size, item->format, item->w, item->h);
+      else
+        decompress_image(item->bytes, item->size, item->image);
+    }
+    catch (const std::exception& e) {
+      item->error = e.what();
+    }
+
+    double progress;
+    {
+      ScopedLock lock(m_mutex);
+      progress = m_progressStart + (1.0 - m_progressStart) * (++m_decoded) / m_toDecode;
+    }
+    fop_progress(m_fop, progress);
+  }
+
+  bool m_lazy;
+  std::map<int, Item> m_items;  // Compressed images by stock index
+  std::multimap<size_t, int> m_bySize; // Stock index of the original images by compressed size
+  FileOp* m_fop;
+  double m_progressStart;
+  int m_decoded;
+  int m_toDecode;
+  Mutex m_mutex;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Cels Compressor
+//////////////////////////////////////////////////////////////////////
+
+// Compresses all images of the sprite in parallel before the file is
+// written, so then the cel chunks can be written in order without
+// waiting for zlib.
+//
+// Images with the same pixels of a previous image (e.g. duplicated
+// frames or pasted copies in any layer) are found comparing their
+// SHA1, so they are compressed only once. Only the first of these
+// cels in the file is saved with its pixels. The next ones in the
+// same layer are saved as linked cels, and the ones in other layers
+// are saved as compressed cels with the same bytes (or as copied
+// cels if "copiedCels" is true, which older versions cannot read).
+// Both kind of cels are loaded as independent images (see
+// CompressedCels::addCopy()).
+class CelsCompressor
+{
+public:
+  CelsCompressor(int level, bool copiedCels)
+    : m_level(level), m_copiedCels(copiedCels) {
+  }
+
+  // Compresses the images of all cels of the sprite. Progress is
+  // reported from 0.0 to "progressEnd".
+  void compressAll(Sprite* sprite, FileOp* fop, double progressEnd) {
+    addImages(sprite, sprite->getFolder());
+    if (m_items.empty())
+      return;
+
+    m_fop = fop;
+    m_progressEnd = progressEnd;
+    m_compressed = 0;
+
+    runTasks(&CelsCompressor::hashItem);
+    findDuplicates();
+    for (FrameNumber frame(0); frame<sprite->getTotalFrames(); ++frame)
+      findCopies(sprite, sprite->getFolder(), frame);
+    runTasks(&CelsCompressor::compressItem);
+
+    for (std::map<int, Item>::iterator it=m_items.begin(); it!=m_items.end(); ++it) {
+      if (!it->second.error.empty())
+        throw base::Exception(it->second.error);
+    }
+  }
+
+  // Returns the cel type to save the given cel. For linked and copied
+  // cels, "layer" and "frame" are the position of the original cel.
+  int getCelType(const Cel* cel, LayerIndex* layer, FrameNumber* frame) const {
+    std::map<const Cel*, CelRef>::const_iterator it = m_refs.find(cel);
+    if (it != m_refs.end()) {
+      *layer = it->second.pos.layer;
+      *frame = it->second.pos.frame;
+      return it->second.type;
+    }
+    else
+      return ASE_FILE_COMPRESSED_CEL;
+  }
+
+  // Returns the compressed pixels of the given image of the stock.
+  const std::vector<uint8_t>& getData(int index) const {
+    std::map<int, Item>::const_iterator it = m_items.find(index);
+    ASSERT(it != m_items.end());
+    if (it->second.duplicateOf >= 0)
+      it = m_items.find(it->second.duplicateOf);
+    return it->second.data;
+  }
+
+private:
+  struct Item {
+    Image* image;
+    base::Sha1 hash;
+    int duplicateOf;            // Stock index of the first image with the same pixels
+    std::vector<uint8_t> data;
+    std::string error;
+    Item() : image(NULL), duplicateOf(-1) { }
+  };
+
+  struct CelPos {
+    LayerIndex layer;
+    FrameNumber frame;
+  };
+
+  struct CelRef {
+    int type;                   // ASE_FILE_LINK_CEL or ASE_FILE_COPIED_CEL
+    CelPos pos;
+  };
+
+  typedef void (CelsCompressor::*ItemFunc)(Item* item);
+
+  class ItemTask {
+  public:
+    ItemTask(CelsCompressor* compressor, ItemFunc func, Item* item)
+      : m_compressor(compressor), m_func(func), m_item(item) { }
+    void operator()() { (m_compressor->*m_func)(m_item); }
+  private:
+    CelsCompressor* m_compressor;
+    ItemFunc m_func;
+    Item* m_item;
+  };
+
+  // Calls "func" for each item using all cores.
+  void runTasks(ItemFunc func) {
+    int threads = (m_fop->single_thread ? 1: MIN(base::thread::hardware_concurrency(), (int)m_items.size()));
+    if (threads <= 1) {
+      for (std::map<int, Item>::iterator it=m_items.begin(); it!=m_items.end(); ++it)
+        (this->*func)(&it->second);
+    }
+    else {
+      base::thread_pool pool(threads);
+      for (std::map<int, Item>::iterator it=m_items.begin(); it!=m_items.end(); ++it)
+        pool.execute(ItemTask(this, func, &it->second));
+      pool.wait_all();
+    }
+  }
+
+  void addImages(Sprite* sprite, Layer* layer) {
+    if (layer->isImage()) {
+      CelConstIterator it = static_cast<LayerImage*>(layer)->getCelBegin();
+      CelConstIterator end = static_cast<LayerImage*>(layer)->getCelEnd();
+
+      for (; it != end; ++it) {
+        Image* image = sprite->getStock()->getImage((*it)->getImage());
+        if (image)
+          m_items[(*it)->getImage()].image = image;
+      }
+    }
+
+    if (layer->isFolder()) {
+      LayerIterator it = static_cast<LayerFolder*>(layer)->getLayerBegin();
+      LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
+
+      for (; it != end; ++it)
+        addImages(sprite, *it);
+    }
+  }
+
+  // Marks each image as a duplicate of the first previous image
+  // (in stock order) with the same pixels.
+  void findDuplicates() {
+    std::multimap<base::Sha1, int> previous;
+
+    for (std::map<int, Item>::iterator item=m_items.begin(); item!=m_items.end(); ++item) {
+      const Image* image = item->second.image;
+      std::multimap<base::Sha1, int>::iterator
+        it = previous.lower_bound(item->second.hash),
+        end = previous.upper_bound(item->second.hash);
+
+      for (; it != end; ++it) {
+        const Image* other = m_items[it->second].image;
+        if (other->getPixelFormat() == image->getPixelFormat() &&
+            other->w == image->w &&
+            other->h == image->h &&
+            memcmp(other->dat, image->dat, image_line_size(image, image->w)*image->h) == 0) {
+          item->second.duplicateOf = it->second;
+          break;
+        }
+      }
+
+      if (item->second.duplicateOf < 0)
+        previous.insert(std::make_pair(item->second.hash, item->first));
+    }
+  }
+
+  // Finds the cels which are saved after a cel with the same pixels
+  // (in the same order as ase_file_write_cels() writes them).
+  void findCopies(Sprite* sprite, Layer* layer, FrameNumber frame) {
+    if (layer->isImage()) {
+      const Cel* cel = static_cast<LayerImage*>(layer)->getCel(frame);
+      std::map<int, Item>::iterator item = (cel ? m_items.find(cel->getImage()): m_items.end());
+
+      if (item != m_items.end()) {
+        int original = (item->second.duplicateOf >= 0 ? item->second.duplicateOf: item->first);
+        CelPos pos;
+        pos.layer = sprite->layerToIndex(layer);
+        pos.frame = frame;
+
+        std::map<std::pair<int, int>, CelPos>::iterator inLayer =
+          m_firstCelsInLayer.find(std::make_pair(original, (int)pos.layer));
+        std::map<int, CelPos>::iterator first = m_firstCels.find(original);
+
+        CelRef ref;
+        if (inLayer != m_firstCelsInLayer.end()) {
+          ref.type = ASE_FILE_LINK_CEL;
+          ref.pos = inLayer->second;
+          m_refs[cel] = ref;
+        }
+        else {
+          m_firstCelsInLayer[std::make_pair(original, (int)pos.layer)] = pos;
+
+          if (first != m_firstCels.end()) {
+            if (m_copiedCels) {
+              ref.type = ASE_FILE_COPIED_CEL;
+              ref.pos = first->second;
+              m_refs[cel] = ref;
+            }
+          }
+          else
+            m_firstCels[original] = pos;
+        }
+      }
+    }
+
+    if (layer->isFolder()) {
+      LayerIterator it = static_cast<LayerFolder*>(layer)->getLayerBegin();
+      LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
+
+      for (; it != end; ++it)
+        findCopies(sprite, *it, frame);
+    }
+  }
+
+  void hashItem(Item* item) {
+    const Image* image = item->image;
+    item->hash = base::Sha1::calculateFromData(image->dat, image_line_size(image, image->w)*image->h);
+  }
+
+  void compressItem(Item* item) {
+    if (item->duplicateOf < 0) {
+      try {
+        compress_image(item->image, m_level, item->data);
+      }
+      catch (const std::exception& e) {
+        item->error = e.what();
+      }
+    }
+
+    double progress;
+    {
+      ScopedLock lock(m_mutex);
+      progress = m_progressEnd * (++m_compressed) / m_items.size();
+    }
+    fop_progress(m_fop, progress);
+  }
 
-static Palette *ase_file_read_color_chunk(FILE *f, Sprite *sprite, FrameNumber frame);
-static Palette *ase_file_read_color2_chunk(FILE *f, Sprite *sprite, FrameNumber frame);
-static void ase_file_write_color2_chunk(FILE *f, Palette *pal);
-static Layer *ase_file_read_layer_chunk(FILE *f, Sprite *sprite, Layer **previous_layer, int *current_level);
-static void ase_file_write_layer_chunk(FILE *f, Layer *layer);
-static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame, PixelFormat pixelFormat, FileOp *fop, ASE_Header *header, size_t chunk_end);
-static void ase_file_write_cel_chunk(FILE *f, Cel *cel, LayerImage *layer, Sprite *sprite);
-static Mask *ase_file_read_mask_chunk(FILE *f);
-static void ase_file_write_mask_chunk(FILE *f, Mask *mask);
+  int m_level;
+  std::map<int, Item> m_items;  // Images to be compressed by stock index
+  bool m_copiedCels;            // Save copied cels of other layers
+  std::map<int, CelPos> m_firstCels; // First saved cel of each different image
+  std::map<std::pair<int, int>, CelPos> m_firstCelsInLayer; // The same by image and layer index
+  std::map<const Cel*, CelRef> m_refs; // Cels saved as links/copies of a previous cel
+  FileOp* m_fop;
+  double m_progressEnd;
+  int m_compressed;
+  Mutex m_mutex;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Ase Format
+//////////////////////////////////////////////////////////////////////
 
 class AseFormat : public FileFormat
 {
+  // Options to save .ase files. They are read from the configuration
+  // when the FileOp is created, so onSave() (which can be called from
+  // a worker thread) doesn't access the configuration.
+  class AseOptions : public FormatOptions
+  {
+  public:
+    int compressionLevel;
+    bool saveThumbnail;
+    bool saveCopiedCels;
+  };
+
   const char* onGetName() const { return "ase"; }
   const char* onGetExtensions() const { return "ase,aseprite"; }
   int onGetFlags() const {
@@ -119,11 +689,13 @@ class AseFormat : public FileFormat
       FILE_SUPPORT_INDEXED |
       FILE_SUPPORT_LAYERS |
       FILE_SUPPORT_FRAMES |
-      FILE_SUPPORT_PALETTES;
+      FILE_SUPPORT_PALETTES |
+      FILE_SUPPORT_GET_FORMAT_OPTIONS;
   }
 
   bool onLoad(FileOp* fop);
   bool onSave(FileOp* fop);
+  SharedPtr<FormatOptions> onGetFormatOptions(FileOp* fop) OVERRIDE;
 };
 
 FileFormat* CreateAseFormat()
@@ -133,9 +705,12 @@ FileFormat* CreateAseFormat()
 
 bool AseFormat::onLoad(FileOp *fop)
 {
-  FileHandle f(fop->filename.c_str(), "rb");
-  if (!f)
-    return false;
+  base::MappedFile file;
+  if (!file.open(fop->filename))
+    throw base::Exception(std::string("Cannot open ") + fop->filename);
+
+  AseInput input(file.data(), file.size());
+  AseInput* f = &input;
 
   ASE_Header header;
   if (!ase_file_read_header(f, &header)) {
@@ -143,6 +718,24 @@ bool AseFormat::onLoad(FileOp *fop)
     return false;
   }
 
+  // Just the thumbnail? It's the first chunk of the first frame, so
+  // the rest of the file is not even touched.
+  if (fop->thumbnail) {
+    UniquePtr<Image> thumbnail(ase_file_read_thumbnail(f));
+    if (thumbnail) {
+      Sprite* sprite = new Sprite(IMAGE_RGB, thumbnail->w, thumbnail->h, 256);
+      LayerImage* layer = new LayerImage(sprite);
+      sprite->getFolder()->addLayer(layer);
+      layer->addCel(new Cel(FrameNumber(0), sprite->getStock()->addImage(thumbnail.release())));
+
+      fop->document = new Document(sprite);
+      return true;
+    }
+
+    // Old files without thumbnail are loaded as usual
+    f->seek(header.pos+128);
+  }
+
   // Create the new sprite
   Sprite *sprite = new Sprite(header.depth == 32 ? IMAGE_RGB:
                               header.depth == 16 ? IMAGE_GRAYSCALE: IMAGE_INDEXED,
@@ -163,11 +756,17 @@ bool AseFormat::onLoad(FileOp *fop)
   Layer* last_layer = sprite->getFolder();
   int current_level = -1;
 
+  // Compressed cels are decoded (or only checked in "lazy" mode)
+  // when the whole file is read, so the first half of the progress
+  // is for reading and the second one for decoding.
+  CompressedCels cels(fop->lazy);
+  double readProgress = 0.5;
+
   /* read frame by frame to end-of-file */
   for (FrameNumber frame(0); frame<sprite->getTotalFrames(); ++frame) {
     /* start frame position */
-    int frame_pos = ftell(f);
-    fop_progress(fop, (float)frame_pos / (float)header.size);
+    int frame_pos = f->tell();
+    fop_progress(fop, readProgress * frame_pos / header.size);
 
     /* read frame header */
     ASE_FrameHeader frame_header;
@@ -182,12 +781,12 @@ bool AseFormat::onLoad(FileOp *fop)
       /* read chunks */
       for (int c=0; c<frame_header.chunks; c++) {
         /* start chunk position */
-        int chunk_pos = ftell(f);
-        fop_progress(fop, (float)chunk_pos / (float)header.size);
+        int chunk_pos = f->tell();
+        fop_progress(fop, readProgress * chunk_pos / header.size);
 
         /* read chunk information */
-        int chunk_size = fgetl(f);
-        int chunk_type = fgetw(f);
+        int chunk_size = f->read32();
+        int chunk_type = f->read16();
 
         switch (chunk_type) {
 
@@ -226,7 +825,7 @@ bool AseFormat::onLoad(FileOp *fop)
             /* fop_error(fop, "Cel chunk\n"); */
 
             ase_file_read_cel_chunk(f, sprite, frame,
-                                    sprite->getPixelFormat(), fop, &header,
+                                    sprite->getPixelFormat(), fop, &cels,
                                     chunk_pos+chunk_size);
             break;
           }
@@ -249,18 +848,22 @@ bool AseFormat::onLoad(FileOp *fop)
             /* fop_error(fop, "Path chunk\n"); */
             break;
 
+          case ASE_FILE_CHUNK_THUMBNAIL:
+            // Only used to show previews of the file
+            break;
+
           default:
             fop_error(fop, "Warning: Unsupported chunk type %d (skipping)\n", chunk_type);
             break;
         }
 
         /* skip chunk size */
-        fseek(f, chunk_pos+chunk_size, SEEK_SET);
+        f->seek(chunk_pos+chunk_size);
       }
     }
 
     /* skip frame size */
-    fseek(f, frame_pos+frame_header.size, SEEK_SET);
+    f->seek(frame_pos+frame_header.size);
 
     /* just one frame? */
     if (fop->oneframe)
@@ -270,15 +873,19 @@ bool AseFormat::onLoad(FileOp *fop)
       break;
   }
 
+  cels.decodeAll(sprite->getStock(), fop, readProgress);
+
   fop->document = new Document(sprite);
+  return true;
+}
 
-  if (ferror(f)) {
-    fop_error(fop, "Error reading file.\n");
-    return false;
-  }
-  else {
-    return true;
-  }
+SharedPtr<FormatOptions> AseFormat::onGetFormatOptions(FileOp* fop)
+{
+  SharedPtr<AseOptions> options(new AseOptions());
+  options->compressionLevel = get_config_int("ASE", "CompressionLevel", Z_DEFAULT_COMPRESSION);
+  options->saveThumbnail = get_config_bool("ASE", "SaveThumbnail", false);
+  options->saveCopiedCels = get_config_bool("ASE", "SaveCopiedCels", false);
+  return options;
 }
 
 bool AseFormat::onSave(FileOp *fop)
@@ -287,6 +894,27 @@ bool AseFormat::onSave(FileOp *fop)
   ASE_Header header;
   ASE_FrameHeader frame_header;
 
+  AseOptions defaultOptions;
+  defaultOptions.compressionLevel = Z_DEFAULT_COMPRESSION;
+  defaultOptions.saveThumbnail = false;
+  defaultOptions.saveCopiedCels = false;
+
+  const AseOptions* options = static_cast<const AseOptions*>(fop->seq.format_options.get());
+  if (!options)
+    options = &defaultOptions;
+
+  // Compression level (fast saves, e.g. backups, use the fastest
+  // level). Most of the time is used to compress the images, so they
+  // use the first 90% of the progress.
+  int level = (fop->fast ? Z_BEST_SPEED:
+               MID(Z_DEFAULT_COMPRESSION,
+                   options->compressionLevel,
+                   Z_BEST_COMPRESSION));
+  double compressProgress = 0.9;
+
+  CelsCompressor compressor(level, options->saveCopiedCels);
+  compressor.compressAll(sprite, fop, compressProgress);
+
   FileHandle f(fop->filename.c_str(), "wb");
 
   /* prepare the header */
@@ -300,12 +928,19 @@ bool AseFormat::onSave(FileOp *fop)
     /* frame duration */
     frame_header.duration = sprite->getFrameDuration(frame);
 
+    /* the thumbnail is the first chunk (so it can be read without
+       reading the rest of the file) */
+    if (frame == 0 && options->saveThumbnail) {
+      UniquePtr<Image> thumbnail(ase_file_create_thumbnail(sprite));
+      ase_file_write_thumbnail_chunk(f, &frame_header, thumbnail);
+    }
+
     /* the sprite is indexed and the palette changes? (or is the first frame) */
     if (sprite->getPixelFormat() == IMAGE_INDEXED &&
         (frame == 0 ||
          sprite->getPalette(frame.previous())->countDiff(sprite->getPalette(frame), NULL, NULL) > 0)) {
       /* write the color chunk */
-      ase_file_write_color2_chunk(f, sprite->getPalette(frame));
+      ase_file_write_color2_chunk(f, &frame_header, sprite->getPalette(frame));
     }
 
     /* write extra chunks in the first frame */
@@ -315,18 +950,18 @@ bool AseFormat::onSave(FileOp *fop)
 
       /* write layer chunks */
       for (; it != end; ++it)
-        ase_file_write_layers(f, *it);
+        ase_file_write_layers(f, &frame_header, *it);
     }
 
     /* write cel chunks */
-    ase_file_write_cels(f, sprite, sprite->getFolder(), frame);
+    ase_file_write_cels(f, &frame_header, sprite, sprite->getFolder(), frame, &compressor);
 
     /* write the frame header */
     ase_file_write_frame_header(f, &frame_header);
 
     /* progress */
     if (sprite->getTotalFrames() > 1)
-      fop_progress(fop, (float)(frame.next()) / (float)(sprite->getTotalFrames()));
+      fop_progress(fop, compressProgress + (1.0 - compressProgress) * frame.next() / sprite->getTotalFrames());
   }
 
   /* write the header */
@@ -341,32 +976,32 @@ bool AseFormat::onSave(FileOp *fop)
   }
 }
 
-static bool ase_file_read_header(FILE *f, ASE_Header *header)
+static bool ase_file_read_header(AseInput* f, ASE_Header *header)
 {
-  header->pos = ftell(f);
+  header->pos = f->tell();
 
-  header->size  = fgetl(f);
-  header->magic = fgetw(f);
+  header->size  = f->read32();
+  header->magic = f->read16();
   if (header->magic != ASE_FILE_MAGIC)
     return false;
 
-  header->frames     = fgetw(f);
-  header->width      = fgetw(f);
-  header->height     = fgetw(f);
-  header->depth      = fgetw(f);
-  header->flags      = fgetl(f);
-  header->speed      = fgetw(f);
-  header->next       = fgetl(f);
-  header->frit       = fgetl(f);
-  header->transparent_index = fgetc(f);
-  header->ignore[0]  = fgetc(f);
-  header->ignore[1]  = fgetc(f);
-  header->ignore[2]  = fgetc(f);
-  header->ncolors    = fgetw(f);
+  header->frames     = f->read16();
+  header->width      = f->read16();
+  header->height     = f->read16();
+  header->depth      = f->read16();
+  header->flags      = f->read32();
+  header->speed      = f->read16();
+  header->next       = f->read32();
+  header->frit       = f->read32();
+  header->transparent_index = f->read8();
+  header->ignore[0]  = f->read8();
+  header->ignore[1]  = f->read8();
+  header->ignore[2]  = f->read8();
+  header->ncolors    = f->read16();
   if (header->ncolors == 0)     // 0 means 256 (old .ase files)
     header->ncolors = 256;
 
-  fseek(f, header->pos+128, SEEK_SET);
+  f->seek(header->pos+128);
   return true;
 }
 
@@ -420,12 +1055,12 @@ static void ase_file_write_header(FILE *f, ASE_Header *header)
   fseek(f, header->pos+header->size, SEEK_SET);
 }
 
-static void ase_file_read_frame_header(FILE *f, ASE_FrameHeader *frame_header)
+static void ase_file_read_frame_header(AseInput* f, ASE_FrameHeader *frame_header)
 {
-  frame_header->size = fgetl(f);
-  frame_header->magic = fgetw(f);
-  frame_header->chunks = fgetw(f);
-  frame_header->duration = fgetw(f);
+  frame_header->size = f->read32();
+  frame_header->magic = f->read16();
+  frame_header->chunks = f->read16();
+  frame_header->duration = f->read16();
   ase_file_read_padding(f, 6);
 }
 
@@ -438,8 +1073,6 @@ static void ase_file_prepare_frame_header(FILE *f, ASE_FrameHeader *frame_header
   frame_header->chunks = 0;
   frame_header->duration = 0;
 
-  current_frame_header = frame_header;
-
   fseek(f, pos+16, SEEK_SET);
 }
 
@@ -459,24 +1092,22 @@ static void ase_file_write_frame_header(FILE *f, ASE_FrameHeader *frame_header)
   ase_file_write_padding(f, 6);
 
   fseek(f, end, SEEK_SET);
-
-  current_frame_header = NULL;
 }
 
-static void ase_file_write_layers(FILE *f, Layer *layer)
+static void ase_file_write_layers(FILE *f, ASE_FrameHeader *frame_header, Layer *layer)
 {
-  ase_file_write_layer_chunk(f, layer);
+  ase_file_write_layer_chunk(f, frame_header, layer);
 
   if (layer->isFolder()) {
     LayerIterator it = static_cast<LayerFolder*>(layer)->getLayerBegin();
     LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
 
     for (; it != end; ++it)
-      ase_file_write_layers(f, *it);
+      ase_file_write_layers(f, frame_header, *it);
   }
 }
 
-static void ase_file_write_cels(FILE *f, Sprite *sprite, Layer *layer, FrameNumber frame)
+static void ase_file_write_cels(FILE *f, ASE_FrameHeader *frame_header, Sprite *sprite, Layer *layer, FrameNumber frame, const CelsCompressor* compressor)
 {
   if (layer->isImage()) {
     Cel* cel = static_cast<LayerImage*>(layer)->getCel(frame);
@@ -484,7 +1115,7 @@ static void ase_file_write_cels(FILE *f, Sprite *sprite, Layer *layer, FrameNumb
 /*       fop_error(fop, "New cel in frame %d, in layer %d\n", */
 /*                   frame, sprite_layer2index(sprite, layer)); */
 
-      ase_file_write_cel_chunk(f, cel, static_cast<LayerImage*>(layer), sprite);
+      ase_file_write_cel_chunk(f, frame_header, cel, static_cast<LayerImage*>(layer), sprite, compressor);
     }
   }
 
@@ -493,14 +1124,14 @@ static void ase_file_write_cels(FILE *f, Sprite *sprite, Layer *layer, FrameNumb
     LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
 
     for (; it != end; ++it)
-      ase_file_write_cels(f, sprite, *it, frame);
+      ase_file_write_cels(f, frame_header, sprite, *it, frame, compressor);
   }
 }
 
-static void ase_file_read_padding(FILE *f, int bytes)
+static void ase_file_read_padding(AseInput* f, int bytes)
 {
   for (int c=0; c<bytes; c++)
-    fgetc(f);
+    f->read8();
 }
 
 static void ase_file_write_padding(FILE *f, int bytes)
@@ -509,9 +1140,9 @@ static void ase_file_write_padding(FILE *f, int bytes)
     fputc(0, f);
 }
 
-static std::string ase_file_read_string(FILE *f)
+static std::string ase_file_read_string(AseInput* f)
 {
-  int length = fgetw(f);
+  int length = f->read16();
   if (length == EOF)
     return "";
 
@@ -519,7 +1150,7 @@ static std::string ase_file_read_string(FILE *f)
   string.reserve(length+1);
 
   for (int c=0; c<length; c++)
-    string.push_back(fgetc(f));
+    string.push_back(f->read8());
 
   return string;
 }
@@ -532,17 +1163,18 @@ static void ase_file_write_string(FILE *f, const std::string& string)
     fputc(string[c], f);
 }
 
-static void ase_file_write_start_chunk(FILE *f, int type)
+// Returns the position of the new chunk, which must be used in
+// ase_file_write_close_chunk() to write the chunk header.
+static int ase_file_write_start_chunk(FILE *f, ASE_FrameHeader *frame_header, int type)
 {
-  current_frame_header->chunks++;
-
-  chunk_type = type;
-  chunk_start = ftell(f);
+  frame_header->chunks++;
 
+  int chunk_start = ftell(f);
   fseek(f, chunk_start+6, SEEK_SET);
+  return chunk_start;
 }
 
-static void ase_file_write_close_chunk(FILE *f)
+static void ase_file_write_close_chunk(FILE *f, int chunk_type, int chunk_start)
 {
   int chunk_end = ftell(f);
   int chunk_size = chunk_end - chunk_start;
@@ -553,25 +1185,25 @@ static void ase_file_write_close_chunk(FILE *f)
   fseek(f, chunk_end, SEEK_SET);
 }
 
-static Palette *ase_file_read_color_chunk(FILE *f, Sprite *sprite, FrameNumber frame)
+static Palette *ase_file_read_color_chunk(AseInput* f, Sprite *sprite, FrameNumber frame)
 {
   int i, c, r, g, b, packets, skip, size;
   Palette* pal = new Palette(*sprite->getPalette(frame));
   pal->setFrame(frame);
 
-  packets = fgetw(f);   // Number of packets
+  packets = f->read16();   // Number of packets
   skip = 0;
 
   // Read all packets
   for (i=0; i<packets; i++) {
-    skip += fgetc(f);
-    size = fgetc(f);
+    skip += f->read8();
+    size = f->read8();
     if (!size) size = 256;
 
     for (c=skip; c<skip+size; c++) {
-      r = fgetc(f);
-      g = fgetc(f);
-      b = fgetc(f);
+      r = f->read8();
+      g = f->read8();
+      b = f->read8();
       pal->setEntry(c, _rgba(_rgb_scale_6[r],
                              _rgb_scale_6[g],
                              _rgb_scale_6[b], 255));
@@ -581,25 +1213,25 @@ static Palette *ase_file_read_color_chunk(FILE *f, Sprite *sprite, FrameNumber f
   return pal;
 }
 
-static Palette *ase_file_read_color2_chunk(FILE *f, Sprite *sprite, FrameNumber frame)
+static Palette *ase_file_read_color2_chunk(AseInput* f, Sprite *sprite, FrameNumber frame)
 {
   int i, c, r, g, b, packets, skip, size;
   Palette* pal = new Palette(*sprite->getPalette(frame));
   pal->setFrame(frame);
 
-  packets = fgetw(f);   // Number of packets
+  packets = f->read16();   // Number of packets
   skip = 0;
 
   // Read all packets
   for (i=0; i<packets; i++) {
-    skip += fgetc(f);
-    size = fgetc(f);
+    skip += f->read8();
+    size = f->read8();
     if (!size) size = 256;
 
     for (c=skip; c<skip+size; c++) {
-      r = fgetc(f);
-      g = fgetc(f);
-      b = fgetc(f);
+      r = f->read8();
+      g = f->read8();
+      b = f->read8();
       pal->setEntry(c, _rgba(r, g, b, 255));
     }
   }
@@ -608,11 +1240,11 @@ static Palette *ase_file_read_color2_chunk(FILE *f, Sprite *sprite, FrameNumber
 }
 
 /* writes the original color chunk in FLI files for the entire palette "pal" */
-static void ase_file_write_color2_chunk(FILE *f, Palette *pal)
+static void ase_file_write_color2_chunk(FILE *f, ASE_FrameHeader *frame_header, Palette *pal)
 {
   int c, color;
 
-  ase_file_write_start_chunk(f, ASE_FILE_CHUNK_FLI_COLOR2);
+  int chunk_start = ase_file_write_start_chunk(f, frame_header, ASE_FILE_CHUNK_FLI_COLOR2);
 
   fputw(1, f);                  // number of packets
 
@@ -627,10 +1259,10 @@ static void ase_file_write_color2_chunk(FILE *f, Palette *pal)
     fputc(_rgba_getb(color), f);
   }
 
-  ase_file_write_close_chunk(f);
+  ase_file_write_close_chunk(f, ASE_FILE_CHUNK_FLI_COLOR2, chunk_start);
 }
 
-static Layer *ase_file_read_layer_chunk(FILE *f, Sprite *sprite, Layer **previous_layer, int *current_level)
+static Layer *ase_file_read_layer_chunk(AseInput* f, Sprite *sprite, Layer **previous_layer, int *current_level)
 {
   std::string name;
   Layer *layer = NULL;
@@ -639,12 +1271,12 @@ static Layer *ase_file_read_layer_chunk(FILE *f, Sprite *sprite, Layer **previou
   int layer_type;
   int child_level;
 
-  flags = fgetw(f);
-  layer_type = fgetw(f);
-  child_level = fgetw(f);
-  fgetw(f);                     // default width
-  fgetw(f);                     // default height
-  fgetw(f);                     // blend mode
+  flags = f->read16();
+  layer_type = f->read16();
+  child_level = f->read16();
+  f->read16();                 // default width
+  f->read16();                 // default height
+  f->read16();                 // blend mode
 
   ase_file_read_padding(f, 4);
   name = ase_file_read_string(f);
@@ -680,9 +1312,9 @@ static Layer *ase_file_read_layer_chunk(FILE *f, Sprite *sprite, Layer **previou
   return layer;
 }
 
-static void ase_file_write_layer_chunk(FILE *f, Layer *layer)
+static void ase_file_write_layer_chunk(FILE *f, ASE_FrameHeader *frame_header, Layer *layer)
 {
-  ase_file_write_start_chunk(f, ASE_FILE_CHUNK_LAYER);
+  int chunk_start = ase_file_write_start_chunk(f, frame_header, ASE_FILE_CHUNK_LAYER);
 
   // Flags
   fputw(layer->getFlags(), f);
@@ -710,7 +1342,7 @@ static void ase_file_write_layer_chunk(FILE *f, Layer *layer)
   /* layer name */
   ase_file_write_string(f, layer->getName());
 
-  ase_file_write_close_chunk(f);
+  ase_file_write_close_chunk(f, ASE_FILE_CHUNK_LAYER, chunk_start);
 
   /* fop_error(fop, "Layer name \"%s\" child level: %d\n", layer->name, child_level); */
 }
@@ -723,9 +1355,8 @@ template<typename ImageTraits>
 class PixelIO
 {
 public:
-  typename ImageTraits::pixel_t read_pixel(FILE* f);
   void write_pixel(FILE* f, typename ImageTraits::pixel_t c);
-  void read_scanline(typename ImageTraits::address_t address, int w, uint8_t* buffer);
+  void read_scanline(typename ImageTraits::address_t address, int w, const uint8_t* buffer);
   void write_scanline(typename ImageTraits::address_t address, int w, uint8_t* buffer);
 };
 
@@ -734,20 +1365,13 @@ class PixelIO<RgbTraits>
 {
   int r, g, b, a;
 public:
-  RgbTraits::pixel_t read_pixel(FILE* f) {
-    r = fgetc(f);
-    g = fgetc(f);
-    b = fgetc(f);
-    a = fgetc(f);
-    return _rgba(r, g, b, a);
-  }
   void write_pixel(FILE* f, RgbTraits::pixel_t c) {
     fputc(_rgba_getr(c), f);
     fputc(_rgba_getg(c), f);
     fputc(_rgba_getb(c), f);
     fputc(_rgba_geta(c), f);
   }
-  void read_scanline(RgbTraits::address_t address, int w, uint8_t* buffer)
+  void read_scanline(RgbTraits::address_t address, int w, const uint8_t* buffer)
   {
     for (int x=0; x<w; ++x) {
       r = *(buffer++);
@@ -774,16 +1398,11 @@ class PixelIO<GrayscaleTraits>
 {
   int k, a;
 public:
-  GrayscaleTraits::pixel_t read_pixel(FILE* f) {
-    k = fgetc(f);
-    a = fgetc(f);
-    return _graya(k, a);
-  }
   void write_pixel(FILE* f, GrayscaleTraits::pixel_t c) {
     fputc(_graya_getv(c), f);
     fputc(_graya_geta(c), f);
   }
-  void read_scanline(GrayscaleTraits::address_t address, int w, uint8_t* buffer)
+  void read_scanline(GrayscaleTraits::address_t address, int w, const uint8_t* buffer)
   {
     for (int x=0; x<w; ++x) {
       k = *(buffer++);
@@ -805,13 +1424,10 @@ template<>
 class PixelIO<IndexedTraits>
 {
 public:
-  IndexedTraits::pixel_t read_pixel(FILE* f) {
-    return fgetc(f);
-  }
   void write_pixel(FILE* f, IndexedTraits::pixel_t c) {
     fputc(c, f);
   }
-  void read_scanline(IndexedTraits::address_t address, int w, uint8_t* buffer)
+  void read_scanline(IndexedTraits::address_t address, int w, const uint8_t* buffer)
   {
     memcpy(address, buffer, w);
   }
@@ -825,17 +1441,27 @@ public:
 // Raw Image
 //////////////////////////////////////////////////////////////////////
 
+// Reads the pixels directly from the mapped file to the image rows.
 template<typename ImageTraits>
-static void read_raw_image(FILE* f, Image* image, FileOp* fop, ASE_Header* header)
+static void read_raw_image(AseInput* f, Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
-  int x, y;
+  size_t scanline_size = ImageTraits::scanline_size(image->w);
+  size_t size;
+  int y;
 
   for (y=0; y<image->h; y++) {
-    for (x=0; x<image->w; x++)
-      image_putpixel_fast<ImageTraits>(image, x, y, pixel_io.read_pixel(f));
-
-    fop_progress(fop, (float)ftell(f) / (float)header->size);
+    typename ImageTraits::address_t address = image_address_fast<ImageTraits>(image, 0, y);
+    const uint8_t* scanline = f->read(scanline_size, &size);
+
+    if (size == scanline_size)
+      pixel_io.read_scanline(address, image->w, scanline);
+    // Truncated file (the rest of the image is zero)
+    else {
+      std::vector<uint8_t> buffer(scanline_size, 0);
+      std::copy(scanline, scanline+size, buffer.begin());
+      pixel_io.read_scanline(address, image->w, &buffer[0]);
+    }
   }
 }
 
@@ -854,8 +1480,10 @@ static void write_raw_image(FILE* f, Image* image)
 // Compressed Image
 //////////////////////////////////////////////////////////////////////
 
+// Decompresses the pixels of a compressed cel (the whole chunk data
+// is already in memory, so it can be called from any thread).
 template<typename ImageTraits>
-static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileOp* fop, ASE_Header* header)
+static void decompress_image(const uint8_t* data, size_t size, Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -864,62 +1492,93 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
+  zstream.next_in = (Bytef*)data;
+  zstream.avail_in = size;
 
   err = inflateInit(&zstream);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in inflateInit().", err);
 
   std::vector<uint8_t> scanline(ImageTraits::scanline_size(image->w));
-  std::vector<uint8_t> uncompressed(image->h * ImageTraits::scanline_size(image->w));
-  std::vector<uint8_t> compressed(4096);
-  int uncompressed_offset = 0;
 
-  while (true) {
-    size_t input_bytes;
+  for (y=0; y<image->h; y++) {
+    zstream.next_out = (Bytef*)&scanline[0];
+    zstream.avail_out = scanline.size();
+
+    // All the input is available, so inflate() fills the whole
+    // scanline, except when the compressed data is truncated (in
+    // that case the rest of the image is zero).
+    err = inflate(&zstream, Z_NO_FLUSH);
+    if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+      inflateEnd(&zstream);
+      throw base::Exception("ZLib error %d in inflate().", err);
+    }
 
-    if (ftell(f)+compressed.size() > chunk_end) {
-      input_bytes = chunk_end - ftell(f); // Remaining bytes
-      ASSERT(input_bytes < compressed.size());
+    std::fill(scanline.end()-zstream.avail_out, scanline.end(), 0);
 
-      if (input_bytes == 0)
-        break;                  // Done, we consumed all chunk
-    }
-    else
-      input_bytes = compressed.size();
+    typename ImageTraits::address_t address = image_address_fast<ImageTraits>(image, 0, y);
+    pixel_io.read_scanline(address, image->w, &scanline[0]);
+  }
+
+  err = inflateEnd(&zstream);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in inflateEnd().", err);
+}
 
-    size_t bytes_read = fread(&compressed[0], 1, input_bytes, f);
-    zstream.next_in = (Bytef*)&compressed[0];
-    zstream.avail_in = bytes_read;
+static void decompress_image(const uint8_t* data, size_t size, Image* image)
+{
+  switch (image->getPixelFormat()) {
+    case IMAGE_RGB:
+      decompress_image<RgbTraits>(data, size, image);
+      break;
+    case IMAGE_GRAYSCALE:
+      decompress_image<GrayscaleTraits>(data, size, image);
+      break;
+    case IMAGE_INDEXED:
+      decompress_image<IndexedTraits>(data, size, image);
+      break;
+  }
+}
 
-    do {
-      zstream.next_out = (Bytef*)&scanline[0];
-      zstream.avail_out = scanline.size();
+// Checks that the compressed pixels of a cel can be decompressed
+// (with the same rules as decompress_image()) without creating the
+// image. It can be called from any thread.
+static void check_compressed_image(const uint8_t* data, size_t size, PixelFormat format, int w, int h)
+{
+  z_stream zstream;
+  int err;
 
-      err = inflate(&zstream, Z_NO_FLUSH);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
-        throw base::Exception("ZLib error %d in inflate().", err);
+  zstream.zalloc = (alloc_func)0;
+  zstream.zfree  = (free_func)0;
+  zstream.opaque = (voidpf)0;
+  zstream.next_in = (Bytef*)data;
+  zstream.avail_in = size;
 
-      size_t uncompressed_bytes = scanline.size() - zstream.avail_out;
-      if (uncompressed_bytes > 0) {
-        if (uncompressed_offset+uncompressed_bytes > uncompressed.size())
-          throw base::Exception("Bad compressed image.");
+  err = inflateInit(&zstream);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in inflateInit().", err);
 
-        std::copy(scanline.begin(), scanline.begin()+uncompressed_bytes,
-                  uncompressed.begin()+uncompressed_offset);
+  // Only the pixels of the image are inflated (decompress_image()
+  // ignores the rest of the data).
+  size_t remaining = (size_t)pixelformat_line_size(format, w) * h;
+  std::vector<uint8_t> buffer(MIN(remaining, (size_t)64*1024));
 
-        uncompressed_offset += uncompressed_bytes;
-      }
-    } while (zstream.avail_out == 0);
+  while (remaining > 0) {
+    zstream.next_out = (Bytef*)&buffer[0];
+    zstream.avail_out = MIN(remaining, buffer.size());
 
-    fop_progress(fop, (float)ftell(f) / (float)header->size);
-  }
+    err = inflate(&zstream, Z_NO_FLUSH);
+    if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+      inflateEnd(&zstream);
+      throw base::Exception("ZLib error %d in inflate().", err);
+    }
 
-  uncompressed_offset = 0;
-  for (y=0; y<image->h; y++) {
-    typename ImageTraits::address_t address = image_address_fast<ImageTraits>(image, 0, y);
-    pixel_io.read_scanline(address, image->w, &uncompressed[uncompressed_offset]);
+    size_t inflated = MIN(remaining, buffer.size()) - zstream.avail_out;
+    remaining -= inflated;
 
-    uncompressed_offset += ImageTraits::scanline_size(image->w);
+    // Truncated data (the rest of the image is zero)
+    if (err != Z_OK || inflated == 0)
+      break;
   }
 
   err = inflateEnd(&zstream);
@@ -927,8 +1586,10 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
     throw base::Exception("ZLib error %d in inflateEnd().", err);
 }
 
+// Compresses the pixels of a cel in memory (it can be called from
+// any thread).
 template<typename ImageTraits>
-static void write_compressed_image(FILE* f, Image* image)
+static void compress_image(Image* image, int level, std::vector<uint8_t>& output)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -937,12 +1598,15 @@ static void write_compressed_image(FILE* f, Image* image)
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
-  err = deflateInit(&zstream, Z_DEFAULT_COMPRESSION);
+  err = deflateInit(&zstream, level);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in deflateInit().", err);
 
   std::vector<uint8_t> scanline(ImageTraits::scanline_size(image->w));
-  std::vector<uint8_t> compressed(4096);
+
+  // The output buffer is big enough for the whole image in most
+  // cases (it's enlarged when it's not).
+  output.resize(deflateBound(&zstream, scanline.size() * image->h));
 
   for (y=0; y<image->h; y++) {
     typename ImageTraits::address_t address = image_address_fast<ImageTraits>(image, 0, y);
@@ -953,42 +1617,155 @@ static void write_compressed_image(FILE* f, Image* image)
     int flush = (y == image->h-1 ? Z_FINISH: Z_NO_FLUSH);
 
     do {
-      zstream.next_out = (Bytef*)&compressed[0];
-      zstream.avail_out = compressed.size();
+      if (zstream.total_out == output.size())
+        output.resize(2*output.size());
+
+      zstream.next_out = (Bytef*)&output[zstream.total_out];
+      zstream.avail_out = output.size() - zstream.total_out;
 
       // Compress
       err = deflate(&zstream, flush);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+        deflateEnd(&zstream);
         throw base::Exception("ZLib error %d in deflate().", err);
-
-      int output_bytes = compressed.size() - zstream.avail_out;
-      if (output_bytes > 0) {
-        if ((fwrite(&compressed[0], 1, output_bytes, f) != (size_t)output_bytes)
-            || ferror(f))
-          throw base::Exception("Error writing compressed image pixels.\n");
       }
     } while (zstream.avail_out == 0);
   }
 
+  output.resize(zstream.total_out);
+
   err = deflateEnd(&zstream);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in deflateEnd().", err);
 }
 
+static void compress_image(Image* image, int level, std::vector<uint8_t>& output)
+{
+  switch (image->getPixelFormat()) {
+    case IMAGE_RGB:
+      compress_image<RgbTraits>(image, level, output);
+      break;
+    case IMAGE_GRAYSCALE:
+      compress_image<GrayscaleTraits>(image, level, output);
+      break;
+    case IMAGE_INDEXED:
+      compress_image<IndexedTraits>(image, level, output);
+      break;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Thumbnail
+//////////////////////////////////////////////////////////////////////
+
+static Image* ase_file_read_thumbnail(AseInput* f)
+{
+  ASE_FrameHeader frame_header;
+  ase_file_read_frame_header(f, &frame_header);
+  if (frame_header.magic != ASE_FILE_FRAME_MAGIC ||
+      frame_header.chunks == 0)
+    return NULL;
+
+  size_t chunk_pos = f->tell();
+  size_t chunk_size = f->read32();
+  int chunk_type = f->read16();
+  if (chunk_type != ASE_FILE_CHUNK_THUMBNAIL)
+    return NULL;
+
+  return ase_file_read_thumbnail_chunk(f, chunk_pos+chunk_size);
+}
+
+static Image* ase_file_read_thumbnail_chunk(AseInput* f, size_t chunk_end)
+{
+  int w = f->read16();
+  int h = f->read16();
+  ase_file_read_padding(f, 8);
+
+  if (w < 1 || h < 1 ||
+      w > ASE_FILE_THUMBNAIL_SIZE ||
+      h > ASE_FILE_THUMBNAIL_SIZE)
+    return NULL;
+
+  size_t pos = f->tell();
+  size_t size;
+  const uint8_t* data = f->read(pos < chunk_end ? chunk_end-pos: 0, &size);
+
+  UniquePtr<Image> thumbnail(Image::create(IMAGE_RGB, w, h));
+  try {
+    decompress_image(data, size, thumbnail);
+  }
+  catch (const std::exception& e) {
+    PRINTF("Error decoding the thumbnail: %s\n", e.what());
+    return NULL;
+  }
+  return thumbnail.release();
+}
+
+static void ase_file_write_thumbnail_chunk(FILE *f, ASE_FrameHeader *frame_header, Image* thumbnail)
+{
+  ASSERT(thumbnail->getPixelFormat() == IMAGE_RGB);
+
+  std::vector<uint8_t> data;
+  compress_image(thumbnail, Z_BEST_SPEED, data);
+
+  int chunk_start = ase_file_write_start_chunk(f, frame_header, ASE_FILE_CHUNK_THUMBNAIL);
+
+  fputw(thumbnail->w, f);
+  fputw(thumbnail->h, f);
+  ase_file_write_padding(f, 8);
+
+  fwrite(&data[0], 1, data.size(), f);
+
+  ase_file_write_close_chunk(f, ASE_FILE_CHUNK_THUMBNAIL, chunk_start);
+}
+
+// Renders the first frame of the sprite in a small RGB image. The
+// thumbnail is created on each save, so only the rows of the sprite
+// that are used by the thumbnail are rendered (one row at a time),
+// instead of rendering the whole sprite to scale it down later.
+static Image* ase_file_create_thumbnail(const Sprite* sprite)
+{
+  int w = sprite->getWidth();
+  int h = sprite->getHeight();
+  int thumb_w = MID(1, ASE_FILE_THUMBNAIL_SIZE * w / MAX(w, h), w);
+  int thumb_h = MID(1, ASE_FILE_THUMBNAIL_SIZE * h / MAX(w, h), h);
+
+  UniquePtr<Image> image(Image::create(sprite->getPixelFormat(), thumb_w, thumb_h));
+
+  if (thumb_w == w && thumb_h == h) {
+    sprite->render(image, 0, 0, FrameNumber(0));
+  }
+  else {
+    UniquePtr<Image> row(Image::create(sprite->getPixelFormat(), w, 1));
+    for (int v=0; v<thumb_h; ++v) {
+      sprite->render(row, 0, -(h*v/thumb_h), FrameNumber(0));
+      for (int u=0; u<thumb_w; ++u)
+        image->putpixel(u, v, row->getpixel(w*u/thumb_w, 0));
+    }
+  }
+
+  if (image->getPixelFormat() == IMAGE_RGB)
+    return image.release();
+
+  return quantization::convert_pixel_format(image, IMAGE_RGB, DITHERING_NONE, NULL,
+                                            sprite->getPalette(FrameNumber(0)),
+                                            sprite->getBackgroundLayer() != NULL);
+}
+
 //////////////////////////////////////////////////////////////////////
 // Cel Chunk
 //////////////////////////////////////////////////////////////////////
 
-static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame,
+static Cel *ase_file_read_cel_chunk(AseInput* f, Sprite *sprite, FrameNumber frame,
                                     PixelFormat pixelFormat,
-                                    FileOp *fop, ASE_Header *header, size_t chunk_end)
+                                    FileOp *fop, CompressedCels *cels, size_t chunk_end)
 {
   /* read chunk data */
-  LayerIndex layer_index = LayerIndex(fgetw(f));
-  int x = ((short)fgetw(f));
-  int y = ((short)fgetw(f));
-  int opacity = fgetc(f);
-  int cel_type = fgetw(f);
+  LayerIndex layer_index = LayerIndex(f->read16());
+  int x = ((short)f->read16());
+  int y = ((short)f->read16());
+  int opacity = f->read8();
+  int cel_type = f->read16();
   Layer* layer;
 
   ase_file_read_padding(f, 7);
@@ -1014,8 +1791,8 @@ static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame,
 
     case ASE_FILE_RAW_CEL: {
       // Read width and height
-      int w = fgetw(f);
-      int h = fgetw(f);
+      int w = f->read16();
+      int h = f->read16();
 
       if (w > 0 && h > 0) {
         Image* image = Image::create(pixelFormat, w, h);
@@ -1024,15 +1801,15 @@ static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame,
         switch (image->getPixelFormat()) {
 
           case IMAGE_RGB:
-            read_raw_image<RgbTraits>(f, image, fop, header);
+            read_raw_image<RgbTraits>(f, image);
             break;
 
           case IMAGE_GRAYSCALE:
-            read_raw_image<GrayscaleTraits>(f, image, fop, header);
+            read_raw_image<GrayscaleTraits>(f, image);
             break;
 
           case IMAGE_INDEXED:
-            read_raw_image<IndexedTraits>(f, image, fop, header);
+            read_raw_image<IndexedTraits>(f, image);
             break;
         }
 
@@ -1043,13 +1820,12 @@ static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame,
 
     case ASE_FILE_LINK_CEL: {
       // Read link position
-      FrameNumber link_frame = FrameNumber(fgetw(f));
+      FrameNumber link_frame = FrameNumber(f->read16());
       Cel* link = static_cast<LayerImage*>(layer)->getCel(link_frame);
 
       if (link) {
         // Create a copy of the linked cel (avoid using links cel)
-        Image* image = Image::createCopy(sprite->getStock()->getImage(link->getImage()));
-        cel->setImage(sprite->getStock()->addImage(image));
+        cel->setImage(cels->addCopy(sprite->getStock(), link->getImage()));
       }
       else {
         // Linked cel doesn't found
@@ -1058,38 +1834,39 @@ static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame,
       break;
     }
 
+    case ASE_FILE_COPIED_CEL: {
+      // Read the position of the original cel
+      LayerIndex original_layer = LayerIndex(f->read16());
+      FrameNumber original_frame = FrameNumber(f->read16());
+      Layer* source = sprite->indexToLayer(original_layer);
+      Cel* original = (source && source->isImage() ?
+                       static_cast<LayerImage*>(source)->getCel(original_frame): NULL);
+
+      if (original) {
+        // The cel has its own copy of the original image
+        cel->setImage(cels->addCopy(sprite->getStock(), original->getImage()));
+      }
+      else {
+        fop_error(fop, "Frame %d didn't found the original cel of layer %d (frame %d, layer %d)\n",
+                  (int)frame, (int)layer_index, (int)original_frame, (int)original_layer);
+        return NULL;
+      }
+      break;
+    }
+
     case ASE_FILE_COMPRESSED_CEL: {
       // Read width and height
-      int w = fgetw(f);
-      int h = fgetw(f);
+      int w = f->read16();
+      int h = f->read16();
 
       if (w > 0 && h > 0) {
-        Image* image = Image::create(pixelFormat, w, h);
-
-        // Try to read pixel data
-        try {
-          switch (image->getPixelFormat()) {
-
-            case IMAGE_RGB:
-              read_compressed_image<RgbTraits>(f, image, chunk_end, fop, header);
-              break;
-
-            case IMAGE_GRAYSCALE:
-              read_compressed_image<GrayscaleTraits>(f, image, chunk_end, fop, header);
-              break;
+        // The rest of the chunk is the compressed data, it's
+        // decoded later (see CompressedCels)
+        size_t pos = f->tell();
+        size_t size;
+        const uint8_t* data = f->read(pos < chunk_end ? chunk_end-pos: 0, &size);
 
-            case IMAGE_INDEXED:
-              read_compressed_image<IndexedTraits>(f, image, chunk_end, fop, header);
-              break;
-          }
-        }
-        // OK, in case of error we can show the problem, but continue
-        // loading more cels.
-        catch (const std::exception& e) {
-          fop_error(fop, e.what());
-        }
-
-        cel->setImage(sprite->getStock()->addImage(image));
+        cel->setImage(cels->addImage(sprite->getStock(), pixelFormat, w, h, data, size));
       }
       break;
     }
@@ -1101,12 +1878,14 @@ static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame,
   return newCel;
 }
 
-static void ase_file_write_cel_chunk(FILE *f, Cel *cel, LayerImage *layer, Sprite *sprite)
+static void ase_file_write_cel_chunk(FILE *f, ASE_FrameHeader *frame_header, Cel *cel, LayerImage *layer, Sprite *sprite, const CelsCompressor* compressor)
 {
   int layer_index = sprite->layerToIndex(layer);
-  int cel_type = ASE_FILE_COMPRESSED_CEL;
+  LayerIndex original_layer;
+  FrameNumber original_frame;
+  int cel_type = compressor->getCelType(cel, &original_layer, &original_frame);
 
-  ase_file_write_start_chunk(f, ASE_FILE_CHUNK_CEL);
+  int chunk_start = ase_file_write_start_chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
 
   fputw(layer_index, f);
   fputw(cel->getX(), f);
@@ -1151,8 +1930,13 @@ static void ase_file_write_cel_chunk(FILE *f, Cel *cel, LayerImage *layer, Sprit
 
     case ASE_FILE_LINK_CEL:
       // Linked cel to another frame
-      //fputw(link->frame, f);
-      fputw(0, f);
+      fputw(original_frame, f);
+      break;
+
+    case ASE_FILE_COPIED_CEL:
+      // Copy of the image of a previous cel
+      fputw(original_layer, f);
+      fputw(original_frame, f);
       break;
 
     case ASE_FILE_COMPRESSED_CEL: {
@@ -1163,20 +1947,11 @@ static void ase_file_write_cel_chunk(FILE *f, Cel *cel, LayerImage *layer, Sprit
         fputw(image->w, f);
         fputw(image->h, f);
 
-        // Pixel data
-        switch (image->getPixelFormat()) {
-
-          case IMAGE_RGB:
-            write_compressed_image<RgbTraits>(f, image);
-            break;
-
-          case IMAGE_GRAYSCALE:
-            write_compressed_image<GrayscaleTraits>(f, image);
-            break;
-
-          case IMAGE_INDEXED:
-            write_compressed_image<IndexedTraits>(f, image);
-            break;
+        // Pixel data (already compressed)
+        const std::vector<uint8_t>& data = compressor->getData(cel->getImage());
+        if (!data.empty()) {
+          if (fwrite(&data[0], 1, data.size(), f) != data.size() || ferror(f))
+            throw base::Exception("Error writing compressed image pixels.\n");
         }
       }
       else {
@@ -1188,18 +1963,18 @@ static void ase_file_write_cel_chunk(FILE *f, Cel *cel, LayerImage *layer, Sprit
     }
   }
 
-  ase_file_write_close_chunk(f);
+  ase_file_write_close_chunk(f, ASE_FILE_CHUNK_CEL, chunk_start);
 }
 
-static Mask *ase_file_read_mask_chunk(FILE *f)
+static Mask *ase_file_read_mask_chunk(AseInput* f)
 {
   int c, u, v, byte;
   Mask *mask;
   // Read chunk data
-  int x = fgetw(f);
-  int y = fgetw(f);
-  int w = fgetw(f);
-  int h = fgetw(f);
+  int x = f->read16();
+  int y = f->read16();
+  int w = f->read16();
+  int h = f->read16();
 
   ase_file_read_padding(f, 8);
   std::string name = ase_file_read_string(f);
@@ -1211,7 +1986,7 @@ static Mask *ase_file_read_mask_chunk(FILE *f)
   // Read image data
   for (v=0; v<h; v++)
     for (u=0; u<(w+7)/8; u++) {
-      byte = fgetc(f);
+      byte = f->read8();
       for (c=0; c<8; c++)
         image_putpixel(mask->getBitmap(), u*8+c, v, byte & (1<<(7-c)));
     }
@@ -1219,12 +1994,12 @@ static Mask *ase_file_read_mask_chunk(FILE *f)
   return mask;
 }
 
-static void ase_file_write_mask_chunk(FILE *f, Mask *mask)
+static void ase_file_write_mask_chunk(FILE *f, ASE_FrameHeader *frame_header, Mask *mask)
 {
   int c, u, v, byte;
   const gfx::Rect& bounds(mask->getBounds());
 
-  ase_file_write_start_chunk(f, ASE_FILE_CHUNK_MASK);
+  int chunk_start = ase_file_write_start_chunk(f, frame_header, ASE_FILE_CHUNK_MASK);
 
   fputw(bounds.x, f);
   fputw(bounds.y, f);
@@ -1245,5 +2020,5 @@ static void ase_file_write_mask_chunk(FILE *f, Mask *mask)
       fputc(byte, f);
     }
 
-  ase_file_write_close_chunk(f);
+  ase_file_write_close_chunk(f, ASE_FILE_CHUNK_MASK, chunk_start);
 }
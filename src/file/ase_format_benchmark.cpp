@@ -0,0 +1,305 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tests/test.h"
+
+#include "base/chrono.h"
+#include "base/unique_ptr.h"
+#include "document.h"
+#include "file/file.h"
+#include "file/file_formats_manager.h"
+#include "raster/raster.h"
+#include "she/she.h"
+#include "zlib.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+  const int kWidth = 512;
+  const int kHeight = 512;
+  const int kFrames = 32;
+
+  // Number of read() syscalls of this process (only on Linux, -1 in
+  // other platforms).
+  long count_read_syscalls()
+  {
+    long count = -1;
+    std::FILE* f = std::fopen("/proc/self/io", "r");
+    if (f) {
+      char line[256];
+      while (std::fgets(line, sizeof(line), f)) {
+        if (std::strncmp(line, "syscr:", 6) == 0) {
+          count = std::atol(line+6);
+          break;
+        }
+      }
+      std::fclose(f);
+    }
+    return count;
+  }
+
+  void fill_pixels(std::vector<uint8_t>& pixels, int frame)
+  {
+    std::srand(frame);
+    for (int y=0; y<kHeight; ++y) {
+      for (int x=0; x<kWidth; ++x) {
+        uint8_t* p = &pixels[4*(y*kWidth+x)];
+        p[0] = (x+frame) & 255;
+        p[1] = (y*2) & 255;
+        p[2] = ((x^y) & 0x10) ? (std::rand() & 255): 0;
+        p[3] = 255;
+      }
+    }
+  }
+
+  // Writes a RGB .ase file with one layer and one cel per frame (raw
+  // or compressed).
+  void write_synthetic_file(const char* filename, bool compressed)
+  {
+    std::FILE* f = std::fopen(filename, "wb");
+    ASSERT_TRUE(f != NULL);
+
+    // Header (the size is written at the end)
+    fputl(0, f);
+    fputw(0xA5E0, f);
+    fputw(kFrames, f);
+    fputw(kWidth, f);
+    fputw(kHeight, f);
+    fputw(32, f);
+    fputl(0, f);
+    fputw(100, f);
+    while (std::ftell(f) < 128)
+      std::fputc(0, f);
+
+    std::vector<uint8_t> pixels(4*kWidth*kHeight);
+    std::vector<uint8_t> data;
+
+    for (int frame=0; frame<kFrames; ++frame) {
+      fill_pixels(pixels, frame);
+
+      if (compressed) {
+        uLongf size = compressBound(pixels.size());
+        data.resize(size);
+        compress(&data[0], &size, &pixels[0], pixels.size());
+        data.resize(size);
+      }
+      else
+        data = pixels;
+
+      const char* layerName = "Layer";
+      int layerChunkSize = (frame == 0 ? 6+18+std::strlen(layerName): 0);
+      int celChunkSize = 6+16+4+data.size();
+
+      // Frame header
+      fputl(16+layerChunkSize+celChunkSize, f);
+      fputw(0xF1FA, f);
+      fputw(frame == 0 ? 2: 1, f);
+      fputw(100, f);
+      for (int c=0; c<6; ++c) std::fputc(0, f);
+
+      // Layer chunk
+      if (frame == 0) {
+        fputl(layerChunkSize, f);
+        fputw(0x2004, f);
+        fputw(3, f);            // Visible & editable
+        fputw(0, f);            // Image layer
+        fputw(0, f);            // Child level
+        fputw(0, f);
+        fputw(0, f);
+        fputw(0, f);
+        for (int c=0; c<4; ++c) std::fputc(0, f);
+        fputw(std::strlen(layerName), f);
+        std::fputs(layerName, f);
+      }
+
+      // Cel chunk
+      fputl(celChunkSize, f);
+      fputw(0x2005, f);
+      fputw(0, f);              // Layer index
+      fputw(0, f);              // X
+      fputw(0, f);              // Y
+      std::fputc(255, f);       // Opacity
+      fputw(compressed ? 2: 0, f);
+      for (int c=0; c<7; ++c) std::fputc(0, f);
+      fputw(kWidth, f);
+      fputw(kHeight, f);
+      std::fwrite(&data[0], 1, data.size(), f);
+    }
+
+    long size = std::ftell(f);
+    std::fseek(f, 0, SEEK_SET);
+    fputl(size, f);
+    std::fclose(f);
+  }
+
+  // The previous way to read the same files: small fread() calls
+  // through the FILE buffer (fgetc() for each component of raw cels,
+  // and blocks of 4KB for compressed cels).
+  void legacy_load(const char* filename, std::vector<Image*>& images)
+  {
+    std::FILE* f = std::fopen(filename, "rb");
+    ASSERT_TRUE(f != NULL);
+
+    fgetl(f);
+    fgetw(f);
+    int frames = fgetw(f);
+    std::fseek(f, 128, SEEK_SET);
+
+    for (int frame=0; frame<frames; ++frame) {
+      long frame_pos = std::ftell(f);
+      long frame_size = fgetl(f);
+      fgetw(f);
+      int chunks = fgetw(f);
+      std::fseek(f, frame_pos+16, SEEK_SET);
+
+      for (int c=0; c<chunks; ++c) {
+        long chunk_pos = std::ftell(f);
+        long chunk_size = fgetl(f);
+        int chunk_type = fgetw(f);
+
+        if (chunk_type == 0x2005) {
+          for (int i=0; i<7; ++i) std::fgetc(f);
+          int cel_type = fgetw(f);
+          for (int i=0; i<7; ++i) std::fgetc(f);
+          int w = fgetw(f);
+          int h = fgetw(f);
+          Image* image = Image::create(IMAGE_RGB, w, h);
+
+          if (cel_type == 0) {
+            for (int y=0; y<h; ++y)
+              for (int x=0; x<w; ++x) {
+                int r = std::fgetc(f);
+                int g = std::fgetc(f);
+                int b = std::fgetc(f);
+                int a = std::fgetc(f);
+                image_putpixel_fast<RgbTraits>(image, x, y, _rgba(r, g, b, a));
+              }
+          }
+          else {
+            z_stream zstream;
+            std::memset(&zstream, 0, sizeof(zstream));
+            inflateInit(&zstream);
+
+            std::vector<uint8_t> uncompressed(4*w*h);
+            std::vector<uint8_t> compressed(4096);
+            size_t offset = 0;
+            size_t chunk_end = chunk_pos+chunk_size;
+
+            while ((size_t)std::ftell(f) < chunk_end) {
+              size_t bytes = std::fread(&compressed[0], 1,
+                                        MIN(compressed.size(), chunk_end-std::ftell(f)), f);
+              zstream.next_in = &compressed[0];
+              zstream.avail_in = bytes;
+              do {
+                zstream.next_out = &uncompressed[offset];
+                zstream.avail_out = uncompressed.size()-offset;
+                inflate(&zstream, Z_NO_FLUSH);
+                offset = uncompressed.size()-zstream.avail_out;
+              } while (zstream.avail_in > 0 && zstream.avail_out > 0);
+            }
+            inflateEnd(&zstream);
+
+            for (int y=0; y<h; ++y) {
+              uint8_t* p = &uncompressed[4*y*w];
+              for (int x=0; x<w; ++x, p+=4)
+                image_putpixel_fast<RgbTraits>(image, x, y, _rgba(p[0], p[1], p[2], p[3]));
+            }
+          }
+          images.push_back(image);
+        }
+        std::fseek(f, chunk_pos+chunk_size, SEEK_SET);
+      }
+      std::fseek(f, frame_pos+frame_size, SEEK_SET);
+    }
+    std::fclose(f);
+  }
+
+  // Loads the file with AseFormat (without the post-load steps,
+  // e.g. the palette generation for RGB sprites).
+  Document* load_ase_file(const char* filename)
+  {
+    FileOp* fop = fop_to_load_document(filename, FILE_LOAD_SEQUENCE_NONE);
+    if (!fop)
+      return NULL;
+
+    fop_operate(fop, NULL);
+    fop_done(fop);
+
+    Document* document = fop->document;
+    fop_free(fop);
+    return document;
+  }
+
+  void run_benchmark(const char* name, bool compressed)
+  {
+    const char* filename = "ase_format_benchmark.ase";
+    write_synthetic_file(filename, compressed);
+
+    // Load the file once so both methods use the OS file cache.
+    {
+      UniquePtr<Document> doc(load_ase_file(filename));
+      ASSERT_TRUE(doc.get() != NULL);
+    }
+
+    std::vector<Image*> images;
+    long syscalls = count_read_syscalls();
+    base::Chrono chrono;
+    legacy_load(filename, images);
+    double legacyTime = chrono.elapsed();
+    long legacySyscalls = count_read_syscalls() - syscalls;
+
+    syscalls = count_read_syscalls();
+    chrono.reset();
+    UniquePtr<Document> doc(load_ase_file(filename));
+    ASSERT_TRUE(doc.get() != NULL);
+    double mappedTime = chrono.elapsed();
+    long mappedSyscalls = count_read_syscalls() - syscalls;
+
+    // Both methods must read the same pixels.
+    Sprite* sprite = doc->getSprite();
+    LayerImage* layer = static_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+    ASSERT_EQ(kFrames, (int)images.size());
+    for (int frame=0; frame<kFrames; ++frame) {
+      Image* image = sprite->getStock()->getImage(layer->getCel(FrameNumber(frame))->getImage());
+      EXPECT_EQ(0, image_count_diff(image, images[frame]));
+      delete images[frame];
+    }
+
+    std::printf("%s: %d frames of %dx%d\n"
+                "  fread(): %ld read syscalls, %.4f s\n"
+                "  mapped:  %ld read syscalls, %.4f s\n",
+                name, kFrames, kWidth, kHeight,
+                legacySyscalls, legacyTime,
+                mappedSyscalls, mappedTime);
+
+    std::remove(filename);
+  }
+
+} // anonymous namespace
+
+TEST(AseFormatBenchmark, LoadFiles)
+{
+  she::ScopedHandle<she::System> system(she::CreateSystem());
+  FileFormatsManager::instance().registerAllFormats();
+
+  run_benchmark("Raw cels", false);
+  run_benchmark("Compressed cels", true);
+}
@@ -23,6 +23,8 @@
 #include "base/scoped_lock.h"
 #include "base/shared_ptr.h"
 #include "base/string.h"
+#include "base/thread.h"
+#include "base/thread_pool.h"
 #include "console.h"
 #include "document.h"
 #include "file/file.h"
@@ -40,6 +42,8 @@
 #include <string.h>
 
 static FileOp* fop_new(FileOpType type);
+static FileOp* fop_new_for_sequence_file(FileOp* fop, const std::string& filename);
+static void fop_free_sequence_file(FileOp* fop);
 static void fop_prepare_for_sequence(FileOp* fop);
 
 static FileFormat* get_fileformat(const char* extension);
@@ -110,7 +114,7 @@ Document* load_document(const char* filename)
 int save_document(Document* document)
 {
   int ret;
-  FileOp* fop = fop_to_save_document(document);
+  FileOp* fop = fop_to_save_document(document, 0);
   if (!fop)
     return -1;
 
@@ -218,11 +222,23 @@ FileOp* fop_to_load_document(const char* filename, int flags)
   if (flags & FILE_LOAD_ONE_FRAME)
     fop->oneframe = true;
 
+  /* decode cels on demand */
+  if (flags & FILE_LOAD_LAZY_CELS)
+    fop->lazy = true;
+
+  /* load the embedded thumbnail (if the format has one) */
+  if (flags & FILE_LOAD_THUMBNAIL)
+    fop->thumbnail = true;
+
+  /* don't use worker threads */
+  if (flags & FILE_LOAD_SINGLE_THREAD)
+    fop->single_thread = true;
+
 done:;
   return fop;
 }
 
-FileOp* fop_to_save_document(Document* document)
+FileOp* fop_to_save_document(Document* document, int flags)
 {
   char extension[32], buf[2048];
   FileOp *fop;
@@ -235,6 +251,12 @@ FileOp* fop_to_save_document(Document* document)
   /* document to save */
   fop->document = document;
 
+  if (flags & FILE_SAVE_FAST)
+    fop->fast = true;
+
+  if (flags & FILE_SAVE_SINGLE_THREAD)
+    fop->single_thread = true;
+
   /* get the extension of the filename (in lower case) */
   ustrcpy(extension, get_extension(fop->document->getFilename()));
   ustrlwr(extension);
@@ -388,6 +410,46 @@ FileOp* fop_to_save_document(Document* document)
   return fop;
 }
 
+// Number of files of a sequence that are queued to be loaded/saved in
+// worker threads (for each thread) before the results are collected.
+#define SEQUENCE_FILES_PER_THREAD 4
+
+// Loads or saves one file of a sequence in a worker thread. Each file
+// uses its own FileOp (created with fop_new_for_sequence_file()), so
+// the format can use the fop_sequence_*() functions without touching
+// the state of the main FileOp.
+class SequenceFileTask
+{
+public:
+  SequenceFileTask(FileOp* fop, FileOp* file_fop, int* result)
+    : m_fop(fop), m_file_fop(file_fop), m_result(result) {
+  }
+
+  void operator()() {
+    // Skip the file if the whole operation was cancelled
+    if (fop_is_stop(m_fop)) {
+      *m_result = false;
+      return;
+    }
+
+    try {
+      if (m_file_fop->type == FileOpLoad)
+        *m_result = m_file_fop->format->load(m_file_fop);
+      else
+        *m_result = m_file_fop->format->save(m_file_fop);
+    }
+    catch (const std::exception& e) {
+      fop_error(m_file_fop, "%s\n", e.what());
+      *m_result = false;
+    }
+  }
+
+private:
+  FileOp* m_fop;
+  FileOp* m_file_fop;
+  int* m_result;
+};
+
 // Executes the file operation: loads or saves the sprite.
 //
 // It can be called from a different thread of the one used
@@ -445,9 +507,16 @@ void fop_operate(FileOp *fop, IFileOpProgress* progress)
       fop->seq.progress_offset = 0.0f;
       fop->seq.progress_fraction = 1.0f / (double)frames;
 
+      // The first file is loaded in this thread (it creates the
+      // document), the rest of them can be loaded in worker threads.
+      int threads = (fop->single_thread ? 1: MIN(base::thread::hardware_concurrency(), (int)frames-1));
+
       std::vector<std::string>::iterator it = fop->seq.filename_list.begin();
       std::vector<std::string>::iterator end = fop->seq.filename_list.end();
       for (; it != end; ++it) {
+        if (old_image && threads > 1)
+          break;
+
         fop->filename = it->c_str();
 
         // Call the "load" procedure to read the first bitmap.
@@ -509,6 +578,64 @@ void fop_operate(FileOp *fop, IFileOpProgress* progress)
         ++frame;
         fop->seq.progress_offset += fop->seq.progress_fraction;
       }
+
+      // Load the rest of the files in parallel.
+      if (old_image && threads > 1) {
+        base::thread_pool pool(threads);
+        bool failed = false;
+
+        while (it != end && !failed && !fop_is_stop(fop)) {
+          int n = MIN(threads*SEQUENCE_FILES_PER_THREAD, (int)(end - it));
+          std::vector<FileOp*> files(n);
+          std::vector<int> results(n);
+
+          for (int i=0; i<n; ++i, ++it) {
+            files[i] = fop_new_for_sequence_file(fop, *it);
+            pool.execute(SequenceFileTask(fop, files[i], &results[i]));
+          }
+          pool.wait_all();
+
+          // Add the loaded frames to the sprite in order.
+          for (int i=0; i<n; ++i) {
+            FileOp* file_fop = files[i];
+
+            if (!failed && !fop_is_stop(fop)) {
+              if (file_fop->has_error())
+                fop_error(fop, "%s", file_fop->error.c_str());
+
+              if (!results[i])
+                fop_error(fop, "Error loading frame %d from file \"%s\"\n",
+                          frame+1, file_fop->filename.c_str());
+
+              if (!results[i] || !file_fop->seq.last_cel) {
+                failed = true;
+              }
+              else {
+                Sprite* sprite = fop->document->getSprite();
+
+                fop->seq.image = file_fop->seq.image;
+                fop->seq.last_cel = file_fop->seq.last_cel;
+                fop->seq.last_cel->setFrame(frame);
+                file_fop->seq.image = NULL;
+                file_fop->seq.last_cel = NULL;
+
+                file_fop->seq.palette->copyColorsTo(fop->seq.palette);
+                if (file_fop->seq.has_alpha)
+                  fop->seq.has_alpha = true;
+                sprite->setTransparentColor(file_fop->document->getSprite()->getTransparentColor());
+
+                SEQUENCE_IMAGE();
+
+                ++frame;
+                fop_progress(fop, 1.0f);
+                fop->seq.progress_offset += fop->seq.progress_fraction;
+              }
+            }
+
+            fop_free_sequence_file(file_fop);
+          }
+        }
+      }
       fop->filename = *fop->seq.filename_list.begin();
 
       // Final setup
@@ -548,28 +675,81 @@ void fop_operate(FileOp *fop, IFileOpProgress* progress)
                                      sprite->getWidth(),
                                      sprite->getHeight());
       if (fop->seq.image != NULL) {
+        int threads = (fop->single_thread ? 1: MIN(base::thread::hardware_concurrency(), (int)sprite->getTotalFrames()));
+
         fop->seq.progress_offset = 0.0f;
         fop->seq.progress_fraction = 1.0f / (double)sprite->getTotalFrames();
 
-        // For each frame in the sprite.
-        for (FrameNumber frame(0); frame < sprite->getTotalFrames(); ++frame) {
-          // Draw the "frame" in "fop->seq.image"
-          sprite->render(fop->seq.image, 0, 0, frame);
-
-          // Setup the palette.
-          sprite->getPalette(frame)->copyColorsTo(fop->seq.palette);
-
-          // Setup the filename to be used.
-          fop->filename = fop->seq.filename_list[frame];
-
-          // Call the "save" procedure... did it fail?
-          if (!fop->format->save(fop)) {
-            fop_error(fop, "Error saving frame %d in the file \"%s\"\n",
-                      frame+1, fop->filename.c_str());
-            break;
+        // Render the frames in this thread while the previous ones are
+        // saved in worker threads.
+        if (threads > 1) {
+          base::thread_pool pool(threads);
+          FrameNumber frame(0);
+          bool failed = false;
+
+          while (frame < sprite->getTotalFrames() && !failed && !fop_is_stop(fop)) {
+            int n = MIN(threads*SEQUENCE_FILES_PER_THREAD, (int)(sprite->getTotalFrames() - frame));
+            std::vector<FileOp*> files(n);
+            std::vector<int> results(n);
+
+            for (int i=0; i<n; ++i) {
+              FileOp* file_fop = fop_new_for_sequence_file(fop, fop->seq.filename_list[frame+i]);
+
+              file_fop->seq.image = Image::create(sprite->getPixelFormat(),
+                                                  sprite->getWidth(),
+                                                  sprite->getHeight());
+              sprite->render(file_fop->seq.image, 0, 0, FrameNumber(frame+i));
+              sprite->getPalette(FrameNumber(frame+i))->copyColorsTo(file_fop->seq.palette);
+
+              files[i] = file_fop;
+              pool.execute(SequenceFileTask(fop, file_fop, &results[i]));
+            }
+            pool.wait_all();
+
+            for (int i=0; i<n; ++i) {
+              FileOp* file_fop = files[i];
+
+              if (!failed && !fop_is_stop(fop)) {
+                if (file_fop->has_error())
+                  fop_error(fop, "%s", file_fop->error.c_str());
+
+                if (!results[i]) {
+                  fop_error(fop, "Error saving frame %d in the file \"%s\"\n",
+                            frame+1, file_fop->filename.c_str());
+                  failed = true;
+                }
+                else {
+                  fop_progress(fop, 1.0f);
+                  fop->seq.progress_offset += fop->seq.progress_fraction;
+                  ++frame;
+                }
+              }
+
+              fop_free_sequence_file(file_fop);
+            }
           }
+        }
+        else {
+          // For each frame in the sprite.
+          for (FrameNumber frame(0); frame < sprite->getTotalFrames(); ++frame) {
+            // Draw the "frame" in "fop->seq.image"
+            sprite->render(fop->seq.image, 0, 0, frame);
+
+            // Setup the palette.
+            sprite->getPalette(frame)->copyColorsTo(fop->seq.palette);
+
+            // Setup the filename to be used.
+            fop->filename = fop->seq.filename_list[frame];
+
+            // Call the "save" procedure... did it fail?
+            if (!fop->format->save(fop)) {
+              fop_error(fop, "Error saving frame %d in the file \"%s\"\n",
+                        frame+1, fop->filename.c_str());
+              break;
+            }
 
-          fop->seq.progress_offset += fop->seq.progress_fraction;
+            fop->seq.progress_offset += fop->seq.progress_fraction;
+          }
         }
         fop->filename = *fop->seq.filename_list.begin();
 
@@ -752,7 +932,7 @@ void fop_progress(FileOp *fop, double progress)
   }
 
   if (fop->progressInterface)
-    fop->progressInterface->ackFileOpProgress(progress);
+    fop->progressInterface->ackFileOpProgress(fop->progress);
 }
 
 double fop_get_progress(FileOp *fop)
@@ -802,6 +982,10 @@ static FileOp* fop_new(FileOpType type)
   fop->done = false;
   fop->stop = false;
   fop->oneframe = false;
+  fop->lazy = false;
+  fop->thumbnail = false;
+  fop->fast = false;
+  fop->single_thread = false;
 
   fop->seq.palette = NULL;
   fop->seq.image = NULL;
@@ -814,6 +998,54 @@ static FileOp* fop_new(FileOpType type)
   return fop;
 }
 
+// Creates a FileOp to load/save just one file of the "fop" sequence
+// in a worker thread.
+static FileOp* fop_new_for_sequence_file(FileOp* fop, const std::string& filename)
+{
+  FileOp* file_fop = fop_new(fop->type);
+
+  file_fop->format = fop->format;
+  file_fop->filename = filename;
+  file_fop->fast = fop->fast;
+  file_fop->single_thread = fop->single_thread;
+
+  fop_prepare_for_sequence(file_fop);
+  file_fop->seq.filename_list.push_back(filename);
+  file_fop->seq.has_alpha = false;
+
+  if (fop->type == FileOpLoad) {
+    // The file is loaded in its own sprite (with the same pixel
+    // format, palette and transparent color of the main sequence) so
+    // the format can modify it without locks.
+    Sprite* sprite = fop->document->getSprite();
+    Sprite* file_sprite = new Sprite(sprite->getPixelFormat(),
+                                     sprite->getWidth(),
+                                     sprite->getHeight(), 256);
+    file_sprite->setTransparentColor(sprite->getTransparentColor());
+    file_fop->document = new Document(file_sprite);
+    fop->seq.palette->copyColorsTo(file_fop->seq.palette);
+  }
+  else {
+    // The document and format options are shared (formats just read
+    // them).
+    file_fop->document = fop->document;
+    file_fop->seq.format_options = fop->seq.format_options;
+  }
+
+  return file_fop;
+}
+
+static void fop_free_sequence_file(FileOp* fop)
+{
+  if (fop->seq.image) image_free(fop->seq.image);
+  if (fop->seq.last_cel) delete fop->seq.last_cel;
+
+  if (fop->type == FileOpLoad)
+    delete fop->document;
+
+  fop_free(fop);
+}
+
 static void fop_prepare_for_sequence(FileOp* fop)
 {
   fop->seq.palette = new Palette(FrameNumber(0), 256);
@@ -31,6 +31,12 @@
 #define FILE_LOAD_SEQUENCE_ASK          0x00000002
 #define FILE_LOAD_SEQUENCE_YES          0x00000004
 #define FILE_LOAD_ONE_FRAME             0x00000008
+#define FILE_LOAD_LAZY_CELS             0x00000010
+#define FILE_LOAD_THUMBNAIL             0x00000020
+#define FILE_LOAD_SINGLE_THREAD         0x00000040
+
+#define FILE_SAVE_FAST                  0x00000001
+#define FILE_SAVE_SINGLE_THREAD         0x00000002
 
 class Document;
 class Cel;
@@ -73,6 +79,18 @@ struct FileOp
   bool oneframe : 1;            // Load just one frame (in formats
                                 // that support animation like
                                 // GIF/FLI/ASE).
+  bool lazy : 1;                // Decode cel images the first time
+                                // they are used (in formats that
+                                // support it like ASE).
+  bool thumbnail : 1;           // Load just a small preview of the
+                                // first frame (in formats that
+                                // store it like ASE, the document
+                                // can be smaller than the sprite).
+  bool fast : 1;                // Save faster using less compression
+                                // (e.g. for backups).
+  bool single_thread : 1;       // Don't create worker threads (e.g.
+                                // when several files are loaded or
+                                // saved at the same time).
 
   // Data for sequences.
   struct {
@@ -115,7 +133,7 @@ int save_document(Document* document);
 // Low-level routines to load/save documents.
 
 FileOp* fop_to_load_document(const char* filename, int flags);
-FileOp* fop_to_save_document(Document* document);
+FileOp* fop_to_save_document(Document* document, int flags);
 void fop_operate(FileOp* fop, IFileOpProgress* progress);
 void fop_done(FileOp* fop);
 void fop_stop(FileOp* fop);
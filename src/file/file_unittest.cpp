@@ -22,6 +22,7 @@
 #include "document.h"
 #include "file/file.h"
 #include "file/file_formats_manager.h"
+#include "ini_file.h"
 #include "raster/raster.h"
 #include "she/she.h"
 
@@ -84,3 +85,167 @@ TEST(File, SeveralSizes)
     }
   }
 }
+
+TEST(File, LoadThumbnail)
+{
+  she::ScopedHandle<she::System> system(she::CreateSystem());
+  FileFormatsManager::instance().registerAllFormats();
+
+  {
+    UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_INDEXED, 512, 256, 256));
+    doc->setFilename("test.ase");
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(doc->getSprite()->getFolder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+    Image* image = doc->getSprite()->getStock()->getImage(layer->getCel(FrameNumber(0))->getImage());
+    image_clear(image, 1);
+
+    // The thumbnail chunk is saved only if it's enabled
+    set_config_bool("ASE", "SaveThumbnail", true);
+    save_document(doc);
+    set_config_bool("ASE", "SaveThumbnail", false);
+  }
+
+  FileOp* fop = fop_to_load_document("test.ase",
+                                     FILE_LOAD_SEQUENCE_NONE |
+                                     FILE_LOAD_ONE_FRAME |
+                                     FILE_LOAD_THUMBNAIL);
+  ASSERT_TRUE(fop != NULL);
+  fop_operate(fop, NULL);
+  fop_done(fop);
+
+  UniquePtr<Document> doc(fop->document);
+  ASSERT_FALSE(fop->has_error());
+  fop_free(fop);
+
+  // The thumbnail is a RGB sprite with the same aspect ratio
+  Sprite* sprite = doc->getSprite();
+  EXPECT_EQ(IMAGE_RGB, sprite->getPixelFormat());
+  EXPECT_EQ(128, sprite->getWidth());
+  EXPECT_EQ(64, sprite->getHeight());
+
+  LayerImage* layer = dynamic_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+  ASSERT_TRUE(layer != NULL);
+  Image* image = sprite->getStock()->getImage(layer->getCel(FrameNumber(0))->getImage());
+  uint32_t color = sprite->getPalette(FrameNumber(0))->getEntry(1);
+  EXPECT_EQ(_rgba(_rgba_getr(color), _rgba_getg(color), _rgba_getb(color), 255),
+            image_getpixel(image, 64, 32));
+}
+
+TEST(File, ReportCorruptedCels)
+{
+  she::ScopedHandle<she::System> system(she::CreateSystem());
+  FileFormatsManager::instance().registerAllFormats();
+
+  {
+    UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_INDEXED, 64, 64, 256));
+    doc->setFilename("test.ase");
+    save_document(doc);
+  }
+
+  // Replace the first deflate block of the cel with an invalid block
+  // type. Chunks start after the file header (128 bytes) and the frame
+  // header (16 bytes), the compressed data is after the chunk header (6
+  // bytes), the cel fields (16 bytes), the size (4 bytes) and the zlib
+  // header (2 bytes).
+  std::vector<uint8_t> data;
+  {
+    FILE* f = std::fopen("test.ase", "rb");
+    ASSERT_TRUE(f != NULL);
+    for (int c; (c = std::fgetc(f)) != EOF; )
+      data.push_back(c);
+    std::fclose(f);
+  }
+  size_t pos = 128+16;
+  while (pos+6 <= data.size() && (data[pos+4] | (data[pos+5] << 8)) != 0x2005)
+    pos += (data[pos] | (data[pos+1] << 8) | (data[pos+2] << 16) | (data[pos+3] << 24));
+  ASSERT_LT(pos+6+16+4+2, data.size());
+  data[pos+6+16+4+2] = 0xff;
+  {
+    FILE* f = std::fopen("test.ase", "wb");
+    ASSERT_TRUE(f != NULL);
+    std::fwrite(&data[0], 1, data.size(), f);
+    std::fclose(f);
+  }
+
+  // The error is reported when the file is loaded (in lazy mode too)
+  for (int lazy=0; lazy<2; ++lazy) {
+    FileOp* fop = fop_to_load_document("test.ase",
+                                       FILE_LOAD_SEQUENCE_NONE |
+                                       (lazy ? FILE_LOAD_LAZY_CELS: 0));
+    ASSERT_TRUE(fop != NULL);
+    fop_operate(fop, NULL);
+    fop_done(fop);
+
+    UniquePtr<Document> doc(fop->document);
+    EXPECT_TRUE(fop->has_error());
+    fop_free(fop);
+  }
+}
+
+TEST(File, DuplicatedCels)
+{
+  she::ScopedHandle<she::System> system(she::CreateSystem());
+  FileFormatsManager::instance().registerAllFormats();
+
+  // Cels are saved as linked and compressed cels, or as linked and
+  // copied cels
+  for (int copiedCels=0; copiedCels<2; ++copiedCels) {
+    set_config_bool("ASE", "SaveCopiedCels", copiedCels ? true: false);
+
+    // Two frames and two layers with the same pixels in all cels
+    {
+      UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_INDEXED, 32, 32, 256));
+      doc->setFilename("test.ase");
+
+      Sprite* sprite = doc->getSprite();
+      sprite->setTotalFrames(FrameNumber(2));
+      LayerImage* layer1 = static_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+      LayerImage* layer2 = new LayerImage(sprite);
+      sprite->getFolder()->addLayer(layer2);
+
+      Image* image = sprite->getStock()->getImage(layer1->getCel(FrameNumber(0))->getImage());
+      for (int y=0; y<image->h; y++)
+        for (int x=0; x<image->w; x++)
+          image_putpixel(image, x, y, (x+y) & 255);
+
+      layer1->addCel(new Cel(FrameNumber(1), sprite->getStock()->addImage(Image::createCopy(image))));
+      layer2->addCel(new Cel(FrameNumber(0), sprite->getStock()->addImage(Image::createCopy(image))));
+      layer2->addCel(new Cel(FrameNumber(1), sprite->getStock()->addImage(Image::createCopy(image))));
+
+      save_document(doc);
+    }
+
+    // Each cel has its own image with the same pixels
+    for (int lazy=0; lazy<2; ++lazy) {
+      FileOp* fop = fop_to_load_document("test.ase",
+                                         FILE_LOAD_SEQUENCE_NONE |
+                                         (lazy ? FILE_LOAD_LAZY_CELS: 0));
+      ASSERT_TRUE(fop != NULL);
+      fop_operate(fop, NULL);
+      fop_done(fop);
+
+      UniquePtr<Document> doc(fop->document);
+      ASSERT_FALSE(fop->has_error());
+      fop_free(fop);
+
+      Sprite* sprite = doc->getSprite();
+      std::vector<Image*> images;
+      for (int i=0; i<2; ++i) {
+        LayerImage* layer = static_cast<LayerImage*>(sprite->indexToLayer(LayerIndex(i)));
+        for (FrameNumber frame(0); frame<2; ++frame) {
+          Image* image = sprite->getStock()->getImage(layer->getCel(frame)->getImage());
+          for (size_t j=0; j<images.size(); ++j)
+            EXPECT_NE(images[j], image);
+          images.push_back(image);
+
+          for (int y=0; y<image->h; y++)
+            for (int x=0; x<image->w; x++)
+              ASSERT_EQ((x+y) & 255, image_getpixel(image, x, y));
+        }
+      }
+    }
+  }
+
+  set_config_bool("ASE", "SaveCopiedCels", false);
+}
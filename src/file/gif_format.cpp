@@ -18,17 +18,23 @@
 
 #include "config.h"
 
+#include "app.h"
+#include "base/thread.h"
 #include "base/unique_ptr.h"
 #include "document.h"
 #include "file/file.h"
 #include "file/file_format.h"
 #include "file/format_options.h"
+#include "gfx/rect.h"
+#include "ini_file.h"
 #include "modules/gui.h"
 #include "raster/raster.h"
 #include "ui/alert.h"
 #include "util/autocrop.h"
 
+#include <algorithm>
 #include <gif_lib.h>
+#include <vector>
 
 enum DisposalMethod {
   DISPOSAL_METHOD_NONE,
@@ -67,6 +73,14 @@ struct GifData
 
 class GifFormat : public FileFormat
 {
+  // Options to save GIF files (read from the configuration when the
+  // FileOp is created, so onSave() doesn't access it).
+  class GifOptions : public FormatOptions
+  {
+  public:
+    bool optimizeFrames;
+  };
+
   const char* onGetName() const { return "gif"; }
   const char* onGetExtensions() const { return "gif"; }
   int onGetFlags() const {
@@ -79,13 +93,15 @@ class GifFormat : public FileFormat
       FILE_SUPPORT_GRAYA |
       FILE_SUPPORT_INDEXED |
       FILE_SUPPORT_FRAMES |
-      FILE_SUPPORT_PALETTES;
+      FILE_SUPPORT_PALETTES |
+      FILE_SUPPORT_GET_FORMAT_OPTIONS;
   }
 
   bool onLoad(FileOp* fop);
   bool onPostLoad(FileOp* fop) OVERRIDE;
   void onDestroyData(FileOp* fop) OVERRIDE;
   bool onSave(FileOp* fop);
+  SharedPtr<FormatOptions> onGetFormatOptions(FileOp* fop) OVERRIDE;
 };
 
 FileFormat* CreateGifFormat()
@@ -315,7 +331,12 @@ bool GifFormat::onPostLoad(FileOp* fop)
   done:;
   }
 
-  if (askForConversion) {
+  // Without UI (e.g. converting files in batch mode) we cannot ask,
+  // so the safest option (RGBA) is used.
+  if (askForConversion && !App::instance()->isGui()) {
+    pixelFormat = IMAGE_RGB;
+  }
+  else if (askForConversion) {
     int result =
       ui::Alert::show("GIF Conversion"
                       "<<The selected file: %s"
@@ -480,60 +501,89 @@ void GifFormat::onDestroyData(FileOp* fop)
   }
 }
 
-bool GifFormat::onSave(FileOp* fop)
+// Renders the frames of the sprite and converts them to indexed
+// images to be saved in the GIF file. The next frame is rendered in a
+// background thread while the current one is being encoded, so only
+// a few frames are in memory at the same time.
+class GifFrameRenderer
 {
-  UniquePtr<GifFileType, int(*)(GifFileType*)> gif_file(EGifOpenFileName(fop->filename.c_str(), 0),
-                                                        EGifCloseFile);
-  if (!gif_file)
-    throw base::Exception("Error creating GIF file.\n");
+public:
+  GifFrameRenderer(Sprite* sprite, int background_color, int transparent_index,
+                   bool single_thread)
+    : m_sprite(sprite)
+    , m_background_color(background_color)
+    , m_transparent_index(transparent_index)
+    , m_single_thread(single_thread)
+    , m_thread(NULL)
+    , m_frame(0)
+    , m_dst(NULL) {
+    // If the sprite is not Indexed type, we will need a temporary
+    // buffer to render the full RGB or Grayscale sprite.
+    if (sprite->getPixelFormat() != IMAGE_INDEXED)
+      m_buffer.reset(Image::create(sprite->getPixelFormat(),
+                                   sprite->getWidth(),
+                                   sprite->getHeight()));
+  }
 
-  Sprite* sprite = fop->document->getSprite();
-  int sprite_w = sprite->getWidth();
-  int sprite_h = sprite->getHeight();
-  PixelFormat sprite_format = sprite->getPixelFormat();
-  bool interlace = false;
-  int loop = 0;
-  int background_color = (sprite_format == IMAGE_INDEXED ? sprite->getTransparentColor(): 0);
-  int transparent_index = (sprite->getBackgroundLayer() ? -1: sprite->getTransparentColor());
+  ~GifFrameRenderer() {
+    if (m_thread) {
+      m_thread->join();
+      delete m_thread;
+    }
+  }
 
-  Palette* current_palette = sprite->getPalette(FrameNumber(0));
-  Palette* previous_palette = current_palette;
-  ColorMapObject* color_map = MakeMapObject(current_palette->size(), NULL);
-  for (int i = 0; i < current_palette->size(); ++i) {
-    color_map->Colors[i].Red   = _rgba_getr(current_palette->getEntry(i));
-    color_map->Colors[i].Green = _rgba_getg(current_palette->getEntry(i));
-    color_map->Colors[i].Blue  = _rgba_getb(current_palette->getEntry(i));
+  // Starts to render the given frame in "dst". The image can be used
+  // after calling wait().
+  void start(FrameNumber frame, Image* dst) {
+    ASSERT(m_thread == NULL);
+    m_frame = frame;
+    m_dst = dst;
+
+    if (!m_single_thread && base::thread::hardware_concurrency() > 1)
+      m_thread = new base::thread(&GifFrameRenderer::thread_proxy, this);
   }
 
-  if (EGifPutScreenDesc(gif_file, sprite_w, sprite_h,
-                        color_map->BitsPerPixel,
-                        background_color, color_map) == GIF_ERROR)
-    throw base::Exception("Error writing GIF header.\n");
+  void wait() {
+    if (m_thread) {
+      m_thread->join();
+      delete m_thread;
+      m_thread = NULL;
+    }
+    else
+      run();
 
-  UniquePtr<Image> buffer_image;
-  UniquePtr<Image> current_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
-  UniquePtr<Image> previous_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
-  int frame_x, frame_y, frame_w, frame_h;
-  int u1, v1, u2, v2;
-  int i1, j1, i2, j2;
+    if (!m_error.empty())
+      throw base::Exception(m_error);
+  }
 
-  // If the sprite is not Indexed type, we will need a temporary
-  // buffer to render the full RGB or Grayscale sprite.
-  if (sprite_format != IMAGE_INDEXED)
-    buffer_image.reset(Image::create(sprite_format, sprite_w, sprite_h));
+private:
+  static void thread_proxy(GifFrameRenderer* renderer) {
+    renderer->run();
+  }
 
-  image_clear(current_image, background_color);
-  image_clear(previous_image, background_color);
+  void run() {
+    try {
+      render(m_frame, m_dst);
+    }
+    catch (const std::exception& e) {
+      m_error = e.what();
+    }
+  }
 
-  for (FrameNumber frame_num(0); frame_num<sprite->getTotalFrames(); ++frame_num) {
-    current_palette = sprite->getPalette(frame_num);
+  void render(FrameNumber frame_num, Image* current_image) {
+    Sprite* sprite = m_sprite;
+    int sprite_w = sprite->getWidth();
+    int sprite_h = sprite->getHeight();
+    const Palette* current_palette = sprite->getPalette(frame_num);
+    int transparent_index = m_transparent_index;
+    Image* buffer_image = m_buffer;
 
     // If the sprite is RGB or Grayscale, we must to convert it to Indexed on the fly.
-    if (sprite_format != IMAGE_INDEXED) {
+    if (sprite->getPixelFormat() != IMAGE_INDEXED) {
       image_clear(buffer_image, 0);
       layer_render(sprite->getFolder(), buffer_image, 0, 0, frame_num);
 
-      switch (sprite_format) {
+      switch (sprite->getPixelFormat()) {
 
         // Convert the RGB image to Indexed
         case IMAGE_RGB:
@@ -566,19 +616,235 @@ bool GifFormat::onSave(FileOp* fop)
     }
     // If the sprite is Indexed, we can render directly into "current_image".
     else {
-      image_clear(current_image, background_color);
+      image_clear(current_image, m_background_color);
       layer_render(sprite->getFolder(), current_image, 0, 0, frame_num);
     }
+  }
+
+  Sprite* m_sprite;
+  int m_background_color;
+  int m_transparent_index;
+  UniquePtr<Image> m_buffer;
+  bool m_single_thread;
+  base::thread* m_thread;
+  FrameNumber m_frame;
+  Image* m_dst;
+  std::string m_error;
+};
+
+// Returns the bounds of the pixels that are different in both images.
+static bool get_diff_bounds(const Image* a, const Image* b, gfx::Rect& bounds)
+{
+  int x1 = a->w, y1 = a->h, x2 = -1, y2 = -1;
+
+  for (int y=0; y<a->h; ++y) {
+    IndexedTraits::address_t a_addr = image_address_fast<IndexedTraits>(a, 0, y);
+    IndexedTraits::address_t b_addr = image_address_fast<IndexedTraits>(b, 0, y);
+    if (memcmp(a_addr, b_addr, a->w) == 0)
+      continue;
+
+    int x = 0;
+    while (a_addr[x] == b_addr[x])
+      ++x;
+    x1 = MIN(x1, x);
+
+    x = a->w-1;
+    while (a_addr[x] == b_addr[x])
+      --x;
+    x2 = MAX(x2, x);
+
+    y1 = MIN(y1, y);
+    y2 = y;
+  }
+
+  if (x2 < 0)
+    return false;
+
+  bounds = gfx::Rect(x1, y1, x2-x1+1, y2-y1+1);
+  return true;
+}
+
+// Returns the bounds of the pixels that are not transparent in
+// "image" but are transparent in "next_image" (the pixels that the
+// disposal method of "image" must clear).
+static bool get_clear_bounds(const Image* image, const Image* next_image, int transparent_index, gfx::Rect& bounds)
+{
+  int x1 = image->w, y1 = image->h, x2 = -1, y2 = -1;
+
+  for (int y=0; y<image->h; ++y) {
+    IndexedTraits::address_t addr = image_address_fast<IndexedTraits>(image, 0, y);
+    IndexedTraits::address_t next_addr = image_address_fast<IndexedTraits>(next_image, 0, y);
+
+    for (int x=0; x<image->w; ++x) {
+      if (addr[x] != transparent_index && next_addr[x] == transparent_index) {
+        x1 = MIN(x1, x);
+        x2 = MAX(x2, x);
+        y1 = MIN(y1, y);
+        y2 = y;
+      }
+    }
+  }
+
+  if (x2 < 0)
+    return false;
+
+  bounds = gfx::Rect(x1, y1, x2-x1+1, y2-y1+1);
+  return true;
+}
+
+// Returns the bounds of the pixels that are not transparent.
+static bool get_opaque_bounds(const Image* image, int transparent_index, gfx::Rect& bounds)
+{
+  int u1, v1, u2, v2;
+
+  if (!get_shrink_rect(&u1, &v1, &u2, &v2, const_cast<Image*>(image), transparent_index))
+    return false;
+
+  bounds = gfx::Rect(u1, v1, u2-u1+1, v2-v1+1);
+  return true;
+}
 
-    if (frame_num == 0) {
+// Returns an index that is not used by the changed pixels of
+// "image" inside the given bounds, so it can be used as the
+// transparent index to skip the unchanged pixels. Returns -1 if all
+// indexes of the palette are used.
+static int find_unused_index(const Image* image, const Image* canvas, const gfx::Rect& bounds, int palette_size)
+{
+  bool used[256];
+  std::fill(used, used+256, false);
+
+  for (int y=bounds.y; y<bounds.y2(); ++y) {
+    IndexedTraits::address_t addr = image_address_fast<IndexedTraits>(image, bounds.x, y);
+    IndexedTraits::address_t canvas_addr = image_address_fast<IndexedTraits>(canvas, bounds.x, y);
+    for (int x=0; x<bounds.w; ++x)
+      if (addr[x] != canvas_addr[x])
+        used[addr[x]] = true;
+  }
+
+  for (int i=0; i<palette_size; ++i)
+    if (!used[i])
+      return i;
+
+  return -1;
+}
+
+SharedPtr<FormatOptions> GifFormat::onGetFormatOptions(FileOp* fop)
+{
+  SharedPtr<GifOptions> options(new GifOptions());
+  options->optimizeFrames = get_config_bool("GIF", "OptimizeFrames", true);
+  return options;
+}
+
+bool GifFormat::onSave(FileOp* fop)
+{
+  UniquePtr<GifFileType, int(*)(GifFileType*)> gif_file(EGifOpenFileName(fop->filename.c_str(), 0),
+                                                        EGifCloseFile);
+  if (!gif_file)
+    throw base::Exception("Error creating GIF file.\n");
+
+  Sprite* sprite = fop->document->getSprite();
+  int sprite_w = sprite->getWidth();
+  int sprite_h = sprite->getHeight();
+  PixelFormat sprite_format = sprite->getPixelFormat();
+  bool interlace = false;
+  int loop = 0;
+  int background_color = (sprite_format == IMAGE_INDEXED ? sprite->getTransparentColor(): 0);
+  int transparent_index = (sprite->getBackgroundLayer() ? -1: sprite->getTransparentColor());
+
+  Palette* current_palette = sprite->getPalette(FrameNumber(0));
+  Palette* previous_palette = current_palette;
+  ColorMapObject* color_map = MakeMapObject(current_palette->size(), NULL);
+  for (int i = 0; i < current_palette->size(); ++i) {
+    color_map->Colors[i].Red   = _rgba_getr(current_palette->getEntry(i));
+    color_map->Colors[i].Green = _rgba_getg(current_palette->getEntry(i));
+    color_map->Colors[i].Blue  = _rgba_getb(current_palette->getEntry(i));
+  }
+
+  if (EGifPutScreenDesc(gif_file, sprite_w, sprite_h,
+                        color_map->BitsPerPixel,
+                        background_color, color_map) == GIF_ERROR)
+    throw base::Exception("Error writing GIF header.\n");
+
+  // When the frames are optimized, each frame only contains the
+  // rectangle that changed from the previous one, and the unchanged
+  // pixels inside that rectangle are written as transparent.
+  const GifOptions* options = static_cast<const GifOptions*>(fop->seq.format_options.get());
+  bool optimize = (options ? options->optimizeFrames: true);
+
+  // "canvas_image" is what a GIF decoder shows on the screen before
+  // the current frame is drawn (the previous frame after its disposal
+  // method was applied).
+  UniquePtr<Image> canvas_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
+  UniquePtr<Image> current_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
+  UniquePtr<Image> next_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
+  UniquePtr<Image> ahead_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
+  std::vector<uint8_t> scanline(sprite_w);
+  FrameNumber total_frames = sprite->getTotalFrames();
+  int frame_x, frame_y, frame_w, frame_h;
+  int u1, v1, u2, v2;
+  int i1, j1, i2, j2;
+
+  image_clear(canvas_image, background_color);
+
+  // The disposal method of a frame depends on the next one, so we
+  // need the current and the next frame rendered while a third one
+  // is rendered in background.
+  GifFrameRenderer renderer(sprite, background_color, transparent_index,
+                            fop->single_thread);
+  renderer.start(FrameNumber(0), current_image);
+  renderer.wait();
+  if (total_frames > 1) {
+    renderer.start(FrameNumber(1), next_image);
+    renderer.wait();
+  }
+
+  for (FrameNumber frame_num(0); frame_num<total_frames; ++frame_num) {
+    bool has_next = (frame_num.next() < total_frames);
+    bool rendering = (frame_num.next().next() < total_frames);
+    if (rendering)
+      renderer.start(frame_num.next().next(), ahead_image);
+
+    current_palette = sprite->getPalette(frame_num);
+
+    int disposal_method = (sprite->getBackgroundLayer() ? DISPOSAL_METHOD_DO_NOT_DISPOSE:
+                                                          DISPOSAL_METHOD_RESTORE_BGCOLOR);
+    int frame_transparent = transparent_index;
+    bool diff_pixels = false;
+
+    // The first frame, and frames with a new palette, must be
+    // completely drawn (the unchanged indexes could be different
+    // colors).
+    if (frame_num == 0 || (optimize && current_palette != previous_palette)) {
       frame_x = 0;
       frame_y = 0;
       frame_w = sprite->getWidth();
       frame_h = sprite->getHeight();
     }
+    else if (optimize) {
+      gfx::Rect bounds;
+      if (get_diff_bounds(current_image, canvas_image, bounds)) {
+        frame_x = bounds.x;
+        frame_y = bounds.y;
+        frame_w = bounds.w;
+        frame_h = bounds.h;
+      }
+      else {
+        // Nothing changed, but we need at least one pixel.
+        frame_x = frame_y = 0;
+        frame_w = frame_h = 1;
+      }
+
+      // Sprites without transparent color can use any index that is
+      // not used in the changed pixels.
+      if (frame_transparent < 0)
+        frame_transparent = find_unused_index(current_image, canvas_image,
+                                              gfx::Rect(frame_x, frame_y, frame_w, frame_h),
+                                              MIN(current_palette->size(), 256));
+      diff_pixels = (frame_transparent >= 0);
+    }
     else {
       // Get the rectangle where start differences with the previous frame.
-      if (get_shrink_rect2(&u1, &v1, &u2, &v2, current_image, previous_image)) {
+      if (get_shrink_rect2(&u1, &v1, &u2, &v2, current_image, canvas_image)) {
         // Check the minimal area with the background color.
         if (get_shrink_rect(&i1, &j1, &i2, &j2, current_image, background_color)) {
           frame_x = MIN(u1, i1);
@@ -589,6 +855,28 @@ bool GifFormat::onSave(FileOp* fop)
       }
     }
 
+    // Choose the disposal method: frames are kept on the screen
+    // (so the next one can be drawn over them) unless some pixel
+    // must be cleared to transparent, in that case the area of
+    // those pixels is restored to the background. The last frame
+    // clears all its pixels so the first one can be drawn again
+    // when the animation loops.
+    if (optimize) {
+      disposal_method = DISPOSAL_METHOD_DO_NOT_DISPOSE;
+
+      gfx::Rect clear_bounds;
+      if (transparent_index >= 0 &&
+          (has_next ? get_clear_bounds(current_image, next_image, transparent_index, clear_bounds):
+                      get_opaque_bounds(current_image, transparent_index, clear_bounds))) {
+        gfx::Rect bounds = gfx::Rect(frame_x, frame_y, frame_w, frame_h).createUnion(clear_bounds);
+        frame_x = bounds.x;
+        frame_y = bounds.y;
+        frame_w = bounds.w;
+        frame_h = bounds.h;
+        disposal_method = DISPOSAL_METHOD_RESTORE_BGCOLOR;
+      }
+    }
+
     // Specify loop extension.
     if (frame_num == 0 && loop >= 0) {
       unsigned char extension_bytes[11];
@@ -611,15 +899,13 @@ bool GifFormat::onSave(FileOp* fop)
     // frame and maybe the transparency index).
     {
       unsigned char extension_bytes[5];
-      int disposal_method = (sprite->getBackgroundLayer() ? DISPOSAL_METHOD_DO_NOT_DISPOSE:
-                                                            DISPOSAL_METHOD_RESTORE_BGCOLOR);
       int frame_delay = sprite->getFrameDuration(frame_num) / 10;
 
       extension_bytes[0] = (((disposal_method & 7) << 2) |
-                            (transparent_index >= 0 ? 1: 0));
+                            (frame_transparent >= 0 ? 1: 0));
       extension_bytes[1] = (frame_delay & 0xff);
       extension_bytes[2] = (frame_delay >> 8) & 0xff;
-      extension_bytes[3] = (transparent_index >= 0 ? transparent_index: 0);
+      extension_bytes[3] = (frame_transparent >= 0 ? frame_transparent: 0);
 
       if (EGifPutExtension(gif_file, GRAPHICS_EXT_FUNC_CODE, 4, extension_bytes) == GIF_ERROR)
         throw base::Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
@@ -645,25 +931,47 @@ bool GifFormat::onSave(FileOp* fop)
       throw base::Exception("Error writing GIF frame %d.\n", (int)frame_num);
 
     // Write the image data (pixels).
-    if (interlace) {
-      // Need to perform 4 passes on the images.
-      for (int i=0; i<4; ++i)
-        for (int y = interlaced_offset[i]; y < frame_h; y += interlaced_jumps[i]) {
-          IndexedTraits::address_t addr = image_address_fast<IndexedTraits>(current_image, frame_x, frame_y + y);
-          if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
-            throw base::Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
-        }
-    }
-    else {
-      // Write all image scanlines (not interlaced in this case).
-      for (int y = 0; y < frame_h; ++y) {
+    for (int i=(interlace ? 0: 3); i<4; ++i) {
+      // Need to perform 4 passes on interlaced images, and just the
+      // last one (all scanlines) on non-interlaced ones.
+      int offset = (interlace ? interlaced_offset[i]: 0);
+      int jump = (interlace ? interlaced_jumps[i]: 1);
+
+      for (int y = offset; y < frame_h; y += jump) {
         IndexedTraits::address_t addr = image_address_fast<IndexedTraits>(current_image, frame_x, frame_y + y);
+
+        // Unchanged pixels are written as transparent.
+        if (diff_pixels) {
+          IndexedTraits::address_t canvas_addr = image_address_fast<IndexedTraits>(canvas_image, frame_x, frame_y + y);
+          for (int x = 0; x < frame_w; ++x)
+            scanline[x] = (addr[x] == canvas_addr[x] ? frame_transparent: addr[x]);
+          addr = &scanline[0];
+        }
+
         if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
           throw base::Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
       }
     }
 
-    image_copy(previous_image, current_image, 0, 0);
+    // Update the canvas with the current frame after its disposal.
+    image_copy(canvas_image, current_image, 0, 0);
+    if (optimize && disposal_method == DISPOSAL_METHOD_RESTORE_BGCOLOR)
+      image_rectfill(canvas_image, frame_x, frame_y,
+                     frame_x+frame_w-1, frame_y+frame_h-1, background_color);
+
+    fop_progress(fop, (float)frame_num.next() / (float)total_frames);
+    if (fop_is_stop(fop))
+      break;
+
+    // Wait the frame that was rendered in background.
+    if (rendering)
+      renderer.wait();
+    {
+      Image* free_image = current_image.release();
+      current_image.reset(next_image.release());
+      next_image.reset(ahead_image.release());
+      ahead_image.reset(free_image);
+    }
   }
 
   return true;
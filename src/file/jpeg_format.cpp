@@ -242,7 +242,9 @@ bool JpegFormat::onSave(FileOp* fop)
   Image *image = fop->seq.image;
   JSAMPARRAY buffer;
   JDIMENSION buffer_height;
-  SharedPtr<JpegOptions> jpeg_options = fop->seq.format_options;
+  // Don't copy the SharedPtr, the options can be shared between
+  // threads saving a sequence of files.
+  JpegOptions* jpeg_options = static_cast<JpegOptions*>(fop->seq.format_options.get());
   int c;
 
   // Open the file for write in it.
@@ -20,6 +20,8 @@
 
 #include "filters/convolution_matrix.h"
 
+#include <cstdlib>
+
 ConvolutionMatrix::ConvolutionMatrix(int width, int height)
   : m_data(width*height, 0)
   , m_width(width)
@@ -31,3 +33,87 @@ ConvolutionMatrix::ConvolutionMatrix(int width, int height)
   , m_defaultTarget(0)
 {
 }
+
+namespace {
+
+  int gcd(int a, int b)
+  {
+    a = std::abs(a);
+    b = std::abs(b);
+    while (b != 0) {
+      int t = a % b;
+      a = b;
+      b = t;
+    }
+    return a;
+  }
+
+}
+
+bool ConvolutionMatrix::getSeparableTerms(std::vector<SeparableTerm>& terms) const
+{
+  terms.clear();
+  if (m_width <= 0 || m_height <= 0)
+    return false;
+
+  // Rank-1 matrix: each row is a multiple of the first non-zero row
+  // (divided by the GCD of its values, so all multipliers are
+  // integers).
+  int y0 = 0, x0 = 0;
+  for (; y0<m_height; ++y0) {
+    for (x0=0; x0<m_width; ++x0)
+      if (value(x0, y0) != 0)
+        break;
+    if (x0 < m_width)
+      break;
+  }
+  if (y0 == m_height)           // All values are zero
+    return false;
+
+  SeparableTerm term;
+  int d = 0;
+  for (int x=0; x<m_width; ++x)
+    d = gcd(d, value(x, y0));
+
+  term.horz.resize(m_width);
+  for (int x=0; x<m_width; ++x)
+    term.horz[x] = value(x, y0) / d;
+
+  bool rank1 = true;
+  term.vert.resize(m_height);
+  for (int y=0; y<m_height && rank1; ++y) {
+    term.vert[y] = value(x0, y) / term.horz[x0];
+    for (int x=0; x<m_width; ++x) {
+      if (value(x, y) != term.horz[x]*term.vert[y]) {
+        rank1 = false;
+        break;
+      }
+    }
+  }
+
+  if (rank1) {
+    terms.push_back(term);
+    return true;
+  }
+
+  // value(x, y) = a[x] + b[y] (two terms: a[x]*1 and 1*b[y])
+  SeparableTerm a, b;
+  a.horz.resize(m_width);
+  a.vert.resize(m_height, 1);
+  b.horz.resize(m_width, 1);
+  b.vert.resize(m_height);
+
+  for (int x=0; x<m_width; ++x)
+    a.horz[x] = value(x, 0);
+  for (int y=0; y<m_height; ++y)
+    b.vert[y] = value(0, y) - value(0, 0);
+
+  for (int y=0; y<m_height; ++y)
+    for (int x=0; x<m_width; ++x)
+      if (value(x, y) != a.horz[x] + b.vert[y])
+        return false;
+
+  terms.push_back(a);
+  terms.push_back(b);
+  return true;
+}
@@ -64,6 +64,21 @@ public:
   int& value(int x, int y) { return m_data[y*m_width+x]; }
   const int& value(int x, int y) const { return m_data[y*m_width+x]; }
 
+  // One separable term of the matrix, i.e. a matrix where each value
+  // is horz[x]*vert[y].
+  struct SeparableTerm {
+    std::vector<int> horz;
+    std::vector<int> vert;
+  };
+
+  // Decomposes the matrix in a sum of separable terms, so the filter
+  // can be applied as a sequence of 1D convolutions. It recognizes
+  // rank-1 matrices (one term, e.g. box or gaussian blurs), and
+  // matrices where value(x, y) = a[x] + b[y] (two terms, e.g. the
+  // pyramidal blurs of the stock). Returns false if the matrix cannot
+  // be decomposed in that way.
+  bool getSeparableTerms(std::vector<SeparableTerm>& terms) const;
+
 private:
   std::string m_name;          // Name
   int m_width, m_height;       // Size of the matrix
@@ -24,20 +24,29 @@
 #include "filters/filter_indexed_data.h"
 #include "filters/filter_manager.h"
 #include "filters/neighboring_pixels.h"
+#include "filters/neighboring_window.h"
 #include "raster/image.h"
 #include "raster/palette.h"
 #include "raster/rgbmap.h"
 
+#include <algorithm>
+
 ConvolutionMatrixFilter::ConvolutionMatrixFilter()
   : m_matrix(NULL)
   , m_tiledMode(TILED_NONE)
 {
 }
 
+ConvolutionMatrixFilter::~ConvolutionMatrixFilter()
+{
+  m_windows.clear();
+}
+
 void ConvolutionMatrixFilter::setMatrix(const SharedPtr<ConvolutionMatrix>& matrix)
 {
   m_matrix = matrix;
-  m_lines.resize(matrix->getHeight());
+  m_matrix->getSeparableTerms(m_terms);
+  m_windows.clear();
 }
 
 void ConvolutionMatrixFilter::setTiledMode(TiledMode tiledMode)
@@ -142,6 +151,238 @@ const char* ConvolutionMatrixFilter::getName()
   return "Convolution Matrix";
 }
 
+void ConvolutionMatrixFilter::beginFiltering()
+{
+  m_windows.clear();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Separable matrices
+//
+// When the matrix is a sum of separable terms (see
+// ConvolutionMatrix::getSeparableTerms()), each term is applied with
+// two 1D convolutions: a vertical one for each column of the image
+// (column sums) and a horizontal one over the column sums of the
+// row. If a term is uniform in one direction (e.g. a box blur), that
+// pass is a running sum that is updated in constant time per pixel:
+// column sums are moved from one row to the next one, and
+// horizontal sums are moved from one pixel to the next one.
+//
+// Pixels with alpha = 0 are handled as in the 2D convolution: they
+// are not added, and their weights are subtracted from the divisor
+// (we convolve an extra "zero" channel to know that weight). All
+// operations are done with integers, so the result is exactly the
+// same as the 2D convolution.
+
+namespace {
+
+  // Returns the value of all elements of "v", or 0 if they are
+  // different.
+  int uniform_value(const std::vector<int>& v)
+  {
+    for (size_t i=1; i<v.size(); ++i)
+      if (v[i] != v[0])
+        return 0;
+    return v[0];
+  }
+
+  // Channels to convolve for each pixel format.
+
+  struct ChannelsRgba {
+    enum { N = 5 };             // r, g, b, a, zero
+    void operator()(RgbTraits::pixel_t color, int* v) const {
+      if (_rgba_geta(color) == 0) {
+        v[0] = v[1] = v[2] = v[3] = 0;
+        v[4] = 1;
+      }
+      else {
+        v[0] = _rgba_getr(color);
+        v[1] = _rgba_getg(color);
+        v[2] = _rgba_getb(color);
+        v[3] = _rgba_geta(color);
+        v[4] = 0;
+      }
+    }
+  };
+
+  struct ChannelsGrayscale {
+    enum { N = 3 };             // v, a, zero
+    void operator()(GrayscaleTraits::pixel_t color, int* v) const {
+      if (_graya_geta(color) == 0) {
+        v[0] = v[1] = 0;
+        v[2] = 1;
+      }
+      else {
+        v[0] = _graya_getv(color);
+        v[1] = _graya_geta(color);
+        v[2] = 0;
+      }
+    }
+  };
+
+  struct ChannelsIndexed {
+    enum { N = 4 };             // r, g, b, index
+    const Palette* pal;
+    ChannelsIndexed(const Palette* pal) : pal(pal) { }
+    void operator()(IndexedTraits::pixel_t color, int* v) const {
+      uint32_t c = pal->getEntry(color);
+      v[0] = _rgba_getr(c);
+      v[1] = _rgba_getg(c);
+      v[2] = _rgba_getb(c);
+      v[3] = color;
+    }
+  };
+
+}
+
+class ConvolutionMatrixFilter::Window : public NeighboringWindow
+{
+public:
+  void reset(const ConvolutionMatrixFilter* filter, const Image* src, const Palette* pal,
+             Target target, int x, int w, int nchannels) {
+    const ConvolutionMatrix* matrix = filter->m_matrix;
+
+    resetArea(src, pal, target, x, w, filter->m_tiledMode);
+    m_terms = &filter->m_terms;
+    m_kw = matrix->getWidth();
+    m_kh = matrix->getHeight();
+    m_cy = matrix->getCenterY();
+    m_nchannels = nchannels;
+
+    // Columns of the image used by each column of the window
+    m_ncols = w + m_kw - 1;
+    m_cols.resize(m_ncols);
+    for (int j=0; j<m_ncols; ++j)
+      m_cols[j] = mapX(x - matrix->getCenterX() + j);
+
+    m_colSums.resize(m_terms->size()*m_nchannels*m_ncols);
+    m_oldRow.resize(m_nchannels*m_ncols);
+    m_newRow.resize(m_nchannels*m_ncols);
+    m_sums.resize(m_nchannels*m_w);
+  }
+
+  // Moves the window to the given row and calculates the sums of all
+  // channels for each pixel.
+  template<typename Traits, typename Channels>
+  void moveTo(int y, const Channels& channels) {
+    const int nterms = m_terms->size();
+    const int size = m_nchannels*m_ncols;
+    const int top = y - m_cy;
+    bool slide = (m_loaded && m_y == y-1);
+    bool recalc = false;
+
+    // Vertical pass: terms with a uniform vertical vector are moved
+    // one row down, the others are calculated from scratch.
+    if (slide) {
+      getRow<Traits>(mapY(top-1), channels, &m_oldRow[0]);
+      getRow<Traits>(mapY(top+m_kh-1), channels, &m_newRow[0]);
+    }
+    for (int t=0; t<nterms; ++t) {
+      int* colSums = &m_colSums[t*size];
+      int k = uniform_value((*m_terms)[t].vert);
+      if (slide && k != 0) {
+        for (int i=0; i<size; ++i)
+          colSums[i] += k*(m_newRow[i] - m_oldRow[i]);
+      }
+      else {
+        std::fill(colSums, colSums+size, 0);
+        recalc = true;
+      }
+    }
+
+    if (recalc) {
+      for (int dy=0; dy<m_kh; ++dy) {
+        getRow<Traits>(mapY(top+dy), channels, &m_newRow[0]);
+
+        for (int t=0; t<nterms; ++t) {
+          if (slide && uniform_value((*m_terms)[t].vert) != 0)
+            continue;
+
+          int k = (*m_terms)[t].vert[dy];
+          if (k != 0) {
+            int* colSums = &m_colSums[t*size];
+            for (int i=0; i<size; ++i)
+              colSums[i] += k*m_newRow[i];
+          }
+        }
+      }
+    }
+
+    m_y = y;
+    m_loaded = true;
+
+    // Horizontal pass
+    std::fill(m_sums.begin(), m_sums.end(), 0);
+    for (int t=0; t<nterms; ++t) {
+      const std::vector<int>& horz = (*m_terms)[t].horz;
+      int k = uniform_value(horz);
+
+      for (int c=0; c<m_nchannels; ++c) {
+        const int* colSums = &m_colSums[(t*m_nchannels + c)*m_ncols];
+        int* sums = &m_sums[c*m_w];
+
+        if (k != 0) {
+          int sum = 0;
+          for (int dx=0; dx<m_kw; ++dx)
+            sum += colSums[dx];
+          sums[0] += k*sum;
+          for (int i=1; i<m_w; ++i) {
+            sum += colSums[i+m_kw-1] - colSums[i-1];
+            sums[i] += k*sum;
+          }
+        }
+        else {
+          for (int dx=0; dx<m_kw; ++dx) {
+            int v = horz[dx];
+            if (v != 0) {
+              const int* col = colSums+dx;
+              for (int i=0; i<m_w; ++i)
+                sums[i] += v*col[i];
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Sum of the "c" channel for each pixel of the row.
+  const int* getSums(int c) const {
+    return &m_sums[c*m_w];
+  }
+
+private:
+  // Gets the channels of each column of the window in the given row.
+  template<typename Traits, typename Channels>
+  void getRow(int row, const Channels& channels, int* dst) const {
+    typename Traits::const_address_t address = image_address_fast<Traits>(m_src, 0, row);
+    int v[Channels::N];
+
+    for (int j=0; j<m_ncols; ++j) {
+      channels(address[m_cols[j]], v);
+      for (int c=0; c<Channels::N; ++c)
+        dst[c*m_ncols + j] = v[c];
+    }
+  }
+
+  const std::vector<ConvolutionMatrix::SeparableTerm>* m_terms;
+  int m_kw, m_kh, m_cy;
+  int m_nchannels;
+  int m_ncols;
+  std::vector<int> m_cols;
+  std::vector<int> m_colSums;   // Sums of each term/channel/column
+  std::vector<int> m_oldRow;
+  std::vector<int> m_newRow;
+  std::vector<int> m_sums;      // Sums of each channel/pixel
+};
+
+bool ConvolutionMatrixFilter::useWindows(const Image* src) const
+{
+  return (!m_terms.empty() &&
+          // get_neighboring_pixels() doesn't clamp the columns in the
+          // same way when the matrix is wider than the image.
+          ((m_tiledMode & TILED_X_AXIS) || m_matrix->getWidth() <= src->w));
+}
+
 void ConvolutionMatrixFilter::applyToRgba(FilterManager* filterMgr)
 {
   if (!m_matrix)
@@ -155,21 +396,39 @@ void ConvolutionMatrixFilter::applyToRgba(FilterManager* filterMgr)
   int x = filterMgr->getX();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
+  Window* window = NULL;
+  const int* sums[ChannelsRgba::N];
+
+  if (useWindows(src)) {
+    window = m_windows.acquire(filterMgr, this, NULL, ChannelsRgba::N);
+    window->moveTo<RgbTraits>(y, ChannelsRgba());
+    for (int c=0; c<ChannelsRgba::N; ++c)
+      sums[c] = window->getSums(c);
+  }
 
-  for (; x<x2; ++x) {
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix);
-    get_neighboring_pixels<RgbTraits>(src, x, y,
-                                      m_matrix->getWidth(),
-                                      m_matrix->getHeight(),
-                                      m_matrix->getCenterX(),
-                                      m_matrix->getCenterY(),
-                                      m_tiledMode, delegate);
+    if (window) {
+      delegate.r = sums[0][i];
+      delegate.g = sums[1][i];
+      delegate.b = sums[2][i];
+      delegate.a = sums[3][i];
+      delegate.div = m_matrix->getDiv() - sums[4][i];
+    }
+    else {
+      delegate.reset(m_matrix);
+      get_neighboring_pixels<RgbTraits>(src, x, y,
+                                        m_matrix->getWidth(),
+                                        m_matrix->getHeight(),
+                                        m_matrix->getCenterX(),
+                                        m_matrix->getCenterY(),
+                                        m_tiledMode, delegate);
+    }
 
     color = image_getpixel_fast<RgbTraits>(src, x, y);
     if (delegate.div == 0) {
@@ -207,6 +466,9 @@ void ConvolutionMatrixFilter::applyToRgba(FilterManager* filterMgr)
 
     *(dst_address++) = _rgba(delegate.r, delegate.g, delegate.b, delegate.a);
   }
+
+  if (window)
+    m_windows.release(window);
 }
 
 void ConvolutionMatrixFilter::applyToGrayscale(FilterManager* filterMgr)
@@ -222,21 +484,37 @@ void ConvolutionMatrixFilter::applyToGrayscale(FilterManager* filterMgr)
   int x = filterMgr->getX();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
+  Window* window = NULL;
+  const int* sums[ChannelsGrayscale::N];
+
+  if (useWindows(src)) {
+    window = m_windows.acquire(filterMgr, this, NULL, ChannelsGrayscale::N);
+    window->moveTo<GrayscaleTraits>(y, ChannelsGrayscale());
+    for (int c=0; c<ChannelsGrayscale::N; ++c)
+      sums[c] = window->getSums(c);
+  }
 
-  for (; x<x2; ++x) {
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix);
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y,
-                                            m_matrix->getWidth(),
-                                            m_matrix->getHeight(),
-                                            m_matrix->getCenterX(),
-                                            m_matrix->getCenterY(),
-                                            m_tiledMode, delegate);
+    if (window) {
+      delegate.v = sums[0][i];
+      delegate.a = sums[1][i];
+      delegate.div = m_matrix->getDiv() - sums[2][i];
+    }
+    else {
+      delegate.reset(m_matrix);
+      get_neighboring_pixels<GrayscaleTraits>(src, x, y,
+                                              m_matrix->getWidth(),
+                                              m_matrix->getHeight(),
+                                              m_matrix->getCenterX(),
+                                              m_matrix->getCenterY(),
+                                              m_tiledMode, delegate);
+    }
 
     color = image_getpixel_fast<GrayscaleTraits>(src, x, y);
     if (delegate.div == 0) {
@@ -260,6 +538,9 @@ void ConvolutionMatrixFilter::applyToGrayscale(FilterManager* filterMgr)
 
     *(dst_address++) = _graya(delegate.v, delegate.a);
   }
+
+  if (window)
+    m_windows.release(window);
 }
 
 void ConvolutionMatrixFilter::applyToIndexed(FilterManager* filterMgr)
@@ -277,21 +558,39 @@ void ConvolutionMatrixFilter::applyToIndexed(FilterManager* filterMgr)
   int x = filterMgr->getX();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
+  Window* window = NULL;
+  const int* sums[ChannelsIndexed::N];
+
+  if (useWindows(src)) {
+    window = m_windows.acquire(filterMgr, this, pal, ChannelsIndexed::N);
+    window->moveTo<IndexedTraits>(y, ChannelsIndexed(pal));
+    for (int c=0; c<ChannelsIndexed::N; ++c)
+      sums[c] = window->getSums(c);
+  }
 
-  for (; x<x2; ++x) {
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix);
-    get_neighboring_pixels<IndexedTraits>(src, x, y,
-                                          m_matrix->getWidth(),
-                                          m_matrix->getHeight(),
-                                          m_matrix->getCenterX(),
-                                          m_matrix->getCenterY(),
-                                          m_tiledMode, delegate);
+    if (window) {
+      delegate.r = sums[0][i];
+      delegate.g = sums[1][i];
+      delegate.b = sums[2][i];
+      delegate.index = sums[3][i];
+      delegate.div = m_matrix->getDiv();
+    }
+    else {
+      delegate.reset(m_matrix);
+      get_neighboring_pixels<IndexedTraits>(src, x, y,
+                                            m_matrix->getWidth(),
+                                            m_matrix->getHeight(),
+                                            m_matrix->getCenterX(),
+                                            m_matrix->getCenterY(),
+                                            m_tiledMode, delegate);
+    }
 
     color = image_getpixel_fast<IndexedTraits>(src, x, y);
     if (delegate.div == 0) {
@@ -330,4 +629,7 @@ void ConvolutionMatrixFilter::applyToIndexed(FilterManager* filterMgr)
       *(dst_address++) = rgbmap->mapColor(delegate.r, delegate.g, delegate.b);
     }
   }
+
+  if (window)
+    m_windows.release(window);
 }
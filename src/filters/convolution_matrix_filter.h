@@ -22,15 +22,19 @@
 #include <vector>
 
 #include "base/shared_ptr.h"
+#include "filters/convolution_matrix.h"
 #include "filters/filter.h"
+#include "filters/neighboring_window.h"
 #include "filters/tiled_mode.h"
 
-class ConvolutionMatrix;
+class Image;
+class Palette;
 
 class ConvolutionMatrixFilter : public Filter
 {
 public:
   ConvolutionMatrixFilter();
+  ~ConvolutionMatrixFilter();
 
   void setMatrix(const SharedPtr<ConvolutionMatrix>& matrix);
   void setTiledMode(TiledMode tiledMode);
@@ -40,14 +44,24 @@ public:
 
   // Filter implementation
   const char* getName();
+  void beginFiltering();
   void applyToRgba(FilterManager* filterMgr);
   void applyToGrayscale(FilterManager* filterMgr);
   void applyToIndexed(FilterManager* filterMgr);
 
 private:
+  class Window;
+
+  bool useWindows(const Image* src) const;
+
   SharedPtr<ConvolutionMatrix> m_matrix;
   TiledMode m_tiledMode;
-  std::vector<uint8_t*> m_lines;
+
+  // Separable terms of m_matrix (empty if it isn't separable)
+  std::vector<ConvolutionMatrix::SeparableTerm> m_terms;
+
+  // Windows of rows processed in the current filtering operation
+  NeighboringWindows<Window> m_windows;
 };
 
 #endif
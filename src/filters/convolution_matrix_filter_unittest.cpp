@@ -0,0 +1,288 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "base/unique_ptr.h"
+#include "filters/convolution_matrix.h"
+#include "filters/convolution_matrix_filter.h"
+#include "filters/filter_indexed_data.h"
+#include "filters/filter_manager.h"
+#include "filters/neighboring_pixels.h"
+#include "raster/image.h"
+#include "raster/palette.h"
+#include "raster/rgbmap.h"
+
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+  // Applies a filter to the rows of an image.
+  class TestFilterManager : public FilterManager
+                          , public FilterIndexedData
+  {
+  public:
+    TestFilterManager(const Image* src, Image* dst, Target target,
+                      Palette* pal = NULL, RgbMap* rgbmap = NULL)
+      : m_src(src), m_dst(dst), m_target(target)
+      , m_pal(pal), m_rgbmap(rgbmap), m_y(0) { }
+
+    void setRow(int y) { m_y = y; }
+
+    const void* getSourceAddress() { return m_src->line[m_y]; }
+    void* getDestinationAddress() { return m_dst->line[m_y]; }
+    int getWidth() { return m_src->w; }
+    Target getTarget() { return m_target; }
+    FilterIndexedData* getIndexedData() { return this; }
+    bool skipPixel() { return false; }
+    const Image* getSourceImage() { return m_src; }
+    int getX() { return 0; }
+    int getY() { return m_y; }
+    Palette* getPalette() { return m_pal; }
+    RgbMap* getRgbMap() { return m_rgbmap; }
+
+  private:
+    const Image* m_src;
+    Image* m_dst;
+    Target m_target;
+    Palette* m_pal;
+    RgbMap* m_rgbmap;
+    int m_y;
+  };
+
+  struct CollectValues {
+    std::vector<int>& values;
+    CollectValues(std::vector<int>& values) : values(values) { }
+    void operator()(uint32_t color) { values.push_back(color); }
+  };
+
+  // Result of the 2D convolution for a RGBA pixel.
+  uint32_t expected_rgba(const Image* src, int x, int y,
+                         const ConvolutionMatrix* matrix, TiledMode tiled)
+  {
+    std::vector<int> values;
+    CollectValues collect(values);
+    get_neighboring_pixels<RgbTraits>(src, x, y,
+                                      matrix->getWidth(), matrix->getHeight(),
+                                      matrix->getCenterX(), matrix->getCenterY(),
+                                      tiled, collect);
+
+    int r = 0, g = 0, b = 0, a = 0, div = matrix->getDiv();
+    const int* weight = &matrix->value(0, 0);
+    for (size_t i=0; i<values.size(); ++i, ++weight) {
+      if (_rgba_geta(values[i]) == 0)
+        div -= *weight;
+      else {
+        r += _rgba_getr(values[i]) * (*weight);
+        g += _rgba_getg(values[i]) * (*weight);
+        b += _rgba_getb(values[i]) * (*weight);
+        a += _rgba_geta(values[i]) * (*weight);
+      }
+    }
+
+    uint32_t color = src->getpixel(x, y);
+    if (div == 0)
+      return color;
+
+    int bias = matrix->getBias();
+    return _rgba(MID(0, r/div + bias, 255),
+                 MID(0, g/div + bias, 255),
+                 MID(0, b/div + bias, 255),
+                 MID(0, a/matrix->getDiv() + bias, 255));
+  }
+
+  // Result of the 2D convolution for the index of an indexed pixel.
+  int expected_index(const Image* src, int x, int y,
+                     const ConvolutionMatrix* matrix, TiledMode tiled)
+  {
+    std::vector<int> values;
+    CollectValues collect(values);
+    get_neighboring_pixels<IndexedTraits>(src, x, y,
+                                          matrix->getWidth(), matrix->getHeight(),
+                                          matrix->getCenterX(), matrix->getCenterY(),
+                                          tiled, collect);
+
+    int index = 0;
+    const int* weight = &matrix->value(0, 0);
+    for (size_t i=0; i<values.size(); ++i, ++weight)
+      index += values[i] * (*weight);
+
+    return MID(0, index/matrix->getDiv() + matrix->getBias(), 255);
+  }
+
+  SharedPtr<ConvolutionMatrix> create_matrix(int w, int h, int cx, int cy,
+                                             const int* values, int bias = 0)
+  {
+    SharedPtr<ConvolutionMatrix> matrix(new ConvolutionMatrix(w, h));
+    int div = 0;
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x) {
+        matrix->value(x, y) = values[y*w+x] * ConvolutionMatrix::Precision;
+        div += matrix->value(x, y);
+      }
+    matrix->setCenterX(cx);
+    matrix->setCenterY(cy);
+    matrix->setDiv(div != 0 ? div: ConvolutionMatrix::Precision);
+    matrix->setBias(bias);
+    return matrix;
+  }
+
+  void apply_filter(ConvolutionMatrixFilter& filter, TestFilterManager& filterMgr,
+                    const Image* src, const std::vector<int>& rows)
+  {
+    filter.beginFiltering();
+    for (size_t i=0; i<rows.size(); ++i) {
+      filterMgr.setRow(rows[i]);
+      switch (src->getPixelFormat()) {
+        case IMAGE_RGB: filter.applyToRgba(&filterMgr); break;
+        case IMAGE_GRAYSCALE: filter.applyToGrayscale(&filterMgr); break;
+        case IMAGE_INDEXED: filter.applyToIndexed(&filterMgr); break;
+      }
+    }
+  }
+
+  // All rows, and then the same rows in two interleaved bands.
+  std::vector<int> all_rows(int h, bool bands)
+  {
+    std::vector<int> rows;
+    for (int y=0; y<h/2; ++y) {
+      rows.push_back(y);
+      if (bands)
+        rows.push_back(h/2 + y);
+    }
+    for (int y=(bands ? h - (h&1): h/2); y<h; ++y)
+      rows.push_back(y);
+    return rows;
+  }
+
+  const int box[] = { 1, 1, 1, 1, 1,
+                      1, 1, 1, 1, 1,
+                      1, 1, 1, 1, 1 };
+
+  const int gaussian[] = { 1, 2, 1,
+                           2, 4, 2,
+                           1, 2, 1 };
+
+  const int pyramid[] = { 1, 2, 3, 2, 1,
+                          2, 3, 4, 3, 2,
+                          3, 4, 5, 4, 3,
+                          2, 3, 4, 3, 2,
+                          1, 2, 3, 2, 1 };
+
+  const int edges[] = { -1, 0, 2, 0, -1,
+                         2, 0, -4, 0, 2,
+                        -1, 0, 2, 0, -1 };
+
+  const int sharpen[] = { 0, -1, 0,
+                          -1, 5, -1,
+                          0, -1, 0 };
+
+}
+
+TEST(ConvolutionMatrix, SeparableTerms)
+{
+  std::vector<ConvolutionMatrix::SeparableTerm> terms;
+
+  EXPECT_TRUE(create_matrix(5, 3, 2, 1, box)->getSeparableTerms(terms));
+  EXPECT_EQ(1, terms.size());
+
+  EXPECT_TRUE(create_matrix(3, 3, 1, 1, gaussian)->getSeparableTerms(terms));
+  ASSERT_EQ(1, terms.size());
+  EXPECT_EQ(3, terms[0].horz.size());
+  EXPECT_EQ(3, terms[0].vert.size());
+
+  EXPECT_TRUE(create_matrix(5, 5, 2, 2, pyramid)->getSeparableTerms(terms));
+  EXPECT_EQ(2, terms.size());
+
+  EXPECT_TRUE(create_matrix(5, 3, 0, 2, edges)->getSeparableTerms(terms));
+  EXPECT_EQ(1, terms.size());
+
+  EXPECT_FALSE(create_matrix(3, 3, 1, 1, sharpen)->getSeparableTerms(terms));
+  EXPECT_TRUE(terms.empty());
+}
+
+TEST(ConvolutionMatrixFilter, RgbaSeparableMatchesConvolution)
+{
+  SharedPtr<ConvolutionMatrix> matrices[] = {
+    create_matrix(5, 3, 2, 1, box),
+    create_matrix(3, 3, 1, 1, gaussian),
+    create_matrix(5, 5, 2, 2, pyramid),
+    create_matrix(5, 3, 0, 2, edges, 128),
+    create_matrix(3, 3, 1, 1, sharpen)
+  };
+  const TiledMode tiledModes[] = { TILED_NONE, TILED_X_AXIS, TILED_Y_AXIS, TILED_BOTH };
+
+  std::srand(1);
+  UniquePtr<Image> src(Image::create(IMAGE_RGB, 19, 13));
+  UniquePtr<Image> dst(Image::create(IMAGE_RGB, 19, 13));
+  for (int y=0; y<src->h; ++y)
+    for (int x=0; x<src->w; ++x) {
+      int a = std::rand() % 4;      // Some transparent pixels
+      src->putpixel(x, y, _rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256,
+                                a == 0 ? 0: std::rand() % 256));
+    }
+
+  for (int m=0; m<int(sizeof(matrices)/sizeof(matrices[0])); ++m) {
+    for (int t=0; t<4; ++t) {
+      for (int bands=0; bands<2; ++bands) {
+        ConvolutionMatrixFilter filter;
+        filter.setMatrix(matrices[m]);
+        filter.setTiledMode(tiledModes[t]);
+
+        TestFilterManager filterMgr(src, dst, TARGET_ALL_CHANNELS);
+        apply_filter(filter, filterMgr, src, all_rows(src->h, bands != 0));
+
+        for (int y=0; y<src->h; ++y)
+          for (int x=0; x<src->w; ++x)
+            ASSERT_EQ(expected_rgba(src, x, y, matrices[m], tiledModes[t]),
+                      dst->getpixel(x, y))
+              << "matrix " << m << " tiled " << tiledModes[t] << " pixel " << x << "," << y;
+      }
+    }
+  }
+}
+
+TEST(ConvolutionMatrixFilter, IndexedSeparableMatchesConvolution)
+{
+  SharedPtr<ConvolutionMatrix> matrix = create_matrix(5, 5, 2, 2, pyramid);
+  std::vector<ConvolutionMatrix::SeparableTerm> terms;
+  Palette pal(FrameNumber(0), 64);
+  for (int i=0; i<64; ++i)
+    pal.setEntry(i, _rgba(i*4, 255-i*4, (i*i) & 255, 255));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal);
+
+  std::srand(2);
+  UniquePtr<Image> src(Image::create(IMAGE_INDEXED, 23, 11));
+  UniquePtr<Image> dst(Image::create(IMAGE_INDEXED, 23, 11));
+  for (int y=0; y<src->h; ++y)
+    for (int x=0; x<src->w; ++x)
+      src->putpixel(x, y, std::rand() % 64);
+
+  ConvolutionMatrixFilter filter;
+  filter.setMatrix(matrix);
+  filter.setTiledMode(TILED_X_AXIS);
+
+  TestFilterManager filterMgr(src, dst, TARGET_INDEX_CHANNEL, &pal, &rgbmap);
+  apply_filter(filter, filterMgr, src, all_rows(src->h, true));
+
+  for (int y=0; y<src->h; ++y)
+    for (int x=0; x<src->w; ++x)
+      ASSERT_EQ(expected_index(src, x, y, matrix, TILED_X_AXIS), dst->getpixel(x, y));
+}
@@ -23,6 +23,11 @@ class FilterManager;
 
 // Interface which applies a filter to a sprite given a FilterManager
 // which indicates where we have to apply the filter.
+//
+// The applyTo...() members can be called at the same time from
+// several threads (each one with its own FilterManager and row), so
+// they must not modify member variables of the filter (without a
+// lock).
 class Filter
 {
 public:
@@ -47,6 +52,12 @@ public:
   // each pixel.
   virtual void applyToIndexed(FilterManager* filterMgr) = 0;
 
+  // Called before the filter is applied to a new set of rows (e.g. a
+  // new target image or a new preview). Filters which keep
+  // information between consecutive rows of the same image must
+  // discard it here.
+  virtual void beginFiltering() { }
+
 };
 
 #endif
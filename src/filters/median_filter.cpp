@@ -24,6 +24,7 @@
 #include "filters/filter_indexed_data.h"
 #include "filters/filter_manager.h"
 #include "filters/neighboring_pixels.h"
+#include "filters/neighboring_window.h"
 #include "filters/tiled_mode.h"
 #include "raster/image.h"
 #include "raster/palette.h"
@@ -36,10 +37,14 @@ MedianFilter::MedianFilter()
   , m_width(0)
   , m_height(0)
   , m_ncolors(0)
-  , m_channel(4)
 {
 }
 
+MedianFilter::~MedianFilter()
+{
+  m_windows.clear();
+}
+
 void MedianFilter::setTiledMode(TiledMode tiled)
 {
   m_tiledMode = tiled;
@@ -50,9 +55,6 @@ void MedianFilter::setSize(int width, int height)
   m_width = width;
   m_height = height;
   m_ncolors = width*height;
-
-  for (int c = 0; c < 4; ++c)
-    m_channel[c].resize(m_ncolors);
 }
 
 const char* MedianFilter::getName()
@@ -60,6 +62,229 @@ const char* MedianFilter::getName()
   return "Median Blur";
 }
 
+void MedianFilter::beginFiltering()
+{
+  m_windows.clear();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Sliding window
+//
+// Median filter in constant time per pixel (S. Perreault and
+// P. Hebert, "Median Filtering in Constant Time"). A Window keeps a
+// histogram of each column of the matrix for all the pixels in one
+// row of the image, so going to the next row only needs to remove
+// the top pixel of each column and add a new bottom one. Then, in
+// each pixel of the row, the histogram of the whole matrix is moved
+// one column to the right adding and removing column histograms.
+//
+// Histograms have 16 coarse bins and 256 fine bins. The fine bins of
+// the matrix are updated lazily, only for the coarse bin where the
+// median is. The result is exactly the same as sorting the pixels of
+// the matrix and picking the element in the middle.
+
+namespace {
+
+  inline void add_bins(int* dst, const uint16_t* src, int n)
+  {
+    for (int i=0; i<n; ++i)
+      dst[i] += src[i];
+  }
+
+  inline void sub_bins(int* dst, const uint16_t* src, int n)
+  {
+    for (int i=0; i<n; ++i)
+      dst[i] -= src[i];
+  }
+
+  // Channels of each pixel format (same order of GetPixelsDelegate*)
+
+  struct ChannelsRgba {
+    void operator()(RgbTraits::pixel_t color, uint8_t* v) const {
+      v[0] = _rgba_getr(color);
+      v[1] = _rgba_getg(color);
+      v[2] = _rgba_getb(color);
+      v[3] = _rgba_geta(color);
+    }
+  };
+
+  struct ChannelsGrayscale {
+    void operator()(GrayscaleTraits::pixel_t color, uint8_t* v) const {
+      v[0] = _graya_getv(color);
+      v[1] = _graya_geta(color);
+    }
+  };
+
+  struct ChannelsIndex {
+    void operator()(IndexedTraits::pixel_t color, uint8_t* v) const {
+      v[0] = color;
+    }
+  };
+
+  struct ChannelsPalette {
+    const Palette* pal;
+    ChannelsPalette(const Palette* pal) : pal(pal) { }
+    void operator()(IndexedTraits::pixel_t color, uint8_t* v) const {
+      uint32_t c = pal->getEntry(color);
+      v[0] = _rgba_getr(c);
+      v[1] = _rgba_getg(c);
+      v[2] = _rgba_getb(c);
+    }
+  };
+
+}
+
+class MedianFilter::Window : public NeighboringWindow
+{
+public:
+  enum { MaxChannels = 4 };
+
+  // Histogram of the whole matrix for one channel.
+  class Matrix
+  {
+  public:
+    void start(const Window* window, int channel) {
+      m_window = window;
+      m_fine = &window->m_fine[window->m_slot[channel]*window->m_ncols*256];
+      m_coarse = &window->m_coarse[window->m_slot[channel]*window->m_ncols*16];
+      m_col = 0;
+
+      std::fill(m_coarseBins, m_coarseBins+16, 0);
+      std::fill(m_fineCol, m_fineCol+16, -1);
+      for (int j=0; j<window->m_kw; ++j)
+        add_bins(m_coarseBins, m_coarse+j*16, 16);
+    }
+
+    // Moves the matrix one column to the right.
+    void next() {
+      add_bins(m_coarseBins, m_coarse+(m_col+m_window->m_kw)*16, 16);
+      sub_bins(m_coarseBins, m_coarse+m_col*16, 16);
+      ++m_col;
+    }
+
+    int median() {
+      const int k = m_window->m_median;
+      const int kw = m_window->m_kw;
+      int b = 0, sum = 0;
+      while (sum + m_coarseBins[b] <= k)
+        sum += m_coarseBins[b++];
+
+      // Update the fine bins of the "b" coarse bin (from scratch or
+      // from the last column where they were updated).
+      int* fine = m_fineBins + b*16;
+      if (m_fineCol[b] < 0 || 2*(m_col - m_fineCol[b]) > kw) {
+        std::fill(fine, fine+16, 0);
+        for (int j=m_col; j<m_col+kw; ++j)
+          add_bins(fine, m_fine+j*256+b*16, 16);
+      }
+      else {
+        for (int j=m_fineCol[b]; j<m_col; ++j) {
+          add_bins(fine, m_fine+(j+kw)*256+b*16, 16);
+          sub_bins(fine, m_fine+j*256+b*16, 16);
+        }
+      }
+      m_fineCol[b] = m_col;
+
+      int u = 0;
+      while (sum + fine[u] <= k)
+        sum += fine[u++];
+      return b*16 + u;
+    }
+
+  private:
+    const Window* m_window;
+    const uint16_t* m_fine;
+    const uint16_t* m_coarse;
+    int m_col;
+    int m_coarseBins[16];
+    int m_fineBins[256];
+    int m_fineCol[16];          // Column where each group of fine bins was updated
+  };
+
+  void reset(const MedianFilter* filter, const Image* src, const Palette* pal,
+             Target target, int x, int w, int channels) {
+    resetArea(src, pal, target, x, w, filter->m_tiledMode);
+    m_kw = filter->m_width;
+    m_kh = filter->m_height;
+    m_median = filter->m_ncolors/2;
+
+    m_nslots = 0;
+    for (int c=0; c<MaxChannels; ++c) {
+      if (channels & (1 << c))
+        m_slot[c] = m_nslots++;
+      else
+        m_slot[c] = -1;
+    }
+
+    // Columns of the image used by each column of the window
+    m_ncols = w + m_kw - 1;
+    m_cols.resize(m_ncols);
+    for (int j=0; j<m_ncols; ++j)
+      m_cols[j] = mapX(x - m_kw/2 + j);
+
+    m_fine.resize(m_nslots*m_ncols*256);
+    m_coarse.resize(m_nslots*m_ncols*16);
+  }
+
+  // Moves the window to the given row.
+  template<typename Traits, typename Channels>
+  void moveTo(int y, const Channels& channels) {
+    int top = y - m_kh/2;
+
+    if (m_loaded && m_y == y-1) {
+      addRow<Traits>(mapY(top-1), -1, channels);
+      addRow<Traits>(mapY(top+m_kh-1), 1, channels);
+    }
+    else {
+      std::fill(m_fine.begin(), m_fine.end(), 0);
+      std::fill(m_coarse.begin(), m_coarse.end(), 0);
+      for (int dy=0; dy<m_kh; ++dy)
+        addRow<Traits>(mapY(top+dy), 1, channels);
+    }
+
+    m_y = y;
+    m_loaded = true;
+  }
+
+private:
+  template<typename Traits, typename Channels>
+  void addRow(int row, int delta, const Channels& channels) {
+    typename Traits::const_address_t address = image_address_fast<Traits>(m_src, 0, row);
+    uint8_t v[MaxChannels];
+
+    for (int j=0; j<m_ncols; ++j) {
+      channels(address[m_cols[j]], v);
+
+      for (int c=0; c<MaxChannels; ++c) {
+        int slot = m_slot[c];
+        if (slot >= 0) {
+          int i = slot*m_ncols + j;
+          m_fine[i*256 + v[c]] += delta;
+          m_coarse[i*16 + (v[c] >> 4)] += delta;
+        }
+      }
+    }
+  }
+
+  int m_kw, m_kh;
+  int m_median;
+  int m_slot[MaxChannels];      // Index of the histograms of each channel (or -1)
+  int m_nslots;
+  int m_ncols;
+  std::vector<int> m_cols;
+  std::vector<uint16_t> m_fine;
+  std::vector<uint16_t> m_coarse;
+};
+
+bool MedianFilter::useWindows(const Image* src) const
+{
+  return (m_width > 0 && m_height > 0 &&
+          m_height <= 0xffff &&
+          // get_neighboring_pixels() doesn't clamp the columns in the
+          // same way when the matrix is wider than the image.
+          ((m_tiledMode & TILED_X_AXIS) || m_width <= src->w));
+}
+
 namespace {
   struct GetPixelsDelegateRgba
   {
@@ -131,11 +356,49 @@ void MedianFilter::applyToRgba(FilterManager* filterMgr)
   Target target = filterMgr->getTarget();
   int color;
   int r, g, b, a;
-  GetPixelsDelegateRgba delegate(m_channel);
   int x = filterMgr->getX();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
 
+  if (useWindows(src)) {
+    Window* window = m_windows.acquire(filterMgr, this, NULL, target & 15);
+    Window::Matrix matrix[4];
+    window->moveTo<RgbTraits>(y, ChannelsRgba());
+    for (int c=0; c<4; ++c)
+      if (target & (1 << c))
+        matrix[c].start(window, c);
+
+    for (int i=0; x<x2; ++x, ++i) {
+      if (i > 0) {
+        for (int c=0; c<4; ++c)
+          if (target & (1 << c))
+            matrix[c].next();
+      }
+
+      // Avoid the non-selected region
+      if (filterMgr->skipPixel()) {
+        ++dst_address;
+        continue;
+      }
+
+      color = image_getpixel_fast<RgbTraits>(src, x, y);
+      r = (target & TARGET_RED_CHANNEL ? matrix[0].median(): _rgba_getr(color));
+      g = (target & TARGET_GREEN_CHANNEL ? matrix[1].median(): _rgba_getg(color));
+      b = (target & TARGET_BLUE_CHANNEL ? matrix[2].median(): _rgba_getb(color));
+      a = (target & TARGET_ALPHA_CHANNEL ? matrix[3].median(): _rgba_geta(color));
+
+      *(dst_address++) = _rgba(r, g, b, a);
+    }
+
+    m_windows.release(window);
+    return;
+  }
+
+  // Local buffers (only needed without sliding windows), so the
+  // filter can be applied in several threads
+  std::vector<std::vector<uint8_t> > channel(4, std::vector<uint8_t>(m_ncolors));
+  GetPixelsDelegateRgba delegate(channel);
+
   for (; x<x2; ++x) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
@@ -150,29 +413,29 @@ void MedianFilter::applyToRgba(FilterManager* filterMgr)
     color = image_getpixel_fast<RgbTraits>(src, x, y);
 
     if (target & TARGET_RED_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      r = m_channel[0][m_ncolors/2];
+      std::nth_element(channel[0].begin(), channel[0].begin()+m_ncolors/2, channel[0].end());
+      r = channel[0][m_ncolors/2];
     }
     else
       r = _rgba_getr(color);
 
     if (target & TARGET_GREEN_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      g = m_channel[1][m_ncolors/2];
+      std::nth_element(channel[1].begin(), channel[1].begin()+m_ncolors/2, channel[1].end());
+      g = channel[1][m_ncolors/2];
     }
     else
       g = _rgba_getg(color);
 
     if (target & TARGET_BLUE_CHANNEL) {
-      std::sort(m_channel[2].begin(), m_channel[2].end());
-      b = m_channel[2][m_ncolors/2];
+      std::nth_element(channel[2].begin(), channel[2].begin()+m_ncolors/2, channel[2].end());
+      b = channel[2][m_ncolors/2];
     }
     else
       b = _rgba_getb(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[3].begin(), m_channel[3].end());
-      a = m_channel[3][m_ncolors/2];
+      std::nth_element(channel[3].begin(), channel[3].begin()+m_ncolors/2, channel[3].end());
+      a = channel[3][m_ncolors/2];
     }
     else
       a = _rgba_geta(color);
@@ -187,11 +450,49 @@ void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   int color, k, a;
-  GetPixelsDelegateGrayscale delegate(m_channel);
   int x = filterMgr->getX();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
 
+  if (useWindows(src)) {
+    int channels = ((target & TARGET_GRAY_CHANNEL ? 1: 0) |
+                    (target & TARGET_ALPHA_CHANNEL ? 2: 0));
+    Window* window = m_windows.acquire(filterMgr, this, NULL, channels);
+    Window::Matrix matrix[2];
+    window->moveTo<GrayscaleTraits>(y, ChannelsGrayscale());
+    for (int c=0; c<2; ++c)
+      if (channels & (1 << c))
+        matrix[c].start(window, c);
+
+    for (int i=0; x<x2; ++x, ++i) {
+      if (i > 0) {
+        for (int c=0; c<2; ++c)
+          if (channels & (1 << c))
+            matrix[c].next();
+      }
+
+      // Avoid the non-selected region
+      if (filterMgr->skipPixel()) {
+        ++dst_address;
+        continue;
+      }
+
+      color = image_getpixel_fast<GrayscaleTraits>(src, x, y);
+      k = (channels & 1 ? matrix[0].median(): _graya_getv(color));
+      a = (channels & 2 ? matrix[1].median(): _graya_geta(color));
+
+      *(dst_address++) = _graya(k, a);
+    }
+
+    m_windows.release(window);
+    return;
+  }
+
+  // Local buffers (only needed without sliding windows), so the
+  // filter can be applied in several threads
+  std::vector<std::vector<uint8_t> > channel(4, std::vector<uint8_t>(m_ncolors));
+  GetPixelsDelegateGrayscale delegate(channel);
+
   for (; x<x2; ++x) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
@@ -206,15 +507,15 @@ void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
     color = image_getpixel_fast<GrayscaleTraits>(src, x, y);
 
     if (target & TARGET_GRAY_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      k = m_channel[0][m_ncolors/2];
+      std::nth_element(channel[0].begin(), channel[0].begin()+m_ncolors/2, channel[0].end());
+      k = channel[0][m_ncolors/2];
     }
     else
       k = _graya_getv(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      a = m_channel[1][m_ncolors/2];
+      std::nth_element(channel[1].begin(), channel[1].begin()+m_ncolors/2, channel[1].end());
+      a = channel[1][m_ncolors/2];
     }
     else
       a = _graya_geta(color);
@@ -231,11 +532,57 @@ void MedianFilter::applyToIndexed(FilterManager* filterMgr)
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
   Target target = filterMgr->getTarget();
   int color, r, g, b;
-  GetPixelsDelegateIndexed delegate(pal, m_channel, target);
   int x = filterMgr->getX();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
 
+  if (useWindows(src)) {
+    int channels = (target & TARGET_INDEX_CHANNEL ? 1: target & 7);
+    Window* window = m_windows.acquire(filterMgr, this, pal, channels);
+    Window::Matrix matrix[3];
+    if (target & TARGET_INDEX_CHANNEL)
+      window->moveTo<IndexedTraits>(y, ChannelsIndex());
+    else
+      window->moveTo<IndexedTraits>(y, ChannelsPalette(pal));
+    for (int c=0; c<3; ++c)
+      if (channels & (1 << c))
+        matrix[c].start(window, c);
+
+    for (int i=0; x<x2; ++x, ++i) {
+      if (i > 0) {
+        for (int c=0; c<3; ++c)
+          if (channels & (1 << c))
+            matrix[c].next();
+      }
+
+      // Avoid the non-selected region
+      if (filterMgr->skipPixel()) {
+        ++dst_address;
+        continue;
+      }
+
+      if (target & TARGET_INDEX_CHANNEL) {
+        *(dst_address++) = matrix[0].median();
+      }
+      else {
+        color = image_getpixel_fast<IndexedTraits>(src, x, y);
+        r = (channels & 1 ? matrix[0].median(): _rgba_getr(pal->getEntry(color)));
+        g = (channels & 2 ? matrix[1].median(): _rgba_getg(pal->getEntry(color)));
+        b = (channels & 4 ? matrix[2].median(): _rgba_getb(pal->getEntry(color)));
+
+        *(dst_address++) = rgbmap->mapColor(r, g, b);
+      }
+    }
+
+    m_windows.release(window);
+    return;
+  }
+
+  // Local buffers (only needed without sliding windows), so the
+  // filter can be applied in several threads
+  std::vector<std::vector<uint8_t> > channel(4, std::vector<uint8_t>(m_ncolors));
+  GetPixelsDelegateIndexed delegate(pal, channel, target);
+
   for (; x<x2; ++x) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
@@ -248,29 +595,29 @@ void MedianFilter::applyToIndexed(FilterManager* filterMgr)
                                           m_tiledMode, delegate);
 
     if (target & TARGET_INDEX_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      *(dst_address++) = m_channel[0][m_ncolors/2];
+      std::nth_element(channel[0].begin(), channel[0].begin()+m_ncolors/2, channel[0].end());
+      *(dst_address++) = channel[0][m_ncolors/2];
     }
     else {
       color = image_getpixel_fast<IndexedTraits>(src, x, y);
 
       if (target & TARGET_RED_CHANNEL) {
-        std::sort(m_channel[0].begin(), m_channel[0].end());
-        r = m_channel[0][m_ncolors/2];
+        std::nth_element(channel[0].begin(), channel[0].begin()+m_ncolors/2, channel[0].end());
+        r = channel[0][m_ncolors/2];
       }
       else
         r = _rgba_getr(pal->getEntry(color));
 
       if (target & TARGET_GREEN_CHANNEL) {
-        std::sort(m_channel[1].begin(), m_channel[1].end());
-        g = m_channel[1][m_ncolors/2];
+        std::nth_element(channel[1].begin(), channel[1].begin()+m_ncolors/2, channel[1].end());
+        g = channel[1][m_ncolors/2];
       }
       else
         g = _rgba_getg(pal->getEntry(color));
 
       if (target & TARGET_BLUE_CHANNEL) {
-        std::sort(m_channel[2].begin(), m_channel[2].end());
-        b = m_channel[2][m_ncolors/2];
+        std::nth_element(channel[2].begin(), channel[2].begin()+m_ncolors/2, channel[2].end());
+        b = channel[2][m_ncolors/2];
       }
       else
         b = _rgba_getb(pal->getEntry(color));
@@ -22,12 +22,17 @@
 #include <vector>
 
 #include "filters/filter.h"
+#include "filters/neighboring_window.h"
 #include "filters/tiled_mode.h"
 
+class Image;
+class Palette;
+
 class MedianFilter : public Filter
 {
 public:
   MedianFilter();
+  ~MedianFilter();
 
   void setTiledMode(TiledMode tiled);
   void setSize(int width, int height);
@@ -38,16 +43,23 @@ public:
 
   // Filter implementation
   const char* getName();
+  void beginFiltering();
   void applyToRgba(FilterManager* filterMgr);
   void applyToGrayscale(FilterManager* filterMgr);
   void applyToIndexed(FilterManager* filterMgr);
 
 private:
+  class Window;
+
+  bool useWindows(const Image* src) const;
+
   TiledMode m_tiledMode;
   int m_width;
   int m_height;
   int m_ncolors;
-  std::vector<std::vector<uint8_t> > m_channel;
+
+  // Windows of rows processed in the current filtering operation
+  NeighboringWindows<Window> m_windows;
 };
 
 #endif
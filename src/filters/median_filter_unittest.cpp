@@ -0,0 +1,265 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "base/unique_ptr.h"
+#include "filters/filter_indexed_data.h"
+#include "filters/filter_manager.h"
+#include "filters/median_filter.h"
+#include "filters/neighboring_pixels.h"
+#include "raster/image.h"
+#include "raster/palette.h"
+#include "raster/rgbmap.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+  // Applies a filter to the rows of an image.
+  class TestFilterManager : public FilterManager
+                          , public FilterIndexedData
+  {
+  public:
+    TestFilterManager(const Image* src, Image* dst, Target target,
+                      Palette* pal = NULL, RgbMap* rgbmap = NULL)
+      : m_src(src), m_dst(dst), m_target(target)
+      , m_pal(pal), m_rgbmap(rgbmap), m_x(0), m_y(0), m_w(src->w) { }
+
+    void setRow(int x, int y, int w) {
+      m_x = x;
+      m_y = y;
+      m_w = w;
+    }
+
+    const void* getSourceAddress() { return m_src->line[m_y] + image_line_size(m_src, m_x); }
+    void* getDestinationAddress() { return m_dst->line[m_y] + image_line_size(m_dst, m_x); }
+    int getWidth() { return m_w; }
+    Target getTarget() { return m_target; }
+    FilterIndexedData* getIndexedData() { return this; }
+    bool skipPixel() { return false; }
+    const Image* getSourceImage() { return m_src; }
+    int getX() { return m_x; }
+    int getY() { return m_y; }
+    Palette* getPalette() { return m_pal; }
+    RgbMap* getRgbMap() { return m_rgbmap; }
+
+  private:
+    const Image* m_src;
+    Image* m_dst;
+    Target m_target;
+    Palette* m_pal;
+    RgbMap* m_rgbmap;
+    int m_x, m_y, m_w;
+  };
+
+  struct CollectValues {
+    std::vector<int>& values;
+    CollectValues(std::vector<int>& values) : values(values) { }
+    void operator()(uint32_t color) { values.push_back(color); }
+  };
+
+  // Median of each channel sorting the pixels of the matrix.
+  template<typename Traits>
+  uint32_t expected_median(const Image* src, int x, int y, int w, int h, TiledMode tiled,
+                           int nchannels, int bitsPerChannel)
+  {
+    std::vector<int> values;
+    CollectValues collect(values);
+    get_neighboring_pixels<Traits>(src, x, y, w, h, w/2, h/2, tiled, collect);
+
+    uint32_t result = 0;
+    int mask = (1 << bitsPerChannel) - 1;
+    for (int c=0; c<nchannels; ++c) {
+      std::vector<int> channel;
+      for (size_t i=0; i<values.size(); ++i)
+        channel.push_back((values[i] >> (c*bitsPerChannel)) & mask);
+      std::sort(channel.begin(), channel.end());
+      result |= channel[w*h/2] << (c*bitsPerChannel);
+    }
+    return result;
+  }
+
+  Image* create_random_image(PixelFormat format, int w, int h, int ncolors)
+  {
+    Image* image = Image::create(format, w, h);
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x) {
+        // Few different colors, so there are a lot of repeated values
+        int v = std::rand() % ncolors;
+        switch (format) {
+          case IMAGE_RGB:
+            image->putpixel(x, y, _rgba(v*7, 255-v*11, v*v, (v*37) & 255));
+            break;
+          case IMAGE_GRAYSCALE:
+            image->putpixel(x, y, _graya(v*13, 255-v));
+            break;
+          case IMAGE_INDEXED:
+            image->putpixel(x, y, v);
+            break;
+        }
+      }
+    return image;
+  }
+
+  // Applies the filter row by row in the given order of rows
+  void apply_filter(MedianFilter& filter, TestFilterManager& filterMgr,
+                    const Image* src, const std::vector<int>& rows, int x, int w)
+  {
+    filter.beginFiltering();
+    for (size_t i=0; i<rows.size(); ++i) {
+      filterMgr.setRow(x, rows[i], w);
+      switch (src->getPixelFormat()) {
+        case IMAGE_RGB: filter.applyToRgba(&filterMgr); break;
+        case IMAGE_GRAYSCALE: filter.applyToGrayscale(&filterMgr); break;
+        case IMAGE_INDEXED: filter.applyToIndexed(&filterMgr); break;
+      }
+    }
+  }
+
+  std::vector<int> all_rows(int h)
+  {
+    std::vector<int> rows;
+    for (int y=0; y<h; ++y)
+      rows.push_back(y);
+    return rows;
+  }
+
+}
+
+TEST(MedianFilter, RgbaAndGrayscaleMatchSorting)
+{
+  const int sizes[][2] = { { 5, 5 }, { 7, 3 }, { 3, 9 }, { 1, 31 }, { 15, 15 } };
+  const TiledMode tiledModes[] = { TILED_NONE, TILED_X_AXIS, TILED_Y_AXIS, TILED_BOTH };
+  std::srand(1);
+
+  for (int f=0; f<2; ++f) {
+    PixelFormat format = (f == 0 ? IMAGE_RGB: IMAGE_GRAYSCALE);
+    UniquePtr<Image> src(create_random_image(format, 23, 17, 20));
+    UniquePtr<Image> dst(Image::create(format, 23, 17));
+
+    for (int s=0; s<int(sizeof(sizes)/sizeof(sizes[0])); ++s) {
+      for (int t=0; t<4; ++t) {
+        MedianFilter filter;
+        filter.setSize(sizes[s][0], sizes[s][1]);
+        filter.setTiledMode(tiledModes[t]);
+
+        TestFilterManager filterMgr(src, dst, TARGET_ALL_CHANNELS);
+        apply_filter(filter, filterMgr, src, all_rows(src->h), 0, src->w);
+
+        for (int y=0; y<src->h; ++y)
+          for (int x=0; x<src->w; ++x) {
+            uint32_t expected =
+              (format == IMAGE_RGB ?
+               expected_median<RgbTraits>(src, x, y, sizes[s][0], sizes[s][1], tiledModes[t], 4, 8):
+               expected_median<GrayscaleTraits>(src, x, y, sizes[s][0], sizes[s][1], tiledModes[t], 2, 8));
+            ASSERT_EQ(expected, dst->getpixel(x, y))
+              << "format " << format << " size " << sizes[s][0] << "x" << sizes[s][1]
+              << " tiled " << tiledModes[t] << " pixel " << x << "," << y;
+          }
+      }
+    }
+  }
+}
+
+// Rows in any order and partial rows (like bands of rows applied from
+// several threads, or a selection) give the same result.
+TEST(MedianFilter, RowsInAnyOrder)
+{
+  std::srand(2);
+  UniquePtr<Image> src(create_random_image(IMAGE_RGB, 40, 30, 50));
+  UniquePtr<Image> dst1(Image::create(IMAGE_RGB, 40, 30));
+  UniquePtr<Image> dst2(Image::create(IMAGE_RGB, 40, 30));
+  image_clear(dst1, 0);
+  image_clear(dst2, 0);
+
+  MedianFilter filter;
+  filter.setSize(9, 7);
+  filter.setTiledMode(TILED_NONE);
+
+  TestFilterManager filterMgr1(src, dst1, TARGET_RED_CHANNEL | TARGET_ALPHA_CHANNEL);
+  apply_filter(filter, filterMgr1, src, all_rows(30), 5, 30);
+
+  // Two interleaved bands of rows
+  std::vector<int> rows;
+  for (int y=0; y<15; ++y) {
+    rows.push_back(y);
+    rows.push_back(y+15);
+  }
+  rows.push_back(3);
+  TestFilterManager filterMgr2(src, dst2, TARGET_RED_CHANNEL | TARGET_ALPHA_CHANNEL);
+  apply_filter(filter, filterMgr2, src, rows, 5, 30);
+
+  for (int y=0; y<30; ++y)
+    for (int x=0; x<40; ++x) {
+      if (x < 5 || x >= 35) {
+        ASSERT_EQ(0, dst2->getpixel(x, y));
+        continue;
+      }
+
+      uint32_t m = expected_median<RgbTraits>(src, x, y, 9, 7, TILED_NONE, 4, 8);
+      uint32_t c = src->getpixel(x, y);
+      uint32_t expected = _rgba(_rgba_getr(m), _rgba_getg(c), _rgba_getb(c), _rgba_geta(m));
+      ASSERT_EQ(expected, dst1->getpixel(x, y));
+      ASSERT_EQ(expected, dst2->getpixel(x, y));
+    }
+}
+
+TEST(MedianFilter, Indexed)
+{
+  std::srand(3);
+  Palette pal(FrameNumber(0), 32);
+  for (int i=0; i<32; ++i)
+    pal.setEntry(i, _rgba(i*8, 255-i*8, (i*i) & 255, 255));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal);
+
+  UniquePtr<Image> src(create_random_image(IMAGE_INDEXED, 31, 19, 32));
+  UniquePtr<Image> dst(Image::create(IMAGE_INDEXED, 31, 19));
+
+  MedianFilter filter;
+  filter.setSize(5, 7);
+  filter.setTiledMode(TILED_BOTH);
+
+  // Index channel
+  TestFilterManager filterMgr(src, dst, TARGET_INDEX_CHANNEL, &pal, &rgbmap);
+  apply_filter(filter, filterMgr, src, all_rows(src->h), 0, src->w);
+
+  for (int y=0; y<src->h; ++y)
+    for (int x=0; x<src->w; ++x)
+      ASSERT_EQ(expected_median<IndexedTraits>(src, x, y, 5, 7, TILED_BOTH, 1, 8),
+                dst->getpixel(x, y));
+
+  // RGB channels of the palette
+  TestFilterManager filterMgr2(src, dst, TARGET_ALL_CHANNELS, &pal, &rgbmap);
+  apply_filter(filter, filterMgr2, src, all_rows(src->h), 0, src->w);
+
+  UniquePtr<Image> rgbSrc(Image::create(IMAGE_RGB, src->w, src->h));
+  for (int y=0; y<src->h; ++y)
+    for (int x=0; x<src->w; ++x)
+      rgbSrc->putpixel(x, y, pal.getEntry(src->getpixel(x, y)));
+
+  for (int y=0; y<src->h; ++y)
+    for (int x=0; x<src->w; ++x) {
+      uint32_t m = expected_median<RgbTraits>(rgbSrc, x, y, 5, 7, TILED_BOTH, 3, 8);
+      ASSERT_EQ(rgbmap.mapColor(_rgba_getr(m), _rgba_getg(m), _rgba_getb(m)),
+                dst->getpixel(x, y));
+    }
+}
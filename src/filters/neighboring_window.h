@@ -0,0 +1,177 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef FILTERS_NEIGHBORING_WINDOW_H_INCLUDED
+#define FILTERS_NEIGHBORING_WINDOW_H_INCLUDED
+
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "filters/filter_manager.h"
+#include "filters/target.h"
+#include "filters/tiled_mode.h"
+#include "raster/image.h"
+
+#include <vector>
+
+class Palette;
+
+// Base class of the sliding windows used by filters that read the
+// neighboring pixels of each pixel (median, convolution matrix). A
+// window keeps some state of the matrix for one row of the image
+// area, so it can be moved to the next row of the same area adding
+// and removing rows of the image.
+class NeighboringWindow
+{
+public:
+  NeighboringWindow()
+    : m_src(NULL), m_pal(NULL), m_target(0)
+    , m_x(0), m_y(0), m_w(0), m_loaded(false)
+    , m_tiledMode(TILED_NONE) {
+  }
+
+  // Returns true if the window was used for the previous row of the
+  // same image area (so it can be moved to the next row).
+  bool continues(const Image* src, const Palette* pal, Target target,
+                 int x, int y, int w) const {
+    return (m_loaded &&
+            m_src == src && m_pal == pal && m_target == target &&
+            m_x == x && m_w == w && m_y == y-1);
+  }
+
+protected:
+  void resetArea(const Image* src, const Palette* pal, Target target,
+                 int x, int w, TiledMode tiledMode) {
+    m_src = src;
+    m_pal = pal;
+    m_target = target;
+    m_x = x;
+    m_w = w;
+    m_y = 0;
+    m_loaded = false;
+    m_tiledMode = tiledMode;
+  }
+
+  // Same limits as get_neighboring_pixels()
+  int mapX(int x) const {
+    if (m_tiledMode & TILED_X_AXIS)
+      return wrap(x, m_src->w);
+    else
+      return MID(0, x, m_src->w-1);
+  }
+
+  int mapY(int y) const {
+    if (m_tiledMode & TILED_Y_AXIS)
+      return wrap(y, m_src->h);
+    else
+      return MID(0, y, m_src->h-1);
+  }
+
+  static int wrap(int v, int size) {
+    v %= size;
+    return (v < 0 ? v+size: v);
+  }
+
+  const Image* m_src;
+  const Palette* m_pal;
+  Target m_target;
+  int m_x, m_y, m_w;
+  bool m_loaded;
+  TiledMode m_tiledMode;
+};
+
+// Windows of rows processed in the current filtering operation which
+// are not being used right now by any thread. Window must be a
+// NeighboringWindow with a reset(filter, src, pal, target, x, w,
+// channels) member function.
+template<class Window>
+class NeighboringWindows
+{
+public:
+  NeighboringWindows() { }
+
+  ~NeighboringWindows() {
+    clear();
+  }
+
+  // Returns a window for the row of "filterMgr". It tries to re-use
+  // the window of the previous row (e.g. the previous row of the same
+  // band when the filter is applied from several threads).
+  template<class Filter>
+  Window* acquire(FilterManager* filterMgr, const Filter* filter,
+                  const Palette* pal, int channels) {
+    const Image* src = filterMgr->getSourceImage();
+    Target target = filterMgr->getTarget();
+    int x = filterMgr->getX();
+    int y = filterMgr->getY();
+    int w = filterMgr->getWidth();
+    Window* window = NULL;
+    {
+      ScopedLock lock(m_mutex);
+
+      for (typename std::vector<Window*>::iterator it = m_windows.begin(), end = m_windows.end();
+           it != end; ++it) {
+        if ((*it)->continues(src, pal, target, x, y, w)) {
+          window = *it;
+          m_windows.erase(it);
+          return window;
+        }
+      }
+
+      // Re-use the window that was released first (probably its band
+      // was completed).
+      if (!m_windows.empty()) {
+        window = m_windows.front();
+        m_windows.erase(m_windows.begin());
+      }
+    }
+
+    if (!window)
+      window = new Window;
+
+    try {
+      window->reset(filter, src, pal, target, x, w, channels);
+    }
+    catch (...) {
+      delete window;
+      throw;
+    }
+    return window;
+  }
+
+  void release(Window* window) {
+    ScopedLock lock(m_mutex);
+    m_windows.push_back(window);
+  }
+
+  void clear() {
+    ScopedLock lock(m_mutex);
+    for (typename std::vector<Window*>::iterator it = m_windows.begin(), end = m_windows.end();
+         it != end; ++it)
+      delete *it;
+    m_windows.clear();
+  }
+
+private:
+  Mutex m_mutex;
+  std::vector<Window*> m_windows;
+
+  DISABLE_COPYING(NeighboringWindows);
+};
+
+#endif
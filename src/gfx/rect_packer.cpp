@@ -0,0 +1,178 @@
+// ASEPRITE gfx library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include "config.h"
+
+#include "gfx/rect_packer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gfx {
+
+RectPacker::RectPacker(const Size& binSize)
+  : m_binSize(binSize)
+{
+  m_freeRects.push_back(Rect(0, 0, binSize.w, binSize.h));
+}
+
+bool RectPacker::insert(const Size& size, Point& position)
+{
+  int bestIndex = -1;
+  int bestBottom = 0;
+  int bestX = 0;
+
+  for (int i=0; i<(int)m_freeRects.size(); ++i) {
+    const Rect& freeRect = m_freeRects[i];
+    if (freeRect.w < size.w || freeRect.h < size.h)
+      continue;
+
+    int bottom = freeRect.y + size.h;
+    if (bestIndex < 0 ||
+        bottom < bestBottom ||
+        (bottom == bestBottom && freeRect.x < bestX)) {
+      bestIndex = i;
+      bestBottom = bottom;
+      bestX = freeRect.x;
+    }
+  }
+
+  if (bestIndex < 0)
+    return false;
+
+  position = m_freeRects[bestIndex].getOrigin();
+
+  Rect usedRect(position, size);
+  splitFreeRects(usedRect);
+  m_usedBounds = m_usedBounds.createUnion(usedRect);
+  return true;
+}
+
+void RectPacker::splitFreeRects(const Rect& usedRect)
+{
+  std::vector<Rect> oldRects;
+  std::vector<Rect> newRects;
+
+  // Split the free rectangles that intersect the used one in (up to)
+  // four maximal rectangles around it.
+  for (std::vector<Rect>::iterator it=m_freeRects.begin(); it!=m_freeRects.end(); ++it) {
+    const Rect& rc = *it;
+
+    if (rc.createIntersect(usedRect).isEmpty()) {
+      oldRects.push_back(rc);
+      continue;
+    }
+
+    if (usedRect.x > rc.x)
+      newRects.push_back(Rect(rc.x, rc.y, usedRect.x - rc.x, rc.h));
+    if (usedRect.x2() < rc.x2())
+      newRects.push_back(Rect(usedRect.x2(), rc.y, rc.x2() - usedRect.x2(), rc.h));
+    if (usedRect.y > rc.y)
+      newRects.push_back(Rect(rc.x, rc.y, rc.w, usedRect.y - rc.y));
+    if (usedRect.y2() < rc.y2())
+      newRects.push_back(Rect(rc.x, usedRect.y2(), rc.w, rc.y2() - usedRect.y2()));
+  }
+
+  // Remove the rectangles that are contained by other ones. The old
+  // rectangles don't contain each other, so we only have to check
+  // the new ones.
+  m_freeRects.clear();
+
+  for (size_t i=0; i<oldRects.size(); ++i) {
+    bool contained = false;
+    for (size_t j=0; j<newRects.size() && !contained; ++j)
+      contained = newRects[j].contains(oldRects[i]);
+
+    if (!contained)
+      m_freeRects.push_back(oldRects[i]);
+  }
+
+  for (size_t i=0; i<newRects.size(); ++i) {
+    bool contained = false;
+    for (size_t j=0; j<oldRects.size() && !contained; ++j)
+      contained = oldRects[j].contains(newRects[i]);
+    for (size_t j=0; j<newRects.size() && !contained; ++j)
+      contained = (j != i && newRects[j].contains(newRects[i]) &&
+                   (newRects[j] != newRects[i] || j < i));
+
+    if (!contained)
+      m_freeRects.push_back(newRects[i]);
+  }
+}
+
+namespace {
+
+  // Sorts the rectangles from the tallest to the smallest one.
+  class CompareSizes {
+  public:
+    CompareSizes(const std::vector<Size>& sizes) : m_sizes(sizes) { }
+    bool operator()(int a, int b) const {
+      if (m_sizes[a].h != m_sizes[b].h)
+        return m_sizes[a].h > m_sizes[b].h;
+      else if (m_sizes[a].w != m_sizes[b].w)
+        return m_sizes[a].w > m_sizes[b].w;
+      else
+        return a < b;
+    }
+  private:
+    const std::vector<Size>& m_sizes;
+  };
+
+}
+
+Size pack_rects(const std::vector<Size>& sizes, std::vector<Point>& positions)
+{
+  positions.resize(sizes.size());
+  if (sizes.empty())
+    return Size(0, 0);
+
+  std::vector<int> order(sizes.size());
+  int maxWidth = 0;
+  int totalHeight = 0;
+  double area = 0.0;
+
+  for (size_t i=0; i<sizes.size(); ++i) {
+    order[i] = i;
+    maxWidth = std::max(maxWidth, sizes[i].w);
+    totalHeight += sizes[i].h;
+    area += (double)sizes[i].w * (double)sizes[i].h;
+  }
+
+  std::sort(order.begin(), order.end(), CompareSizes(sizes));
+
+  // Try different widths for the bin (from the square root of the
+  // whole area to the double), the height is never a limit.
+  int minWidth = std::max(maxWidth, (int)std::ceil(std::sqrt(area)));
+  int step = std::max(1, minWidth / 8);
+  Size bestSize(0, 0);
+  std::vector<Point> bestPositions(sizes.size());
+
+  for (int width=minWidth; width<=minWidth*2; width+=step) {
+    RectPacker packer(Size(width, totalHeight));
+    std::vector<Point> pos(sizes.size());
+    bool ok = true;
+
+    for (size_t i=0; i<order.size() && ok; ++i)
+      ok = packer.insert(sizes[order[i]], pos[order[i]]);
+
+    if (!ok)
+      continue;
+
+    Size size(packer.getUsedBounds().x2(),
+              packer.getUsedBounds().y2());
+
+    if (bestSize.w == 0 ||
+        (double)size.w*size.h < (double)bestSize.w*bestSize.h) {
+      bestSize = size;
+      bestPositions = pos;
+    }
+  }
+
+  positions = bestPositions;
+  return bestSize;
+}
+
+} // namespace gfx
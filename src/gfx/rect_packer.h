@@ -0,0 +1,51 @@
+// ASEPRITE gfx library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#ifndef GFX_RECT_PACKER_H_INCLUDED
+#define GFX_RECT_PACKER_H_INCLUDED
+
+#include "gfx/point.h"
+#include "gfx/rect.h"
+#include "gfx/size.h"
+#include <vector>
+
+namespace gfx {
+
+  // Places rectangles inside a bin of a fixed size without overlapping
+  // them, using the "MaxRects" algorithm: the packer keeps the list of
+  // maximal free rectangles of the bin, each new rectangle is placed
+  // in the free one where its bottom side is the top-most (and then
+  // the left-most), and the free rectangles that intersect it are
+  // split.
+  class RectPacker {
+  public:
+    RectPacker(const Size& binSize);
+
+    const Size& getBinSize() const { return m_binSize; }
+
+    // Returns the bounds of all inserted rectangles.
+    const Rect& getUsedBounds() const { return m_usedBounds; }
+
+    // Finds a place for a rectangle of the given size. Returns false
+    // if there is no space for it in the bin.
+    bool insert(const Size& size, Point& position);
+
+  private:
+    void splitFreeRects(const Rect& usedRect);
+
+    Size m_binSize;
+    Rect m_usedBounds;
+    std::vector<Rect> m_freeRects;
+  };
+
+  // Packs all the given sizes in a bin as small as possible (trying
+  // different bin widths). Returns the size of the bin, and the
+  // position of each rectangle in "positions".
+  Size pack_rects(const std::vector<Size>& sizes, std::vector<Point>& positions);
+
+} // namespace gfx
+
+#endif
@@ -0,0 +1,120 @@
+// ASEPRITE gfx library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "gfx/rect_packer.h"
+
+#include <cstdlib>
+
+using namespace std;
+using namespace gfx;
+
+namespace gfx {
+
+ostream& operator<<(ostream& os, const Point& pt)
+{
+  return os << "(" << pt.x << ", " << pt.y << ")";
+}
+
+ostream& operator<<(ostream& os, const Size& sz)
+{
+  return os << "(" << sz.w << ", " << sz.h << ")";
+}
+
+ostream& operator<<(ostream& os, const Rect& rect)
+{
+  return os << "("
+            << rect.x << ", "
+            << rect.y << ", "
+            << rect.w << ", "
+            << rect.h << ")";
+}
+
+} // namespace gfx
+
+static bool overlap(const std::vector<Size>& sizes, const std::vector<Point>& positions)
+{
+  for (size_t i=0; i<sizes.size(); ++i)
+    for (size_t j=i+1; j<sizes.size(); ++j)
+      if (!Rect(positions[i], sizes[i]).createIntersect(Rect(positions[j], sizes[j])).isEmpty())
+        return true;
+  return false;
+}
+
+TEST(RectPacker, FillBin)
+{
+  RectPacker packer(Size(4, 4));
+  Point pos;
+
+  for (int i=0; i<4; ++i) {
+    EXPECT_TRUE(packer.insert(Size(2, 2), pos));
+    EXPECT_EQ(0, pos.x % 2);
+    EXPECT_EQ(0, pos.y % 2);
+  }
+  EXPECT_FALSE(packer.insert(Size(1, 1), pos));
+  EXPECT_EQ(Rect(0, 0, 4, 4), packer.getUsedBounds());
+}
+
+TEST(RectPacker, TopLeftFirst)
+{
+  RectPacker packer(Size(10, 10));
+  Point pos;
+
+  EXPECT_TRUE(packer.insert(Size(6, 3), pos));
+  EXPECT_EQ(Point(0, 0), pos);
+  EXPECT_TRUE(packer.insert(Size(4, 2), pos));
+  EXPECT_EQ(Point(6, 0), pos);
+  EXPECT_TRUE(packer.insert(Size(10, 2), pos));
+  EXPECT_EQ(Point(0, 3), pos);
+  EXPECT_FALSE(packer.insert(Size(11, 1), pos));
+}
+
+TEST(PackRects, Empty)
+{
+  std::vector<Size> sizes;
+  std::vector<Point> positions;
+  EXPECT_EQ(Size(0, 0), pack_rects(sizes, positions));
+  EXPECT_TRUE(positions.empty());
+}
+
+TEST(PackRects, SameSizes)
+{
+  std::vector<Size> sizes(16, Size(8, 8));
+  std::vector<Point> positions;
+  Size binSize = pack_rects(sizes, positions);
+
+  EXPECT_EQ(Size(32, 32), binSize);
+  EXPECT_FALSE(overlap(sizes, positions));
+}
+
+TEST(PackRects, RandomSizes)
+{
+  std::srand(1);
+
+  std::vector<Size> sizes;
+  int area = 0;
+  for (int i=0; i<200; ++i) {
+    sizes.push_back(Size(1+std::rand()%40, 1+std::rand()%40));
+    area += sizes.back().w * sizes.back().h;
+  }
+
+  std::vector<Point> positions;
+  Size binSize = pack_rects(sizes, positions);
+
+  EXPECT_FALSE(overlap(sizes, positions));
+  for (size_t i=0; i<sizes.size(); ++i)
+    EXPECT_TRUE(Rect(0, 0, binSize.w, binSize.h).contains(Rect(positions[i], sizes[i])));
+
+  // The packed bin shouldn't waste too much space.
+  EXPECT_LT(binSize.w * binSize.h, area * 3 / 2);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -23,6 +23,7 @@
 #include "base/memory.h"
 #include "base/memory_dump.h"
 #include "console.h"
+#include "raster/blend.h"
 #include "resource_finder.h"
 #include "she/she.h"
 #include "ui/base.h"
@@ -78,6 +79,9 @@ int app_main(int argc, char* argv[])
   // Initialize the random seed.
   std::srand(static_cast<unsigned int>(std::time(NULL)));
 
+  // Select the SIMD blenders before any worker thread is started.
+  blend_span_init();
+
 #ifdef WIN32
   CoInitialize(NULL);
 #endif
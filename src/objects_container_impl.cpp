@@ -22,9 +22,38 @@
 
 using namespace undo;
 
+// Minimum capacity of the hash tables and minimum size of the dense
+// vector of IDs to move its objects to the sparse table.
+#define MIN_CAPACITY 64
+
+// Values to calculate the hash table index of the given keys. As
+// objects are aligned, the lowest bits of pointers are discarded.
+static inline uint32_t hash_value(void* ptr)
+{
+  return uint32_t(uintptr_t(ptr) >> 3) ^ uint32_t(uint64_t(uintptr_t(ptr)) >> 32);
+}
+
+static inline uint32_t hash_value(ObjectId id)
+{
+  return id;
+}
+
+// Returns the hash table index of the given key, where "shift" is
+// 32 - log2(capacity).
+template<typename Key>
+static inline size_t hash_key(Key key, int shift)
+{
+  // Fibonacci hashing: the index is taken from the highest bits of
+  // the product (the lowest ones are not well mixed). Sequential IDs
+  // are spread evenly in the table.
+  return (hash_value(key) * 2654435769u) >> shift;
+}
+
 ObjectsContainerImpl::ObjectsContainerImpl()
+  : m_idCounter(0)
+  , m_idBase(1)                 // ID 0 is never used
+  , m_denseEntries(0)
 {
-  m_idCounter = 0;
 }
 
 ObjectsContainerImpl::~ObjectsContainerImpl()
@@ -34,53 +63,219 @@ ObjectsContainerImpl::~ObjectsContainerImpl()
 ObjectId ObjectsContainerImpl::addObject(void* object)
 {
   // First we check if the object is already in the container.
-  std::map<void*, ObjectId>::iterator it = m_ptrToId.find(object);
-  if (it != m_ptrToId.end())
-    return it->second;          // So we return the already assigned ID
+  const ObjectId* oldId = m_ptrToId.find(object);
+  if (oldId)
+    return *oldId;              // So we return the already assigned ID
 
   // In other case we add the new object
   ObjectId id = ++m_idCounter;
-
-  m_idToPtr[id] = object;
-  m_ptrToId[object] = id;
+  setObject(id, object);
+  m_ptrToId.add(object, id);
 
   return id;
 }
 
 void ObjectsContainerImpl::insertObject(ObjectId id, void* object)
 {
-  std::map<ObjectId, void*>::iterator it1 = m_idToPtr.find(id);
-  if (it1 != m_idToPtr.end())
+  if (findObject(id))
     throw ExistentObjectException();
 
-  std::map<void*, ObjectId>::iterator it2 = m_ptrToId.find(object);
-  if (it2 != m_ptrToId.end())
+  if (m_ptrToId.find(object))
     throw ExistentObjectException();
 
-  m_idToPtr[id] = object;
-  m_ptrToId[object] = id;
+  // New IDs from addObject() must be greater than this one
+  if (m_idCounter < id)
+    m_idCounter = id;
+
+  setObject(id, object);
+  m_ptrToId.add(object, id);
 }
 
 void ObjectsContainerImpl::removeObject(ObjectId id)
 {
-  std::map<ObjectId, void*>::iterator it1 = m_idToPtr.find(id);
-  if (it1 == m_idToPtr.end())
+  void* object = findObject(id);
+  if (!object || !m_ptrToId.remove(object))
     throw ObjectNotFoundException();
 
-  void* ptr = it1->second;
-  std::map<void*, ObjectId>::iterator it2 = m_ptrToId.find(ptr);
-  if (it2 == m_ptrToId.end())
-    throw ObjectNotFoundException();
+  if (id < m_idBase) {
+    m_sparseIds.remove(id);
+    return;
+  }
+
+  m_denseIds[id - m_idBase] = NULL;
+  --m_denseEntries;
 
-  m_idToPtr.erase(it1);
-  m_ptrToId.erase(it2);
+  // Remove the last NULL entries (objects are usually removed in
+  // the reverse order they were added, e.g. when the undo history
+  // is discarded).
+  size_t size = m_denseIds.size();
+  while (size > 0 && !m_denseIds[size-1])
+    --size;
+  m_denseIds.resize(size);
+
+  // If less than a quarter of the IDs are used, the objects are
+  // moved to the sparse table (e.g. a few long-lived objects between
+  // a lot of removed ones).
+  if (4*m_denseEntries < size && size > MIN_CAPACITY)
+    moveDenseObjectsToSparse();
+  else if (4*size < m_denseIds.capacity())
+    std::vector<void*>(m_denseIds).swap(m_denseIds);
 }
 
 void* ObjectsContainerImpl::getObject(ObjectId id)
 {
-  std::map<ObjectId, void*>::iterator it = m_idToPtr.find(id);
-  if (it == m_idToPtr.end())
+  void* object = findObject(id);
+  if (!object)
     throw ObjectNotFoundException();
 
-  return it->second;
+  return object;
+}
+
+void* ObjectsContainerImpl::findObject(ObjectId id) const
+{
+  if (id >= m_idBase) {
+    if (id - m_idBase < m_denseIds.size())
+      return m_denseIds[id - m_idBase];
+    else
+      return NULL;
+  }
+  else {
+    void* const* object = m_sparseIds.find(id);
+    return (object ? *object: NULL);
+  }
+}
+
+void ObjectsContainerImpl::setObject(ObjectId id, void* object)
+{
+  if (id < m_idBase) {
+    m_sparseIds.add(id, object);
+    return;
+  }
+
+  // The vector can be smaller than the ID if the last objects were
+  // removed (IDs are never re-used)
+  if (id - m_idBase >= m_denseIds.size())
+    m_denseIds.resize(id - m_idBase + 1, NULL);
+
+  m_denseIds[id - m_idBase] = object;
+  ++m_denseEntries;
+}
+
+void ObjectsContainerImpl::moveDenseObjectsToSparse()
+{
+  for (size_t i=0; i<m_denseIds.size(); ++i) {
+    if (m_denseIds[i])
+      m_sparseIds.add(ObjectId(m_idBase + i), m_denseIds[i]);
+  }
+
+  // The following IDs given by addObject() will be dense again
+  m_idBase = m_idCounter+1;
+  m_denseEntries = 0;
+  std::vector<void*>().swap(m_denseIds);
+}
+
+//////////////////////////////////////////////////////////////////////
+// ObjectsContainerImpl::HashTable
+
+template<typename Key, typename Value>
+ObjectsContainerImpl::HashTable<Key, Value>::HashTable()
+  : m_entries(0)
+{
+  rehash(MIN_CAPACITY);
+}
+
+template<typename Key, typename Value>
+const Value* ObjectsContainerImpl::HashTable<Key, Value>::find(Key key) const
+{
+  const Entry& entry = m_table[findIndex(key)];
+  return (entry.key != Key() ? &entry.value: NULL);
+}
+
+template<typename Key, typename Value>
+void ObjectsContainerImpl::HashTable<Key, Value>::add(Key key, Value value)
+{
+  // Keep the load factor below 1/2
+  if (2*(m_entries+1) > m_table.size())
+    rehash(2*m_table.size());
+
+  Entry& entry = m_table[findIndex(key)];
+  ASSERT(entry.key == Key());
+  entry.key = key;
+  entry.value = value;
+  ++m_entries;
+}
+
+template<typename Key, typename Value>
+bool ObjectsContainerImpl::HashTable<Key, Value>::remove(Key key)
+{
+  size_t index = findIndex(key);
+  if (m_table[index].key == Key())
+    return false;
+
+  removeIndex(index);
+  return true;
+}
+
+// Returns the index of the entry of the given key, or the index of
+// the empty entry where it should be added.
+template<typename Key, typename Value>
+size_t ObjectsContainerImpl::HashTable<Key, Value>::findIndex(Key key) const
+{
+  size_t mask = m_table.size()-1;
+  size_t index = hash_key(key, m_hashShift);
+
+  while (m_table[index].key != Key() && m_table[index].key != key)
+    index = (index+1) & mask;
+
+  return index;
+}
+
+// Removes the entry moving back the following entries of the same
+// cluster (so we don't need tombstones).
+template<typename Key, typename Value>
+void ObjectsContainerImpl::HashTable<Key, Value>::removeIndex(size_t index)
+{
+  size_t mask = m_table.size()-1;
+  size_t next = index;
+
+  for (;;) {
+    next = (next+1) & mask;
+    if (m_table[next].key == Key())
+      break;
+
+    // Move the "next" entry to the hole if its ideal position is
+    // not between the hole and its current position.
+    size_t ideal = hash_key(m_table[next].key, m_hashShift);
+    if (((next - ideal) & mask) >= ((next - index) & mask)) {
+      m_table[index] = m_table[next];
+      index = next;
+    }
+  }
+
+  m_table[index].key = Key();
+  m_table[index].value = Value();
+  --m_entries;
+
+  // Shrink the table when the load factor is below 1/8 (so it's
+  // below 1/4 after the shrink, and adding entries doesn't grow it
+  // again immediately)
+  if (8*m_entries < m_table.size() && m_table.size() > MIN_CAPACITY)
+    rehash(m_table.size()/2);
+}
+
+template<typename Key, typename Value>
+void ObjectsContainerImpl::HashTable<Key, Value>::rehash(size_t capacity)
+{
+  Entry empty = { Key(), Value() };
+  std::vector<Entry> old(capacity, empty);
+  m_table.swap(old);
+
+  m_hashShift = 32;
+  for (size_t c=capacity; c>1; c>>=1)
+    --m_hashShift;
+
+  for (size_t i=0; i<old.size(); ++i) {
+    if (old[i].key != Key())
+      m_table[findIndex(old[i].key)] = old[i];
+  }
 }
@@ -21,8 +21,18 @@
 
 #include "undo/objects_container.h"
 
-#include <map>
+#include <vector>
 
+// IDs are given sequentially, so the most recent ones are kept in a
+// dense vector. When most of them are removed, the remaining objects
+// are moved to a hash table (so the memory usage depends on the
+// number of objects in the container, not on the number of IDs
+// given until now).
+//
+// getObject() doesn't modify the container, so several threads can
+// get objects at the same time without locks, but the container must
+// not be modified meanwhile (the undo history is modified only with
+// the document locked for writing).
 class ObjectsContainerImpl : public undo::ObjectsContainer
 {
 public:
@@ -37,9 +47,51 @@ public:
   void* getObject(undo::ObjectId id);
 
 private:
+  // Hash table with open addressing and linear probing. The key
+  // Key() (NULL or ID 0) is used for empty entries. The capacity is
+  // always a power of two, and it's shrunk when most entries are
+  // removed.
+  template<typename Key, typename Value>
+  class HashTable
+  {
+  public:
+    HashTable();
+
+    const Value* find(Key key) const;
+    void add(Key key, Value value);
+    bool remove(Key key);
+
+  private:
+    struct Entry {
+      Key key;
+      Value value;
+    };
+
+    size_t findIndex(Key key) const;
+    void removeIndex(size_t index);
+    void rehash(size_t capacity);
+
+    std::vector<Entry> m_table;
+    size_t m_entries;
+    int m_hashShift;            // 32 - log2(capacity) for hash_key()
+  };
+
+  void* findObject(undo::ObjectId id) const;
+  void setObject(undo::ObjectId id, void* object);
+  void moveDenseObjectsToSparse();
+
   undo::ObjectId m_idCounter;
-  std::map<undo::ObjectId, void*> m_idToPtr;
-  std::map<void*, undo::ObjectId> m_ptrToId;
+
+  // Object pointers indexed by "ID - m_idBase". NULL entries are
+  // removed objects (the last ones are removed from the vector).
+  std::vector<void*> m_denseIds;
+  undo::ObjectId m_idBase;
+  size_t m_denseEntries;        // Number of non-NULL entries in m_denseIds
+
+  // Objects with IDs lower than m_idBase.
+  HashTable<undo::ObjectId, void*> m_sparseIds;
+
+  HashTable<void*, undo::ObjectId> m_ptrToId;
 };
 
 #endif
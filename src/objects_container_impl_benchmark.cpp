@@ -0,0 +1,134 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <gtest/gtest.h>
+
+#include "base/chrono.h"
+#include "objects_container_impl.h"
+
+#include <cstdio>
+#include <map>
+#include <vector>
+
+using namespace undo;
+
+namespace {
+
+  // The previous ObjectsContainerImpl implementation (two std::map).
+  class MapObjectsContainer : public ObjectsContainer {
+  public:
+    MapObjectsContainer() : m_idCounter(0) { }
+
+    ObjectId addObject(void* object) {
+      std::map<void*, ObjectId>::iterator it = m_ptrToId.find(object);
+      if (it != m_ptrToId.end())
+        return it->second;
+
+      ObjectId id = ++m_idCounter;
+      m_idToPtr[id] = object;
+      m_ptrToId[object] = id;
+      return id;
+    }
+
+    void insertObject(ObjectId id, void* object) {
+      m_idToPtr[id] = object;
+      m_ptrToId[object] = id;
+    }
+
+    void removeObject(ObjectId id) {
+      std::map<ObjectId, void*>::iterator it = m_idToPtr.find(id);
+      if (it == m_idToPtr.end())
+        throw ObjectNotFoundException();
+
+      m_ptrToId.erase(it->second);
+      m_idToPtr.erase(it);
+    }
+
+    void* getObject(ObjectId id) {
+      std::map<ObjectId, void*>::iterator it = m_idToPtr.find(id);
+      if (it == m_idToPtr.end())
+        throw ObjectNotFoundException();
+      return it->second;
+    }
+
+  private:
+    ObjectId m_idCounter;
+    std::map<ObjectId, void*> m_idToPtr;
+    std::map<void*, ObjectId> m_ptrToId;
+  };
+
+  // Simulates the undoers of a big operation: each object is added
+  // several times (e.g. the layer/sprite of each undoer), looked up
+  // by ID (revert), and finally removed and inserted back.
+  template<class Container>
+  void run_benchmark(const char* name, int count, int rounds)
+  {
+    std::vector<int*> objects(count);
+    std::vector<ObjectId> ids(count);
+    for (int i=0; i<count; ++i)
+      objects[i] = new int(i);
+
+    double addTime = 0.0, getTime = 0.0, removeTime = 0.0;
+    size_t sum = 0;
+
+    for (int round=0; round<rounds; ++round) {
+      Container objs;
+      base::Chrono chrono;
+      for (int j=0; j<4; ++j)
+        for (int i=0; i<count; ++i)
+          ids[i] = objs.addObject(objects[i]);
+      addTime += chrono.elapsed();
+
+      chrono.reset();
+      for (int j=0; j<4; ++j)
+        for (int i=0; i<count; ++i)
+          sum += *objs.template getObjectT<int>(ids[i]);
+      getTime += chrono.elapsed();
+
+      chrono.reset();
+      for (int i=0; i<count; ++i)
+        objs.removeObject(ids[i]);
+      for (int i=0; i<count; ++i)
+        objs.insertObject(ids[i], objects[i]);
+      removeTime += chrono.elapsed();
+    }
+
+    EXPECT_EQ(size_t(4) * rounds * count * (count-1) / 2, sum);
+
+    std::printf("%s (%d objects): add %.4f s, get %.4f s, remove/insert %.4f s\n",
+                name, count, addTime, getTime, removeTime);
+
+    for (int i=0; i<count; ++i)
+      delete objects[i];
+  }
+
+} // anonymous namespace
+
+TEST(ObjectsContainerImplBenchmark, BulkOperations)
+{
+  run_benchmark<MapObjectsContainer>("std::map", 100000, 10);
+  run_benchmark<ObjectsContainerImpl>("Hash table", 100000, 10);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -22,6 +22,8 @@
 
 #include "objects_container_impl.h"
 
+#include <vector>
+
 using namespace undo;
 
 TEST(ObjectsContainerImpl, AddObjectReturnsSameIdForSameObject)
@@ -78,6 +80,132 @@ TEST(ObjectsContainerImpl, InsertExistObjectsThrows)
   EXPECT_NO_THROW(objs.insertObject(id2, &b));
 }
 
+TEST(ObjectsContainerImpl, ManyObjects)
+{
+  ObjectsContainerImpl objs;
+  std::vector<int> values(10000);
+  std::vector<ObjectId> ids(values.size());
+
+  for (size_t i=0; i<values.size(); ++i)
+    ids[i] = objs.addObject(&values[i]);
+
+  // Remove odd objects
+  for (size_t i=1; i<values.size(); i+=2)
+    objs.removeObject(ids[i]);
+
+  for (size_t i=0; i<values.size(); ++i) {
+    if ((i & 1) == 0) {
+      EXPECT_EQ(&values[i], objs.getObjectT<int>(ids[i]));
+      EXPECT_EQ(ids[i], objs.addObject(&values[i]));
+    }
+    else
+      EXPECT_THROW(objs.getObject(ids[i]), ObjectNotFoundException);
+  }
+
+  // Insert them back with the same IDs
+  for (size_t i=1; i<values.size(); i+=2)
+    objs.insertObject(ids[i], &values[i]);
+
+  for (size_t i=0; i<values.size(); ++i) {
+    EXPECT_EQ(&values[i], objs.getObjectT<int>(ids[i]));
+    EXPECT_EQ(ids[i], objs.addObject(&values[i]));
+  }
+}
+
+TEST(ObjectsContainerImpl, RemoveAllObjectsAndAddThemAgain)
+{
+  ObjectsContainerImpl objs;
+  std::vector<int> values(10000);
+  std::vector<ObjectId> ids(values.size());
+
+  for (size_t i=0; i<values.size(); ++i)
+    ids[i] = objs.addObject(&values[i]);
+
+  // Remove them in reverse order (the tables are shrunk)
+  for (size_t i=values.size(); i>0; --i)
+    objs.removeObject(ids[i-1]);
+
+  for (size_t i=0; i<values.size(); ++i)
+    EXPECT_THROW(objs.getObject(ids[i]), ObjectNotFoundException);
+
+  // New IDs are not re-used
+  std::vector<ObjectId> newIds(values.size());
+  for (size_t i=0; i<values.size(); ++i) {
+    newIds[i] = objs.addObject(&values[i]);
+    EXPECT_GT(newIds[i], ids[values.size()-1]);
+  }
+
+  // Remove the odd objects and insert them back with their old IDs
+  for (size_t i=1; i<values.size(); i+=2) {
+    objs.removeObject(newIds[i]);
+    objs.insertObject(ids[i], &values[i]);
+  }
+
+  for (size_t i=0; i<values.size(); ++i) {
+    ObjectId id = ((i & 1) ? ids[i]: newIds[i]);
+    EXPECT_EQ(&values[i], objs.getObjectT<int>(id));
+    EXPECT_EQ(id, objs.addObject(&values[i]));
+  }
+}
+
+TEST(ObjectsContainerImpl, KeepOldObjectsWhileNewOnesAreRemoved)
+{
+  ObjectsContainerImpl objs;
+  std::vector<int> values(1000);
+  std::vector<ObjectId> ids(values.size());
+  int a, b;
+
+  ObjectId idA = objs.addObject(&a);
+
+  // Remove all objects except "a" and some of the others (these ones
+  // are moved to the sparse table)
+  for (int j=0; j<10; ++j) {
+    for (size_t i=0; i<values.size(); ++i)
+      ids[i] = objs.addObject(&values[i]);
+
+    for (size_t i=0; i<values.size(); ++i)
+      if (j < 9 || (i % 100) != 0)
+        objs.removeObject(ids[i]);
+  }
+
+  EXPECT_EQ(&a, objs.getObjectT<int>(idA));
+  EXPECT_EQ(idA, objs.addObject(&a));
+
+  for (size_t i=0; i<values.size(); ++i) {
+    if ((i % 100) == 0) {
+      EXPECT_EQ(&values[i], objs.getObjectT<int>(ids[i]));
+      EXPECT_EQ(ids[i], objs.addObject(&values[i]));
+    }
+    else
+      EXPECT_THROW(objs.getObject(ids[i]), ObjectNotFoundException);
+  }
+
+  // Old IDs can be removed and inserted back
+  objs.removeObject(idA);
+  EXPECT_THROW(objs.getObject(idA), ObjectNotFoundException);
+  EXPECT_THROW(objs.insertObject(ids[0], &b), ExistentObjectException);
+  objs.insertObject(idA, &b);
+  EXPECT_EQ(&b, objs.getObjectT<int>(idA));
+
+  // New objects get new IDs
+  ObjectId idA2 = objs.addObject(&a);
+  EXPECT_GT(idA2, ids[values.size()-1]);
+  EXPECT_EQ(&a, objs.getObjectT<int>(idA2));
+}
+
+TEST(ObjectsContainerImpl, AddObjectAfterInsertObjectReturnsNewId)
+{
+  ObjectsContainerImpl objs;
+  int a, b;
+
+  objs.insertObject(10, &a);
+  ObjectId idB = objs.addObject(&b);
+
+  EXPECT_NE(10, idB);
+  EXPECT_EQ(&a, objs.getObjectT<int>(10));
+  EXPECT_EQ(&b, objs.getObjectT<int>(idB));
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
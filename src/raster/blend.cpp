@@ -19,6 +19,8 @@
 #include "config.h"
 
 #include "raster/blend.h"
+
+#include "base/cpu_info.h"
 #include "raster/image.h"
 
 BLEND_COLOR _rgba_blenders[] =
@@ -33,6 +35,18 @@ BLEND_COLOR _graya_blenders[] =
   _graya_blend_copy,
 };
 
+BLEND_RGBA_SPAN _rgba_span_blenders[] =
+{
+  _rgba_blend_normal_span,
+  _rgba_blend_copy_span,
+};
+
+BLEND_GRAYA_SPAN _graya_span_blenders[] =
+{
+  _graya_blend_normal_span,
+  _graya_blend_copy_span,
+};
+
 /**********************************************************************/
 /* RGB blenders                                                       */
 /**********************************************************************/
@@ -206,3 +220,136 @@ int _graya_blend_merge(int back, int front, int opacity)
 
   return _graya(D_k, D_a);
 }
+
+/**********************************************************************/
+/* Span blenders                                                      */
+/**********************************************************************/
+
+template<typename PixelType, int (*blender)(int, int, int)>
+static void scalar_span(PixelType* dst, const PixelType* back, const PixelType* front,
+                        int n, int opacity, const PixelType* mask_color)
+{
+  if (mask_color) {
+    PixelType mask = *mask_color;
+    for (int i=0; i<n; ++i) {
+      if (front[i] != mask)
+        dst[i] = (*blender)(back[i], front[i], opacity);
+      else
+        dst[i] = back[i];
+    }
+  }
+  else {
+    for (int i=0; i<n; ++i)
+      dst[i] = (*blender)(back[i], front[i], opacity);
+  }
+}
+
+static const BLEND_SPAN_FUNCS blend_span_scalar = {
+  scalar_span<uint32_t, _rgba_blend_normal>,
+  scalar_span<uint32_t, _rgba_blend_copy>,
+  scalar_span<uint32_t, _rgba_blend_forpath>,
+  scalar_span<uint32_t, _rgba_blend_merge>,
+  scalar_span<uint16_t, _graya_blend_normal>,
+  scalar_span<uint16_t, _graya_blend_copy>,
+  scalar_span<uint16_t, _graya_blend_forpath>,
+  scalar_span<uint16_t, _graya_blend_merge>,
+};
+
+static const BLEND_SPAN_FUNCS* get_span_funcs(int impl)
+{
+  switch (impl) {
+    case BLEND_SPAN_SCALAR:
+      return &blend_span_scalar;
+#ifdef HAVE_SSE2
+    case BLEND_SPAN_SSE2:
+      if (base::cpu_has_sse2())
+        return &_blend_span_sse2;
+      break;
+#endif
+#ifdef HAVE_AVX2
+    case BLEND_SPAN_AVX2:
+      if (base::cpu_has_avx2())
+        return &_blend_span_avx2;
+      break;
+#endif
+  }
+  return NULL;
+}
+
+static int get_best_span_impl()
+{
+  if (get_span_funcs(BLEND_SPAN_AVX2))
+    return BLEND_SPAN_AVX2;
+  else if (get_span_funcs(BLEND_SPAN_SSE2))
+    return BLEND_SPAN_SSE2;
+  else
+    return BLEND_SPAN_SCALAR;
+}
+
+// Constant-initialized, so span blenders are valid even if images
+// are merged from global constructors of other translation units.
+// The best implementation is selected by blend_span_init() at
+// startup, before any worker thread can use these variables.
+static int span_impl = BLEND_SPAN_SCALAR;
+static const BLEND_SPAN_FUNCS* span_funcs = &blend_span_scalar;
+
+void blend_span_init()
+{
+  blend_span_set_impl(get_best_span_impl());
+}
+
+int blend_span_get_impl()
+{
+  return span_impl;
+}
+
+bool blend_span_set_impl(int impl)
+{
+  const BLEND_SPAN_FUNCS* funcs = get_span_funcs(impl);
+  if (!funcs)
+    return false;
+
+  span_impl = impl;
+  span_funcs = funcs;
+  return true;
+}
+
+void _rgba_blend_normal_span(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, const uint32_t* mask_color)
+{
+  span_funcs->rgba_normal(dst, back, front, n, opacity, mask_color);
+}
+
+void _rgba_blend_copy_span(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, const uint32_t* mask_color)
+{
+  span_funcs->rgba_copy(dst, back, front, n, opacity, mask_color);
+}
+
+void _rgba_blend_forpath_span(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, const uint32_t* mask_color)
+{
+  span_funcs->rgba_forpath(dst, back, front, n, opacity, mask_color);
+}
+
+void _rgba_blend_merge_span(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, const uint32_t* mask_color)
+{
+  span_funcs->rgba_merge(dst, back, front, n, opacity, mask_color);
+}
+
+void _graya_blend_normal_span(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, const uint16_t* mask_color)
+{
+  span_funcs->graya_normal(dst, back, front, n, opacity, mask_color);
+}
+
+void _graya_blend_copy_span(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, const uint16_t* mask_color)
+{
+  span_funcs->graya_copy(dst, back, front, n, opacity, mask_color);
+}
+
+void _graya_blend_forpath_span(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, const uint16_t* mask_color)
+{
+  span_funcs->graya_forpath(dst, back, front, n, opacity, mask_color);
+}
+
+void _graya_blend_merge_span(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, const uint16_t* mask_color)
+{
+  span_funcs->graya_merge(dst, back, front, n, opacity, mask_color);
+}
@@ -43,4 +43,72 @@ int _graya_blend_copy(int back, int front, int opacity);
 int _graya_blend_forpath(int back, int front, int opacity);
 int _graya_blend_merge(int back, int front, int opacity);
 
+//////////////////////////////////////////////////////////////////////
+// Span blenders
+//
+// They blend "n" pixels of "front" over "back" with the same result
+// of the blenders above, and store the result in "dst" ("dst" can be
+// the same pointer as "back"). If "mask_color" is not NULL, front
+// pixels equal to *mask_color are not blended (dst[i] = back[i]).
+//
+// SSE2 or AVX2 instructions are used if the CPU supports them.
+
+typedef void (*BLEND_RGBA_SPAN)(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                                int n, int opacity, const uint32_t* mask_color);
+typedef void (*BLEND_GRAYA_SPAN)(uint16_t* dst, const uint16_t* back, const uint16_t* front,
+                                 int n, int opacity, const uint16_t* mask_color);
+
+extern BLEND_RGBA_SPAN _rgba_span_blenders[];
+extern BLEND_GRAYA_SPAN _graya_span_blenders[];
+
+void _rgba_blend_normal_span(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, const uint32_t* mask_color);
+void _rgba_blend_copy_span(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, const uint32_t* mask_color);
+void _rgba_blend_forpath_span(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, const uint32_t* mask_color);
+void _rgba_blend_merge_span(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, const uint32_t* mask_color);
+
+void _graya_blend_normal_span(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, const uint16_t* mask_color);
+void _graya_blend_copy_span(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, const uint16_t* mask_color);
+void _graya_blend_forpath_span(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, const uint16_t* mask_color);
+void _graya_blend_merge_span(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, const uint16_t* mask_color);
+
+// Implementations of the span blenders.
+enum {
+  BLEND_SPAN_SCALAR,
+  BLEND_SPAN_SSE2,
+  BLEND_SPAN_AVX2,
+};
+
+// Selects the best implementation of span blenders supported by the
+// CPU (the scalar one is used until this is called). It must be
+// called from the main thread before any thread pool is created.
+void blend_span_init();
+
+// Returns the implementation used by the span blenders.
+int blend_span_get_impl();
+
+// Changes the implementation of span blenders (used by tests to
+// compare implementations). Returns false if it's not available in
+// this CPU or it wasn't compiled.
+bool blend_span_set_impl(int impl);
+
+// Table of span functions of one implementation.
+struct BLEND_SPAN_FUNCS {
+  BLEND_RGBA_SPAN rgba_normal;
+  BLEND_RGBA_SPAN rgba_copy;
+  BLEND_RGBA_SPAN rgba_forpath;
+  BLEND_RGBA_SPAN rgba_merge;
+  BLEND_GRAYA_SPAN graya_normal;
+  BLEND_GRAYA_SPAN graya_copy;
+  BLEND_GRAYA_SPAN graya_forpath;
+  BLEND_GRAYA_SPAN graya_merge;
+};
+
+#ifdef HAVE_SSE2
+extern const BLEND_SPAN_FUNCS _blend_span_sse2;
+#endif
+
+#ifdef HAVE_AVX2
+extern const BLEND_SPAN_FUNCS _blend_span_avx2;
+#endif
+
 #endif
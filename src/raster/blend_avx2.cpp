@@ -0,0 +1,82 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// This file is compiled with AVX2 instructions enabled, so it must
+// not include headers with inline functions that can be used from
+// other files (the linker could pick the AVX2 version for CPUs
+// without AVX2 support).
+
+#include "config.h"
+
+#ifdef HAVE_AVX2
+
+#include "raster/blend.h"
+#include "raster/blend_simd.h"
+
+#include <immintrin.h>
+
+namespace {
+
+// 8 pixels per vector.
+struct Avx2Ops {
+  typedef __m256i V;
+  typedef __m256 F;
+  enum { N = 8 };
+
+  static inline V load32(const uint32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+  static inline void store32(uint32_t* p, V v) { _mm256_storeu_si256((__m256i*)p, v); }
+
+  static inline V load16(const uint16_t* p) {
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+  }
+
+  static inline void store16(uint16_t* p, V v) {
+    // Pack 32-bit lanes to 16-bit and join the two 64-bit results
+    v = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0x08);
+    _mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(v));
+  }
+
+  static inline V zero() { return _mm256_setzero_si256(); }
+  static inline V set1(int a) { return _mm256_set1_epi32(a); }
+  static inline V add(V a, V b) { return _mm256_add_epi32(a, b); }
+  static inline V sub(V a, V b) { return _mm256_sub_epi32(a, b); }
+  static inline V and_(V a, V b) { return _mm256_and_si256(a, b); }
+  static inline V or_(V a, V b) { return _mm256_or_si256(a, b); }
+  static inline V cmpeq(V a, V b) { return _mm256_cmpeq_epi32(a, b); }
+  static inline V select(V m, V a, V b) { return _mm256_blendv_epi8(b, a, m); }
+  template<int n> static inline V srli(V a) { return _mm256_srli_epi32(a, n); }
+  template<int n> static inline V slli(V a) { return _mm256_slli_epi32(a, n); }
+  static inline V srl(V a, int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+  static inline V sll(V a, int n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+
+  // Multiplies values in [0,255] (the high 16 bits of each lane are zero)
+  static inline V mul16(V a, V b) { return _mm256_mullo_epi16(a, b); }
+
+  static inline F tofloat(V a) { return _mm256_cvtepi32_ps(a); }
+  static inline V trunc(F a) { return _mm256_cvttps_epi32(a); }
+  static inline F fset1(float a) { return _mm256_set1_ps(a); }
+  static inline F fmul(F a, F b) { return _mm256_mul_ps(a, b); }
+  static inline F fdiv(F a, F b) { return _mm256_div_ps(a, b); }
+  static inline F fmax(F a, F b) { return _mm256_max_ps(a, b); }
+};
+
+} // anonymous namespace
+
+extern const BLEND_SPAN_FUNCS _blend_span_avx2 = BLEND_SPAN_FUNCS_INIT(Avx2Ops);
+
+#endif
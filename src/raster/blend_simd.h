@@ -0,0 +1,247 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef RASTER_BLEND_SIMD_H_INCLUDED
+#define RASTER_BLEND_SIMD_H_INCLUDED
+
+// Generic SIMD span blenders. This file is included from
+// blend_sse2.cpp and blend_avx2.cpp (each one compiled with its own
+// instruction set flags), so everything here must have internal
+// linkage. The "Ops" template parameter wraps the intrinsics of one
+// instruction set, where each vector contains Ops::N pixels expanded
+// to 32-bit lanes.
+//
+// The results are bit-exact with the scalar blenders of blend.cpp:
+// INT_MULT() is computed with integers, and divisions are computed
+// with single precision floats and truncated. A float division is
+// exact enough here: numerators are smaller than 2^16 and
+// denominators are in [1,255], so the rounded quotient never crosses
+// an integer.
+
+namespace {
+
+template<class Ops>
+struct SpanKernels {
+  typedef typename Ops::V V;
+  typedef typename Ops::F F;
+
+  // INT_MULT(a, b) for values in [0,255]
+  static inline V int_mult(V a, V b) {
+    V t = Ops::add(Ops::mul16(a, b), Ops::set1(0x80));
+    return Ops::template srli<8>(Ops::add(Ops::template srli<8>(t), t));
+  }
+
+  // Returns trunc(a*b/c) where a is signed and b, c are non-negative
+  // floats (c > 0).
+  static inline V mul_div(V a, F b, F c) {
+    return Ops::trunc(Ops::fdiv(Ops::fmul(Ops::tofloat(a), b), c));
+  }
+
+  static inline V channel(V c, int shift) {
+    return Ops::and_(Ops::srl(c, shift), Ops::set1(0xff));
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // RGBA
+
+  static inline V rgba_normal(V back, V front, V opacity) {
+    V zero = Ops::zero();
+    V B_a = Ops::template srli<24>(back);
+    V F_a = Ops::template srli<24>(front);
+    V F_a2 = int_mult(F_a, opacity);
+
+    // Back alpha == 0
+    V r1 = Ops::or_(Ops::and_(front, Ops::set1(0xffffff)),
+                    Ops::template slli<24>(F_a2));
+
+    // General case
+    V D_a = Ops::sub(Ops::add(B_a, F_a2), int_mult(B_a, F_a2));
+    F fa = Ops::tofloat(F_a2);
+    F da = Ops::fmax(Ops::tofloat(D_a), Ops::fset1(1.0f));
+    V r3 = Ops::template slli<24>(D_a);
+    for (int shift=0; shift<24; shift+=8) {
+      V B_c = channel(back, shift);
+      V F_c = channel(front, shift);
+      V D_c = Ops::add(B_c, mul_div(Ops::sub(F_c, B_c), fa, da));
+      r3 = Ops::or_(r3, Ops::sll(D_c, shift));
+    }
+
+    return Ops::select(Ops::cmpeq(B_a, zero), r1,
+                       Ops::select(Ops::cmpeq(F_a, zero), back, r3));
+  }
+
+  static inline V rgba_copy(V back, V front, V opacity) {
+    return front;
+  }
+
+  static inline V rgba_forpath(V back, V front, V opacity) {
+    V F_a = int_mult(Ops::template srli<24>(front), opacity);
+    return Ops::or_(Ops::and_(front, Ops::set1(0xffffff)),
+                    Ops::template slli<24>(F_a));
+  }
+
+  static inline V rgba_merge(V back, V front, V opacity) {
+    V zero = Ops::zero();
+    V B_a = Ops::template srli<24>(back);
+    V F_a = Ops::template srli<24>(front);
+    F op = Ops::tofloat(opacity);
+    F c255 = Ops::fset1(255.0f);
+    V B_zero = Ops::cmpeq(B_a, zero);
+    V F_zero = Ops::cmpeq(F_a, zero);
+
+    V D_a = Ops::add(B_a, mul_div(Ops::sub(F_a, B_a), op, c255));
+    V r = Ops::template slli<24>(D_a);
+    for (int shift=0; shift<24; shift+=8) {
+      V B_c = channel(back, shift);
+      V F_c = channel(front, shift);
+      V D_c = Ops::add(B_c, mul_div(Ops::sub(F_c, B_c), op, c255));
+      D_c = Ops::select(B_zero, F_c, Ops::select(F_zero, B_c, D_c));
+      r = Ops::or_(r, Ops::sll(D_c, shift));
+    }
+    return r;
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // Grayscale
+
+  static inline V graya_normal(V back, V front, V opacity) {
+    V zero = Ops::zero();
+    V B_a = Ops::template srli<8>(back);
+    V F_a = Ops::template srli<8>(front);
+    V F_a2 = int_mult(F_a, opacity);
+
+    // Back alpha == 0
+    V r1 = Ops::or_(Ops::and_(front, Ops::set1(0xff)),
+                    Ops::template slli<8>(F_a2));
+
+    // General case
+    V D_a = Ops::sub(Ops::add(B_a, F_a2), int_mult(B_a, F_a2));
+    F da = Ops::fmax(Ops::tofloat(D_a), Ops::fset1(1.0f));
+    V B_g = Ops::and_(back, Ops::set1(0xff));
+    V F_g = Ops::and_(front, Ops::set1(0xff));
+    V D_g = Ops::add(B_g, mul_div(Ops::sub(F_g, B_g), Ops::tofloat(F_a2), da));
+    V r3 = Ops::or_(D_g, Ops::template slli<8>(D_a));
+
+    return Ops::select(Ops::cmpeq(B_a, zero), r1,
+                       Ops::select(Ops::cmpeq(F_a, zero), back, r3));
+  }
+
+  static inline V graya_copy(V back, V front, V opacity) {
+    return front;
+  }
+
+  static inline V graya_forpath(V back, V front, V opacity) {
+    V F_a = int_mult(Ops::template srli<8>(front), opacity);
+    return Ops::or_(Ops::and_(front, Ops::set1(0xff)),
+                    Ops::template slli<8>(F_a));
+  }
+
+  static inline V graya_merge(V back, V front, V opacity) {
+    V zero = Ops::zero();
+    V B_a = Ops::template srli<8>(back);
+    V F_a = Ops::template srli<8>(front);
+    F op = Ops::tofloat(opacity);
+    F c255 = Ops::fset1(255.0f);
+
+    V B_g = Ops::and_(back, Ops::set1(0xff));
+    V F_g = Ops::and_(front, Ops::set1(0xff));
+    V D_g = Ops::add(B_g, mul_div(Ops::sub(F_g, B_g), op, c255));
+    D_g = Ops::select(Ops::cmpeq(B_a, zero), F_g,
+                      Ops::select(Ops::cmpeq(F_a, zero), B_g, D_g));
+    V D_a = Ops::add(B_a, mul_div(Ops::sub(F_a, B_a), op, c255));
+    return Ops::or_(D_g, Ops::template slli<8>(D_a));
+  }
+};
+
+// Span driver: processes blocks of Ops::N pixels with the vector
+// kernel and the remaining pixels with the scalar blender.
+template<class Ops,
+         typename Ops::V (*kernel)(typename Ops::V, typename Ops::V, typename Ops::V),
+         int (*blender)(int, int, int)>
+void rgba_span(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+               int n, int opacity, const uint32_t* mask_color)
+{
+  typedef typename Ops::V V;
+  V op = Ops::set1(opacity);
+  int i = 0;
+
+  if (mask_color) {
+    V mask = Ops::set1(*mask_color);
+    for (; i+Ops::N <= n; i+=Ops::N) {
+      V b = Ops::load32(back+i);
+      V f = Ops::load32(front+i);
+      Ops::store32(dst+i, Ops::select(Ops::cmpeq(f, mask), b, (*kernel)(b, f, op)));
+    }
+    for (; i<n; ++i)
+      dst[i] = (front[i] != *mask_color ? (*blender)(back[i], front[i], opacity): back[i]);
+  }
+  else {
+    for (; i+Ops::N <= n; i+=Ops::N)
+      Ops::store32(dst+i, (*kernel)(Ops::load32(back+i), Ops::load32(front+i), op));
+    for (; i<n; ++i)
+      dst[i] = (*blender)(back[i], front[i], opacity);
+  }
+}
+
+template<class Ops,
+         typename Ops::V (*kernel)(typename Ops::V, typename Ops::V, typename Ops::V),
+         int (*blender)(int, int, int)>
+void graya_span(uint16_t* dst, const uint16_t* back, const uint16_t* front,
+                int n, int opacity, const uint16_t* mask_color)
+{
+  typedef typename Ops::V V;
+  V op = Ops::set1(opacity);
+  int i = 0;
+
+  if (mask_color) {
+    V mask = Ops::set1(*mask_color);
+    for (; i+Ops::N <= n; i+=Ops::N) {
+      V b = Ops::load16(back+i);
+      V f = Ops::load16(front+i);
+      Ops::store16(dst+i, Ops::select(Ops::cmpeq(f, mask), b, (*kernel)(b, f, op)));
+    }
+    for (; i<n; ++i)
+      dst[i] = (front[i] != *mask_color ? (*blender)(back[i], front[i], opacity): back[i]);
+  }
+  else {
+    for (; i+Ops::N <= n; i+=Ops::N)
+      Ops::store16(dst+i, (*kernel)(Ops::load16(back+i), Ops::load16(front+i), op));
+    for (; i<n; ++i)
+      dst[i] = (*blender)(back[i], front[i], opacity);
+  }
+}
+
+} // anonymous namespace
+
+// Initializer of a BLEND_SPAN_FUNCS table (it's an aggregate of
+// function addresses, so it's initialized statically). The table
+// used by the span blenders is selected at startup (see
+// blend_span_init() in blend.cpp).
+#define BLEND_SPAN_FUNCS_INIT(Ops)                                      \
+  {                                                                     \
+    rgba_span<Ops, SpanKernels<Ops>::rgba_normal, _rgba_blend_normal>,    \
+    rgba_span<Ops, SpanKernels<Ops>::rgba_copy, _rgba_blend_copy>,        \
+    rgba_span<Ops, SpanKernels<Ops>::rgba_forpath, _rgba_blend_forpath>,  \
+    rgba_span<Ops, SpanKernels<Ops>::rgba_merge, _rgba_blend_merge>,      \
+    graya_span<Ops, SpanKernels<Ops>::graya_normal, _graya_blend_normal>, \
+    graya_span<Ops, SpanKernels<Ops>::graya_copy, _graya_blend_copy>,     \
+    graya_span<Ops, SpanKernels<Ops>::graya_forpath, _graya_blend_forpath>, \
+    graya_span<Ops, SpanKernels<Ops>::graya_merge, _graya_blend_merge>,   \
+  }
+
+#endif
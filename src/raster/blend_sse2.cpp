@@ -0,0 +1,77 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#ifdef HAVE_SSE2
+
+#include "raster/blend.h"
+#include "raster/blend_simd.h"
+
+#include <emmintrin.h>
+
+namespace {
+
+// 4 pixels per vector.
+struct Sse2Ops {
+  typedef __m128i V;
+  typedef __m128 F;
+  enum { N = 4 };
+
+  static inline V load32(const uint32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+  static inline void store32(uint32_t* p, V v) { _mm_storeu_si128((__m128i*)p, v); }
+
+  static inline V load16(const uint16_t* p) {
+    return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128());
+  }
+
+  static inline void store16(uint16_t* p, V v) {
+    // Sign-extend the low 16 bits so _mm_packs_epi32() doesn't saturate
+    v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+    _mm_storel_epi64((__m128i*)p, _mm_packs_epi32(v, v));
+  }
+
+  static inline V zero() { return _mm_setzero_si128(); }
+  static inline V set1(int a) { return _mm_set1_epi32(a); }
+  static inline V add(V a, V b) { return _mm_add_epi32(a, b); }
+  static inline V sub(V a, V b) { return _mm_sub_epi32(a, b); }
+  static inline V and_(V a, V b) { return _mm_and_si128(a, b); }
+  static inline V or_(V a, V b) { return _mm_or_si128(a, b); }
+  static inline V cmpeq(V a, V b) { return _mm_cmpeq_epi32(a, b); }
+  static inline V select(V m, V a, V b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+  template<int n> static inline V srli(V a) { return _mm_srli_epi32(a, n); }
+  template<int n> static inline V slli(V a) { return _mm_slli_epi32(a, n); }
+  static inline V srl(V a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+  static inline V sll(V a, int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+
+  // Multiplies values in [0,255] (the high 16 bits of each lane are zero)
+  static inline V mul16(V a, V b) { return _mm_mullo_epi16(a, b); }
+
+  static inline F tofloat(V a) { return _mm_cvtepi32_ps(a); }
+  static inline V trunc(F a) { return _mm_cvttps_epi32(a); }
+  static inline F fset1(float a) { return _mm_set1_ps(a); }
+  static inline F fmul(F a, F b) { return _mm_mul_ps(a, b); }
+  static inline F fdiv(F a, F b) { return _mm_div_ps(a, b); }
+  static inline F fmax(F a, F b) { return _mm_max_ps(a, b); }
+};
+
+} // anonymous namespace
+
+extern const BLEND_SPAN_FUNCS _blend_span_sse2 = BLEND_SPAN_FUNCS_INIT(Sse2Ops);
+
+#endif
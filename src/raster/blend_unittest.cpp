@@ -0,0 +1,170 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "raster/blend.h"
+#include "raster/image.h"
+
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+  // Alpha values where the blenders have special cases.
+  const int alphas[] = { 0, 1, 2, 127, 128, 129, 253, 254, 255 };
+  const int nalphas = sizeof(alphas) / sizeof(alphas[0]);
+
+  int random_alpha()
+  {
+    if (std::rand() % 2)
+      return alphas[std::rand() % nalphas];
+    else
+      return std::rand() % 256;
+  }
+
+  uint32_t random_rgba()
+  {
+    return _rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, random_alpha());
+  }
+
+  uint16_t random_graya()
+  {
+    return _graya(std::rand() % 256, random_alpha());
+  }
+
+  template<typename PixelType>
+  struct SpanTest {
+    typedef void (*Span)(PixelType*, const PixelType*, const PixelType*, int, int, const PixelType*);
+
+    // Compares the span function against the scalar blender for all
+    // opacities and lengths of spans (to test the scalar tails).
+    static void check(Span span, BLEND_COLOR blender, PixelType (*random_pixel)())
+    {
+      const int n = 67;
+      std::vector<PixelType> back(n), front(n), dst(n);
+      for (int i=0; i<n; ++i) {
+        back[i] = random_pixel();
+        front[i] = random_pixel();
+      }
+      PixelType mask = front[3];
+      front[n-1] = front[8] = mask;
+
+      for (int opacity=0; opacity<256; ++opacity) {
+        for (int len=n-17; len<=n; ++len) {
+          // Without mask color
+          span(&dst[0], &back[0], &front[0], len, opacity, NULL);
+          for (int i=0; i<len; ++i)
+            ASSERT_EQ((PixelType)blender(back[i], front[i], opacity), dst[i])
+              << "pixel " << i << " opacity " << opacity;
+
+          // With mask color
+          span(&dst[0], &back[0], &front[0], len, opacity, &mask);
+          for (int i=0; i<len; ++i) {
+            PixelType expected = (front[i] != mask ? blender(back[i], front[i], opacity): back[i]);
+            ASSERT_EQ(expected, dst[i]) << "pixel " << i << " opacity " << opacity;
+          }
+        }
+      }
+
+      // In-place blending (dst == back)
+      std::vector<PixelType> copy(back);
+      span(&copy[0], &copy[0], &front[0], n, 128, NULL);
+      for (int i=0; i<n; ++i)
+        ASSERT_EQ((PixelType)blender(back[i], front[i], 128), copy[i]);
+    }
+  };
+
+  void check_impl(int impl)
+  {
+    int old_impl = blend_span_get_impl();
+    if (!blend_span_set_impl(impl))
+      return;                   // Not supported by this CPU
+
+    std::srand(impl);
+    for (int i=0; i<4; ++i) {
+      SpanTest<uint32_t>::check(_rgba_blend_normal_span, _rgba_blend_normal, random_rgba);
+      SpanTest<uint32_t>::check(_rgba_blend_copy_span, _rgba_blend_copy, random_rgba);
+      SpanTest<uint32_t>::check(_rgba_blend_forpath_span, _rgba_blend_forpath, random_rgba);
+      SpanTest<uint32_t>::check(_rgba_blend_merge_span, _rgba_blend_merge, random_rgba);
+
+      SpanTest<uint16_t>::check(_graya_blend_normal_span, _graya_blend_normal, random_graya);
+      SpanTest<uint16_t>::check(_graya_blend_copy_span, _graya_blend_copy, random_graya);
+      SpanTest<uint16_t>::check(_graya_blend_forpath_span, _graya_blend_forpath, random_graya);
+      SpanTest<uint16_t>::check(_graya_blend_merge_span, _graya_blend_merge, random_graya);
+    }
+
+    blend_span_set_impl(old_impl);
+  }
+
+} // anonymous namespace
+
+TEST(Blend, ScalarSpans)
+{
+  check_impl(BLEND_SPAN_SCALAR);
+}
+
+TEST(Blend, Sse2Spans)
+{
+  check_impl(BLEND_SPAN_SSE2);
+}
+
+TEST(Blend, Avx2Spans)
+{
+  check_impl(BLEND_SPAN_AVX2);
+}
+
+TEST(Blend, ImageMerge)
+{
+  for (int fmt=0; fmt<2; ++fmt) {
+    PixelFormat imgtype = (fmt == 0 ? IMAGE_RGB: IMAGE_GRAYSCALE);
+    Image* dst = Image::create(imgtype, 37, 11);
+    Image* src = Image::create(imgtype, 29, 7);
+    Image* expected = Image::create(imgtype, 37, 11);
+
+    std::srand(fmt);
+    for (int y=0; y<dst->h; ++y)
+      for (int x=0; x<dst->w; ++x)
+        dst->putpixel(x, y, fmt == 0 ? random_rgba(): random_graya());
+    for (int y=0; y<src->h; ++y)
+      for (int x=0; x<src->w; ++x)
+        src->putpixel(x, y, fmt == 0 ? random_rgba(): random_graya());
+    src->mask_color = src->getpixel(5, 5);
+
+    BLEND_COLOR blender = (fmt == 0 ? _rgba_blend_normal: _graya_blend_normal);
+    for (int y=0; y<dst->h; ++y)
+      for (int x=0; x<dst->w; ++x) {
+        int u = x-13, v = y-2;
+        int c = dst->getpixel(x, y);
+        if (u >= 0 && v >= 0 && u < src->w && v < src->h &&
+            (uint32_t)src->getpixel(u, v) != src->mask_color)
+          c = blender(c, src->getpixel(u, v), 200);
+        expected->putpixel(x, y, c);
+      }
+
+    dst->merge(src, 13, 2, 200, BLEND_MODE_NORMAL);
+
+    for (int y=0; y<dst->h; ++y)
+      for (int x=0; x<dst->w; ++x)
+        ASSERT_EQ(expected->getpixel(x, y), dst->getpixel(x, y));
+
+    delete dst;
+    delete src;
+    delete expected;
+  }
+}
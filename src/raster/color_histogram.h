@@ -19,6 +19,8 @@
 #ifndef RASTER_COLOR_HISTOGRAM_H_INCLUDED
 #define RASTER_COLOR_HISTOGRAM_H_INCLUDED
 
+#include <algorithm>
+#include <limits>
 #include <vector>
 #include "raster/image.h"
 #include "raster/image_traits.h"
@@ -38,10 +40,21 @@ public:
     BElements = 1 << BBits
   };
 
-  ColorHistogram()
+  // If "fullPrecision" is true, the histogram accumulates the 8-bit
+  // components of the samples of each entry, so the colors created
+  // by median-cut are not limited to the histogram resolution.
+  ColorHistogram(bool fullPrecision = false)
     : m_histogram(RElements*GElements*BElements, 0)
     , m_useHighPrecision(true)
+    , m_lastColor(0)
   {
+    if (fullPrecision)
+      m_sums.resize(3*RElements*GElements*BElements, 0.0);
+  }
+
+  bool isFullPrecision() const
+  {
+    return !m_sums.empty();
   }
 
   // Returns the number of points in the specified histogram
@@ -52,21 +65,36 @@ public:
     return m_histogram[histogramIndex(i, j, k)];
   }
 
+  // Returns the sum of the given component (0=red, 1=green, 2=blue)
+  // of all samples in the specified entry. Only for full-precision
+  // histograms.
+  double componentSum(int i, int j, int k, int component) const
+  {
+    ASSERT(isFullPrecision());
+    return m_sums[3*histogramIndex(i, j, k) + component];
+  }
+
   // Add the specified "color" in the histogram as many times as the
   // specified value in "count".
   void addSamples(uint32_t color, size_t count = 1)
   {
     int i = histogramIndex(color);
 
-    if (m_histogram[i] < std::numeric_limits<size_t>::max()-count) // Avoid overflow
-      m_histogram[i] += count;
-    else
-      m_histogram[i] = std::numeric_limits<size_t>::max();
+    addCount(m_histogram[i], count);
+
+    if (!m_sums.empty()) {
+      m_sums[3*i  ] += double(_rgba_getr(color)) * count;
+      m_sums[3*i+1] += double(_rgba_getg(color)) * count;
+      m_sums[3*i+2] += double(_rgba_getb(color)) * count;
+    }
 
     // Accurate colors are used only for less than 256 colors.  If the
     // image has more than 256 colors the m_histogram is used
-    // instead.
-    if (m_useHighPrecision) {
+    // instead. Consecutive samples usually are the same color, so we
+    // can avoid searching the last added color.
+    if (m_useHighPrecision && (m_highPrecision.empty() || color != m_lastColor)) {
+      m_lastColor = color;
+
       std::vector<uint32_t>::iterator it =
         std::find(m_highPrecision.begin(), m_highPrecision.end(), color);
 
@@ -83,6 +111,42 @@ public:
     }
   }
 
+  // Adds all samples of "other" histogram in this one. The colors of
+  // "other" are considered as added after the colors of this
+  // histogram (so the order of the high-precision table is the same
+  // as if all samples were added in this histogram).
+  void merge(const ColorHistogram& other)
+  {
+    ASSERT(isFullPrecision() == other.isFullPrecision());
+
+    for (size_t i=0; i<m_histogram.size(); ++i)
+      addCount(m_histogram[i], other.m_histogram[i]);
+
+    for (size_t i=0; i<m_sums.size(); ++i)
+      m_sums[i] += other.m_sums[i];
+
+    if (m_useHighPrecision) {
+      if (!other.m_useHighPrecision) {
+        m_useHighPrecision = false;
+      }
+      else {
+        for (size_t i=0; i<other.m_highPrecision.size(); ++i) {
+          uint32_t color = other.m_highPrecision[i];
+          if (std::find(m_highPrecision.begin(), m_highPrecision.end(), color) != m_highPrecision.end())
+            continue;
+
+          if (m_highPrecision.size() < 256) {
+            m_highPrecision.push_back(color);
+          }
+          else {
+            m_useHighPrecision = false;
+            break;
+          }
+        }
+      }
+    }
+  }
+
   // Creates a set of entries for the given palette in the given range
   // with the more important colors in the histogram. Returns the
   // number of used entries in the palette (maybe the range [from,to]
@@ -110,6 +174,14 @@ public:
   }
 
 private:
+  static void addCount(size_t& value, size_t count)
+  {
+    if (value < std::numeric_limits<size_t>::max()-count) // Avoid overflow
+      value += count;
+    else
+      value = std::numeric_limits<size_t>::max();
+  }
+
   // Converts input color in a index for the histogram. It reduces
   // each 8-bit component to the resolution given in the template
   // parameters.
@@ -135,6 +207,13 @@ private:
   // True if we can use m_highPrecision still (it means that the
   // number of different samples is less than 256 colors still).
   bool m_useHighPrecision;
+
+  // Last color added in m_highPrecision (or found in it).
+  uint32_t m_lastColor;
+
+  // Sum of the RGB components of the samples in each histogram entry
+  // (empty if the histogram isn't full-precision).
+  std::vector<double> m_sums;
 };
 
 }
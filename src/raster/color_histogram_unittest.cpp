@@ -0,0 +1,86 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "raster/color_histogram.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace quantization;
+
+typedef ColorHistogram<5, 6, 5> Histogram;
+
+namespace {
+
+  void check_merge(int ncolors, bool fullPrecision)
+  {
+    std::vector<uint32_t> samples(5000);
+    std::srand(ncolors);
+    for (size_t i=0; i<samples.size(); ++i) {
+      int c = std::rand() % ncolors;
+      samples[i] = _rgba(c*7 % 256, c*13 % 256, c*29 % 256, 255);
+    }
+
+    // All samples in one histogram vs. three merged histograms
+    Histogram whole(fullPrecision), a(fullPrecision), b(fullPrecision), c(fullPrecision);
+    for (size_t i=0; i<samples.size(); ++i) {
+      whole.addSamples(samples[i]);
+      if (i < 1000) a.addSamples(samples[i]);
+      else if (i < 3000) b.addSamples(samples[i]);
+      else c.addSamples(samples[i]);
+    }
+    a.merge(b);
+    a.merge(c);
+
+    Palette pal1(FrameNumber(0), 256), pal2(FrameNumber(0), 256);
+    int n1 = whole.createOptimizedPalette(&pal1, 1, 255);
+    int n2 = a.createOptimizedPalette(&pal2, 1, 255);
+    ASSERT_EQ(n1, n2);
+    for (int i=0; i<pal1.size(); ++i)
+      EXPECT_EQ(pal1.getEntry(i), pal2.getEntry(i));
+  }
+
+} // anonymous namespace
+
+TEST(ColorHistogram, Merge)
+{
+  check_merge(100, false);      // High-precision table
+  check_merge(1000, false);     // Median-cut
+  check_merge(1000, true);
+}
+
+TEST(ColorHistogram, FullPrecision)
+{
+  // Two close colors in the same histogram entry
+  Histogram histogram(true);
+  histogram.addSamples(_rgba(9, 9, 9, 255), 1);
+  histogram.addSamples(_rgba(11, 11, 11, 255), 1);
+  for (int i=0; i<300; ++i)
+    histogram.addSamples(_rgba(200, i % 256, 255 - i % 256, 255), 1);
+
+  Palette pal(FrameNumber(0), 256);
+  histogram.createOptimizedPalette(&pal, 0, 255);
+
+  bool found = false;
+  for (int i=0; i<pal.size(); ++i)
+    if (pal.getEntry(i) == _rgba(10, 10, 10, 255))
+      found = true;
+  EXPECT_TRUE(found);
+}
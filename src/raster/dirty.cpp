@@ -20,8 +20,54 @@
 
 #include "raster/dirty.h"
 #include "raster/image.h"
+#include "raster/image_traits.h"
 
 #include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Adds to "dirty" one span for each row of each tile where the
+// pixels of "image1" and "image2" are different.
+template<class Traits>
+void add_different_spans(Dirty* dirty, const Image* image1, const Image* image2)
+{
+  typedef typename Traits::pixel_t pixel_t;
+  const int tileSize = Dirty::kTileSize;
+
+  for (int ty=0; ty<image1->h; ty+=tileSize) {
+    int th = MIN(tileSize, image1->h-ty);
+
+    for (int tx=0; tx<image1->w; tx+=tileSize) {
+      int tw = MIN(tileSize, image1->w-tx);
+      bool tileAdded = false;
+
+      for (int y=ty; y<ty+th; ++y) {
+        const pixel_t* a = ((const pixel_t*)image1->line[y]) + tx;
+        const pixel_t* b = ((const pixel_t*)image2->line[y]) + tx;
+
+        if (std::memcmp(a, b, tw*sizeof(pixel_t)) == 0)
+          continue;
+
+        int x1 = 0;
+        while (a[x1] == b[x1])
+          ++x1;
+
+        int x2 = tw-1;
+        while (a[x2] == b[x2])
+          --x2;
+
+        if (!tileAdded) {
+          dirty->addTile(tx, ty);
+          tileAdded = true;
+        }
+        dirty->addSpan(tx+x1, y, x2-x1+1);
+      }
+    }
+  }
+}
+
+} // anonymous namespace
 
 Dirty::Dirty(PixelFormat format, int x1, int y1, int x2, int y2)
   : m_format(format)
@@ -34,22 +80,10 @@ Dirty::Dirty(const Dirty& src)
   : m_format(src.m_format)
   , m_x1(src.m_x1), m_y1(src.m_y1)
   , m_x2(src.m_x2), m_y2(src.m_y2)
+  , m_tiles(src.m_tiles)
+  , m_spans(src.m_spans)
+  , m_data(src.m_data)
 {
-  m_rows.resize(src.m_rows.size());
-
-  for (size_t v=0; v<m_rows.size(); ++v) {
-    const Row& srcRow = src.getRow(v);
-    Row* row = new Row(srcRow.y);
-
-    row->cols.resize(srcRow.cols.size());
-
-    for (size_t u=0; u<row->cols.size(); ++u) {
-      Col* col = new Col(*srcRow.cols[u]);
-      row->cols[u] = col;
-    }
-
-    m_rows[v] = row;
-  }
 }
 
 Dirty::Dirty(Image* image, Image* image_diff)
@@ -57,102 +91,72 @@ Dirty::Dirty(Image* image, Image* image_diff)
   , m_x1(0), m_y1(0)
   , m_x2(image->w-1), m_y2(image->h-1)
 {
-  int x, y, x1, x2;
-
-  for (y=0; y<image->h; y++) {
-    x1 = -1;
-    for (x=0; x<image->w; x++) {
-      if (image_getpixel(image, x, y) != image_getpixel(image_diff, x, y)) {
-        x1 = x;
-        break;
-      }
-    }
-    if (x1 < 0)
-      continue;
-
-    for (x2=image->w-1; x2>x1; x2--) {
-      if (image_getpixel(image, x2, y) != image_getpixel(image_diff, x2, y))
-        break;
-    }
-
-    Col* col = new Col(x1, x2-x1+1);
-    col->data.resize(getLineSize(col->w));
-
-    Row* row = new Row(y);
-    row->cols.push_back(col);
-
-    m_rows.push_back(row);
+  ASSERT(image->getPixelFormat() == image_diff->getPixelFormat());
+  ASSERT(image->w == image_diff->w && image->h == image_diff->h);
+
+  switch (m_format) {
+    case IMAGE_RGB:
+      add_different_spans<RgbTraits>(this, image, image_diff);
+      break;
+    case IMAGE_GRAYSCALE:
+      add_different_spans<GrayscaleTraits>(this, image, image_diff);
+      break;
+    case IMAGE_INDEXED:
+      add_different_spans<IndexedTraits>(this, image, image_diff);
+      break;
+    default:
+      ASSERT(false && "Dirty doesn't support bitmap images");
+      break;
   }
 }
 
-Dirty::~Dirty()
+int Dirty::getMemSize() const
 {
-  RowsList::iterator row_it = m_rows.begin();
-  RowsList::iterator row_end = m_rows.end();
-
-  for (; row_it != row_end; ++row_it) {
-    ColsList::iterator col_it = (*row_it)->cols.begin();
-    ColsList::iterator col_end = (*row_it)->cols.end();
-
-    for (; col_it != col_end; ++col_it)
-      delete *col_it;
+  int size = 4+1+2*4+4;         // DWORD+BYTE+WORD[4]+DWORD
+  size += m_tiles.size() * 6;   // x, y, spans (WORD[3])
+  size += m_spans.size() * 6;   // x, y, w (WORD[3])
+  size += m_data.size();
+  return size;
+}
 
-    delete *row_it;
-  }
+void Dirty::addTile(int x, int y)
+{
+  m_tiles.push_back(Tile(x, y, m_spans.size()));
 }
 
-int Dirty::getMemSize() const
+const Dirty::Span& Dirty::addSpan(int x, int y, int w)
 {
-  int size = 4+1+2*4+2;         // DWORD+BYTE+WORD[4]+WORD
-
-  RowsList::const_iterator row_it = m_rows.begin();
-  RowsList::const_iterator row_end = m_rows.end();
-  for (; row_it != row_end; ++row_it) {
-    size += 4;                  // y, cols (WORD[2])
-
-    ColsList::const_iterator col_it = (*row_it)->cols.begin();
-    ColsList::const_iterator col_end = (*row_it)->cols.end();
-    for (; col_it != col_end; ++col_it) {
-      size += 4;                // x, w (WORD[2])
-      size += getLineSize((*col_it)->w);
-    }
-  }
+  ASSERT(!m_tiles.empty());
+  ASSERT(w > 0);
 
-  return size;
+  m_spans.push_back(Span(x, y, w, m_data.size()));
+  m_tiles.back().spans++;
+
+  // The vector grows geometrically, so the pixels of a lot of spans
+  // need just a few allocations.
+  m_data.resize(m_data.size() + getLineSize(w));
+
+  return m_spans.back();
 }
 
 void Dirty::saveImagePixels(Image* image)
 {
-  RowsList::iterator row_it = m_rows.begin();
-  RowsList::iterator row_end = m_rows.end();
-  for (; row_it != row_end; ++row_it) {
-    Row* row = *row_it;
-
-    ColsList::iterator col_it = (*row_it)->cols.begin();
-    ColsList::iterator col_end = (*row_it)->cols.end();
-    for (; col_it != col_end; ++col_it) {
-      Col* col = *col_it;
-
-      uint8_t* address = (uint8_t*)image_address(image, col->x, row->y);
-      std::copy(address, address+getLineSize(col->w), col->data.begin());
-    }
+  SpansList::iterator it = m_spans.begin();
+  SpansList::iterator end = m_spans.end();
+  for (; it != end; ++it) {
+    uint8_t* address = (uint8_t*)image_address(image, it->x, it->y);
+    std::copy(address, address+getLineSize(it->w), m_data.begin()+it->offset);
   }
 }
 
 void Dirty::swapImagePixels(Image* image)
 {
-  RowsList::iterator row_it = m_rows.begin();
-  RowsList::iterator row_end = m_rows.end();
-  for (; row_it != row_end; ++row_it) {
-    Row* row = *row_it;
-
-    ColsList::iterator col_it = (*row_it)->cols.begin();
-    ColsList::iterator col_end = (*row_it)->cols.end();
-    for (; col_it != col_end; ++col_it) {
-      Col* col = *col_it;
-
-      uint8_t* address = (uint8_t*)image_address(image, col->x, row->y);
-      std::swap_ranges(address, address+getLineSize(col->w), col->data.begin());
-    }
+  image->incrementModifications();
+
+  SpansList::iterator it = m_spans.begin();
+  SpansList::iterator end = m_spans.end();
+  for (; it != end; ++it) {
+    uint8_t* address = (uint8_t*)image_address(image, it->x, it->y);
+    std::swap_ranges(address, address+getLineSize(it->w), m_data.begin()+it->offset);
   }
 }
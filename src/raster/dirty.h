@@ -27,35 +27,40 @@ class Pen;
 class Image;
 class Mask;
 
-#define DIRTY_VALID_COLUMN      1
-#define DIRTY_MUSTBE_UPDATED    2
-
+// Keeps a copy of the modified pixels of an image to swap them later
+// (e.g. to undo/redo a brush stroke). The image is divided in tiles
+// of kTileSize x kTileSize pixels, and only modified tiles are
+// tracked. Each tile contains a list of spans (one for each row of
+// the tile with modified pixels), and the pixels of all spans are
+// stored contiguously in one buffer, so a long stroke doesn't need
+// one allocation per modified row.
 class Dirty {
 public:
-  struct Col;
-  struct Row;
-
-  typedef std::vector<Col*> ColsList;
-  typedef std::vector<Row*> RowsList;
+  enum { kTileSize = 32 };
 
-  struct Col {
-    int x, w;
-    std::vector<uint8_t> data;
+  struct Span {
+    int x, y, w;
+    size_t offset;              // Offset of the pixels in getData()
 
-    Col(int x, int w) : x(x), w(w) { }
+    Span(int x, int y, int w, size_t offset)
+      : x(x), y(y), w(w), offset(offset) { }
   };
 
-  struct Row {
-    int y;
-    ColsList cols;
+  struct Tile {
+    int x, y;                   // Position of the tile (in pixels)
+    int span;                   // First span of the tile
+    int spans;                  // Number of spans
 
-    Row(int y) : y(y) { }
+    Tile(int x, int y, int span)
+      : x(x), y(y), span(span), spans(0) { }
   };
 
+  typedef std::vector<Span> SpansList;
+  typedef std::vector<Tile> TilesList;
+
   Dirty(PixelFormat format, int x1, int y1, int x2, int y2);
   Dirty(const Dirty& src);
   Dirty(Image* image1, Image* image2);
-  ~Dirty();
 
   int getMemSize() const;
 
@@ -65,13 +70,24 @@ public:
   int x2() const { return m_x2; }
   int y2() const { return m_y2; }
 
-  int getRowsCount() const { return m_rows.size(); }
-  const Row& getRow(int i) const { return *m_rows[i]; }
+  int getTilesCount() const { return m_tiles.size(); }
+  const Tile& getTile(int i) const { return m_tiles[i]; }
+
+  int getSpansCount() const { return m_spans.size(); }
+  const Span& getSpan(int i) const { return m_spans[i]; }
+
+  const uint8_t* getData() const { return m_data.empty() ? NULL: &m_data[0]; }
+  uint8_t* getData() { return m_data.empty() ? NULL: &m_data[0]; }
 
   inline int getLineSize(int width) const {
     return pixelformat_line_size(m_format, width);
   }
 
+  // Adds a new tile at the given position, the following calls to
+  // addSpan() add spans (and space for their pixels) to this tile.
+  void addTile(int x, int y);
+  const Span& addSpan(int x, int y, int w);
+
   void saveImagePixels(Image* image);
   void swapImagePixels(Image* image);
 
@@ -81,16 +97,12 @@ private:
   // Disable copying through operator=
   Dirty& operator=(const Dirty&);
 
-//private: // TODO these fields are public because Undo creates
-public:    // a Dirty instance from a deserialization process,
-           // remember to "privatize" these members when the
-           // new Undo implementation is finished.
-
   PixelFormat m_format;
   int m_x1, m_y1;
   int m_x2, m_y2;
-  RowsList m_rows;
-
+  TilesList m_tiles;
+  SpansList m_spans;
+  std::vector<uint8_t> m_data;  // Pixels of all spans
 };
 
 #endif
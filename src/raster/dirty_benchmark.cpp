@@ -0,0 +1,172 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tests/test.h"
+
+#include "base/chrono.h"
+#include "base/unique_ptr.h"
+#include "raster/dirty.h"
+#include "raster/image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Counts all allocations of the benchmark process.
+static size_t allocations = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+  ++allocations;
+  void* ptr = std::malloc(size > 0 ? size: 1);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) throw()
+{
+  std::free(ptr);
+}
+
+namespace {
+
+  // The previous Dirty implementation: a list of rows, each one with
+  // a list of columns with their own buffer of pixels.
+  class RowsDirty {
+  public:
+    struct Col {
+      int x, w;
+      std::vector<uint8_t> data;
+      Col(int x, int w) : x(x), w(w) { }
+    };
+
+    struct Row {
+      int y;
+      std::vector<Col*> cols;
+      Row(int y) : y(y) { }
+    };
+
+    RowsDirty(Image* image, Image* image_diff) {
+      for (int y=0; y<image->h; y++) {
+        int x1 = -1, x2;
+        for (int x=0; x<image->w; x++) {
+          if (image_getpixel(image, x, y) != image_getpixel(image_diff, x, y)) {
+            x1 = x;
+            break;
+          }
+        }
+        if (x1 < 0)
+          continue;
+
+        for (x2=image->w-1; x2>x1; x2--) {
+          if (image_getpixel(image, x2, y) != image_getpixel(image_diff, x2, y))
+            break;
+        }
+
+        Col* col = new Col(x1, x2-x1+1);
+        col->data.resize(image_line_size(image, col->w));
+
+        Row* row = new Row(y);
+        row->cols.push_back(col);
+        m_rows.push_back(row);
+      }
+    }
+
+    ~RowsDirty() {
+      for (size_t v=0; v<m_rows.size(); ++v) {
+        for (size_t u=0; u<m_rows[v]->cols.size(); ++u)
+          delete m_rows[v]->cols[u];
+        delete m_rows[v];
+      }
+    }
+
+    void saveImagePixels(Image* image) {
+      for (size_t v=0; v<m_rows.size(); ++v) {
+        Row* row = m_rows[v];
+        for (size_t u=0; u<row->cols.size(); ++u) {
+          Col* col = row->cols[u];
+          uint8_t* address = (uint8_t*)image_address(image, col->x, row->y);
+          std::copy(address, address+image_line_size(image, col->w), col->data.begin());
+        }
+      }
+    }
+
+    void swapImagePixels(Image* image) {
+      for (size_t v=0; v<m_rows.size(); ++v) {
+        Row* row = m_rows[v];
+        for (size_t u=0; u<row->cols.size(); ++u) {
+          Col* col = row->cols[u];
+          uint8_t* address = (uint8_t*)image_address(image, col->x, row->y);
+          std::swap_ranges(address, address+image_line_size(image, col->w), col->data.begin());
+        }
+      }
+    }
+
+  private:
+    std::vector<Row*> m_rows;
+  };
+
+  // Draws a long freehand-like stroke (a Lissajous curve) with a
+  // square pen of 5x5 pixels.
+  void draw_long_stroke(Image* image, int points)
+  {
+    for (int i=0; i<points; ++i) {
+      double t = 2.0 * 3.14159265 * i / points;
+      int x = int(image->w/2 + (image->w/2-8) * std::sin(3*t));
+      int y = int(image->h/2 + (image->h/2-8) * std::sin(4*t));
+      image_rectfill(image, x-2, y-2, x+2, y+2, _rgba(255, 0, 0, 255));
+    }
+  }
+
+  template<class DirtyType>
+  void run_benchmark(const char* name, Image* original, Image* modified, int swaps)
+  {
+    UniquePtr<Image> image(Image::createCopy(original));
+
+    size_t allocs = allocations;
+    base::Chrono chrono;
+    UniquePtr<DirtyType> dirty(new DirtyType(image, modified));
+    dirty->saveImagePixels(image);
+    double createTime = chrono.elapsed();
+    allocs = allocations - allocs;
+
+    chrono.reset();
+    for (int i=0; i<swaps; ++i)
+      dirty->swapImagePixels(image);
+    double swapTime = chrono.elapsed();
+
+    std::printf("%s: %d allocations, create %.4f s, %d swaps %.4f s\n",
+                name, (int)allocs, createTime, swaps, swapTime);
+  }
+
+} // anonymous namespace
+
+TEST(DirtyBenchmark, LongStroke)
+{
+  UniquePtr<Image> original(Image::create(IMAGE_RGB, 2048, 2048));
+  image_clear(original, _rgba(255, 255, 255, 255));
+
+  UniquePtr<Image> modified(Image::createCopy(original));
+  draw_long_stroke(modified, 20000);
+
+  run_benchmark<RowsDirty>("Rows/columns", original, modified, 100);
+  run_benchmark<Dirty>("Tiles", original, modified, 100);
+}
@@ -35,15 +35,15 @@ using namespace base::serialization::little_endian;
 //
 //    BYTE              image type
 //    WORD[4]           x1, y1, x2, y2
-//    WORD              rows
-//    for each row
-//      WORD[2]         y, columns
-//      for each column
-//       WORD[2]        x, w
-//       for each pixel ("w" times)
-//         BYTE[4]      for RGB images, or
-//         BYTE[2]      for Grayscale images, or
-//         BYTE         for Indexed images
+//    DWORD             tiles
+//    for each tile
+//      WORD[3]         x, y, spans
+//      for each span
+//        WORD[3]       x, y, w
+//        for each pixel ("w" times)
+//          BYTE[4]     for RGB images, or
+//          BYTE[2]     for Grayscale images, or
+//          BYTE        for Indexed images
 
 void write_dirty(std::ostream& os, Dirty* dirty)
 {
@@ -52,27 +52,31 @@ void write_dirty(std::ostream& os, Dirty* dirty)
   write16(os, dirty->y1());
   write16(os, dirty->x2());
   write16(os, dirty->y2());
-  write16(os, dirty->getRowsCount());
+  write32(os, dirty->getTilesCount());
 
-  for (int v=0; v<dirty->getRowsCount(); v++) {
-    const Dirty::Row& row = dirty->getRow(v);
+  const uint8_t* data = dirty->getData();
 
-    write16(os, row.y);
-    write16(os, row.cols.size());
+  for (int t=0; t<dirty->getTilesCount(); t++) {
+    const Dirty::Tile& tile = dirty->getTile(t);
 
-    for (size_t u=0; u<row.cols.size(); u++) {
-      write16(os, row.cols[u]->x);
-      write16(os, row.cols[u]->w);
+    write16(os, tile.x);
+    write16(os, tile.y);
+    write16(os, tile.spans);
 
-      size_t size = dirty->getLineSize(row.cols[u]->w);
-      os.write((char*)&row.cols[u]->data[0], size);
+    for (int s=tile.span; s<tile.span+tile.spans; s++) {
+      const Dirty::Span& span = dirty->getSpan(s);
+
+      write16(os, span.x);
+      write16(os, span.y);
+      write16(os, span.w);
+
+      os.write((const char*)data+span.offset, dirty->getLineSize(span.w));
     }
   }
 }
 
 Dirty* read_dirty(std::istream& is)
 {
-  int u, v, x, y, w;
   int pixelFormat = read8(is);
   int x1 = read16(is);
   int y1 = read16(is);
@@ -80,34 +84,21 @@ Dirty* read_dirty(std::istream& is)
   int y2 = read16(is);
   UniquePtr<Dirty> dirty(new Dirty(static_cast<PixelFormat>(pixelFormat), x1, y1, x2, y2));
 
-  int noRows = read16(is);
-  if (noRows > 0) {
-    dirty->m_rows.resize(noRows);
-
-    for (v=0; v<dirty->getRowsCount(); v++) {
-      y = read16(is);
-
-      UniquePtr<Dirty::Row> row(new Dirty::Row(y));
+  int noTiles = read32(is);
+  for (int t=0; t<noTiles; t++) {
+    int x = read16(is);
+    int y = read16(is);
+    int noSpans = read16(is);
 
-      int noCols = read16(is);
-      row->cols.resize(noCols);
+    dirty->addTile(x, y);
 
-      for (u=0; u<noCols; u++) {
-        x = read16(is);
-        w = read16(is);
-
-        UniquePtr<Dirty::Col> col(new Dirty::Col(x, w));
-
-        int size = dirty->getLineSize(col->w);
-        ASSERT(size > 0);
-
-        col->data.resize(size);
-        is.read((char*)&col->data[0], size);
-
-        row->cols[u] = col.release();
-      }
+    for (int s=0; s<noSpans; s++) {
+      x = read16(is);
+      y = read16(is);
+      int w = read16(is);
 
-      dirty->m_rows[v] = row.release();
+      const Dirty::Span& span = dirty->addSpan(x, y, w);
+      is.read((char*)dirty->getData()+span.offset, dirty->getLineSize(w));
     }
   }
 
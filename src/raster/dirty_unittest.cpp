@@ -0,0 +1,125 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tests/test.h"
+
+#include "base/unique_ptr.h"
+#include "raster/dirty.h"
+#include "raster/dirty_io.h"
+#include "raster/image.h"
+
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+  Image* create_random_image(PixelFormat format, int w, int h)
+  {
+    Image* image = Image::create(format, w, h);
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        image_putpixel(image, x, y, std::rand() & 0xff);
+    return image;
+  }
+
+  bool same_pixels(const Image* a, const Image* b)
+  {
+    for (int y=0; y<a->h; ++y)
+      for (int x=0; x<a->w; ++x)
+        if (image_getpixel(a, x, y) != image_getpixel(b, x, y))
+          return false;
+    return true;
+  }
+
+} // anonymous namespace
+
+TEST(Dirty, SpansInsideTiles)
+{
+  UniquePtr<Image> a(Image::create(IMAGE_INDEXED, 100, 50));
+  image_clear(a, 0);
+  UniquePtr<Image> b(Image::createCopy(a));
+
+  // Two pixels in the same row but in different tiles
+  image_putpixel(b, 3, 5, 1);
+  image_putpixel(b, 40, 5, 1);
+  // Another row in the second tile
+  image_putpixel(b, 35, 10, 1);
+  // A horizontal line that crosses three tiles
+  image_hline(b, 30, 40, 70, 1);
+  // The last (clipped) tile
+  image_putpixel(b, 99, 49, 1);
+
+  Dirty dirty(a, b);
+  ASSERT_EQ(6, dirty.getTilesCount());
+  ASSERT_EQ(7, dirty.getSpansCount());
+
+  EXPECT_EQ(0, dirty.getTile(0).x);
+  EXPECT_EQ(0, dirty.getTile(0).y);
+  EXPECT_EQ(1, dirty.getTile(0).spans);
+  EXPECT_EQ(3, dirty.getSpan(0).x);
+  EXPECT_EQ(5, dirty.getSpan(0).y);
+  EXPECT_EQ(1, dirty.getSpan(0).w);
+
+  EXPECT_EQ(32, dirty.getTile(1).x);
+  EXPECT_EQ(0, dirty.getTile(1).y);
+  EXPECT_EQ(2, dirty.getTile(1).spans);
+  EXPECT_EQ(40, dirty.getSpan(1).x);
+  EXPECT_EQ(35, dirty.getSpan(2).x);
+  EXPECT_EQ(10, dirty.getSpan(2).y);
+
+  EXPECT_EQ(0, dirty.getTile(2).x);
+  EXPECT_EQ(32, dirty.getTile(2).y);
+  EXPECT_EQ(30, dirty.getSpan(3).x);
+  EXPECT_EQ(2, dirty.getSpan(3).w);
+  EXPECT_EQ(32, dirty.getSpan(4).x);
+  EXPECT_EQ(32, dirty.getSpan(4).w);
+  EXPECT_EQ(64, dirty.getSpan(5).x);
+  EXPECT_EQ(7, dirty.getSpan(5).w);
+
+  EXPECT_EQ(96, dirty.getTile(5).x);
+  EXPECT_EQ(99, dirty.getSpan(6).x);
+  EXPECT_EQ(49, dirty.getSpan(6).y);
+}
+
+TEST(Dirty, SaveAndSwapPixels)
+{
+  PixelFormat formats[] = { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED };
+
+  for (int i=0; i<3; ++i) {
+    std::srand(i);
+    UniquePtr<Image> original(create_random_image(formats[i], 77, 91));
+    UniquePtr<Image> modified(Image::createCopy(original));
+    for (int c=0; c<200; ++c)
+      image_putpixel(modified, std::rand() % 77, std::rand() % 91, std::rand());
+
+    UniquePtr<Image> image(Image::createCopy(original));
+    UniquePtr<Dirty> dirty(new Dirty(image, modified));
+    dirty->saveImagePixels(image);
+    image_copy(image, modified, 0, 0);
+
+    // Undo
+    dirty->swapImagePixels(image);
+    EXPECT_TRUE(same_pixels(original, image));
+
+    // Redo (from a serialized copy)
+    std::stringstream stream;
+    raster::write_dirty(stream, dirty);
+    dirty.reset(raster::read_dirty(stream));
+    dirty->swapImagePixels(image);
+    EXPECT_TRUE(same_pixels(modified, image));
+  }
+}
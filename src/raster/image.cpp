@@ -35,6 +35,7 @@
 Image::Image(PixelFormat format, int w, int h)
   : GfxObj(GFXOBJ_IMAGE)
   , m_format(format)
+  , m_modifications(0)
 {
   this->w = w;
   this->h = h;
@@ -360,6 +361,8 @@ void image_fixup_transparent_colors(Image* image)
 {
   int x, y, u, v;
 
+  image->incrementModifications();
+
   switch (image->getPixelFormat()) {
 
     case IMAGE_RGB: {
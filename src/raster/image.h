@@ -55,6 +55,13 @@ public:
 
   int getMemSize() const;
 
+  // Number of modifications of the pixels (to know if some rendered
+  // version of the image must be updated). Member functions that
+  // modify pixels increment it, functions that modify pixels through
+  // "line" or "dat" must call incrementModifications().
+  int getModifications() const { return m_modifications; }
+  void incrementModifications() { ++m_modifications; }
+
   virtual int getpixel(int x, int y) const = 0;
   virtual void putpixel(int x, int y, int color) = 0;
   virtual void clear(int color) = 0;
@@ -67,6 +74,7 @@ public:
 
 private:
   PixelFormat m_format;
+  int m_modifications;
 };
 
 void image_free(Image* image);
@@ -79,11 +79,13 @@ public:
 
   virtual void putpixel(int x, int y, int color)
   {
+    incrementModifications();
     image_putpixel_fast<Traits>(this, x, y, color);
   }
 
   virtual void clear(int color)
   {
+    incrementModifications();
     address_t addr = raw_pixels();
     unsigned int c, size = w*h;
 
@@ -132,6 +134,7 @@ public:
 
     // copy process
 
+    incrementModifications();
     bytes = Traits::scanline_size(xend - xbeg + 1);
 
     for (ydst=ybeg; ydst<=yend; ydst++, ysrc++) {
@@ -144,12 +147,15 @@ public:
 
   virtual void merge(const Image* src, int x, int y, int opacity, int blend_mode)
   {
-    BLEND_COLOR blender = Traits::get_blender(blend_mode);
-    register uint32_t mask_color = src->mask_color;
+    typename Traits::span_blender_t blender = Traits::get_span_blender(blend_mode);
+    typename Traits::pixel_t mask_color = src->mask_color;
+    // If the mask color doesn't fit in a pixel, no pixel is skipped
+    const typename Traits::pixel_t* mask_ptr =
+      (mask_color == src->mask_color ? &mask_color: NULL);
     Image* dst = this;
     address_t src_address;
     address_t dst_address;
-    int xbeg, xend, xsrc, xdst;
+    int xbeg, xend, xsrc;
     int ybeg, yend, ysrc, ydst;
 
     // nothing to do
@@ -188,22 +194,18 @@ public:
 
     // merge process
 
+    incrementModifications();
     for (ydst=ybeg; ydst<=yend; ydst++, ysrc++) {
       src_address = ((ImageImpl<Traits>*)src)->line_address(ysrc)+xsrc;
       dst_address = ((ImageImpl<Traits>*)dst)->line_address(ydst)+xbeg;
 
-      for (xdst=xbeg; xdst<=xend; xdst++) {
-        if (*src_address != mask_color)
-          *dst_address = (*blender)(*dst_address, *src_address, opacity);
-
-        dst_address++;
-        src_address++;
-      }
+      (*blender)(dst_address, dst_address, src_address, xend-xbeg+1, opacity, mask_ptr);
     }
   }
 
   virtual void hline(int x1, int y, int x2, int color)
   {
+    incrementModifications();
     address_t addr = line_address(y)+x1;
 
     for (int x=x1; x<=x2; ++x)
@@ -212,6 +214,7 @@ public:
 
   virtual void rectfill(int x1, int y1, int x2, int y2, int color)
   {
+    incrementModifications();
     address_t addr;
     int x, y;
 
@@ -237,6 +240,8 @@ public:
 template<>
 void ImageImpl<RgbTraits>::rectblend(int x1, int y1, int x2, int y2, int color, int opacity)
 {
+  incrementModifications();
+
   address_t addr;
   int x, y;
 
@@ -252,12 +257,16 @@ void ImageImpl<RgbTraits>::rectblend(int x1, int y1, int x2, int y2, int color,
 template<>
 void ImageImpl<IndexedTraits>::clear(int color)
 {
+  incrementModifications();
+
   memset(raw_pixels(), color, w*h);
 }
 
 template<>
 void ImageImpl<IndexedTraits>::merge(const Image* src, int x, int y, int opacity, int blend_mode)
 {
+  incrementModifications();
+
   Image* dst = this;
   address_t src_address;
   address_t dst_address;
@@ -332,6 +341,8 @@ void ImageImpl<IndexedTraits>::merge(const Image* src, int x, int y, int opacity
 template<>
 void ImageImpl<BitmapTraits>::clear(int color)
 {
+  incrementModifications();
+
   memset(raw_pixels(), color ? 0xff: 0x00, ((w+7)/8) * h);
 }
 
@@ -344,6 +355,8 @@ void ImageImpl<BitmapTraits>::clear(int color)
 template<>
 void ImageImpl<BitmapTraits>::hline(int x1, int y, int x2, int color)
 {
+  incrementModifications();
+
   div_t d = div(x1, 8);
   address_t addr = line_address(y)+d.quot;
   int x;
@@ -359,6 +372,8 @@ void ImageImpl<BitmapTraits>::hline(int x1, int y, int x2, int color)
 template<>
 void ImageImpl<BitmapTraits>::rectfill(int x1, int y1, int x2, int y2, int color)
 {
+  incrementModifications();
+
   div_t d, beg_d = div(x1, 8);
   address_t addr;
   int x, y;
@@ -382,6 +397,8 @@ void ImageImpl<BitmapTraits>::rectfill(int x1, int y1, int x2, int y2, int color
 template<>
 void ImageImpl<BitmapTraits>::copy(const Image* src, int x, int y)
 {
+  incrementModifications();
+
   Image* dst = this;
   address_t src_address;
   address_t dst_address;
@@ -447,6 +464,8 @@ void ImageImpl<BitmapTraits>::copy(const Image* src, int x, int y)
 template<>
 void ImageImpl<BitmapTraits>::merge(const Image* src, int x, int y, int opacity, int blend_mode)
 {
+  incrementModifications();
+
   Image* dst = this;
   address_t src_address;
   address_t dst_address;
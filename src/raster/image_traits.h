@@ -68,6 +68,7 @@ struct RgbTraits
 
   typedef uint32_t pixel_t;
   typedef pixel_t* address_t;
+  typedef BLEND_RGBA_SPAN span_blender_t;
   typedef const pixel_t* const_address_t;
 
   static inline int scanline_size(int w)
@@ -80,6 +81,12 @@ struct RgbTraits
     ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
     return _rgba_blenders[blend_mode];
   }
+
+  static inline BLEND_RGBA_SPAN get_span_blender(int blend_mode)
+  {
+    ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
+    return _rgba_span_blenders[blend_mode];
+  }
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -117,6 +124,7 @@ struct GrayscaleTraits
 
   typedef uint16_t pixel_t;
   typedef pixel_t* address_t;
+  typedef BLEND_GRAYA_SPAN span_blender_t;
   typedef const pixel_t* const_address_t;
 
   static inline int scanline_size(int w)
@@ -129,6 +137,12 @@ struct GrayscaleTraits
     ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
     return _graya_blenders[blend_mode];
   }
+
+  static inline BLEND_GRAYA_SPAN get_span_blender(int blend_mode)
+  {
+    ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
+    return _graya_span_blenders[blend_mode];
+  }
 };
 
 //////////////////////////////////////////////////////////////////////
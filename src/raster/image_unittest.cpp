@@ -0,0 +1,54 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tests/test.h"
+#include "tests/test.h"
+
+#include "base/unique_ptr.h"
+#include "raster/image.h"
+
+TEST(Image, ModificationsAreCounted)
+{
+  UniquePtr<Image> image(Image::create(IMAGE_RGB, 8, 8));
+  UniquePtr<Image> other(Image::create(IMAGE_RGB, 4, 4));
+  int modifications = image->getModifications();
+
+  image_putpixel(image, 1, 1, _rgba(255, 0, 0, 255));
+  EXPECT_LT(modifications, image->getModifications());
+
+  modifications = image->getModifications();
+  image_clear(image, 0);
+  EXPECT_LT(modifications, image->getModifications());
+
+  modifications = image->getModifications();
+  image_copy(image, other, 2, 2);
+  EXPECT_LT(modifications, image->getModifications());
+
+  modifications = image->getModifications();
+  image_merge(image, other, 2, 2, 255, BLEND_MODE_NORMAL);
+  EXPECT_LT(modifications, image->getModifications());
+
+  modifications = image->getModifications();
+  image_rectfill(image, 0, 0, 3, 3, 0);
+  EXPECT_LT(modifications, image->getModifications());
+
+  // Reading pixels doesn't modify the image
+  modifications = image->getModifications();
+  image_getpixel(image, 1, 1);
+  image_copy(other, image, 0, 0);
+  EXPECT_EQ(modifications, image->getModifications());
+}
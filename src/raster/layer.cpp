@@ -133,6 +133,7 @@ void LayerImage::destroyAllCels()
     delete cel;
   }
   m_cels.clear();
+  m_frameCels.clear();
 }
 
 void LayerImage::getCels(CelList& cels)
@@ -155,6 +156,7 @@ void LayerImage::addCel(Cel *cel)
   }
 
   m_cels.insert(it, cel);
+  indexCel(cel);
 }
 
 /**
@@ -170,20 +172,28 @@ void LayerImage::removeCel(Cel *cel)
   ASSERT(it != m_cels.end());
 
   m_cels.erase(it);
+  unindexCel(cel);
 }
 
-const Cel* LayerImage::getCel(FrameNumber frame) const
+/**
+ * Changes the frame of a cel that is already inside the layer.
+ *
+ * Use this routine instead of Cel::setFrame() so the layer can keep
+ * its frame index up to date.
+ */
+void LayerImage::moveCel(Cel *cel, FrameNumber frame)
 {
-  CelConstIterator it = getCelBegin();
-  CelConstIterator end = getCelEnd();
-
-  for (; it != end; ++it) {
-    const Cel* cel = *it;
-    if (cel->getFrame() == frame)
-      return cel;
-  }
+  unindexCel(cel);
+  cel->setFrame(frame);
+  indexCel(cel);
+}
 
-  return NULL;
+const Cel* LayerImage::getCel(FrameNumber frame) const
+{
+  if (frame >= 0 && frame < (int)m_frameCels.size())
+    return m_frameCels[frame];
+  else
+    return NULL;
 }
 
 Cel* LayerImage::getCel(FrameNumber frame)
@@ -191,6 +201,42 @@ Cel* LayerImage::getCel(FrameNumber frame)
   return const_cast<Cel*>(static_cast<const LayerImage*>(this)->getCel(frame));
 }
 
+void LayerImage::indexCel(Cel* cel)
+{
+  int frame = cel->getFrame();
+  ASSERT(frame >= 0);
+
+  if (frame >= (int)m_frameCels.size())
+    m_frameCels.resize(frame+1, NULL);
+
+  // Two cels can share the same frame temporarily (e.g. when frames
+  // are being moved one by one), in that case we keep the first one.
+  if (!m_frameCels[frame])
+    m_frameCels[frame] = cel;
+}
+
+void LayerImage::unindexCel(Cel* cel)
+{
+  int frame = cel->getFrame();
+  if (frame < 0 || frame >= (int)m_frameCels.size() ||
+      m_frameCels[frame] != cel)
+    return;
+
+  m_frameCels[frame] = NULL;
+
+  // Look for other cel in the same frame
+  for (CelIterator it=m_cels.begin(), end=m_cels.end(); it != end; ++it) {
+    if (*it != cel && (*it)->getFrame() == frame) {
+      m_frameCels[frame] = *it;
+      break;
+    }
+  }
+
+  // Remove empty entries at the end
+  while (!m_frameCels.empty() && !m_frameCels.back())
+    m_frameCels.pop_back();
+}
+
 /**
  * Configures some properties of the specified layer to make it as the
  * "Background" of the sprite.
@@ -24,6 +24,7 @@
 #include "raster/gfxobj.h"
 
 #include <string>
+#include <vector>
 
 class Cel;
 class Image;
@@ -105,6 +106,7 @@ public:
 
   void addCel(Cel *cel);
   void removeCel(Cel *cel);
+  void moveCel(Cel *cel, FrameNumber frame);
   const Cel* getCel(FrameNumber frame) const;
   Cel* getCel(FrameNumber frame);
 
@@ -120,8 +122,15 @@ public:
 
 private:
   void destroyAllCels();
+  void indexCel(Cel* cel);
+  void unindexCel(Cel* cel);
 
   CelList m_cels;   // List of all cels inside this layer used by frames.
+
+  // Cels indexed by frame number (to get the cel of a specific frame
+  // without iterating the whole m_cels list). NULL entries are frames
+  // without cel.
+  std::vector<Cel*> m_frameCels;
 };
 
 //////////////////////////////////////////////////////////////////////
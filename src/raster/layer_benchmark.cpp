@@ -0,0 +1,117 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tests/test.h"
+
+#include "base/chrono.h"
+#include "base/unique_ptr.h"
+#include "raster/cel.h"
+#include "raster/image.h"
+#include "raster/layer.h"
+#include "raster/sprite.h"
+#include "raster/stock.h"
+
+#include <cstdio>
+
+namespace {
+
+  // The previous LayerImage::getCel() implementation: a linear
+  // search in the list of cels.
+  const Cel* get_cel_linear(const LayerImage* layer, FrameNumber frame)
+  {
+    CelConstIterator it = layer->getCelBegin();
+    CelConstIterator end = layer->getCelEnd();
+
+    for (; it != end; ++it) {
+      const Cel* cel = *it;
+      if (cel->getFrame() == frame)
+        return cel;
+    }
+
+    return NULL;
+  }
+
+  Sprite* create_sprite(int frames, int layers)
+  {
+    Sprite* sprite = new Sprite(IMAGE_RGB, 32, 32, 256);
+    sprite->setTotalFrames(FrameNumber(frames));
+
+    for (int i=0; i<layers; ++i) {
+      LayerImage* layer = new LayerImage(sprite);
+      sprite->getFolder()->addLayer(layer);
+
+      for (int frame=0; frame<frames; ++frame) {
+        Image* image = Image::create(IMAGE_RGB, 32, 32);
+        image_clear(image, _rgba(frame & 255, i*64, 0, 255));
+        layer->addCel(new Cel(FrameNumber(frame),
+                              sprite->getStock()->addImage(image)));
+      }
+    }
+    return sprite;
+  }
+
+  void run_benchmark(int frames)
+  {
+    const int layers = 4;
+    UniquePtr<Sprite> sprite(create_sprite(frames, layers));
+    UniquePtr<Image> image(Image::create(IMAGE_RGB, 32, 32));
+
+    // Render all frames (getCel() is called for each layer/frame)
+    base::Chrono chrono;
+    for (int frame=0; frame<frames; ++frame) {
+      image_clear(image, 0);
+      layer_render(sprite->getFolder(), image, 0, 0, FrameNumber(frame));
+    }
+    double renderTime = chrono.elapsed();
+
+    // Only lookups, with the index and with a linear search
+    int found = 0;
+    chrono.reset();
+    for (int frame=0; frame<frames; ++frame)
+      for (LayerIterator it=sprite->getFolder()->getLayerBegin(),
+             end=sprite->getFolder()->getLayerEnd(); it != end; ++it)
+        if (static_cast<LayerImage*>(*it)->getCel(FrameNumber(frame)))
+          ++found;
+    double indexTime = chrono.elapsed();
+
+    chrono.reset();
+    for (int frame=0; frame<frames; ++frame)
+      for (LayerIterator it=sprite->getFolder()->getLayerBegin(),
+             end=sprite->getFolder()->getLayerEnd(); it != end; ++it)
+        if (get_cel_linear(static_cast<LayerImage*>(*it), FrameNumber(frame)))
+          ++found;
+    double linearTime = chrono.elapsed();
+
+    EXPECT_EQ(2*frames*layers, found);
+
+    std::printf("%5d frames: render %.3f us/frame, "
+                "getCel %.4f us/cel, linear search %.4f us/cel\n",
+                frames,
+                1000000.0 * renderTime / frames,
+                1000000.0 * indexTime / (frames*layers),
+                1000000.0 * linearTime / (frames*layers));
+  }
+
+} // anonymous namespace
+
+TEST(LayerBenchmark, GetCelWithManyFrames)
+{
+  run_benchmark(100);
+  run_benchmark(500);
+  run_benchmark(2000);
+  run_benchmark(5000);
+}
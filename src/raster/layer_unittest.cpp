@@ -0,0 +1,101 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tests/test.h"
+
+#include "base/unique_ptr.h"
+#include "raster/cel.h"
+#include "raster/image.h"
+#include "raster/layer.h"
+#include "raster/sprite.h"
+#include "raster/stock.h"
+
+namespace {
+
+  LayerImage* add_layer(Sprite* sprite)
+  {
+    LayerImage* layer = new LayerImage(sprite);
+    sprite->getFolder()->addLayer(layer);
+    return layer;
+  }
+
+  Cel* add_cel(LayerImage* layer, int frame)
+  {
+    int index = layer->getSprite()->getStock()->addImage(Image::create(IMAGE_INDEXED, 4, 4));
+    Cel* cel = new Cel(FrameNumber(frame), index);
+    layer->addCel(cel);
+    return cel;
+  }
+
+}
+
+TEST(LayerImage, GetCel)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_INDEXED, 4, 4, 256));
+  LayerImage* layer = add_layer(sprite);
+  Cel* cel2 = add_cel(layer, 2);
+  Cel* cel0 = add_cel(layer, 0);
+
+  EXPECT_EQ(cel0, layer->getCel(FrameNumber(0)));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(1)));
+  EXPECT_EQ(cel2, layer->getCel(FrameNumber(2)));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(3)));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(1000)));
+
+  layer->removeCel(cel2);
+  EXPECT_EQ(cel0, layer->getCel(FrameNumber(0)));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(2)));
+  layer->addCel(cel2);
+  EXPECT_EQ(cel2, layer->getCel(FrameNumber(2)));
+}
+
+TEST(LayerImage, MoveCel)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_INDEXED, 4, 4, 256));
+  LayerImage* layer = add_layer(sprite);
+  Cel* cel0 = add_cel(layer, 0);
+  Cel* cel1 = add_cel(layer, 1);
+
+  layer->moveCel(cel1, FrameNumber(5));
+  EXPECT_EQ(cel0, layer->getCel(FrameNumber(0)));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(1)));
+  EXPECT_EQ(cel1, layer->getCel(FrameNumber(5)));
+  EXPECT_EQ(FrameNumber(5), cel1->getFrame());
+
+  layer->moveCel(cel1, FrameNumber(1));
+  EXPECT_EQ(cel1, layer->getCel(FrameNumber(1)));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(5)));
+}
+
+TEST(LayerImage, SwapCelsThroughTheSameFrame)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_INDEXED, 4, 4, 256));
+  LayerImage* layer = add_layer(sprite);
+  Cel* cel0 = add_cel(layer, 0);
+  Cel* cel1 = add_cel(layer, 1);
+
+  // Both cels are in frame 1 for a while (as when
+  // DocumentApi::moveFrameBefore() moves the cels one by one)
+  layer->moveCel(cel0, FrameNumber(1));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(0)));
+  EXPECT_TRUE(layer->getCel(FrameNumber(1)) == cel0 ||
+              layer->getCel(FrameNumber(1)) == cel1);
+
+  layer->moveCel(cel1, FrameNumber(0));
+  EXPECT_EQ(cel1, layer->getCel(FrameNumber(0)));
+  EXPECT_EQ(cel0, layer->getCel(FrameNumber(1)));
+}
@@ -91,6 +91,9 @@ namespace quantization {
     // all histogram's points inside the box.
     uint32_t meanColor(const Histogram& histogram) const
     {
+      if (histogram.isFullPrecision())
+        return fullPrecisionMeanColor(histogram);
+
       size_t r = 0, g = 0, b = 0;
       size_t count = 0;
       int i, j, k;
@@ -116,6 +119,35 @@ namespace quantization {
                    (255 * b / (Histogram::BElements-1)) / count, 255);
     }
 
+    // Returns the mean of the original 8-bit colors inside the box
+    // (for histograms that accumulate the components of each sample).
+    uint32_t fullPrecisionMeanColor(const Histogram& histogram) const
+    {
+      double r = 0, g = 0, b = 0;
+      double count = 0;
+      int i, j, k;
+
+      for (i=r1; i<=r2; ++i)
+        for (j=g1; j<=g2; ++j)
+          for (k=b1; k<=b2; ++k) {
+            size_t c = histogram.at(i, j, k);
+            if (c > 0) {
+              r += histogram.componentSum(i, j, k, 0);
+              g += histogram.componentSum(i, j, k, 1);
+              b += histogram.componentSum(i, j, k, 2);
+              count += c;
+            }
+          }
+
+      assert(count > 0 && "Box without histogram points, you must fill the histogram before using this function.");
+      if (count == 0)
+        return _rgba(0, 0, 0, 255);
+
+      return _rgba(int(r / count + 0.5),
+                   int(g / count + 0.5),
+                   int(b / count + 0.5), 255);
+    }
+
     // The boxes will be sort in the priority_queue by volume.
     bool operator<(const Box& other) const
     {
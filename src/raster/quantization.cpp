@@ -24,6 +24,8 @@
 
 #include "gfx/hsv.h"
 #include "gfx/rgb.h"
+#include "base/thread.h"
+#include "base/thread_pool.h"
 #include "raster/blend.h"
 #include "raster/color_histogram.h"
 #include "raster/image.h"
@@ -42,9 +44,7 @@ static Image* ordered_dithering(const Image* src_image,
                                 const RgbMap* rgbmap,
                                 const Palette* palette);
 
-static void create_palette_from_bitmaps(const std::vector<Image*>& images, Palette* palette, bool has_background_layer);
-
-Palette* quantization::create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber)
+Palette* quantization::create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber, bool fullPrecision)
 {
   bool has_background_layer = (sprite->getBackgroundLayer() != NULL);
   Palette* palette = new Palette(FrameNumber(0), 256);
@@ -70,7 +70,7 @@ Palette* quantization::create_palette_from_rgb(const Sprite* sprite, FrameNumber
   image_array[c++] = flat_image; // The 'flat_image'
 
   // Generate an optimized palette for all images
-  create_palette_from_bitmaps(image_array, palette, has_background_layer);
+  create_palette_from_images(image_array, palette, has_background_layer, fullPrecision);
 
   delete flat_image;
   return palette;
@@ -130,21 +130,33 @@ Image* quantization::convert_pixel_format(const Image* image,
           break;
 
         // RGB -> Indexed
-        case IMAGE_INDEXED:
+        case IMAGE_INDEXED: {
+          // Consecutive pixels usually have the same color, so we can
+          // avoid some searches in the RgbMap
+          uint32_t last_color = 0;
+          int last_index = -1;
+
           idx_address = new_image->dat;
           for (i=0; i<size; i++) {
             c = *rgb_address;
-            r = _rgba_getr(c);
-            g = _rgba_getg(c);
-            b = _rgba_getb(c);
             if (_rgba_geta(c) == 0)
               *idx_address = 0;
-            else
-              *idx_address = rgbmap->mapColor(r, g, b);
+            else {
+              c &= 0xffffff;
+              if (last_index < 0 || c != last_color) {
+                r = _rgba_getr(c);
+                g = _rgba_getg(c);
+                b = _rgba_getb(c);
+                last_color = c;
+                last_index = rgbmap->mapColor(r, g, b);
+              }
+              *idx_address = last_index;
+            }
             rgb_address++;
             idx_address++;
           }
           break;
+        }
       }
       break;
 
@@ -337,11 +349,66 @@ static Image* ordered_dithering(const Image* src_image,
 // Creation of optimized palette for RGB images
 // by David Capello
 
-static void create_palette_from_bitmaps(const std::vector<Image*>& images, Palette* palette, bool has_background_layer)
+namespace {
+
+typedef quantization::ColorHistogram<5, 6, 5> Histogram;
+
+// Minimum number of pixels to build the histogram in several threads.
+const int kMinParallelPixels = 256*256;
+
+// Adds the pixels of a range of rows to a histogram. Rows are
+// numbered as if all images were one below the other.
+class HistogramTask
 {
-  quantization::ColorHistogram<5, 6, 5> histogram;
-  uint32_t color;
-  RgbTraits::address_t address;
+public:
+  HistogramTask(const std::vector<Image*>& images, int beginRow, int endRow, Histogram* histogram)
+    : m_images(&images)
+    , m_beginRow(beginRow)
+    , m_endRow(endRow)
+    , m_histogram(histogram) {
+  }
+
+  void operator()() {
+    uint32_t color;
+    RgbTraits::address_t address;
+    int row = 0;
+
+    for (int i=0; i<(int)m_images->size() && row < m_endRow; ++i) {
+      const Image* image = (*m_images)[i];
+      int y = MAX(0, m_beginRow - row);
+      int yend = MIN(image->h, m_endRow - row);
+      row += image->h;
+
+      for (; y<yend; ++y) {
+        address = image_address_fast<RgbTraits>(image, 0, y);
+
+        for (int x=0; x<image->w; ++x) {
+          color = *address;
+
+          if (_rgba_geta(color) > 0) {
+            color |= _rgba(0, 0, 0, 255);
+            m_histogram->addSamples(color, 1);
+          }
+
+          ++address;
+        }
+      }
+    }
+  }
+
+private:
+  const std::vector<Image*>* m_images;
+  int m_beginRow;
+  int m_endRow;
+  Histogram* m_histogram;
+};
+
+} // anonymous namespace
+
+void quantization::create_palette_from_images(const std::vector<Image*>& images, Palette* palette,
+                                              bool has_background_layer, bool fullPrecision)
+{
+  Histogram histogram(fullPrecision);
 
   // If the sprite has a background layer, the first entry can be
   // used, in other case the 0 indexed will be the mask color, so it
@@ -349,22 +416,44 @@ static void create_palette_from_bitmaps(const std::vector<Image*>& images, Palet
   // Indexed).
   int first_usable_entry = (has_background_layer ? 0: 1);
 
+  int rows = 0, pixels = 0;
   for (int i=0; i<(int)images.size(); ++i) {
-    const Image* image = images[i];
+    rows += images[i]->h;
+    if (pixels < kMinParallelPixels)
+      pixels += images[i]->w * images[i]->h;
+  }
 
-    for (int y=0; y<image->h; ++y) {
-      address = image_address_fast<RgbTraits>(image, 0, y);
+  int ntasks = 1;
+  if (pixels >= kMinParallelPixels)
+    ntasks = MIN(rows, base::thread::hardware_concurrency());
 
-      for (int x=0; x<image->w; ++x) {
-        color = *address;
+  if (ntasks <= 1) {
+    HistogramTask(images, 0, rows, &histogram)();
+  }
+  else {
+    // Each task builds the histogram of a consecutive range of rows,
+    // then the histograms are merged in the same order (so the result
+    // is the same as the single-threaded version).
+    std::vector<Histogram*> partial(ntasks, (Histogram*)NULL);
+    {
+      base::thread_pool pool(ntasks-1);
+
+      for (int t=1; t<ntasks; ++t) {
+        partial[t] = new Histogram(fullPrecision);
+        pool.execute(HistogramTask(images,
+                                   (int)((long long)rows * t / ntasks),
+                                   (int)((long long)rows * (t+1) / ntasks),
+                                   partial[t]));
+      }
 
-        if (_rgba_geta(color) > 0) {
-          color |= _rgba(0, 0, 0, 255);
-          histogram.addSamples(color, 1);
-        }
+      // The first range is processed in this thread
+      HistogramTask(images, 0, rows / ntasks, &histogram)();
+      pool.wait_all();
+    }
 
-        ++address;
-      }
+    for (int t=1; t<ntasks; ++t) {
+      histogram.merge(*partial[t]);
+      delete partial[t];
     }
   }
 
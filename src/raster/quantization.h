@@ -23,6 +23,8 @@
 #include "raster/frame_number.h"
 #include "raster/pixel_format.h"
 
+#include <vector>
+
 class Image;
 class Palette;
 class RgbMap;
@@ -32,7 +34,15 @@ class Stock;
 namespace quantization {
 
   // Creates a new palette suitable to quantize the given RGB sprite to Indexed color.
-  Palette* create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber);
+  // If "fullPrecision" is true, the palette colors are calculated from the original
+  // 8-bit colors instead of the histogram resolution (5-6-5 bits).
+  Palette* create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber,
+                                   bool fullPrecision = false);
+
+  // Creates an optimized palette for the given RGB images. The
+  // histogram of colors is built in several threads for big images.
+  void create_palette_from_images(const std::vector<Image*>& images, Palette* palette,
+                                  bool has_background_layer, bool fullPrecision);
 
   // Changes the image pixel format. The dithering method is used only
   // when you want to convert from RGB to Indexed.
@@ -0,0 +1,95 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "base/chrono.h"
+#include "base/unique_ptr.h"
+#include "document.h"
+#include "raster/quantization.h"
+#include "raster/raster.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+  // Creates a RGB sprite with "frames" frames of synthetic images
+  // (gradients with some noise, so the histogram has a lot of colors).
+  Document* create_synthetic_document(int w, int h, int frames)
+  {
+    Document* doc = Document::createBasicDocument(IMAGE_RGB, w, h, 256);
+    Sprite* sprite = doc->getSprite();
+    LayerImage* layer = static_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+
+    sprite->setTotalFrames(FrameNumber(frames));
+    std::srand(frames);
+
+    for (int f=0; f<frames; ++f) {
+      Image* image;
+      if (f == 0)
+        image = sprite->getStock()->getImage(layer->getCel(FrameNumber(0))->getImage());
+      else {
+        image = Image::create(IMAGE_RGB, w, h);
+        layer->addCel(new Cel(FrameNumber(f), sprite->getStock()->addImage(image)));
+      }
+
+      for (int y=0; y<h; ++y) {
+        for (int x=0; x<w; ++x) {
+          int noise = std::rand() % 16;
+          image_putpixel_fast<RgbTraits>(image, x, y,
+                                         _rgba((x + f) & 255,
+                                               (y + noise) & 255,
+                                               (x*y/w + 4*f) & 255, 255));
+        }
+      }
+    }
+
+    return doc;
+  }
+
+  void run_benchmark(int w, int h, int frames, bool fullPrecision)
+  {
+    UniquePtr<Document> doc(create_synthetic_document(w, h, frames));
+
+    base::Chrono chrono;
+    UniquePtr<Palette> palette(quantization::create_palette_from_rgb(doc->getSprite(),
+                                                                     FrameNumber(0),
+                                                                     fullPrecision));
+    double elapsed = chrono.elapsed();
+
+    std::printf("%dx%d, %d frames, %s: %.3f s\n",
+                w, h, frames, fullPrecision ? "full-precision": "5-6-5 histogram",
+                elapsed);
+
+    EXPECT_EQ(256, palette->size());
+  }
+
+} // anonymous namespace
+
+TEST(QuantizationBenchmark, SmallSprite)
+{
+  run_benchmark(64, 64, 500, false);
+  run_benchmark(64, 64, 500, true);
+}
+
+TEST(QuantizationBenchmark, BigSprite)
+{
+  run_benchmark(320, 240, 500, false);
+  run_benchmark(320, 240, 500, true);
+}
@@ -20,21 +20,128 @@
 
 #include "raster/rgbmap.h"
 
+#include "base/atomic_ptr.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "raster/image.h"
 #include "raster/palette.h"
 
-#include <allegro.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
 
+namespace {
+
+// Maximum number of changed palette entries that are searched
+// linearly before rebuilding the whole k-d tree.
+const int kMaxPending = 16;
+
+// Size (in indexes) of each block of memory used to store the
+// candidates of the cells.
+const int kBlockSize = 16*1024;
+
+// Table to convert sRGB components to linear RGB.
+class LinearRgbTable
+{
+public:
+  LinearRgbTable() {
+    for (int i=0; i<256; ++i) {
+      double v = i / 255.0;
+      m_table[i] = (v <= 0.04045 ? v / 12.92: std::pow((v + 0.055) / 1.055, 2.4));
+    }
+  }
+
+  double operator[](int i) const { return m_table[i]; }
+
+private:
+  double m_table[256];
+};
+
+LinearRgbTable linear_rgb;
+
+double lab_f(double t)
+{
+  return (t > 0.008856 ? std::pow(t, 1.0/3.0): 7.787*t + 16.0/116.0);
+}
+
+// Converts a sRGB color to CIE L*a*b* (D65 white point), with four
+// units per L*a*b* unit.
+void rgb_to_lab(int r, int g, int b, int* lab)
+{
+  double R = linear_rgb[r], G = linear_rgb[g], B = linear_rgb[b];
+  double x = lab_f((0.4124*R + 0.3576*G + 0.1805*B) / 0.95047);
+  double y = lab_f((0.2126*R + 0.7152*G + 0.0722*B));
+  double z = lab_f((0.0193*R + 0.1192*G + 0.9505*B) / 1.08883);
+
+  lab[0] = (int)std::floor(4.0 * (116.0*y - 16.0) + 0.5);
+  lab[1] = (int)std::floor(4.0 * 500.0*(x - y) + 0.5);
+  lab[2] = (int)std::floor(4.0 * 200.0*(y - z) + 0.5);
+}
+
+struct KdNode {
+  int point[3];
+  int index;                    // Palette index
+  int axis;                     // Split axis of this node
+  bool deleted;                 // The palette entry was changed
+};
+
+struct AxisLess {
+  int axis;
+  AxisLess(int axis) : axis(axis) { }
+  bool operator()(const KdNode& a, const KdNode& b) const {
+    return a.point[axis] < b.point[axis];
+  }
+};
+
+} // anonymous namespace
+
+// The palette entries are indexed in a balanced k-d tree (stored in a
+// vector, where each node is in the middle of its sub-tree range).
+// When a few entries change, their old nodes are marked as deleted
+// and the new colors are searched linearly (m_pending), so small
+// palette edits don't need to rebuild the whole tree.
+//
+// The tree isn't used directly by mapColor(). Each 5-bit RGB cell (as
+// in the old Allegro RGB_MAP) has the list of palette entries that can
+// be the nearest one to some color of the cell. These lists are
+// calculated with the tree the first time a color of the cell is
+// mapped, and they usually contain one or a few entries, so mapColor()
+// is a table lookup plus a few distances. With the L*a*b* metric a
+// cell isn't a box in the metric space, so the cell keeps the nearest
+// entry of each one of its 512 colors instead.
 class RgbMapImpl
 {
 public:
-  RgbMapImpl() {
-    m_allegMap = new RGB_MAP;
+  RgbMapImpl(RgbMap::Metric metric) : m_cells(32*32*32, (const uint32_t*)NULL) {
     m_palette = NULL;
     m_modifications = 0;
+    m_blockUsed = kBlockSize;
+    setMetric(metric);
   }
 
   ~RgbMapImpl() {
-    delete m_allegMap;
+    clearCells();
+  }
+
+  RgbMap::Metric getMetric() const {
+    return m_metric;
+  }
+
+  void setMetric(RgbMap::Metric metric) {
+    m_metric = metric;
+
+    m_weights[0] = m_weights[1] = m_weights[2] = 1;
+    if (metric == RgbMap::WEIGHTED_RGB_DISTANCE) {
+      m_weights[0] = 3;
+      m_weights[1] = 4;
+      m_weights[2] = 2;
+    }
+
+    clearCells();
+    if (!m_colors.empty())
+      rebuild();
   }
 
   bool match(const Palette* palette) const {
@@ -43,43 +150,358 @@ public:
   }
 
   void regenerate(const Palette* palette) {
+    int oldSize = m_colors.size();
+    int newSize = palette->size();
+
     m_palette = palette;
     m_modifications = palette->getModifications();
 
-    PALETTE allegPal;
-    palette->toAllegro(allegPal);
-    create_rgb_table(m_allegMap, allegPal, NULL);
+    clearCells();
+
+    // Entry 0 is only used in one-color palettes
+    if (oldSize <= 1 || newSize == 1) {
+      copyColors(palette);
+      rebuild();
+      return;
+    }
+
+    std::vector<int> changed;
+    for (int i=1; i<newSize; ++i)
+      if (i >= oldSize || m_colors[i] != palette->getEntry(i))
+        changed.push_back(i);
+
+    if ((int)(m_pending.size() + changed.size()) > kMaxPending) {
+      copyColors(palette);
+      rebuild();
+      return;
+    }
+
+    // Remove entries that are not in the palette anymore
+    for (int i=newSize; i<oldSize; ++i)
+      unindex(i);
+
+    m_colors.resize(newSize);
+    m_points.resize(newSize*3);
+    m_nodeOf.resize(newSize, -1);
 
-    for (int r=0; r<32; ++r)
-      for (int g=0; g<32; ++g)
-        for (int b=0; b<32; ++b) {
-          if (m_allegMap->data[r][g][b] >= palette->size())
-            m_allegMap->data[r][g][b] = palette->findBestfit(_rgb_scale_5[r],
-                                                             _rgb_scale_5[g],
-                                                             _rgb_scale_5[b]);
-        }
+    for (int j=0; j<(int)changed.size(); ++j) {
+      int i = changed[j];
+      if (i < oldSize)
+        unindex(i);
+
+      m_colors[i] = palette->getEntry(i);
+      calcPoint(i);
+      m_pending.push_back(i);
+    }
   }
 
   int mapColor(int r, int g, int b) const {
     ASSERT(r >= 0 && r < 256);
     ASSERT(g >= 0 && g < 256);
     ASSERT(b >= 0 && b < 256);
-    return m_allegMap->data[r>>3][g>>3][b>>3];
+
+    int cell = ((r>>3)<<10) | ((g>>3)<<5) | (b>>3);
+    const uint32_t* candidates = base::load_acquire(&m_cells[cell]);
+    if (!candidates)
+      candidates = fillCell(cell);
+
+    if (m_metric == RgbMap::LAB_DISTANCE)
+      return candidates[((r&7)<<6) | ((g&7)<<3) | (b&7)];
+
+    // candidates[0] is the number of entries, sorted by index (so on
+    // ties the lowest index wins). Each entry is the RGB color with
+    // the palette index in the alpha channel.
+    int n = candidates[0];
+    if (n == 1)
+      return _rgba_geta(candidates[1]);
+
+    int bestDist = INT_MAX;
+    int bestIndex = 0;
+    for (int j=1; j<=n; ++j) {
+      uint32_t c = candidates[j];
+      int dr = r - _rgba_getr(c);
+      int dg = g - _rgba_getg(c);
+      int db = b - _rgba_getb(c);
+      int dist = m_weights[0]*dr*dr + m_weights[1]*dg*dg + m_weights[2]*db*db;
+      if (dist < bestDist) {
+        bestDist = dist;
+        bestIndex = _rgba_geta(c);
+      }
+    }
+    return bestIndex;
   }
 
 private:
-  RGB_MAP* m_allegMap;
+  // Calculates the candidates of the given cell. The lists are filled
+  // from several threads (e.g. filters), so this is done with the
+  // mutex locked, and the pointer of the cell is published (with
+  // release semantics) when its list is complete, so readers see
+  // NULL or a complete list.
+  const uint32_t* fillCell(int cell) const {
+    ScopedLock lock(m_mutex);
+    if (m_cells[cell])
+      return m_cells[cell];
+
+    int boxMin[3] = { (cell>>10)<<3, ((cell>>5)&31)<<3, (cell&31)<<3 };
+    int boxMax[3] = { boxMin[0]+7, boxMin[1]+7, boxMin[2]+7 };
+
+    if (m_metric == RgbMap::LAB_DISTANCE) {
+      uint32_t* table = allocCandidates(8*8*8);
+      for (int j=0; j<8*8*8; ++j) {
+        int query[3];
+        rgb_to_lab(boxMin[0] + (j>>6), boxMin[1] + ((j>>3)&7), boxMin[2] + (j&7), query);
+        table[j] = findNearest(query);
+      }
+      base::store_release(&m_cells[cell], (const uint32_t*)table);
+      return table;
+    }
+
+    // Any color of the cell is at most "bound" from the entry nearest
+    // to the center of the cell, so its nearest entry cannot be
+    // farther than that from the cell.
+    int center[3] = { boxMin[0]+4, boxMin[1]+4, boxMin[2]+4 };
+    int bestIndex = findNearest(center);
+    int bound = (m_points.empty() ? 0: maxBoxDist(&m_points[bestIndex*3], boxMin, boxMax));
+
+    std::vector<int> candidates;
+    collect(0, m_nodes.size(), boxMin, boxMax, bound, candidates);
+    for (int j=0; j<(int)m_pending.size(); ++j) {
+      int i = m_pending[j];
+      if (minBoxDist(&m_points[i*3], boxMin, boxMax) <= bound)
+        candidates.push_back(i);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    uint32_t* list = allocCandidates(candidates.size()+1);
+    list[0] = candidates.size();
+    for (int j=0; j<(int)candidates.size(); ++j) {
+      int i = candidates[j];
+      list[j+1] = _rgba(m_points[i*3], m_points[i*3+1], m_points[i*3+2], i);
+    }
+
+    base::store_release(&m_cells[cell], (const uint32_t*)list);
+    return list;
+  }
+
+  // Returns the nearest entry to the given point of the metric space
+  // (searching the tree and the pending entries).
+  int findNearest(const int* query) const {
+    int bestDist = INT_MAX;
+    int bestIndex = 0;
+    search(0, m_nodes.size(), query, bestDist, bestIndex);
+    for (int j=0; j<(int)m_pending.size(); ++j) {
+      int i = m_pending[j];
+      checkCandidate(&m_points[i*3], i, query, bestDist, bestIndex);
+    }
+    return bestIndex;
+  }
+
+  uint32_t* allocCandidates(int n) const {
+    if (n > kBlockSize - m_blockUsed) {
+      m_blocks.push_back(new uint32_t[MAX(n, kBlockSize)]);
+      m_blockUsed = 0;
+    }
+    uint32_t* ptr = m_blocks.back() + m_blockUsed;
+    m_blockUsed += n;
+    return ptr;
+  }
+
+  void clearCells() {
+    std::fill(m_cells.begin(), m_cells.end(), (const uint32_t*)NULL);
+    for (int j=0; j<(int)m_blocks.size(); ++j)
+      delete[] m_blocks[j];
+    m_blocks.clear();
+    m_blockUsed = kBlockSize;
+  }
+
+  void copyColors(const Palette* palette) {
+    m_colors.resize(palette->size());
+    for (int i=0; i<(int)m_colors.size(); ++i)
+      m_colors[i] = palette->getEntry(i);
+  }
+
+  void calcPoint(int i) {
+    int r = _rgba_getr(m_colors[i]);
+    int g = _rgba_getg(m_colors[i]);
+    int b = _rgba_getb(m_colors[i]);
+
+    if (m_metric == RgbMap::LAB_DISTANCE)
+      rgb_to_lab(r, g, b, &m_points[i*3]);
+    else {
+      m_points[i*3  ] = r;
+      m_points[i*3+1] = g;
+      m_points[i*3+2] = b;
+    }
+  }
+
+  void rebuild() {
+    int n = m_colors.size();
+
+    m_points.resize(n*3);
+    for (int i=0; i<n; ++i)
+      calcPoint(i);
+
+    m_pending.clear();
+    m_nodes.clear();
+    m_nodeOf.assign(n, -1);
+
+    for (int i=(n == 1 ? 0: 1); i<n; ++i) {
+      KdNode node;
+      std::copy(&m_points[i*3], &m_points[i*3]+3, node.point);
+      node.index = i;
+      node.axis = 0;
+      node.deleted = false;
+      m_nodes.push_back(node);
+    }
+
+    buildTree(0, m_nodes.size());
+
+    for (int j=0; j<(int)m_nodes.size(); ++j)
+      m_nodeOf[m_nodes[j].index] = j;
+  }
+
+  // Sorts the nodes in [lo, hi) so the middle node splits the range
+  // in the axis with more spread.
+  void buildTree(int lo, int hi) {
+    if (hi - lo <= 1)
+      return;
+
+    int minValue[3] = { INT_MAX, INT_MAX, INT_MAX };
+    int maxValue[3] = { INT_MIN, INT_MIN, INT_MIN };
+    for (int j=lo; j<hi; ++j) {
+      for (int k=0; k<3; ++k) {
+        minValue[k] = MIN(minValue[k], m_nodes[j].point[k]);
+        maxValue[k] = MAX(maxValue[k], m_nodes[j].point[k]);
+      }
+    }
+
+    int axis = 0;
+    for (int k=1; k<3; ++k)
+      if (m_weights[k]*(maxValue[k]-minValue[k]) > m_weights[axis]*(maxValue[axis]-minValue[axis]))
+        axis = k;
+
+    int mid = (lo + hi) / 2;
+    std::nth_element(m_nodes.begin()+lo, m_nodes.begin()+mid, m_nodes.begin()+hi, AxisLess(axis));
+    m_nodes[mid].axis = axis;
+
+    buildTree(lo, mid);
+    buildTree(mid+1, hi);
+  }
+
+  // Removes the palette entry "i" from the index.
+  void unindex(int i) {
+    if (m_nodeOf[i] >= 0) {
+      m_nodes[m_nodeOf[i]].deleted = true;
+      m_nodeOf[i] = -1;
+    }
+    else {
+      m_pending.erase(std::remove(m_pending.begin(), m_pending.end(), i),
+                      m_pending.end());
+    }
+  }
+
+  inline void checkCandidate(const int* point, int index, const int* query,
+                             int& bestDist, int& bestIndex) const {
+    int dist = 0;
+    for (int k=0; k<3; ++k) {
+      int d = query[k] - point[k];
+      dist += m_weights[k]*d*d;
+    }
+
+    // On ties the lowest index wins
+    if (dist < bestDist || (dist == bestDist && index < bestIndex)) {
+      bestDist = dist;
+      bestIndex = index;
+    }
+  }
+
+  int minBoxDist(const int* point, const int* boxMin, const int* boxMax) const {
+    int dist = 0;
+    for (int k=0; k<3; ++k) {
+      int d = 0;
+      if (point[k] < boxMin[k]) d = boxMin[k] - point[k];
+      else if (point[k] > boxMax[k]) d = point[k] - boxMax[k];
+      dist += m_weights[k]*d*d;
+    }
+    return dist;
+  }
+
+  int maxBoxDist(const int* point, const int* boxMin, const int* boxMax) const {
+    int dist = 0;
+    for (int k=0; k<3; ++k) {
+      int d = MAX(std::abs(point[k] - boxMin[k]), std::abs(point[k] - boxMax[k]));
+      dist += m_weights[k]*d*d;
+    }
+    return dist;
+  }
+
+  // Adds to "candidates" the entries of the tree that are at most
+  // "bound" from the given box.
+  void collect(int lo, int hi, const int* boxMin, const int* boxMax, int bound,
+               std::vector<int>& candidates) const {
+    if (lo >= hi)
+      return;
+
+    int mid = (lo + hi) / 2;
+    const KdNode& node = m_nodes[mid];
+    if (!node.deleted && minBoxDist(node.point, boxMin, boxMax) <= bound)
+      candidates.push_back(node.index);
+
+    int split = node.point[node.axis];
+    int dmin = boxMin[node.axis] - split;
+    int dmax = split - boxMax[node.axis];
+    int w = m_weights[node.axis];
+    if (dmin <= 0 || w*dmin*dmin <= bound)
+      collect(lo, mid, boxMin, boxMax, bound, candidates);
+    if (dmax <= 0 || w*dmax*dmax <= bound)
+      collect(mid+1, hi, boxMin, boxMax, bound, candidates);
+  }
+
+  void search(int lo, int hi, const int* query, int& bestDist, int& bestIndex) const {
+    if (lo >= hi)
+      return;
+
+    int mid = (lo + hi) / 2;
+    const KdNode& node = m_nodes[mid];
+    if (!node.deleted)
+      checkCandidate(node.point, node.index, query, bestDist, bestIndex);
+
+    int d = query[node.axis] - node.point[node.axis];
+    int planeDist = m_weights[node.axis]*d*d;
+    if (d < 0) {
+      search(lo, mid, query, bestDist, bestIndex);
+      if (planeDist <= bestDist)
+        search(mid+1, hi, query, bestDist, bestIndex);
+    }
+    else {
+      search(mid+1, hi, query, bestDist, bestIndex);
+      if (planeDist <= bestDist)
+        search(lo, mid, query, bestDist, bestIndex);
+    }
+  }
+
+  RgbMap::Metric m_metric;
+  int m_weights[3];
   const Palette* m_palette;
   int m_modifications;
+  std::vector<uint32_t> m_colors; // Indexed palette colors
+  std::vector<int> m_points;      // Color of each entry in the metric space (3 ints per entry)
+  std::vector<KdNode> m_nodes;    // K-d tree
+  std::vector<int> m_nodeOf;      // Node of each palette entry (-1 if it isn't in the tree)
+  std::vector<int> m_pending;     // Changed entries (not in the tree)
+  mutable std::vector<const uint32_t*> m_cells; // Candidates (or nearest entries with L*a*b*) of each 5-bit RGB cell (NULL if they aren't calculated yet)
+  mutable std::vector<uint32_t*> m_blocks;      // Memory of the candidates lists
+  mutable int m_blockUsed;                      // Used indexes of the last block
+  mutable Mutex m_mutex;                        // To fill cells from several threads
 };
 
 //////////////////////////////////////////////////////////////////////
 // RgbMap
 
-RgbMap::RgbMap()
+RgbMap::RgbMap(Metric metric)
   : GfxObj(GFXOBJ_RGBMAP)
 {
-  m_impl = new RgbMapImpl;
+  m_impl = new RgbMapImpl(metric);
 }
 
 RgbMap::~RgbMap()
@@ -87,6 +509,16 @@ RgbMap::~RgbMap()
   delete m_impl;
 }
 
+RgbMap::Metric RgbMap::getMetric() const
+{
+  return m_impl->getMetric();
+}
+
+void RgbMap::setMetric(Metric metric)
+{
+  m_impl->setMetric(metric);
+}
+
 bool RgbMap::match(const Palette* palette) const
 {
   return m_impl->match(palette);
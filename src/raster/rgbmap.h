@@ -24,15 +24,39 @@
 
 class Palette;
 
+// Finds the nearest palette entry of a RGB color. Entry 0 is never
+// returned (it's used as the transparent color), unless the palette
+// has only one color.
 class RgbMap : public GfxObj
 {
 public:
-  RgbMap();
+  // Distance function used to compare colors.
+  enum Metric {
+    // Euclidean distance in RGB space.
+    RGB_DISTANCE,
+    // Euclidean distance with weighted RGB channels (3/4/2) to
+    // approximate the perceived difference.
+    WEIGHTED_RGB_DISTANCE,
+    // Euclidean distance in CIE L*a*b* space (Delta E 1976).
+    LAB_DISTANCE,
+  };
+
+  RgbMap(Metric metric = RGB_DISTANCE);
   virtual ~RgbMap();
 
+  Metric getMetric() const;
+  void setMetric(Metric metric);
+
   bool match(const Palette* palette) const;
+
+  // Updates the map with the colors of the given palette. Only the
+  // changed entries are re-indexed if the previous palette was
+  // similar.
   void regenerate(const Palette* palette);
 
+  // Returns the palette index of the nearest color to (r, g, b). It's
+  // thread-safe (but it cannot be used while the map is regenerated
+  // or its metric is changed).
   int mapColor(int r, int g, int b) const;
 
 private:
@@ -0,0 +1,111 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "base/chrono.h"
+#include "raster/image.h"
+#include "raster/palette.h"
+#include "raster/rgbmap.h"
+
+#include <allegro.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+  const int kLookups = 4*1024*1024;
+
+  // Colors of the lookups: random colors (the worst case for the
+  // cache) or a smooth gradient (like the pixels of a real image).
+  void create_colors(std::vector<int>& colors, bool random)
+  {
+    colors.resize(kLookups*3);
+    for (int i=0; i<kLookups; ++i) {
+      if (random) {
+        colors[i*3  ] = std::rand() % 256;
+        colors[i*3+1] = std::rand() % 256;
+        colors[i*3+2] = std::rand() % 256;
+      }
+      else {
+        int x = i % 1024, y = i / 1024;
+        colors[i*3  ] = (x / 4) & 255;
+        colors[i*3+1] = (y / 16) & 255;
+        colors[i*3+2] = ((x+y) / 8) & 255;
+      }
+    }
+  }
+
+  void run_benchmark(const char* name, bool random)
+  {
+    Palette pal(FrameNumber(0), 256);
+    std::srand(1);
+    for (int i=0; i<pal.size(); ++i)
+      pal.setEntry(i, _rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, 255));
+
+    std::vector<int> colors;
+    create_colors(colors, random);
+
+    // The previous RgbMap implementation: an Allegro RGB_MAP table
+    base::Chrono chrono;
+    RGB_MAP allegMap;
+    PALETTE allegPal;
+    pal.toAllegro(allegPal);
+    create_rgb_table(&allegMap, allegPal, NULL);
+    double tableRegenTime = chrono.elapsed();
+
+    int sum = 0;
+    chrono.reset();
+    for (int i=0; i<kLookups; ++i)
+      sum += allegMap.data[colors[i*3]>>3][colors[i*3+1]>>3][colors[i*3+2]>>3];
+    double tableTime = chrono.elapsed();
+
+    chrono.reset();
+    RgbMap map;
+    map.regenerate(&pal);
+    double mapRegenTime = chrono.elapsed();
+
+    // First pass fills the cache, the second one only reads it
+    double mapTime[2];
+    for (int pass=0; pass<2; ++pass) {
+      chrono.reset();
+      for (int i=0; i<kLookups; ++i)
+        sum += map.mapColor(colors[i*3], colors[i*3+1], colors[i*3+2]);
+      mapTime[pass] = chrono.elapsed();
+    }
+
+    EXPECT_NE(0, sum);
+
+    std::printf("%s colors: old table regen %.3f ms, %.2f ns/lookup; "
+                "RgbMap regen %.3f ms, %.2f ns/lookup (%.2f ns/lookup cached)\n",
+                name,
+                1000.0 * tableRegenTime,
+                1000000000.0 * tableTime / kLookups,
+                1000.0 * mapRegenTime,
+                1000000000.0 * mapTime[0] / kLookups,
+                1000000000.0 * mapTime[1] / kLookups);
+  }
+
+} // anonymous namespace
+
+TEST(RgbMapBenchmark, MapColor)
+{
+  run_benchmark("Gradient", false);
+  run_benchmark("Random", true);
+}
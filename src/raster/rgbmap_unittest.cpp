@@ -0,0 +1,172 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "raster/image.h"
+#include "raster/palette.h"
+#include "raster/rgbmap.h"
+
+#include <climits>
+#include <cstdlib>
+
+namespace {
+
+  // Linear search of the nearest color (it skips the entry 0 like
+  // RgbMap does).
+  int find_nearest(const Palette* pal, int r, int g, int b, const int* weights)
+  {
+    int best = 0, bestDist = INT_MAX;
+    for (int i=(pal->size() == 1 ? 0: 1); i<pal->size(); ++i) {
+      uint32_t c = pal->getEntry(i);
+      int dr = r - _rgba_getr(c);
+      int dg = g - _rgba_getg(c);
+      int db = b - _rgba_getb(c);
+      int dist = weights[0]*dr*dr + weights[1]*dg*dg + weights[2]*db*db;
+      if (dist < bestDist) {
+        bestDist = dist;
+        best = i;
+      }
+    }
+    return best;
+  }
+
+  uint32_t random_color()
+  {
+    return _rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, 255);
+  }
+
+  void check_map(const RgbMap& map, const Palette* pal, const int* weights)
+  {
+    for (int j=0; j<2000; ++j) {
+      int r = std::rand() % 256;
+      int g = std::rand() % 256;
+      int b = std::rand() % 256;
+      ASSERT_EQ(find_nearest(pal, r, g, b, weights), map.mapColor(r, g, b))
+        << "color " << r << " " << g << " " << b;
+    }
+  }
+
+} // anonymous namespace
+
+TEST(RgbMap, ExactMatches)
+{
+  Palette pal(FrameNumber(0), 256);
+  std::srand(1);
+  for (int i=0; i<pal.size(); ++i)
+    pal.setEntry(i, random_color());
+
+  RgbMap map;
+  map.regenerate(&pal);
+
+  for (int i=1; i<pal.size(); ++i) {
+    uint32_t c = pal.getEntry(i);
+    int j = map.mapColor(_rgba_getr(c), _rgba_getg(c), _rgba_getb(c));
+    EXPECT_EQ(c, pal.getEntry(j));
+  }
+}
+
+TEST(RgbMap, NearestColor)
+{
+  const int rgbWeights[] = { 1, 1, 1 };
+  const int weightedWeights[] = { 3, 4, 2 };
+
+  std::srand(2);
+  for (int ncolors=1; ncolors<=256; ncolors*=2) {
+    Palette pal(FrameNumber(0), ncolors);
+    for (int i=0; i<pal.size(); ++i)
+      pal.setEntry(i, random_color());
+
+    RgbMap map;
+    map.regenerate(&pal);
+    check_map(map, &pal, rgbWeights);
+
+    map.setMetric(RgbMap::WEIGHTED_RGB_DISTANCE);
+    check_map(map, &pal, weightedWeights);
+  }
+}
+
+TEST(RgbMap, IncrementalChanges)
+{
+  const int weights[] = { 1, 1, 1 };
+  Palette pal(FrameNumber(0), 64);
+  std::srand(3);
+  for (int i=0; i<pal.size(); ++i)
+    pal.setEntry(i, random_color());
+
+  RgbMap map;
+  map.regenerate(&pal);
+
+  for (int step=0; step<40; ++step) {
+    // Change some entries and sometimes the size of the palette
+    for (int k=0; k<1+step%3; ++k)
+      pal.setEntry(std::rand() % pal.size(), random_color());
+    if (step % 7 == 0)
+      pal.resize(8 + std::rand() % 200);
+
+    EXPECT_FALSE(map.match(&pal));
+    map.regenerate(&pal);
+    EXPECT_TRUE(map.match(&pal));
+    check_map(map, &pal, weights);
+  }
+}
+
+TEST(RgbMap, CachedResults)
+{
+  const int weights[] = { 1, 1, 1 };
+  Palette pal(FrameNumber(0), 32);
+  std::srand(4);
+  for (int i=0; i<pal.size(); ++i)
+    pal.setEntry(i, random_color());
+
+  RgbMap map;
+  map.regenerate(&pal);
+
+  // Colors in the same 5-bit cell must not share their cached result
+  for (int k=0; k<3; ++k) {
+    for (int r=0; r<256; r+=3)
+      for (int g=0; g<256; g+=5)
+        for (int b=0; b<256; b+=7)
+          ASSERT_EQ(find_nearest(&pal, r, g, b, weights), map.mapColor(r, g, b))
+            << "color " << r << " " << g << " " << b;
+
+    // The cache must be discarded when the palette changes
+    pal.setEntry(1 + std::rand() % (pal.size()-1), random_color());
+    map.regenerate(&pal);
+  }
+}
+
+TEST(RgbMap, LabDistance)
+{
+  Palette pal(FrameNumber(0), 5);
+  pal.setEntry(0, _rgba(0, 0, 0, 255));
+  pal.setEntry(1, _rgba(0, 0, 0, 255));
+  pal.setEntry(2, _rgba(255, 255, 255, 255));
+  pal.setEntry(3, _rgba(255, 0, 0, 255));
+  pal.setEntry(4, _rgba(0, 0, 255, 255));
+
+  RgbMap map(RgbMap::LAB_DISTANCE);
+  map.regenerate(&pal);
+
+  EXPECT_EQ(1, map.mapColor(0, 0, 0));
+  EXPECT_EQ(2, map.mapColor(255, 255, 255));
+  EXPECT_EQ(3, map.mapColor(255, 0, 0));
+  EXPECT_EQ(4, map.mapColor(0, 0, 255));
+  EXPECT_EQ(3, map.mapColor(230, 40, 30));
+  EXPECT_EQ(2, map.mapColor(240, 240, 250));
+}
@@ -20,12 +20,16 @@
 
 #include <string.h>
 
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/unique_ptr.h"
 #include "raster/image.h"
 #include "raster/stock.h"
 
 Stock::Stock(PixelFormat format)
   : GfxObj(GFXOBJ_STOCK)
   , m_format(format)
+  , m_mutex(NULL)
 {
   // Image with index=0 is always NULL.
   m_image.push_back(NULL);
@@ -34,6 +38,7 @@ Stock::Stock(PixelFormat format)
 Stock::Stock(const Stock& stock)
   : GfxObj(stock)
   , m_format(stock.getPixelFormat())
+  , m_mutex(NULL)
 {
   try {
     for (int i=0; i<stock.size(); ++i) {
@@ -59,9 +64,10 @@ Stock::Stock(const Stock& stock)
 Stock::~Stock()
 {
   for (int i=0; i<size(); ++i) {
-    if (getImage(i))
-      delete getImage(i);
+    delete m_image[i];
+    deleteDecoder(i);
   }
+  delete m_mutex;
 }
 
 PixelFormat Stock::getPixelFormat() const
@@ -78,6 +84,19 @@ Image* Stock::getImage(int index) const
 {
   ASSERT((index >= 0) && (index < size()));
 
+  if (m_mutex) {
+    ScopedLock lock(*m_mutex);
+
+    if (index < (int)m_decoders.size() && m_decoders[index]) {
+      UniquePtr<ImageDecoder> decoder(m_decoders[index]);
+      m_decoders[index] = NULL;
+      m_image[index] = decoder->decodeImage();
+    }
+
+    // Read in the lock, another thread could be decoding the image.
+    return m_image[index];
+  }
+
   return m_image[index];
 }
 
@@ -89,6 +108,28 @@ int Stock::addImage(Image* image)
   return i;
 }
 
+int Stock::addPendingImage(ImageDecoder* decoder)
+{
+  if (!m_mutex)
+    m_mutex = new Mutex;
+
+  int i = addImage(NULL);
+  m_decoders.resize(i+1, NULL);
+  m_decoders[i] = decoder;
+  return i;
+}
+
+bool Stock::isImagePending(int index) const
+{
+  ASSERT((index >= 0) && (index < size()));
+
+  if (!m_mutex)
+    return false;
+
+  ScopedLock lock(*m_mutex);
+  return (index < (int)m_decoders.size() && m_decoders[index] != NULL);
+}
+
 void Stock::removeImage(Image* image)
 {
   for (int i=0; i<size(); i++)
@@ -103,5 +144,14 @@ void Stock::removeImage(Image* image)
 void Stock::replaceImage(int index, Image* image)
 {
   ASSERT((index > 0) && (index < size()));
+  deleteDecoder(index);
   m_image[index] = image;
 }
+
+void Stock::deleteDecoder(int index)
+{
+  if (index < (int)m_decoders.size()) {
+    delete m_decoders[index];
+    m_decoders[index] = NULL;
+  }
+}
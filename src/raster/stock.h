@@ -24,9 +24,24 @@
 #include <vector>
 
 class Image;
+class Mutex;
 
 typedef std::vector<Image*> ImagesList;
 
+// Creates an image of the stock the first time it is used (see
+// Stock::addPendingImage()). E.g. file formats can keep the
+// compressed pixels of a cel and decode them only when they are
+// needed.
+class ImageDecoder
+{
+public:
+  virtual ~ImageDecoder() { }
+
+  // Returns the decoded image. It cannot throw exceptions (in case of
+  // error it should return an image anyway, e.g. a cleared image).
+  virtual Image* decodeImage() = 0;
+};
+
 class Stock : public GfxObj
 {
 public:
@@ -42,7 +57,8 @@ public:
     return m_image.size();
   }
 
-  // Returns the image in the "index" position
+  // Returns the image in the "index" position. If the image was
+  // added with a decoder, it's decoded here (only the first time).
   Image* getImage(int index) const;
 
   // Adds a new image in the stock resizing the images-array. Returns
@@ -50,6 +66,16 @@ public:
   // Stock::getImage() function).
   int addImage(Image* image);
 
+  // Adds an image which will be created by the given decoder the
+  // first time that getImage() is called for it. The stock owns the
+  // decoder. This must be used before the stock is shared with other
+  // threads (e.g. when a file is loaded).
+  int addPendingImage(ImageDecoder* decoder);
+
+  // Returns true if the image in the "index" position is waiting to
+  // be decoded.
+  bool isImagePending(int index) const;
+
   // Removes a image from the stock, it doesn't resize the stock.
   void removeImage(Image* image);
 
@@ -65,7 +91,21 @@ public:
 
 //private: TODO uncomment this line
   PixelFormat m_format; // Type of images (all images in the stock must be of this type).
-  ImagesList m_image;   // The images-array where the images are.
+  mutable ImagesList m_image; // The images-array where the images are.
+
+private:
+  void deleteDecoder(int index);
+
+  // Decoders of images not yet decoded (it's empty if the stock
+  // doesn't contain images to be decoded).
+  mutable std::vector<ImageDecoder*> m_decoders;
+
+  // Protects m_decoders/m_image to decode images from several
+  // threads. It's created with the first decoder. getImage() is the
+  // only member function that can be called from several threads at
+  // the same time (the other ones modify the stock, so they must be
+  // called with the sprite locked for writing).
+  Mutex* m_mutex;
 };
 
 #endif
@@ -0,0 +1,84 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tests/test.h"
+
+#include "raster/image.h"
+#include "raster/stock.h"
+
+namespace {
+
+  class TestDecoder : public ImageDecoder {
+  public:
+    TestDecoder(int* calls) : m_calls(calls) { }
+    Image* decodeImage() {
+      ++(*m_calls);
+      Image* image = Image::create(IMAGE_INDEXED, 4, 3);
+      image->clear(7);
+      return image;
+    }
+  private:
+    int* m_calls;
+  };
+
+}
+
+TEST(Stock, PendingImageIsDecodedOnce)
+{
+  int calls = 0;
+  Stock stock(IMAGE_INDEXED);
+  int index = stock.addPendingImage(new TestDecoder(&calls));
+
+  EXPECT_TRUE(stock.isImagePending(index));
+  EXPECT_EQ(0, calls);
+
+  Image* image = stock.getImage(index);
+  ASSERT_TRUE(image != NULL);
+  EXPECT_EQ(4, image->w);
+  EXPECT_EQ(3, image->h);
+  EXPECT_EQ(7, (int)image->getpixel(3, 2));
+  EXPECT_FALSE(stock.isImagePending(index));
+
+  EXPECT_EQ(image, stock.getImage(index));
+  EXPECT_EQ(1, calls);
+}
+
+TEST(Stock, ReplacePendingImage)
+{
+  int calls = 0;
+  Stock stock(IMAGE_INDEXED);
+  int index = stock.addPendingImage(new TestDecoder(&calls));
+
+  Image* image = Image::create(IMAGE_INDEXED, 2, 2);
+  stock.replaceImage(index, image);
+
+  EXPECT_FALSE(stock.isImagePending(index));
+  EXPECT_EQ(image, stock.getImage(index));
+  EXPECT_EQ(0, calls);
+}
+
+TEST(Stock, CopyDecodesPendingImages)
+{
+  int calls = 0;
+  Stock stock(IMAGE_INDEXED);
+  int index = stock.addPendingImage(new TestDecoder(&calls));
+
+  Stock copy(stock);
+  EXPECT_EQ(1, calls);
+  EXPECT_FALSE(copy.isImagePending(index));
+  EXPECT_EQ(7, (int)copy.getImage(index)->getpixel(0, 0));
+}
@@ -0,0 +1,279 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include "thumbnail_cache.h"
+
+#include "base/fs.h"
+#include "base/path.h"
+#include "base/serialization.h"
+#include "base/sha1.h"
+#include "base/thread.h"
+#include "base/unique_ptr.h"
+#include "raster/image.h"
+
+#include "zlib.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#ifdef WIN32
+  #include <process.h>
+#else
+  #include <unistd.h>
+#endif
+
+#define THUMBNAIL_MAGIC         0x4D485441 // "ATHM"
+#define THUMBNAIL_VERSION       1
+#define MAX_THUMBNAIL_SIZE      1024
+
+using namespace base::serialization;
+using namespace base::serialization::little_endian;
+
+static void write64(std::ostream& os, uint64_t value)
+{
+  write32(os, uint32_t(value));
+  write32(os, uint32_t(value >> 32));
+}
+
+static uint64_t read64(std::istream& is)
+{
+  uint64_t value = read32(is);
+  return value | (uint64_t(read32(is)) << 32);
+}
+
+// Reads the header of a cache file (the version of the original file).
+static bool read_header(std::istream& is, time_t* mtime, uint64_t* size, std::string* filename)
+{
+  if (read32(is) != THUMBNAIL_MAGIC ||
+      read32(is) != THUMBNAIL_VERSION)
+    return false;
+
+  *mtime = time_t(read64(is));
+  *size = read64(is);
+
+  filename->assign(read16(is), '\0');
+  if (!filename->empty())
+    is.read(&(*filename)[0], filename->size());
+
+  return is.good();
+}
+
+// Returns a name for a temporary file which is different in each
+// thread (and each instance of the program).
+static std::string get_temp_file_name(const std::string& filename)
+{
+  char buf[64];
+#ifdef WIN32
+  unsigned long pid = _getpid();
+#else
+  unsigned long pid = getpid();
+#endif
+  std::sprintf(buf, ".%lx-%lx.tmp", pid,
+               (unsigned long)base::this_thread::native_handle());
+  return filename + buf;
+}
+
+struct CacheFile {
+  std::string filename;
+  time_t time;                  // Last time that the thumbnail was used
+  uint64_t size;
+  bool operator<(const CacheFile& other) const { return time < other.time; }
+};
+
+ThumbnailCache::ThumbnailCache(const std::string& dir)
+  : m_dir(dir)
+{
+}
+
+Image* ThumbnailCache::loadThumbnail(const std::string& filename, time_t mtime, uint64_t size) const
+{
+  std::ifstream is(getCacheFileName(filename).c_str(), std::ios::binary);
+  if (!is)
+    return NULL;
+
+  // Header (the file must be the same version of the cached file)
+  time_t cachedMtime;
+  uint64_t cachedSize;
+  std::string cachedFilename;
+  if (!read_header(is, &cachedMtime, &cachedSize, &cachedFilename) ||
+      cachedMtime != mtime ||
+      cachedSize != size ||
+      cachedFilename != filename)
+    return NULL;
+
+  // Mark the thumbnail as recently used (it's removed after the
+  // thumbnails that weren't used for more time)
+  base::set_file_time(getCacheFileName(filename), std::time(NULL));
+
+  int w = read16(is);
+  int h = read16(is);
+  uLongf compressedSize = read32(is);
+  if (!is || w < 1 || h < 1 || w > MAX_THUMBNAIL_SIZE || h > MAX_THUMBNAIL_SIZE)
+    return NULL;
+
+  std::vector<uint8_t> compressed(compressedSize);
+  if (compressedSize > 0)
+    is.read((char*)&compressed[0], compressedSize);
+  if (!is)
+    return NULL;
+
+  // Pixels
+  int lineSize = pixelformat_line_size(IMAGE_RGB, w);
+  std::vector<uint8_t> pixels(lineSize*h);
+  uLongf pixelsSize = pixels.size();
+  if (uncompress(&pixels[0], &pixelsSize, &compressed[0], compressedSize) != Z_OK ||
+      pixelsSize != pixels.size())
+    return NULL;
+
+  Image* thumbnail = Image::create(IMAGE_RGB, w, h);
+  for (int y=0; y<h; ++y)
+    std::copy(&pixels[y*lineSize], &pixels[y*lineSize]+lineSize, thumbnail->line[y]);
+
+  return thumbnail;
+}
+
+bool ThumbnailCache::saveThumbnail(const std::string& filename, time_t mtime, uint64_t size,
+                                   const Image* thumbnail) const
+{
+  ASSERT(thumbnail->getPixelFormat() == IMAGE_RGB);
+
+  if (!base::directory_exists(m_dir)) {
+    try {
+      std::string parent = base::get_file_path(m_dir);
+      if (!parent.empty() && !base::directory_exists(parent))
+        base::make_directory(parent);
+
+      base::make_directory(m_dir);
+    }
+    catch (...) {
+      // Other thread could create the directory at the same time
+      if (!base::directory_exists(m_dir))
+        return false;
+    }
+  }
+
+  int lineSize = image_line_size(thumbnail, thumbnail->w);
+  std::vector<uint8_t> pixels(lineSize*thumbnail->h);
+  for (int y=0; y<thumbnail->h; ++y)
+    std::copy(thumbnail->line[y], thumbnail->line[y]+lineSize, &pixels[y*lineSize]);
+
+  std::vector<uint8_t> compressed(compressBound(pixels.size()));
+  uLongf compressedSize = compressed.size();
+  if (compress2(&compressed[0], &compressedSize,
+                &pixels[0], pixels.size(), Z_BEST_SPEED) != Z_OK)
+    return false;
+
+  // Write a temporary file and then rename it, so other threads (or
+  // other instances of the program) don't read half-written files.
+  std::string cacheFilename = getCacheFileName(filename);
+  std::string tmpFilename = get_temp_file_name(cacheFilename);
+  bool ok;
+  {
+    std::ofstream os(tmpFilename.c_str(), std::ios::binary);
+    write32(os, THUMBNAIL_MAGIC);
+    write32(os, THUMBNAIL_VERSION);
+    write64(os, uint64_t(mtime));
+    write64(os, size);
+    write16(os, filename.size());
+    os.write(filename.c_str(), filename.size());
+    write16(os, thumbnail->w);
+    write16(os, thumbnail->h);
+    write32(os, compressedSize);
+    os.write((const char*)&compressed[0], compressedSize);
+    ok = os.good();
+  }
+
+  if (ok) {
+    std::remove(cacheFilename.c_str());
+    ok = (std::rename(tmpFilename.c_str(), cacheFilename.c_str()) == 0);
+  }
+
+  if (!ok)
+    std::remove(tmpFilename.c_str());
+
+  return ok;
+}
+
+void ThumbnailCache::removeOldThumbnails(uint64_t maxSize, const volatile bool* stop) const
+{
+  std::vector<std::string> names;
+  base::list_files(m_dir, names);
+
+  std::vector<CacheFile> files;
+  for (size_t i=0; i<names.size(); ++i) {
+    if (base::get_file_extension(names[i]) != "thumb")
+      continue;
+
+    CacheFile file;
+    file.filename = base::join_path(m_dir, names[i]);
+    file.time = base::get_file_time(file.filename);
+    files.push_back(file);
+  }
+
+  // Remove thumbnails of files that were deleted
+  std::vector<CacheFile> existent;
+  uint64_t totalSize = 0;
+  for (size_t i=0; i<files.size(); ++i) {
+    if (stop && *stop)
+      return;
+
+    time_t mtime;
+    uint64_t size;
+    std::string filename;
+    bool valid;
+    {
+      std::ifstream is(files[i].filename.c_str(), std::ios::binary);
+      valid = (is && read_header(is, &mtime, &size, &filename) &&
+               base::file_exists(filename));
+      if (valid) {
+        is.seekg(0, std::ios::end);
+        files[i].size = uint64_t(is.tellg());
+      }
+    }
+
+    if (valid) {
+      existent.push_back(files[i]);
+      totalSize += files[i].size;
+    }
+    else
+      std::remove(files[i].filename.c_str());
+  }
+
+  // Remove the least recently used thumbnails
+  if (totalSize > maxSize) {
+    std::sort(existent.begin(), existent.end());
+    for (size_t i=0; i<existent.size() && totalSize > maxSize; ++i) {
+      std::remove(existent[i].filename.c_str());
+      totalSize -= existent[i].size;
+    }
+  }
+}
+
+std::string ThumbnailCache::getCacheFileName(const std::string& filename) const
+{
+  base::Sha1 sha1 = base::Sha1::calculateFromData(filename.c_str(), filename.size());
+  char buf[2*base::Sha1::HashSize+1];
+  for (int i=0; i<base::Sha1::HashSize; ++i)
+    std::sprintf(buf+2*i, "%02x", sha1[i]);
+
+  return base::join_path(m_dir, std::string(buf) + ".thumb");
+}
@@ -0,0 +1,62 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef THUMBNAIL_CACHE_H_INCLUDED
+#define THUMBNAIL_CACHE_H_INCLUDED
+
+#include <ctime>
+#include <string>
+
+class Image;
+
+// Stores thumbnails of files in a folder (one cache file for each
+// file), so they don't need to be generated again if the file
+// wasn't modified (same modification time and size). The
+// modification time of each cache file is the last time it was
+// used, so the least recently used thumbnails are removed first.
+//
+// All methods can be called from several threads at the same time.
+class ThumbnailCache
+{
+public:
+  ThumbnailCache(const std::string& dir);
+
+  // Returns a new RGB image with the thumbnail of the given file, or
+  // NULL if there is no thumbnail in the cache for this version of
+  // the file. The thumbnail is marked as recently used.
+  Image* loadThumbnail(const std::string& filename, time_t mtime, uint64_t size) const;
+
+  // Saves the RGB thumbnail of the given file in the cache. Returns
+  // false if the thumbnail cannot be saved.
+  bool saveThumbnail(const std::string& filename, time_t mtime, uint64_t size,
+                     const Image* thumbnail) const;
+
+  // Removes the thumbnails of files that don't exist anymore, and the
+  // least recently used thumbnails while the cache files use more
+  // than "maxSize" bytes. It can take a while, so it returns as soon
+  // as possible (without removing anything else) if "stop" is set
+  // to true from other thread.
+  void removeOldThumbnails(uint64_t maxSize, const volatile bool* stop = NULL) const;
+
+private:
+  std::string getCacheFileName(const std::string& filename) const;
+
+  std::string m_dir;
+};
+
+#endif
@@ -0,0 +1,155 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <gtest/gtest.h>
+
+#include "base/fs.h"
+#include "base/path.h"
+#include "base/unique_ptr.h"
+#include "raster/image.h"
+#include "thumbnail_cache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+class ThumbnailCacheTest : public ::testing::Test {
+protected:
+  ThumbnailCacheTest()
+    : m_dir(base::join_path(base::get_temp_path(), "aseprite_thumbnail_cache_test")) {
+  }
+
+  ~ThumbnailCacheTest() {
+    if (base::directory_exists(m_dir)) {
+      ThumbnailCache(m_dir).removeOldThumbnails(0);
+      base::remove_directory(m_dir);
+    }
+  }
+
+  std::string m_dir;
+};
+
+static Image* create_test_image()
+{
+  Image* image = Image::create(IMAGE_RGB, 7, 5);
+  for (int y=0; y<image->h; ++y)
+    for (int x=0; x<image->w; ++x)
+      image->putpixel(x, y, _rgba(x*32, y*32, x+y, 255));
+  return image;
+}
+
+TEST_F(ThumbnailCacheTest, SaveAndLoad)
+{
+  ThumbnailCache cache(m_dir);
+  UniquePtr<Image> image(create_test_image());
+
+  EXPECT_TRUE(cache.saveThumbnail("sprite.ase", 1000, 2000, image));
+
+  UniquePtr<Image> thumbnail(cache.loadThumbnail("sprite.ase", 1000, 2000));
+  ASSERT_TRUE(thumbnail != NULL);
+  EXPECT_EQ(IMAGE_RGB, thumbnail->getPixelFormat());
+  EXPECT_EQ(image->w, thumbnail->w);
+  EXPECT_EQ(image->h, thumbnail->h);
+  for (int y=0; y<image->h; ++y)
+    for (int x=0; x<image->w; ++x)
+      EXPECT_EQ(image->getpixel(x, y), thumbnail->getpixel(x, y));
+}
+
+TEST_F(ThumbnailCacheTest, ModifiedFileIsNotLoaded)
+{
+  ThumbnailCache cache(m_dir);
+  UniquePtr<Image> image(create_test_image());
+
+  EXPECT_TRUE(cache.saveThumbnail("sprite.ase", 1000, 2000, image));
+
+  EXPECT_EQ(NULL, cache.loadThumbnail("sprite.ase", 1001, 2000));
+  EXPECT_EQ(NULL, cache.loadThumbnail("sprite.ase", 1000, 2001));
+}
+
+TEST_F(ThumbnailCacheTest, MissingThumbnail)
+{
+  ThumbnailCache cache(m_dir);
+
+  EXPECT_EQ(NULL, cache.loadThumbnail("sprite.ase", 1000, 2000));
+}
+
+TEST_F(ThumbnailCacheTest, RemoveOldThumbnails)
+{
+  ThumbnailCache cache(m_dir);
+  UniquePtr<Image> image(create_test_image());
+
+  // Two existent files and one that was deleted
+  std::string files[3];
+  for (int i=0; i<3; ++i) {
+    char buf[64];
+    std::sprintf(buf, "aseprite_thumbnail_cache_test%d.ase", i);
+    files[i] = base::join_path(base::get_temp_path(), buf);
+    std::ofstream(files[i].c_str()) << i;
+
+    EXPECT_TRUE(cache.saveThumbnail(files[i], 1000, 2000, image));
+  }
+  base::delete_file(files[2]);
+
+  cache.removeOldThumbnails(1024*1024);
+  {
+    UniquePtr<Image> a(cache.loadThumbnail(files[0], 1000, 2000));
+    UniquePtr<Image> b(cache.loadThumbnail(files[1], 1000, 2000));
+    EXPECT_TRUE(a != NULL);
+    EXPECT_TRUE(b != NULL);
+    EXPECT_EQ(NULL, cache.loadThumbnail(files[2], 1000, 2000));
+  }
+
+  // Both thumbnails were used a long time ago, and they have the
+  // same size
+  std::vector<std::string> names;
+  base::list_files(m_dir, names);
+  ASSERT_EQ(2u, names.size());
+  for (size_t i=0; i<names.size(); ++i)
+    base::set_file_time(base::join_path(m_dir, names[i]), 1000);
+
+  std::ifstream is(base::join_path(m_dir, names[0]).c_str(), std::ios::binary);
+  is.seekg(0, std::ios::end);
+  uint64_t thumbnailSize = uint64_t(is.tellg());
+  is.close();
+
+  // Use the second thumbnail, so only it is kept
+  UniquePtr<Image>(cache.loadThumbnail(files[1], 1000, 2000));
+  cache.removeOldThumbnails(thumbnailSize);
+  {
+    UniquePtr<Image> a(cache.loadThumbnail(files[0], 1000, 2000));
+    UniquePtr<Image> b(cache.loadThumbnail(files[1], 1000, 2000));
+    EXPECT_EQ(NULL, a.get());
+    EXPECT_TRUE(b != NULL);
+  }
+
+  // Nothing is removed if the operation is stopped
+  volatile bool stop = true;
+  cache.removeOldThumbnails(0, &stop);
+  EXPECT_TRUE(UniquePtr<Image>(cache.loadThumbnail(files[1], 1000, 2000)) != NULL);
+
+  base::delete_file(files[0]);
+  base::delete_file(files[1]);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
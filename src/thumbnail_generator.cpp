@@ -22,6 +22,7 @@
 
 #include "app.h"
 #include "base/bind.h"
+#include "base/path.h"
 #include "base/scoped_lock.h"
 #include "base/thread.h"
 #include "document.h"
@@ -31,93 +32,108 @@
 #include "raster/palette.h"
 #include "raster/rotate.h"
 #include "raster/sprite.h"
+#include "thumbnail_cache.h"
 
+#include <algorithm>
 #include <allegro.h>
+#include <cstdlib>
 
 #define MAX_THUMBNAIL_SIZE              128
+#define MAX_THUMBNAIL_WORKERS           4
+#define MAX_CACHE_SIZE                  (64*1024*1024) // Bytes of cached thumbnails
 
-class ThumbnailGenerator::Worker
+class ThumbnailGenerator::Task
 {
 public:
-  Worker(FileOp* fop, IFileItem* fileitem)
-    : m_fop(fop)
-    , m_fileitem(fileitem)
-    , m_thumbnail(NULL)
-    , m_palette(NULL)
-    , m_thumbnailBitmap(NULL)
-    , m_thread(Bind<void>(&Worker::loadBgThread, this)) {
+  Task(IFileItem* fileitem, Priority priority, int order)
+    : fileitem(fileitem)
+    , filename(fileitem->getFileName())
+    , priority(priority)
+    , order(order)
+    , fop(NULL)
+    , stop(false)
+    , thumbnail(NULL) {
   }
 
-  ~Worker() {
-    fop_stop(m_fop);
-    m_thread.join();
-
-    fop_free(m_fop);
+  ~Task() {
+    if (thumbnail)
+      destroy_bitmap(thumbnail);
   }
 
-  IFileItem* getFileItem() { return m_fileitem; }
-  bool isDone() const { return fop_is_done(m_fop); }
-  double getProgress() const { return fop_get_progress(m_fop); }
-
-private:
-  void loadBgThread() {
-    try {
-      fop_operate(m_fop, NULL);
-
-      // Post load
-      fop_post_load(m_fop);
-
-      // Convert the loaded document into the Allegro bitmap "m_thumbnail".
-      const Sprite* sprite = (m_fop->document && m_fop->document->getSprite()) ? m_fop->document->getSprite():
-                                                                                 NULL;
-      if (!fop_is_stop(m_fop) && sprite) {
-        // The palette to convert the Image to a BITMAP
-        m_palette.reset(new Palette(*sprite->getPalette(FrameNumber(0))));
-
-        // Render the 'sprite' in one plain 'image'
-        UniquePtr<Image> image(Image::create(sprite->getPixelFormat(),
-                                             sprite->getWidth(),
-                                             sprite->getHeight()));
-        sprite->render(image, 0, 0, FrameNumber(0));
-
-        // Calculate the thumbnail size
-        int thumb_w = MAX_THUMBNAIL_SIZE * image->w / MAX(image->w, image->h);
-        int thumb_h = MAX_THUMBNAIL_SIZE * image->h / MAX(image->w, image->h);
-        if (MAX(thumb_w, thumb_h) > MAX(image->w, image->h)) {
-          thumb_w = image->w;
-          thumb_h = image->h;
-        }
-        thumb_w = MID(1, thumb_w, MAX_THUMBNAIL_SIZE);
-        thumb_h = MID(1, thumb_h, MAX_THUMBNAIL_SIZE);
-
-        // Stretch the 'image'
-        m_thumbnail.reset(Image::create(image->getPixelFormat(), thumb_w, thumb_h));
-        image_clear(m_thumbnail, 0);
-        image_scale(m_thumbnail, image, 0, 0, thumb_w, thumb_h);
-      }
+  IFileItem* fileitem;
+  std::string filename;
+  Priority priority;
+  int order;
+  FileOp* fop;                  // Only while the file is being loaded
+  bool stop;
+  BITMAP* thumbnail;            // Generated thumbnail
+};
 
-      delete m_fop->document;
+// Returns the folder where thumbnails are cached.
+static std::string get_cache_dir()
+{
+#if defined ALLEGRO_UNIX || defined ALLEGRO_MACOSX
+  // $HOME/.aseprite/thumbnails
+  const char* home = std::getenv("HOME");
+  if (home)
+    return base::join_path(base::join_path(home, ".aseprite"), "thumbnails");
+#endif
+
+  // $BINDIR/thumbnails
+  char buf[1024], path[1024];
+  get_executable_name(path, sizeof(path));
+  replace_filename(buf, path, "thumbnails", sizeof(buf));
+  return buf;
+}
 
-      // Set the thumbnail of the file-item.
-      if (m_thumbnail) {
-        BITMAP* bmp = create_bitmap_ex(16, m_thumbnail->w, m_thumbnail->h);
-        image_to_allegro(m_thumbnail, bmp, 0, 0, m_palette);
-        m_fileitem->setThumbnail(bmp);
+// Renders the first frame of the sprite and returns a RGB image
+// with the thumbnail (with the same colors that image_to_allegro()
+// would use for the original pixel format).
+static Image* render_thumbnail(const Sprite* sprite)
+{
+  const Palette* palette = sprite->getPalette(FrameNumber(0));
+
+  // Render the 'sprite' in one plain 'image'
+  UniquePtr<Image> image(Image::create(sprite->getPixelFormat(),
+                                       sprite->getWidth(),
+                                       sprite->getHeight()));
+  sprite->render(image, 0, 0, FrameNumber(0));
+
+  // Calculate the thumbnail size
+  int thumb_w = MAX_THUMBNAIL_SIZE * image->w / MAX(image->w, image->h);
+  int thumb_h = MAX_THUMBNAIL_SIZE * image->h / MAX(image->w, image->h);
+  if (MAX(thumb_w, thumb_h) > MAX(image->w, image->h)) {
+    thumb_w = image->w;
+    thumb_h = image->h;
+  }
+  thumb_w = MID(1, thumb_w, MAX_THUMBNAIL_SIZE);
+  thumb_h = MID(1, thumb_h, MAX_THUMBNAIL_SIZE);
+
+  // Stretch the 'image'
+  UniquePtr<Image> thumbnail(Image::create(image->getPixelFormat(), thumb_w, thumb_h));
+  image_clear(thumbnail, 0);
+  image_scale(thumbnail, image, 0, 0, thumb_w, thumb_h);
+
+  if (thumbnail->getPixelFormat() == IMAGE_RGB)
+    return thumbnail.release();
+
+  Image* rgbThumbnail = Image::create(IMAGE_RGB, thumb_w, thumb_h);
+  for (int y=0; y<thumb_h; ++y) {
+    for (int x=0; x<thumb_w; ++x) {
+      int c = thumbnail->getpixel(x, y);
+      switch (thumbnail->getPixelFormat()) {
+        case IMAGE_GRAYSCALE:
+          c = _rgba(_graya_getv(c), _graya_getv(c), _graya_getv(c), 255);
+          break;
+        case IMAGE_INDEXED:
+          c = palette->getEntry(c);
+          break;
       }
+      rgbThumbnail->putpixel(x, y, c);
     }
-    catch (const std::exception& e) {
-      fop_error(m_fop, "Error loading file:\n%s", e.what());
-    }
-    fop_done(m_fop);
   }
-
-  FileOp* m_fop;
-  IFileItem* m_fileitem;
-  UniquePtr<Image> m_thumbnail;
-  BITMAP* m_thumbnailBitmap;
-  UniquePtr<Palette> m_palette;
-  base::thread m_thread;
-};
+  return rgbThumbnail;
+}
 
 static void delete_singleton(ThumbnailGenerator* singleton)
 {
@@ -134,92 +150,234 @@ ThumbnailGenerator* ThumbnailGenerator::instance()
   return singleton;
 }
 
+ThumbnailGenerator::ThumbnailGenerator()
+  : m_taskCounter(0)
+  , m_exit(false)
+  , m_cache(new ThumbnailCache(get_cache_dir()))
+  , m_stopPruning(false)
+{
+  int threads = MID(1, base::thread::hardware_concurrency(), MAX_THUMBNAIL_WORKERS);
+  for (int i=0; i<threads; ++i)
+    m_threads.push_back(new base::thread(&ThumbnailGenerator::workerProc, this));
+
+  // Don't let the cache grow forever (it's pruned in background
+  // because it reads the header of all cached thumbnails)
+  m_pruneThread.reset(new base::thread(&ThumbnailGenerator::pruneProc, this));
+}
+
+ThumbnailGenerator::~ThumbnailGenerator()
+{
+  {
+    ScopedLock hold(m_workersAccess);
+    m_exit = true;
+  }
+  m_stopPruning = true;
+  stopAllWorkers();
+  m_taskAvailable.notifyAll();
+
+  m_pruneThread->join();
+
+  for (size_t i=0; i<m_threads.size(); ++i) {
+    m_threads[i]->join();
+    delete m_threads[i];
+  }
+
+  for (TaskList::iterator it=m_done.begin(), end=m_done.end(); it!=end; ++it)
+    delete *it;
+}
+
 ThumbnailGenerator::WorkerStatus ThumbnailGenerator::getWorkerStatus(IFileItem* fileitem, double& progress)
 {
   ScopedLock hold(m_workersAccess);
 
-  for (WorkerList::iterator
-         it=m_workers.begin(), end=m_workers.end(); it!=end; ++it) {
-    Worker* worker = *it;
-    if (worker->getFileItem() == fileitem) {
-      if (worker->isDone())
-        return ThumbnailIsDone;
-      else {
-        progress = worker->getProgress();
-        return WorkingOnThumbnail;
-      }
-    }
+  if (Task* task = findTask(m_running, fileitem)) {
+    progress = (task->fop ? fop_get_progress(task->fop): 0.0);
+    return WorkingOnThumbnail;
   }
-  return WithoutWorker;
+  else if (findTask(m_done, fileitem))
+    return ThumbnailIsDone;
+  else
+    return WithoutWorker;
 }
 
 bool ThumbnailGenerator::checkWorkers()
 {
   ScopedLock hold(m_workersAccess);
-  bool doingWork = !m_workers.empty();
+  bool doingWork = (!m_queue.empty() || !m_running.empty() || !m_done.empty());
 
-  for (WorkerList::iterator
-         it=m_workers.begin(); it != m_workers.end(); ) {
-    if ((*it)->isDone()) {
-      delete *it;
-      it = m_workers.erase(it);
-    }
-    else {
-      ++it;
+  for (TaskList::iterator it=m_done.begin(), end=m_done.end(); it!=end; ++it) {
+    Task* task = *it;
+
+    // Set the thumbnail of the file-item.
+    if (task->thumbnail) {
+      task->fileitem->setThumbnail(task->thumbnail);
+      task->thumbnail = NULL;
     }
+    delete task;
   }
+  m_done.clear();
 
   return doingWork;
 }
 
-void ThumbnailGenerator::addWorkerToGenerateThumbnail(IFileItem* fileitem)
+void ThumbnailGenerator::addWorkerToGenerateThumbnail(IFileItem* fileitem, Priority priority)
 {
-  double progress;
-
   if (fileitem->isBrowsable() ||
-      fileitem->getThumbnail() != NULL ||
-      getWorkerStatus(fileitem, progress) != WithoutWorker)
+      fileitem->getThumbnail() != NULL)
     return;
 
-  FileOp* fop = fop_to_load_document(fileitem->getFileName().c_str(),
-                                     FILE_LOAD_SEQUENCE_NONE |
-                                     FILE_LOAD_ONE_FRAME);
-  if (!fop)
+  ScopedLock hold(m_workersAccess);
+
+  if (findTask(m_running, fileitem) ||
+      findTask(m_done, fileitem))
     return;
 
-  if (fop->has_error()) {
-    fop_free(fop);
+  if (Task* task = findTask(m_queue, fileitem)) {
+    if (task->priority < priority)
+      task->priority = priority;
+    return;
+  }
+
+  m_queue.push_back(new Task(fileitem, priority, ++m_taskCounter));
+  m_taskAvailable.notifyOne();
+}
+
+void ThumbnailGenerator::cancelPendingThumbnails()
+{
+  ScopedLock hold(m_workersAccess);
+
+  for (TaskList::iterator it=m_queue.begin(), end=m_queue.end(); it!=end; ++it)
+    delete *it;
+  m_queue.clear();
+}
+
+void ThumbnailGenerator::stopAllWorkers()
+{
+  cancelPendingThumbnails();
+
+  ScopedLock hold(m_workersAccess);
+  for (TaskList::iterator it=m_running.begin(), end=m_running.end(); it!=end; ++it) {
+    Task* task = *it;
+    task->stop = true;
+    if (task->fop)
+      fop_stop(task->fop);
   }
-  else {
-    Worker* worker = new Worker(fop, fileitem);
-    try {
+}
+
+void ThumbnailGenerator::workerProc(ThumbnailGenerator* generator)
+{
+  generator->workerLoop();
+}
+
+void ThumbnailGenerator::pruneProc(ThumbnailGenerator* generator)
+{
+  generator->m_cache->removeOldThumbnails(MAX_CACHE_SIZE, &generator->m_stopPruning);
+}
+
+void ThumbnailGenerator::workerLoop()
+{
+  for (;;) {
+    Task* task;
+    {
       ScopedLock hold(m_workersAccess);
-      m_workers.push_back(worker);
+      while (m_queue.empty() && !m_exit)
+        m_taskAvailable.wait(hold);
+
+      if (m_exit)
+        break;
+
+      // Get the task with more priority (or the oldest one)
+      TaskList::iterator best = m_queue.begin();
+      for (TaskList::iterator it=m_queue.begin(), end=m_queue.end(); it!=end; ++it) {
+        if ((*it)->priority > (*best)->priority ||
+            ((*it)->priority == (*best)->priority && (*it)->order < (*best)->order))
+          best = it;
+      }
+
+      task = *best;
+      m_queue.erase(best);
+      m_running.push_back(task);
     }
-    catch (...) {
-      delete worker;
-      throw;
+
+    generateThumbnail(task);
+
+    {
+      ScopedLock hold(m_workersAccess);
+      m_running.erase(std::find(m_running.begin(), m_running.end(), task));
+      m_done.push_back(task);
     }
   }
 }
 
-void ThumbnailGenerator::stopAllWorkers()
+void ThumbnailGenerator::generateThumbnail(Task* task)
 {
-  base::thread* ptr = new base::thread(Bind<void>(&ThumbnailGenerator::stopAllWorkersBackground, this));
-  m_stopThread.reset(ptr);
-}
+  const char* filename = task->filename.c_str();
+  time_t mtime = file_time(filename);
+  uint64_t size = file_size_ex(filename);
+
+  // Is the thumbnail in the cache?
+  UniquePtr<Image> thumbnail(m_cache->loadThumbnail(task->filename, mtime, size));
+  if (!thumbnail) {
+    // Several thumbnails are generated at the same time, so the FileOp
+    // doesn't create its own threads.
+    FileOp* fop = fop_to_load_document(filename,
+                                       FILE_LOAD_SEQUENCE_NONE |
+                                       FILE_LOAD_ONE_FRAME |
+                                       FILE_LOAD_THUMBNAIL |
+                                       FILE_LOAD_SINGLE_THREAD);
+    if (!fop)
+      return;
+
+    {
+      ScopedLock hold(m_workersAccess);
+      if (task->stop)
+        fop_stop(fop);
+      task->fop = fop;
+    }
 
-void ThumbnailGenerator::stopAllWorkersBackground()
-{
-  WorkerList workersCopy;
-  {
-    ScopedLock hold(m_workersAccess);
-    workersCopy = m_workers;
-    m_workers.clear();
+    if (!fop->has_error() && !fop_is_stop(fop)) {
+      try {
+        fop_operate(fop, NULL);
+
+        // Post load
+        fop_post_load(fop);
+
+        // Convert the loaded document into the thumbnail.
+        const Sprite* sprite = (fop->document && fop->document->getSprite()) ? fop->document->getSprite():
+                                                                               NULL;
+        if (!fop_is_stop(fop) && sprite)
+          thumbnail.reset(render_thumbnail(sprite));
+      }
+      catch (const std::exception& e) {
+        fop_error(fop, "Error loading file:\n%s", e.what());
+      }
+
+      delete fop->document;
+    }
+    fop_done(fop);
+
+    {
+      ScopedLock hold(m_workersAccess);
+      task->fop = NULL;
+    }
+    fop_free(fop);
+
+    if (thumbnail)
+      m_cache->saveThumbnail(task->filename, mtime, size, thumbnail);
   }
 
-  for (WorkerList::iterator
-         it=workersCopy.begin(), end=workersCopy.end(); it!=end; ++it) {
-    delete *it;
+  if (thumbnail) {
+    BITMAP* bmp = create_bitmap_ex(16, thumbnail->w, thumbnail->h);
+    image_to_allegro(thumbnail, bmp, 0, 0, NULL);
+    task->thumbnail = bmp;
+  }
+}
+
+ThumbnailGenerator::Task* ThumbnailGenerator::findTask(TaskList& tasks, IFileItem* fileitem)
+{
+  for (TaskList::iterator it=tasks.begin(), end=tasks.end(); it!=end; ++it) {
+    if ((*it)->fileitem == fileitem)
+      return *it;
   }
+  return NULL;
 }
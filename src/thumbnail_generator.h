@@ -19,49 +19,80 @@
 #ifndef THUMBNAIL_GENERATOR_H_INCLUDED
 #define THUMBNAIL_GENERATOR_H_INCLUDED
 
+#include "base/condition_variable.h"
 #include "base/mutex.h"
 #include "base/unique_ptr.h"
 
 #include <vector>
 
 class IFileItem;
+class ThumbnailCache;
 namespace base { class thread; }
 
+// Generates thumbnails of files in a fixed set of worker threads.
+// Thumbnails are stored in a disk cache, so they are not generated
+// again in the next session if the file wasn't modified. The least
+// recently used thumbnails are removed from the cache in other
+// thread when the generator is created.
 class ThumbnailGenerator
 {
 public:
   enum WorkerStatus { WithoutWorker, WorkingOnThumbnail, ThumbnailIsDone };
 
+  // Items with higher priority are processed first.
+  enum Priority { VisibleItem, SelectedItem };
+
   static ThumbnailGenerator* instance();
 
-  // Generate a thumbnail for the given file-item.  It must be called
-  // from the GUI thread.
-  void addWorkerToGenerateThumbnail(IFileItem* fileitem);
+  ThumbnailGenerator();
+  ~ThumbnailGenerator();
+
+  // Queues the generation of a thumbnail for the given file-item. If
+  // the item is already in the queue, its priority is raised (if
+  // needed). It must be called from the GUI thread.
+  void addWorkerToGenerateThumbnail(IFileItem* fileitem,
+                                    Priority priority = SelectedItem);
+
+  // Removes all queued thumbnails that weren't started yet (e.g. to
+  // queue only the items that are visible right now).
+  void cancelPendingThumbnails();
 
   // Returns the status of the worker that is generating the thumbnail
   // for the given file.
   WorkerStatus getWorkerStatus(IFileItem* fileitem, double& progress);
 
-  // Checks the status of workers. If there are workers that already
-  // done its job, we've to destroy them. This function must be called
-  // from the GUI thread (because a thread is joint to it).
-  // Returns true if there are workers generating thumbnails.
+  // Checks the status of workers. Finished thumbnails are assigned to
+  // their file-items, so this function must be called from the GUI
+  // thread. Returns true if there are workers generating thumbnails.
   bool checkWorkers();
 
   // Stops all workers generating thumbnails. This is an non-blocking
-  // operation. The cancelation of all workers is done in a background
-  // thread.
+  // operation: queued items are removed and the current ones are
+  // canceled as soon as possible.
   void stopAllWorkers();
 
 private:
-  void stopAllWorkersBackground();
+  class Task;
+  typedef std::vector<Task*> TaskList;
+
+  void workerLoop();
+  void generateThumbnail(Task* task);
+  Task* findTask(TaskList& tasks, IFileItem* fileitem);
 
-  class Worker;
-  typedef std::vector<Worker*> WorkerList;
+  static void workerProc(ThumbnailGenerator* generator);
+  static void pruneProc(ThumbnailGenerator* generator);
 
-  WorkerList m_workers;
+  TaskList m_queue;             // Tasks waiting for a worker
+  TaskList m_running;           // Tasks being processed by workers
+  TaskList m_done;              // Tasks to be checked by checkWorkers()
+  int m_taskCounter;            // To process tasks in FIFO order
+  bool m_exit;
   Mutex m_workersAccess;
-  UniquePtr<base::thread> m_stopThread;
+  ConditionVariable m_taskAvailable;
+  std::vector<base::thread*> m_threads;
+  UniquePtr<ThumbnailCache> m_cache;
+  UniquePtr<base::thread> m_pruneThread;
+  volatile bool m_stopPruning;
 };
 
 #endif
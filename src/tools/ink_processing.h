@@ -23,6 +23,8 @@
 #include "raster/sprite.h"
 #include "settings/document_settings.h"
 
+#include <algorithm>
+
 //////////////////////////////////////////////////////////////////////
 // Ink Processing
 //////////////////////////////////////////////////////////////////////
@@ -118,8 +120,35 @@ static void ink_hline8_opaque(int x1, int y, int x2, ToolLoop* loop)
 // Transparent Ink
 //////////////////////////////////////////////////////////////////////
 
+// Blends the same color over a whole hline using span blenders (used
+// when the tool doesn't need to check the selection mask).
+template<class Traits>
+static void ink_hline_transparent_span(int x1, int y, int x2, ToolLoop* loop)
+{
+  const int kChunkSize = 256;
+  typename Traits::pixel_t colors[kChunkSize];
+  typename Traits::span_blender_t blender = Traits::get_span_blender(BLEND_MODE_NORMAL);
+  typename Traits::address_t src_address = image_address_fast<Traits>(loop->getSrcImage(), x1, y);
+  typename Traits::address_t dst_address = image_address_fast<Traits>(loop->getDstImage(), x1, y);
+  int opacity = loop->getOpacity();
+
+  std::fill(colors, colors+kChunkSize, (typename Traits::pixel_t)loop->getPrimaryColor());
+
+  for (int x=x1; x<=x2; x+=kChunkSize) {
+    int n = MIN(kChunkSize, x2-x+1);
+    (*blender)(dst_address, src_address, colors, n, opacity, NULL);
+    src_address += n;
+    dst_address += n;
+  }
+}
+
 static void ink_hline32_transparent(int x1, int y, int x2, ToolLoop* loop)
 {
+  if (!loop->useMask()) {
+    ink_hline_transparent_span<RgbTraits>(x1, y, x2, loop);
+    return;
+  }
+
   int color = loop->getPrimaryColor();
   int opacity = loop->getOpacity();
 
@@ -130,6 +159,11 @@ static void ink_hline32_transparent(int x1, int y, int x2, ToolLoop* loop)
 
 static void ink_hline16_transparent(int x1, int y, int x2, ToolLoop* loop)
 {
+  if (!loop->useMask()) {
+    ink_hline_transparent_span<GrayscaleTraits>(x1, y, x2, loop);
+    return;
+  }
+
   int color = loop->getPrimaryColor();
   int opacity = loop->getOpacity();
 
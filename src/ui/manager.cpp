@@ -5,6 +5,7 @@
 // read LICENSE.txt for more information.
 
 // #define REPORT_EVENTS
+// #define REPORT_QUEUE_STATS
 // #define LIMIT_DISPATCH_TIME
 
 #include "config.h"
@@ -14,7 +15,7 @@
 #include "ui/gui.h"
 #include "ui/intern.h"
 
-#ifdef REPORT_EVENTS
+#if defined(REPORT_EVENTS) || defined(REPORT_QUEUE_STATS)
 #include <cstdio>
 #endif
 #include <allegro.h>
@@ -72,6 +73,7 @@ Manager* Manager::m_defaultManager = NULL;
 static WidgetsList new_windows; // Windows that we should show
 static WidgetsList mouse_widgets_list; // List of widgets to send mouse events
 static Messages msg_queue;             // Messages queue
+static Messages msg_free_nodes;        // Nodes to be reused by msg_queue
 static Filters msg_filters[NFILTERS]; // Filters for every enqueued message
 
 static Widget* focus_widget;    // The widget with the focus
@@ -95,6 +97,79 @@ static int cmp_right(Widget* widget, int x, int y);
 static int cmp_up(Widget* widget, int x, int y);
 static int cmp_down(Widget* widget, int x, int y);
 
+// Adds the message at the end of the queue reusing a free node (so
+// std::list doesn't allocate a new node for each message).
+static void push_message(Message* msg)
+{
+  if (!msg_free_nodes.empty()) {
+    msg_free_nodes.front() = msg;
+    msg_queue.splice(msg_queue.end(), msg_free_nodes, msg_free_nodes.begin());
+  }
+  else
+    msg_queue.push_back(msg);
+
+  MessageStats& stats = jmessage_stats();
+  ++stats.queued;
+  stats.maxQueued = MAX(stats.maxQueued, stats.queued);
+}
+
+// Removes the message from the queue keeping its node to be reused.
+// Returns the iterator to the next message.
+static Messages::iterator erase_message(Messages::iterator it)
+{
+  Messages::iterator next = it;
+  ++next;
+  msg_free_nodes.splice(msg_free_nodes.begin(), msg_queue, it);
+
+  --jmessage_stats().queued;
+  return next;
+}
+
+// Merges "msg" with the "queued" message (the last one in the queue)
+// when it's useless to process both of them: consecutive mouse
+// motions, or redraws of the same area, for the same widgets.
+// Returns true if "msg" was merged (so it can be freed).
+static bool coalesce_message(Message* queued, const Message* msg)
+{
+  if (queued->any.used ||
+      queued->type != msg->type ||
+      *queued->any.widgets != *msg->any.widgets)
+    return false;
+
+  switch (msg->type) {
+
+    case JM_MOTION:
+      queued->any.shifts = msg->any.shifts;
+      queued->mouse.x = msg->mouse.x;
+      queued->mouse.y = msg->mouse.y;
+      queued->mouse.flags = msg->mouse.flags;
+      queued->mouse.left = msg->mouse.left;
+      queued->mouse.right = msg->mouse.right;
+      queued->mouse.middle = msg->mouse.middle;
+      return true;
+
+    case JM_DRAW: {
+      const jrect& a = queued->draw.rect;
+      const jrect& b = msg->draw.rect;
+
+      // The new area is inside the queued one
+      if (b.x1 >= a.x1 && b.y1 >= a.y1 && b.x2 <= a.x2 && b.y2 <= a.y2) {
+        queued->draw.count = msg->draw.count;
+        return true;
+      }
+      // The new area contains the queued one
+      else if (a.x1 >= b.x1 && a.y1 >= b.y1 && a.x2 <= b.x2 && a.y2 <= b.y2) {
+        queued->draw.count = msg->draw.count;
+        queued->draw.rect = msg->draw.rect;
+        return true;
+      }
+      break;
+    }
+  }
+
+  return false;
+}
+
 /* hooks the close-button in some platform with window support */
 static void allegro_window_close_hook()
 {
@@ -460,6 +535,29 @@ void Manager::dispatchMessages()
   enqueueMessage(msg);
 
   pumpQueue();
+
+#ifdef REPORT_QUEUE_STATS
+  {
+    static int last_ticks = ji_clock;
+    static MessageStats last_stats = jmessage_stats();
+
+    if (ji_clock - last_ticks >= 1000) {
+      MessageStats& stats = jmessage_stats();
+
+      printf("Messages queue: %d queued (max %d), %d allocated, %d recycled, %d coalesced in %d ms\n",
+             stats.queued, stats.maxQueued,
+             stats.allocated - last_stats.allocated,
+             stats.recycled - last_stats.recycled,
+             stats.coalesced - last_stats.coalesced,
+             ji_clock - last_ticks);
+      fflush(stdout);
+
+      stats.maxQueued = stats.queued;
+      last_stats = stats;
+      last_ticks = ji_clock;
+    }
+  }
+#endif
 }
 
 void Manager::addToGarbage(Widget* widget)
@@ -494,10 +592,16 @@ void Manager::enqueueMessage(Message* msg)
   }
 
   // There are a destination widget at least?
-  if (!msg->any.widgets->empty())
-    msg_queue.push_back(msg);
-  else
+  if (msg->any.widgets->empty()) {
     jmessage_free(msg);
+  }
+  // Can we merge it with the last message?
+  else if (!msg_queue.empty() && coalesce_message(msg_queue.back(), msg)) {
+    ++jmessage_stats().coalesced;
+    jmessage_free(msg);
+  }
+  else
+    push_message(msg);
 }
 
 Window* Manager::getTopWindow()
@@ -733,7 +837,7 @@ void Manager::removeMessage(Message* msg)
 {
   Messages::iterator it = std::find(msg_queue.begin(), msg_queue.end(), msg);
   ASSERT(it != msg_queue.end());
-  msg_queue.erase(it);
+  erase_message(it);
 }
 
 void Manager::removeMessagesFor(Widget* widget)
@@ -751,7 +855,7 @@ void Manager::removeMessagesForTimer(Timer* timer)
         message->any.type == JM_TIMER &&
         message->timer.timer == timer) {
       jmessage_free(message);
-      it = msg_queue.erase(it);
+      it = erase_message(it);
     }
     else
       ++it;
@@ -1101,7 +1205,7 @@ void Manager::pumpQueue()
     }
 
     // Remove the message from the msg_queue
-    it = msg_queue.erase(it);
+    it = erase_message(it);
 
     // Destroy the message
     jmessage_free(first_msg);
@@ -8,6 +8,7 @@
 
 #include <allegro/keyboard.h>
 #include <string.h>
+#include <vector>
 
 #include "base/memory.h"
 #include "ui/manager.h"
@@ -17,21 +18,75 @@
 
 namespace ui {
 
+// Maximum number of freed messages that are kept to be reused.
+#define MAX_FREE_MESSAGES 256
+
 static int registered_messages = JM_REGISTERED_MESSAGES;
+static MessageStats message_stats;
+
+// Freed messages (with their empty list of destinations) are kept
+// here so new messages don't need to be allocated each time (e.g. for
+// mouse motions).
+static class MessagesPool {
+public:
+  ~MessagesPool() {
+    for (std::vector<Message*>::iterator it=m_free.begin(); it!=m_free.end(); ++it) {
+      delete (*it)->any.widgets;
+      delete *it;
+    }
+  }
+
+  // Returns a message with garbage data, but with an empty list of
+  // destinations.
+  Message* alloc() {
+    Message* msg;
+    if (!m_free.empty()) {
+      msg = m_free.back();
+      m_free.pop_back();
+      ++message_stats.recycled;
+    }
+    else {
+      msg = new Message;
+      msg->any.widgets = new WidgetsList;
+      ++message_stats.allocated;
+    }
+    return msg;
+  }
+
+  void free(Message* msg) {
+    if (m_free.size() < MAX_FREE_MESSAGES) {
+      msg->any.widgets->clear();
+      m_free.push_back(msg);
+    }
+    else {
+      delete msg->any.widgets;
+      delete msg;
+    }
+  }
+
+private:
+  std::vector<Message*> m_free;
+} messages_pool;
 
 int ji_register_message_type()
 {
   return registered_messages++;
 }
 
+MessageStats& jmessage_stats()
+{
+  return message_stats;
+}
+
 Message* jmessage_new(int type)
 {
-  Message* msg = new Message;
+  Message* msg = messages_pool.alloc();
+  WidgetsList* widgets = msg->any.widgets;
 
   memset(msg, 0, sizeof(Message));
 
   msg->type = type;
-  msg->any.widgets = new WidgetsList;
+  msg->any.widgets = widgets;
   msg->any.shifts =
     (key[KEY_LSHIFT] || key[KEY_RSHIFT] ? KB_SHIFT_FLAG: 0) |
     (key[KEY_LCONTROL] || key[KEY_RCONTROL] ? KB_CTRL_FLAG: 0) |
@@ -68,17 +123,15 @@ Message* jmessage_new_key_related(int type, int readkey_value)
 
 Message* jmessage_new_copy(const Message* msg)
 {
-  Message* copy;
-
   ASSERT(msg != NULL);
 
-  copy = new Message;
-  if (!copy)
-    return NULL;
+  Message* copy = messages_pool.alloc();
+  WidgetsList* widgets = copy->any.widgets;
 
   memcpy(copy, msg, sizeof(Message));
 
-  copy->any.widgets = new WidgetsList(*msg->any.widgets);
+  copy->any.widgets = widgets;
+  copy->any.widgets->assign(msg->any.widgets->begin(), msg->any.widgets->end());
   copy->any.used = false;
 
   return copy;
@@ -88,13 +141,12 @@ Message* jmessage_new_copy_without_dests(const Message* msg)
 {
   ASSERT(msg != NULL);
 
-  Message* copy = new Message;
-  if (!copy)
-    return NULL;
+  Message* copy = messages_pool.alloc();
+  WidgetsList* widgets = copy->any.widgets;
 
   memcpy(copy, msg, sizeof(Message));
 
-  copy->any.widgets = new WidgetsList;
+  copy->any.widgets = widgets;
   copy->any.used = false;
 
   return copy;
@@ -104,8 +156,7 @@ void jmessage_free(Message* msg)
 {
   ASSERT(msg != NULL);
 
-  delete msg->any.widgets;
-  delete msg;
+  messages_pool.free(msg);
 }
 
 void jmessage_add_dest(Message* msg, Widget* widget)
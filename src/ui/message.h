@@ -93,8 +93,20 @@ namespace ui {
     MessageUser user;
   };
 
+  // Counters to check the performance of the messages queue.
+  struct MessageStats
+  {
+    int allocated;              // Messages allocated in the heap
+    int recycled;               // Messages reused from the pool
+    int coalesced;              // Messages merged with the last queued one
+    int queued;                 // Messages in the queue right now
+    int maxQueued;              // Maximum number of queued messages
+  };
+
   int ji_register_message_type();
 
+  MessageStats& jmessage_stats();
+
   Message* jmessage_new(int type);
   Message* jmessage_new_key_related(int type, int readkey_value);
   Message* jmessage_new_copy(const Message* msg);
@@ -0,0 +1,86 @@
+// ASEPRITE gui library
+// Copyright (C) 2001-2013  David Capello
+//
+// This source file is distributed under a BSD-like license, please
+// read LICENSE.txt for more information.
+
+#define TEST_GUI
+#include "tests/test.h"
+
+using namespace ui;
+
+TEST(Message, RecycleFreedMessages)
+{
+  MessageStats old = jmessage_stats();
+
+  Message* msg = jmessage_new(JM_MOTION);
+  jmessage_free(msg);
+
+  // The message was allocated or recycled from a previous test
+  int allocated = jmessage_stats().allocated;
+  EXPECT_EQ(1, (jmessage_stats().allocated - old.allocated) +
+               (jmessage_stats().recycled - old.recycled));
+
+  for (int i=0; i<10; ++i) {
+    msg = jmessage_new(JM_MOTION);
+    EXPECT_TRUE(msg->any.widgets->empty());
+    EXPECT_EQ(JM_MOTION, msg->type);
+    jmessage_free(msg);
+  }
+
+  EXPECT_EQ(allocated, jmessage_stats().allocated);
+}
+
+TEST(Message, CoalesceMotions)
+{
+  Manager* manager = Manager::getDefault();
+  Widget* widget = new Widget(JI_WIDGET);
+  MessageStats old = jmessage_stats();
+
+  for (int i=0; i<10; ++i) {
+    Message* msg = jmessage_new(JM_MOTION);
+    msg->mouse.x = i;
+    jmessage_add_dest(msg, widget);
+    manager->enqueueMessage(msg);
+  }
+
+  // Just one message is in the queue (with the last position)
+  EXPECT_EQ(old.queued+1, jmessage_stats().queued);
+  EXPECT_EQ(old.coalesced+9, jmessage_stats().coalesced);
+
+  manager->removeMessagesFor(widget);
+  manager->dispatchMessages();
+  EXPECT_EQ(old.queued, jmessage_stats().queued);
+
+  delete widget;
+}
+
+TEST(Message, CoalesceDrawsOfTheSameArea)
+{
+  Manager* manager = Manager::getDefault();
+  Widget* widget = new Widget(JI_WIDGET);
+  MessageStats old = jmessage_stats();
+  int rects[][4] = { { 10, 10, 20, 20 },  // Queued
+                     { 12, 12, 18, 18 },  // Inside the previous one
+                     { 0, 0, 30, 30 },    // Contains the previous one
+                     { 40, 40, 50, 50 } }; // Other area
+
+  for (int i=0; i<4; ++i) {
+    Message* msg = jmessage_new(JM_DRAW);
+    msg->draw.rect.x1 = rects[i][0];
+    msg->draw.rect.y1 = rects[i][1];
+    msg->draw.rect.x2 = rects[i][2];
+    msg->draw.rect.y2 = rects[i][3];
+    jmessage_add_dest(msg, widget);
+    manager->enqueueMessage(msg);
+  }
+
+  EXPECT_EQ(old.queued+2, jmessage_stats().queued);
+  EXPECT_EQ(old.coalesced+2, jmessage_stats().coalesced);
+
+  manager->removeMessagesFor(widget);
+  manager->dispatchMessages();
+  EXPECT_EQ(old.queued, jmessage_stats().queued);
+
+  delete widget;
+}
@@ -29,7 +29,8 @@ public:
   virtual void dispose() = 0;
 
   // Returns the amount of memory (in bytes) which this instance is
-  // using to revert the action.
+  // using to revert the action. It must not change while the undoer
+  // is in a UndoersStack (which keeps the total size of its undoers).
   virtual size_t getMemSize() const = 0;
 
   // Returns the kind of modification that this item does with the
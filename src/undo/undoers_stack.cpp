@@ -16,7 +16,7 @@ using namespace undo;
 UndoersStack::UndoersStack(UndoHistory* undoHistory)
 {
   m_undoHistory = undoHistory;
-  m_size = 0;
+  m_memSize = 0;
 }
 
 UndoersStack::~UndoersStack()
@@ -29,13 +29,8 @@ void UndoersStack::clear()
   for (iterator it = begin(), end = this->end(); it != end; ++it)
     (*it)->dispose();           // Delete the Undoer.
 
-  m_size = 0;
   m_items.clear();              // Clear the list of items.
-}
-
-size_t UndoersStack::getMemSize() const
-{
-  return m_size;
+  m_memSize = 0;
 }
 
 ObjectsContainer* UndoersStack::getObjects() const
@@ -55,7 +50,7 @@ void UndoersStack::pushUndoer(Undoer* undoer)
     throw;
   }
 
-  m_size += undoer->getMemSize();
+  m_memSize += undoer->getMemSize();
 }
 
 Undoer* UndoersStack::popUndoer(PopFrom popFrom)
@@ -71,7 +66,7 @@ Undoer* UndoersStack::popUndoer(PopFrom popFrom)
 
     undoer = (*it);                 // Set the undoer to return.
     m_items.erase(it);              // Erase the item from the stack.
-    m_size -= undoer->getMemSize(); // Reduce the stack size.
+    m_memSize -= undoer->getMemSize();
   }
   else
     undoer = NULL;
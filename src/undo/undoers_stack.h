@@ -49,7 +49,9 @@ public:
 
   void clear();
 
-  size_t getMemSize() const;
+  // Memory used by the undoers of the stack (their sizes are added
+  // and subtracted when they are pushed and popped).
+  size_t getMemSize() const { return m_memSize; }
 
   // UndoersCollector implementation
   void pushUndoer(Undoer* undoer);
@@ -63,9 +65,7 @@ public:
 private:
   UndoHistory* m_undoHistory;
   Items m_items;
-
-  // Bytes occupied by all undoers in the stack.
-  size_t m_size;
+  size_t m_memSize;
 };
 
 } // namespace undo
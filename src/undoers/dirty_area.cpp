@@ -27,13 +27,17 @@
 #include "undo/objects_container.h"
 #include "undo/undoers_collector.h"
 
+#include <sstream>
+
 using namespace undo;
 using namespace undoers;
 
 DirtyArea::DirtyArea(ObjectsContainer* objects, Image* image, Dirty* dirty)
   : m_imageId(objects->addObject(image))
 {
-  raster::write_dirty(m_stream, dirty);
+  std::stringstream stream;
+  raster::write_dirty(stream, dirty);
+  m_data.store(stream);
 }
 
 void DirtyArea::dispose()
@@ -44,7 +48,9 @@ void DirtyArea::dispose()
 void DirtyArea::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 {
   Image* image = objects->getObjectT<Image>(m_imageId);
-  UniquePtr<Dirty> dirty(raster::read_dirty(m_stream));
+  std::stringstream stream;
+  m_data.load(stream);
+  UniquePtr<Dirty> dirty(raster::read_dirty(stream));
 
   // Swap the saved pixels in the dirty with the pixels in the image
   dirty->swapImagePixels(image);
@@ -25,6 +25,8 @@
 #include "undo/undo_exception.h"
 #include "undo/undoers_collector.h"
 
+#include <vector>
+
 using namespace undo;
 using namespace undoers;
 
@@ -33,13 +35,15 @@ ImageArea::ImageArea(ObjectsContainer* objects, Image* image, int x, int y, int
   , m_format(image->getPixelFormat())
   , m_x(x), m_y(y), m_w(w), m_h(h)
   , m_lineSize(image_line_size(image, w))
-  , m_data(m_lineSize * h)
 {
   ASSERT(w >= 1 && h >= 1);
   ASSERT(x >= 0 && y >= 0 && x+w <= image->w && y+h <= image->h);
 
+  std::vector<uint8_t> data(m_lineSize * h);
   for (int v=0; v<h; ++v)
-    memcpy(&m_data[m_lineSize*v], image_address(image, x, y+v), m_lineSize);
+    memcpy(&data[m_lineSize*v], image_address(image, x, y+v), m_lineSize);
+
+  m_data.store(&data[0], data.size());
 }
 
 void ImageArea::dispose()
@@ -58,6 +62,9 @@ void ImageArea::revert(ObjectsContainer* objects, UndoersCollector* redoers)
   redoers->pushUndoer(new ImageArea(objects, image, m_x, m_y, m_w, m_h));
 
   // Restore the old image portion
+  std::vector<uint8_t> data;
+  m_data.load(data);
   for (int v=0; v<m_h; ++v)
-    memcpy(image_address(image, m_x, m_y+v), &m_data[m_lineSize*v], m_lineSize);
+    memcpy(image_address(image, m_x, m_y+v), &data[m_lineSize*v], m_lineSize);
+  image->incrementModifications();
 }
@@ -20,10 +20,9 @@
 #define UNDOERS_IMAGE_AREA_H_INCLUDED
 
 #include "undo/object_id.h"
+#include "undoers/stored_data.h"
 #include "undoers/undoer_base.h"
 
-#include <vector>
-
 class Image;
 
 namespace undoers {
@@ -34,7 +33,7 @@ public:
   ImageArea(undo::ObjectsContainer* objects, Image* image, int x, int y, int w, int h);
 
   void dispose() OVERRIDE;
-  size_t getMemSize() const OVERRIDE { return sizeof(*this) + m_data.size(); }
+  size_t getMemSize() const OVERRIDE { return sizeof(*this) + m_data.getMemSize(); }
   void revert(undo::ObjectsContainer* objects, undo::UndoersCollector* redoers) OVERRIDE;
 
 private:
@@ -42,7 +41,7 @@ private:
   uint8_t m_format;
   uint16_t m_x, m_y, m_w, m_h;
   uint32_t m_lineSize;
-  std::vector<uint8_t> m_data;
+  StoredData m_data;
 };
 
 } // namespace undoers
@@ -29,13 +29,17 @@
 #include "undoers/add_cel.h"
 #include "undoers/object_io.h"
 
+#include <sstream>
+
 using namespace undo;
 using namespace undoers;
 
 RemoveCel::RemoveCel(ObjectsContainer* objects, Layer* layer, Cel* cel)
   : m_layerId(objects->addObject(layer))
 {
-  write_object(objects, m_stream, cel, raster::write_cel);
+  std::stringstream stream;
+  write_object(objects, stream, cel, raster::write_cel);
+  m_data.store(stream);
 }
 
 void RemoveCel::dispose()
@@ -46,7 +50,9 @@ void RemoveCel::dispose()
 void RemoveCel::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 {
   LayerImage* layer = objects->getObjectT<LayerImage>(m_layerId);
-  Cel* cel = read_object<Cel>(objects, m_stream, raster::read_cel);
+  std::stringstream stream;
+  m_data.load(stream);
+  Cel* cel = read_object<Cel>(objects, stream, raster::read_cel);
 
   // Push an AddCel as redoer
   redoers->pushUndoer(new AddCel(objects, layer, cel));
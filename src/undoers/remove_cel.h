@@ -20,10 +20,9 @@
 #define UNDOERS_REMOVE_CEL_H_INCLUDED
 
 #include "undo/object_id.h"
+#include "undoers/stored_data.h"
 #include "undoers/undoer_base.h"
 
-#include <sstream>
-
 class Cel;
 class Layer;
 
@@ -35,16 +34,12 @@ public:
   RemoveCel(undo::ObjectsContainer* objects, Layer* layer, Cel* cel);
 
   void dispose() OVERRIDE;
-  size_t getMemSize() const OVERRIDE { return sizeof(*this) + getStreamSize(); }
+  size_t getMemSize() const OVERRIDE { return sizeof(*this) + m_data.getMemSize(); }
   void revert(undo::ObjectsContainer* objects, undo::UndoersCollector* redoers) OVERRIDE;
 
 private:
-  size_t getStreamSize() const {
-    return const_cast<std::stringstream*>(&m_stream)->tellp();
-  }
-
   undo::ObjectId m_layerId;
-  std::stringstream m_stream;
+  StoredData m_data;
 };
 
 } // namespace undoers
@@ -28,6 +28,8 @@
 #include "undoers/add_image.h"
 #include "undoers/object_io.h"
 
+#include <sstream>
+
 using namespace undo;
 using namespace undoers;
 
@@ -37,7 +39,9 @@ RemoveImage::RemoveImage(ObjectsContainer* objects, Stock* stock, int imageIndex
 {
   Image* image = stock->getImage(imageIndex);
 
-  write_object(objects, m_stream, image, raster::write_image);
+  std::stringstream stream;
+  write_object(objects, stream, image, raster::write_image);
+  m_data.store(stream);
 }
 
 void RemoveImage::dispose()
@@ -48,7 +52,9 @@ void RemoveImage::dispose()
 void RemoveImage::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 {
   Stock* stock = objects->getObjectT<Stock>(m_stockId);
-  Image* image = read_object<Image>(objects, m_stream, raster::read_image);
+  std::stringstream stream;
+  m_data.load(stream);
+  Image* image = read_object<Image>(objects, stream, raster::read_image);
 
   // Push an AddImage as redoer
   redoers->pushUndoer(new AddImage(objects, stock, m_imageIndex));
@@ -33,6 +33,8 @@
 #include "undoers/add_layer.h"
 #include "undoers/object_io.h"
 
+#include <sstream>
+
 using namespace undo;
 using namespace undoers;
 
@@ -97,7 +99,9 @@ RemoveLayer::RemoveLayer(ObjectsContainer* objects, Document* document, Layer* l
   m_afterId = (after ? objects->addObject(after): 0);
 
   LayerSubObjectsSerializerImpl serializer(objects, layer->getSprite());
-  write_object(objects, m_stream, layer, serializer);
+  std::stringstream stream;
+  write_object(objects, stream, layer, serializer);
+  m_data.store(stream);
 }
 
 void RemoveLayer::dispose()
@@ -113,7 +117,9 @@ void RemoveLayer::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 
   // Read the layer from the stream
   LayerSubObjectsSerializerImpl serializer(objects, folder->getSprite());
-  Layer* layer = read_object<Layer>(objects, m_stream, serializer);
+  std::stringstream stream;
+  m_data.load(stream);
+  Layer* layer = read_object<Layer>(objects, stream, serializer);
 
   document->getApi(redoers).addLayer(folder, layer, after);
 }
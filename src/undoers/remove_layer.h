@@ -20,10 +20,9 @@
 #define UNDOERS_REMOVE_LAYER_H_INCLUDED
 
 #include "undo/object_id.h"
+#include "undoers/stored_data.h"
 #include "undoers/undoer_base.h"
 
-#include <sstream>
-
 class Document;
 class Layer;
 
@@ -35,18 +34,14 @@ public:
   RemoveLayer(undo::ObjectsContainer* objects, Document* document, Layer* layer);
 
   void dispose() OVERRIDE;
-  size_t getMemSize() const OVERRIDE { return sizeof(*this) + getStreamSize(); }
+  size_t getMemSize() const OVERRIDE { return sizeof(*this) + m_data.getMemSize(); }
   void revert(undo::ObjectsContainer* objects, undo::UndoersCollector* redoers) OVERRIDE;
 
 private:
-  size_t getStreamSize() const {
-    return const_cast<std::stringstream*>(&m_stream)->tellp();
-  }
-
   undo::ObjectId m_documentId;
   undo::ObjectId m_folderId;
   undo::ObjectId m_afterId;
-  std::stringstream m_stream;
+  StoredData m_data;
 };
 
 } // namespace undoers
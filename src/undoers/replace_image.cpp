@@ -27,6 +27,8 @@
 #include "undo/undoers_collector.h"
 #include "undoers/object_io.h"
 
+#include <sstream>
+
 using namespace undo;
 using namespace undoers;
 
@@ -36,7 +38,9 @@ ReplaceImage::ReplaceImage(ObjectsContainer* objects, Stock* stock, int imageInd
 {
   Image* image = stock->getImage(imageIndex);
 
-  write_object(objects, m_stream, image, raster::write_image);
+  std::stringstream stream;
+  write_object(objects, stream, image, raster::write_image);
+  m_data.store(stream);
 }
 
 void ReplaceImage::dispose()
@@ -49,7 +53,9 @@ void ReplaceImage::revert(ObjectsContainer* objects, UndoersCollector* redoers)
   Stock* stock = objects->getObjectT<Stock>(m_stockId);
 
   // Read the image to be restored from the stream
-  Image* image = read_object<Image>(objects, m_stream, raster::read_image);
+  std::stringstream stream;
+  m_data.load(stream);
+  Image* image = read_object<Image>(objects, stream, raster::read_image);
 
   // Save the current image in the redoers
   redoers->pushUndoer(new ReplaceImage(objects, stock, m_imageIndex));
@@ -24,20 +24,21 @@
 #include "undoers/undoer_base.h"
 
 class Cel;
-class Layer;
+class LayerImage;
 
 namespace undoers {
 
 class SetCelFrame : public UndoerBase
 {
 public:
-  SetCelFrame(undo::ObjectsContainer* objects, Cel* cel);
+  SetCelFrame(undo::ObjectsContainer* objects, LayerImage* layer, Cel* cel);
 
   void dispose() OVERRIDE;
   size_t getMemSize() const OVERRIDE { return sizeof(*this); }
   void revert(undo::ObjectsContainer* objects, undo::UndoersCollector* redoers) OVERRIDE;
 
 private:
+  undo::ObjectId m_layerId;
   undo::ObjectId m_celId;
   FrameNumber m_frame;
 };
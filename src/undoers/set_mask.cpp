@@ -27,6 +27,8 @@
 #include "undo/objects_container.h"
 #include "undo/undoers_collector.h"
 
+#include <sstream>
+
 using namespace undo;
 using namespace undoers;
 
@@ -34,8 +36,11 @@ SetMask::SetMask(ObjectsContainer* objects, Document* document)
   : m_documentId(objects->addObject(document))
   , m_isMaskVisible(document->isMaskVisible())
 {
-  if (m_isMaskVisible)
-    raster::write_mask(m_stream, document->getMask());
+  if (m_isMaskVisible) {
+    std::stringstream stream;
+    raster::write_mask(stream, document->getMask());
+    m_data.store(stream);
+  }
 }
 
 void SetMask::dispose()
@@ -51,7 +56,9 @@ void SetMask::revert(ObjectsContainer* objects, UndoersCollector* redoers)
   redoers->pushUndoer(new SetMask(objects, document));
 
   if (m_isMaskVisible) {
-    UniquePtr<Mask> mask(raster::read_mask(m_stream));
+    std::stringstream stream;
+    m_data.load(stream);
+    UniquePtr<Mask> mask(raster::read_mask(stream));
 
     document->setMask(mask);
 
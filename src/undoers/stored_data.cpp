@@ -0,0 +1,459 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include "undoers/stored_data.h"
+
+#include "base/fs.h"
+#include "base/mutex.h"
+#include "base/path.h"
+#include "base/scoped_lock.h"
+#include "base/sha1.h"
+#include "base/temp_dir.h"
+#include "base/unique_ptr.h"
+
+#include <cstdio>
+#include <list>
+#include <map>
+#include <new>
+#include <stdexcept>
+
+#include "zlib.h"
+
+using namespace undoers;
+
+namespace {
+
+  // Chunks of 64KB are small enough to find repeated blocks (e.g.
+  // in big images with small modifications).
+  const size_t kChunkSize = 64*1024;
+
+  const size_t kDefaultMemoryLimit = 16*1024*1024;
+
+}
+
+struct undoers::StoredChunk
+{
+  typedef std::list<StoredChunk*>::iterator ResidentIterator;
+
+  base::Sha1 hash;              // Hash of the uncompressed data
+  uint32_t size;                // Uncompressed size
+  uint32_t storedSize;          // Bytes in "data" or in the temporary file
+  bool compressed;              // False if it's stored without compression
+  std::vector<uint8_t> data;    // Empty if the chunk is in the temporary file
+  long fileOffset;
+  int refs;
+  ResidentIterator residentIt;
+};
+
+namespace {
+
+  typedef StoredData::Stats Stats;
+
+  // All the chunks used by StoredData objects.
+  class ChunksStore
+  {
+  public:
+    typedef StoredChunk Chunk;
+
+    static ChunksStore* instance();
+
+    ChunksStore()
+      : m_memoryLimit(kDefaultMemoryLimit)
+      , m_memorySize(0)
+      , m_file(NULL)
+      , m_fileSize(0)
+      , m_fileFreeSize(0)
+      , m_sharedChunks(0) {
+    }
+
+    ~ChunksStore() {
+      closeFile();
+    }
+
+    size_t getMemoryLimit() {
+      ScopedLock lock(m_mutex);
+      return m_memoryLimit;
+    }
+
+    void setMemoryLimit(size_t limit) {
+      ScopedLock lock(m_mutex);
+      m_memoryLimit = limit;
+      spill();
+    }
+
+    Stats getStats() {
+      ScopedLock lock(m_mutex);
+      Stats stats;
+      stats.chunks = m_chunks.size();
+      stats.memorySize = m_memorySize;
+      stats.fileSize = m_fileSize - m_fileFreeSize;
+      stats.fileFreeSize = m_fileFreeSize;
+      stats.sharedChunks = m_sharedChunks;
+      return stats;
+    }
+
+    // Returns the chunk with the given data (with a new reference).
+    Chunk* addChunk(const uint8_t* data, size_t size) {
+      base::Sha1 hash = base::Sha1::calculateFromData(data, size);
+      {
+        ScopedLock lock(m_mutex);
+        Chunk* chunk = findChunk(hash);
+        if (chunk)
+          return chunk;
+      }
+
+      // Compress the data (without locking the store)
+      UniquePtr<Chunk> newChunk(new Chunk);
+      newChunk->hash = hash;
+      newChunk->size = size;
+      newChunk->fileOffset = -1;
+      newChunk->refs = 1;
+
+      uLongf compressedSize = compressBound(size);
+      newChunk->data.resize(compressedSize);
+      if (compress2(&newChunk->data[0], &compressedSize, data, size, Z_BEST_SPEED) == Z_OK &&
+          compressedSize < size) {
+        newChunk->compressed = true;
+        newChunk->storedSize = compressedSize;
+        newChunk->data.resize(compressedSize);
+      }
+      else {
+        newChunk->compressed = false;
+        newChunk->storedSize = size;
+        newChunk->data.assign(data, data+size);
+      }
+      // Free the extra capacity
+      std::vector<uint8_t>(newChunk->data).swap(newChunk->data);
+
+      ScopedLock lock(m_mutex);
+
+      // Other thread could add the same chunk in the meantime
+      Chunk* chunk = findChunk(hash);
+      if (chunk)
+        return chunk;
+
+      m_resident.push_back(newChunk.get());
+      try {
+        m_chunks.insert(std::make_pair(hash, newChunk.get()));
+      }
+      catch (...) {
+        m_resident.pop_back();
+        throw;
+      }
+      newChunk->residentIt = --m_resident.end();
+      m_memorySize += newChunk->storedSize;
+
+      spill();
+      return newChunk.release();
+    }
+
+    void releaseChunk(Chunk* chunk) {
+      ScopedLock lock(m_mutex);
+      if (--chunk->refs > 0)
+        return;
+
+      m_chunks.erase(chunk->hash);
+      if (chunk->fileOffset < 0) {
+        m_resident.erase(chunk->residentIt);
+        m_memorySize -= chunk->storedSize;
+      }
+      else
+        freeExtent(chunk->fileOffset, chunk->storedSize);
+      delete chunk;
+
+      // Delete the temporary file when it's not needed anymore.
+      if (m_chunks.empty())
+        closeFile();
+    }
+
+    // Appends the uncompressed data of the chunk to "data".
+    void readChunk(Chunk* chunk, std::vector<uint8_t>& data) {
+      size_t pos = data.size();
+      data.resize(pos + chunk->size);
+
+      ScopedLock lock(m_mutex);
+      std::vector<uint8_t> fileData;
+      const uint8_t* src;
+
+      if (chunk->fileOffset >= 0) {
+        fileData.resize(chunk->storedSize);
+        if (fseek(m_file, chunk->fileOffset, SEEK_SET) != 0 ||
+            fread(&fileData[0], 1, chunk->storedSize, m_file) != chunk->storedSize)
+          throw std::runtime_error("Error reading undo data from the temporary file");
+        src = &fileData[0];
+      }
+      else
+        src = &chunk->data[0];
+
+      if (chunk->compressed) {
+        uLongf size = chunk->size;
+        if (uncompress(&data[pos], &size, src, chunk->storedSize) != Z_OK ||
+            size != chunk->size)
+          throw std::runtime_error("Error uncompressing undo data");
+      }
+      else
+        std::copy(src, src+chunk->size, data.begin()+pos);
+    }
+
+  private:
+    Chunk* findChunk(const base::Sha1& hash) {
+      std::map<base::Sha1, Chunk*>::iterator it = m_chunks.find(hash);
+      if (it != m_chunks.end()) {
+        ++it->second->refs;
+        ++m_sharedChunks;
+        return it->second;
+      }
+      else
+        return NULL;
+    }
+
+    // Moves the oldest chunks to the temporary file until the memory
+    // limit is satisfied. If the file cannot be used, chunks are kept
+    // in memory.
+    void spill() {
+      while (m_memorySize > m_memoryLimit && !m_resident.empty()) {
+        if (!openFile())
+          return;
+
+        Chunk* chunk = m_resident.front();
+        long offset = allocExtent(chunk->storedSize);
+        if (fseek(m_file, offset, SEEK_SET) != 0 ||
+            fwrite(&chunk->data[0], 1, chunk->storedSize, m_file) != chunk->storedSize) {
+          freeExtent(offset, chunk->storedSize);
+          return;
+        }
+
+        chunk->fileOffset = offset;
+        m_memorySize -= chunk->storedSize;
+        std::vector<uint8_t>().swap(chunk->data);
+        m_resident.pop_front();
+      }
+    }
+
+    // Returns the offset of the file where "size" bytes can be
+    // written. It re-uses the smallest released extent where the data
+    // fits, or the end of the file.
+    long allocExtent(size_t size) {
+      std::map<long, size_t>::iterator best = m_freeExtents.end();
+      for (std::map<long, size_t>::iterator it = m_freeExtents.begin(), end = m_freeExtents.end();
+           it != end; ++it) {
+        if (it->second >= size &&
+            (best == m_freeExtents.end() || it->second < best->second))
+          best = it;
+      }
+
+      if (best == m_freeExtents.end()) {
+        long offset = m_fileSize;
+        m_fileSize += size;
+        return offset;
+      }
+
+      long offset = best->first;
+      size_t rest = best->second - size;
+      m_freeExtents.erase(best);
+      if (rest > 0)
+        m_freeExtents[offset+size] = rest;
+      m_fileFreeSize -= size;
+      return offset;
+    }
+
+    // Marks the given bytes of the file as free, joining them with the
+    // adjacent free extents. Free extents at the end of the file are
+    // removed (so the file grows from there).
+    void freeExtent(long offset, size_t size) {
+      std::map<long, size_t>::iterator next = m_freeExtents.lower_bound(offset);
+      m_fileFreeSize += size;
+
+      if (next != m_freeExtents.end() && offset + (long)size == next->first) {
+        size += next->second;
+        m_freeExtents.erase(next++);
+      }
+
+      if (next != m_freeExtents.begin()) {
+        std::map<long, size_t>::iterator prev = next;
+        --prev;
+        if (prev->first + (long)prev->second == offset) {
+          offset = prev->first;
+          size += prev->second;
+          m_freeExtents.erase(prev);
+        }
+      }
+
+      if (offset + (long)size == m_fileSize) {
+        m_fileSize = offset;
+        m_fileFreeSize -= size;
+      }
+      else
+        m_freeExtents[offset] = size;
+    }
+
+    bool openFile() {
+      if (m_file)
+        return true;
+
+      try {
+        m_tempDir.reset(new base::TempDir("aseprite-undo"));
+        m_fileName = base::join_path(m_tempDir->path(), "undo.dat");
+        m_file = fopen(m_fileName.c_str(), "w+b");
+      }
+      catch (...) {
+        // The temporary directory cannot be created
+      }
+
+      if (!m_file) {
+        m_tempDir.reset(NULL);
+        return false;
+      }
+      m_fileSize = 0;
+      return true;
+    }
+
+    void closeFile() {
+      if (!m_file)
+        return;
+
+      fclose(m_file);
+      m_file = NULL;
+      m_fileSize = 0;
+      m_fileFreeSize = 0;
+      m_freeExtents.clear();
+      try {
+        base::delete_file(m_fileName);
+        m_tempDir.reset(NULL);
+      }
+      catch (...) {
+        // The directory is left in the temporary folder
+        m_tempDir.release();
+      }
+    }
+
+    Mutex m_mutex;
+    std::map<base::Sha1, Chunk*> m_chunks;
+    std::list<Chunk*> m_resident;   // Chunks in memory (from oldest to newest)
+    size_t m_memoryLimit;
+    size_t m_memorySize;
+    UniquePtr<base::TempDir> m_tempDir;
+    std::string m_fileName;
+    FILE* m_file;
+    long m_fileSize;                       // End of the used part of the file
+    size_t m_fileFreeSize;                 // Bytes in m_freeExtents
+    std::map<long, size_t> m_freeExtents;  // Released parts of the file (offset -> size)
+    size_t m_sharedChunks;
+  };
+
+  // The store is created before main() (and not in the first use)
+  // because StoredData objects are used from several threads.
+  ChunksStore g_store;
+
+  ChunksStore* ChunksStore::instance() {
+    return &g_store;
+  }
+
+}
+
+StoredData::StoredData()
+  : m_size(0)
+  , m_memSize(0)
+{
+}
+
+StoredData::~StoredData()
+{
+  clear();
+}
+
+void StoredData::store(const uint8_t* data, size_t size)
+{
+  ChunksStore* store = ChunksStore::instance();
+
+  clear();
+  try {
+    m_chunks.reserve((size + kChunkSize - 1) / kChunkSize);
+
+    for (size_t pos=0; pos<size; pos+=kChunkSize)
+      m_chunks.push_back(store->addChunk(data+pos, MIN(kChunkSize, size-pos)));
+    m_size = size;
+
+    // The stored size of a chunk doesn't change after it's created
+    m_memSize = m_chunks.capacity() * sizeof(StoredChunk*);
+    for (std::vector<StoredChunk*>::const_iterator it = m_chunks.begin(), end = m_chunks.end();
+         it != end; ++it)
+      m_memSize += sizeof(StoredChunk) + (*it)->storedSize;
+  }
+  catch (...) {
+    clear();
+    throw;
+  }
+}
+
+void StoredData::store(const std::stringstream& stream)
+{
+  std::string data = stream.str();
+  store((const uint8_t*)data.c_str(), data.size());
+}
+
+void StoredData::load(std::vector<uint8_t>& data) const
+{
+  ChunksStore* store = ChunksStore::instance();
+
+  data.clear();
+  data.reserve(m_size);
+  for (std::vector<StoredChunk*>::const_iterator it = m_chunks.begin(), end = m_chunks.end();
+       it != end; ++it)
+    store->readChunk(*it, data);
+}
+
+void StoredData::load(std::stringstream& stream) const
+{
+  std::vector<uint8_t> data;
+  load(data);
+  stream.str(std::string(data.begin(), data.end()));
+}
+
+void StoredData::clear()
+{
+  ChunksStore* store = ChunksStore::instance();
+
+  for (std::vector<StoredChunk*>::iterator it = m_chunks.begin(), end = m_chunks.end();
+       it != end; ++it)
+    store->releaseChunk(*it);
+
+  m_chunks.clear();
+  m_size = 0;
+  m_memSize = 0;
+}
+
+// static
+size_t StoredData::getMemoryLimit()
+{
+  return ChunksStore::instance()->getMemoryLimit();
+}
+
+// static
+void StoredData::setMemoryLimit(size_t limit)
+{
+  ChunksStore::instance()->setMemoryLimit(limit);
+}
+
+// static
+StoredData::Stats StoredData::getStats()
+{
+  return ChunksStore::instance()->getStats();
+}
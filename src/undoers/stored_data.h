@@ -0,0 +1,84 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UNDOERS_STORED_DATA_H_INCLUDED
+#define UNDOERS_STORED_DATA_H_INCLUDED
+
+#include "base/disable_copying.h"
+
+#include <sstream>
+#include <vector>
+
+namespace undoers {
+
+struct StoredChunk;
+
+// Storage of the data of undoers (pixels, serialized objects, etc.).
+//
+// The data is split in chunks which are compressed with zlib and
+// shared between all undoers with the same content (e.g. the same
+// area of an image that wasn't modified between two undoers). When
+// the compressed chunks in memory exceed getMemoryLimit(), the
+// oldest ones are moved to a temporary file. The memory limit is the
+// "Options/UndoMemoryLimit" setting (see App).
+class StoredData
+{
+public:
+  struct Stats {
+    size_t chunks;              // Number of different chunks
+    size_t memorySize;          // Bytes of compressed chunks in memory
+    size_t fileSize;            // Bytes of compressed chunks in the temporary file
+    size_t fileFreeSize;        // Bytes of released chunks in the temporary file (re-used by new chunks)
+    size_t sharedChunks;        // Times that an existent chunk was re-used
+  };
+
+  StoredData();
+  ~StoredData();
+
+  void store(const uint8_t* data, size_t size);
+  void store(const std::stringstream& stream);
+
+  void load(std::vector<uint8_t>& data) const;
+  void load(std::stringstream& stream) const;
+
+  // Size of the original data.
+  size_t getSize() const { return m_size; }
+
+  // Space used by this data: the compressed size of all its chunks,
+  // in memory or in the temporary file. Shared chunks are counted in
+  // each StoredData using them, so the size doesn't change after
+  // store() and the undo size limit bounds the temporary file too.
+  size_t getMemSize() const { return m_memSize; }
+
+  static size_t getMemoryLimit();
+  static void setMemoryLimit(size_t limit);
+  static Stats getStats();
+
+private:
+  void clear();
+
+  std::vector<StoredChunk*> m_chunks;
+  size_t m_size;
+  size_t m_memSize;
+
+  DISABLE_COPYING(StoredData);
+};
+
+} // namespace undoers
+
+#endif  // UNDOERS_STORED_DATA_H_INCLUDED
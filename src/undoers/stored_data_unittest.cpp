@@ -0,0 +1,185 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "undoers/stored_data.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace undoers;
+
+namespace {
+
+  std::vector<uint8_t> create_data(size_t size, int seed)
+  {
+    std::srand(seed);
+    std::vector<uint8_t> data(size);
+    for (size_t i=0; i<size; ++i)
+      data[i] = std::rand() % 8;  // Compressible data
+    return data;
+  }
+
+}
+
+TEST(StoredData, StoreAndLoad)
+{
+  std::vector<uint8_t> original = create_data(300*1024 + 17, 1);
+  std::vector<uint8_t> loaded;
+
+  StoredData data;
+  data.store(&original[0], original.size());
+  EXPECT_EQ(original.size(), data.getSize());
+  EXPECT_LT(data.getMemSize(), original.size() / 2);
+
+  data.load(loaded);
+  EXPECT_TRUE(original == loaded);
+
+  std::stringstream stream;
+  stream << "Hello World";
+  data.store(stream);
+
+  std::stringstream stream2;
+  data.load(stream2);
+  EXPECT_EQ("Hello World", stream2.str());
+}
+
+TEST(StoredData, SharedChunks)
+{
+  std::vector<uint8_t> original = create_data(256*1024, 2);
+  StoredData::Stats stats = StoredData::getStats();
+  {
+    StoredData data1, data2;
+    data1.store(&original[0], original.size());
+    EXPECT_EQ(stats.chunks+4, StoredData::getStats().chunks);
+
+    // All chunks are shared
+    data2.store(&original[0], original.size());
+    EXPECT_EQ(stats.chunks+4, StoredData::getStats().chunks);
+    EXPECT_EQ(stats.sharedChunks+4, StoredData::getStats().sharedChunks);
+
+    // Shared chunks are counted in each owner, and the size of the
+    // data doesn't change when other owners are added
+    EXPECT_EQ(data1.getMemSize(), data2.getMemSize());
+    {
+      StoredData data4;
+      size_t size = data1.getMemSize();
+      data4.store(&original[0], original.size());
+      EXPECT_EQ(size, data1.getMemSize());
+    }
+
+    // Modify only one chunk
+    original[70*1024] ^= 1;
+    StoredData data3;
+    data3.store(&original[0], original.size());
+    EXPECT_EQ(stats.chunks+5, StoredData::getStats().chunks);
+
+    std::vector<uint8_t> loaded;
+    data3.load(loaded);
+    EXPECT_TRUE(original == loaded);
+    original[70*1024] ^= 1;
+    data1.load(loaded);
+    EXPECT_TRUE(original == loaded);
+  }
+  EXPECT_EQ(stats.chunks, StoredData::getStats().chunks);
+}
+
+TEST(StoredData, MoveChunksToFile)
+{
+  size_t oldLimit = StoredData::getMemoryLimit();
+  StoredData::setMemoryLimit(64*1024);
+
+  std::vector<StoredData*> datas;
+  for (int i=0; i<20; ++i) {
+    std::vector<uint8_t> original = create_data(100*1024, 10+i);
+    datas.push_back(new StoredData);
+    datas.back()->store(&original[0], original.size());
+  }
+
+  StoredData::Stats stats = StoredData::getStats();
+  EXPECT_LE(stats.memorySize, 64*1024);
+  EXPECT_GT(stats.fileSize, 0);
+
+  // Chunks in the file are counted too (so the undo size limit
+  // bounds the size of the file)
+  size_t totalSize = 0;
+  for (int i=0; i<20; ++i)
+    totalSize += datas[i]->getMemSize();
+  EXPECT_GE(totalSize, stats.memorySize + stats.fileSize);
+
+  // Data from memory and from the file
+  for (int i=19; i>=0; --i) {
+    std::vector<uint8_t> loaded;
+    datas[i]->load(loaded);
+    EXPECT_TRUE(create_data(100*1024, 10+i) == loaded);
+  }
+
+  for (int i=0; i<20; ++i)
+    delete datas[i];
+
+  // The file is deleted when all chunks are released
+  EXPECT_EQ(0, StoredData::getStats().fileSize);
+
+  StoredData::setMemoryLimit(oldLimit);
+}
+
+TEST(StoredData, ReuseFileSpace)
+{
+  size_t oldLimit = StoredData::getMemoryLimit();
+  StoredData::setMemoryLimit(64*1024);
+
+  std::vector<StoredData*> datas(20);
+  for (int i=0; i<20; ++i) {
+    std::vector<uint8_t> original = create_data(100*1024, 40+i);
+    datas[i] = new StoredData;
+    datas[i]->store(&original[0], original.size());
+  }
+
+  StoredData::Stats stats = StoredData::getStats();
+  size_t fileEnd = stats.fileSize + stats.fileFreeSize;
+
+  // Release half of the data and store new data of the same size
+  for (int i=0; i<20; i+=2) {
+    delete datas[i];
+    datas[i] = NULL;
+  }
+  EXPECT_GT(StoredData::getStats().fileFreeSize, 0);
+
+  for (int i=0; i<20; i+=2) {
+    std::vector<uint8_t> original = create_data(100*1024, 60+i);
+    datas[i] = new StoredData;
+    datas[i]->store(&original[0], original.size());
+  }
+
+  // The released space of the file was re-used
+  stats = StoredData::getStats();
+  EXPECT_LE(stats.fileSize + stats.fileFreeSize, fileEnd + 100*1024);
+
+  for (int i=0; i<20; ++i) {
+    std::vector<uint8_t> loaded;
+    datas[i]->load(loaded);
+    EXPECT_TRUE(create_data(100*1024, (i % 2 == 0 ? 60: 40)+i) == loaded);
+    delete datas[i];
+  }
+
+  EXPECT_EQ(0, StoredData::getStats().fileSize);
+  EXPECT_EQ(0, StoredData::getStats().fileFreeSize);
+
+  StoredData::setMemoryLimit(oldLimit);
+}
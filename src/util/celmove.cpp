@@ -89,9 +89,11 @@ void move_cel(ContextWriter& writer)
   if (src_cel != NULL) {
     if (src_layer == dst_layer) {
       if (undo.isEnabled())
-        undo.pushUndoer(new undoers::SetCelFrame(undo.getObjects(), src_cel));
+        undo.pushUndoer(new undoers::SetCelFrame(undo.getObjects(),
+                                                 static_cast<LayerImage*>(src_layer),
+                                                 src_cel));
 
-      src_cel->setFrame(dst_frame);
+      static_cast<LayerImage*>(src_layer)->moveCel(src_cel, dst_frame);
     }
     /* move the cel in different layers */
     else {
@@ -21,61 +21,86 @@
 #include "util/render.h"
 
 #include "app/color_utils.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread_pool.h"
+#include "base/unique_ptr.h"
 #include "document.h"
 #include "ini_file.h"
 #include "raster/raster.h"
 #include "settings/document_settings.h"
 #include "settings/settings.h"
 #include "ui_context.h"
+#include "util/render_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <vector>
 
 //////////////////////////////////////////////////////////////////////
 // Zoomed merge
 
+// Blends "n" pixels of "src" over "back" and puts the result in
+// "scanline" (pixels equal to the mask color keep the "back" value).
 template<class DstTraits, class SrcTraits>
 class BlenderHelper
 {
-  BLEND_COLOR m_blend_color;
-  uint32_t m_mask_color;
+  typename SrcTraits::span_blender_t m_blender;
+  typename SrcTraits::pixel_t m_mask_color;
+  const typename SrcTraits::pixel_t* m_mask;
 public:
   BlenderHelper(const Image* src, const Palette* pal, int blend_mode)
   {
-    m_blend_color = SrcTraits::get_blender(blend_mode);
+    m_blender = SrcTraits::get_span_blender(blend_mode);
     m_mask_color = src->mask_color;
+    m_mask = (m_mask_color == src->mask_color ? &m_mask_color: NULL);
   }
-  inline void operator()(typename DstTraits::address_t& scanline_address,
-                         typename DstTraits::address_t& dst_address,
-                         typename SrcTraits::address_t& src_address,
-                         int opacity)
+  inline void operator()(typename DstTraits::address_t scanline,
+                         typename DstTraits::const_address_t back,
+                         typename SrcTraits::const_address_t src,
+                         int n, int opacity)
   {
-    if (*src_address != m_mask_color)
-      *scanline_address = (*m_blend_color)(*dst_address, *src_address, opacity);
-    else
-      *scanline_address = *dst_address;
+    (*m_blender)(scanline, back, src, n, opacity, m_mask);
   }
 };
 
 template<>
 class BlenderHelper<RgbTraits, GrayscaleTraits>
 {
-  BLEND_COLOR m_blend_color;
-  uint32_t m_mask_color;
+  BLEND_RGBA_SPAN m_blender;
+  RgbTraits::pixel_t m_mask_color;
+  const RgbTraits::pixel_t* m_mask;
+  std::vector<RgbTraits::pixel_t> m_src;
 public:
   BlenderHelper(const Image* src, const Palette* pal, int blend_mode)
   {
-    m_blend_color = RgbTraits::get_blender(blend_mode);
-    m_mask_color = src->mask_color;
+    m_blender = RgbTraits::get_span_blender(blend_mode);
+
+    // The conversion from gray to RGB is injective, so we can compare
+    // converted pixels against the converted mask color
+    if (src->mask_color <= 0xffff) {
+      int v = _graya_getv(src->mask_color);
+      m_mask_color = _rgba(v, v, v, _graya_geta(src->mask_color));
+      m_mask = &m_mask_color;
+    }
+    else
+      m_mask = NULL;
   }
-  inline void operator()(RgbTraits::address_t& scanline_address,
-                         RgbTraits::address_t& dst_address,
-                         GrayscaleTraits::address_t& src_address,
-                         int opacity)
+  inline void operator()(RgbTraits::address_t scanline,
+                         RgbTraits::const_address_t back,
+                         GrayscaleTraits::const_address_t src,
+                         int n, int opacity)
   {
-    if (*src_address != m_mask_color) {
-      int v = _graya_getv(*src_address);
-      *scanline_address = (*m_blend_color)(*dst_address, _rgba(v, v, v, _graya_geta(*src_address)), opacity);
+    if ((int)m_src.size() < n)
+      m_src.resize(n);
+
+    for (int x=0; x<n; ++x) {
+      int v = _graya_getv(src[x]);
+      m_src[x] = _rgba(v, v, v, _graya_geta(src[x]));
     }
-    else
-      *scanline_address = *dst_address;
+
+    (*m_blender)(scanline, back, &m_src[0], n, opacity, m_mask);
   }
 };
 
@@ -92,20 +117,21 @@ public:
     m_mask_color = src->mask_color;
     m_pal = pal;
   }
-  inline void operator()(RgbTraits::address_t& scanline_address,
-                         RgbTraits::address_t& dst_address,
-                         IndexedTraits::address_t& src_address,
-                         int opacity)
+  inline void operator()(RgbTraits::address_t scanline,
+                         RgbTraits::const_address_t back,
+                         IndexedTraits::const_address_t src,
+                         int n, int opacity)
   {
-    if (m_blend_mode == BLEND_MODE_COPY) {
-      *scanline_address = m_pal->getEntry(*src_address);
-    }
-    else {
-      if (*src_address != m_mask_color) {
-        *scanline_address = _rgba_blend_normal(*dst_address, m_pal->getEntry(*src_address), opacity);
+    for (int x=0; x<n; ++x) {
+      if (m_blend_mode == BLEND_MODE_COPY) {
+        scanline[x] = m_pal->getEntry(src[x]);
+      }
+      else {
+        if (src[x] != m_mask_color)
+          scanline[x] = _rgba_blend_normal(back[x], m_pal->getEntry(src[x]), opacity);
+        else
+          scanline[x] = back[x];
       }
-      else
-        *scanline_address = *dst_address;
     }
   }
 };
@@ -177,6 +203,11 @@ static void merge_zoomed_image(Image* dst, const Image* src, const Palette* pal,
   // the scanline variable is used to blend src/dst pixels one time for each pixel
   scanline = new typename DstTraits::pixel_t[src_w];
 
+  // pixels of 'dst' below each pixel of 'src' (only needed with zoom)
+  typename DstTraits::pixel_t* back = (zoom > 0 ? new typename DstTraits::pixel_t[src_w]: NULL);
+  typename DstTraits::const_address_t back_address;
+  int n;
+
   // for each line to draw of the source image...
   for (y=0; y<src_h; y++) {
     ASSERT(src_x >= 0 && src_x < src->w);
@@ -186,32 +217,33 @@ static void merge_zoomed_image(Image* dst, const Image* src, const Palette* pal,
     src_address = image_address_fast<SrcTraits>(src, src_x, src_y);
     dst_address = image_address_fast<DstTraits>(dst, dst_x, dst_y);
     dst_address_end = dst_address + dst_w;
-    scanline_address = scanline;
-
-    // read 'src' and 'dst' and blend them, put the result in `scanline'
-    for (x=0; x<src_w; x++) {
-      ASSERT(scanline_address >= scanline);
-      ASSERT(scanline_address <  scanline + src_w);
 
-      ASSERT(src_address >= image_address_fast<SrcTraits>(src, src_x, src_y));
-      ASSERT(src_address <= image_address_fast<SrcTraits>(src, src_x+src_w-1, src_y));
-      ASSERT(dst_address >= image_address_fast<DstTraits>(dst, dst_x, dst_y));
-      ASSERT(dst_address <= image_address_fast<DstTraits>(dst, dst_x+dst_w-1, dst_y));
-      ASSERT(dst_address <  dst_address_end);
+    // read the 'dst' pixels to be blended with 'src'
+    if (back) {
+      for (n=0; n<src_w; ) {
+        ASSERT(dst_address >= image_address_fast<DstTraits>(dst, dst_x, dst_y));
+        ASSERT(dst_address <  dst_address_end);
 
-      blender(scanline_address, dst_address, src_address, opacity);
+        back[n++] = *dst_address;
 
-      src_address++;
-      if ((x == 0) && (first_box_w > 0))
-        dst_address += first_box_w;
-      else
-        dst_address += box_w;
-      scanline_address++;
+        if ((n == 1) && (first_box_w > 0))
+          dst_address += first_box_w;
+        else
+          dst_address += box_w;
 
-      if (dst_address >= dst_address_end)
-        break;
+        if (dst_address >= dst_address_end)
+          break;
+      }
+      back_address = back;
+    }
+    else {
+      n = MIN(src_w, dst_w);
+      back_address = dst_address;
     }
 
+    // blend 'src' and 'dst', put the result in `scanline'
+    blender(scanline, back_address, src_address, n, opacity);
+
     // get the 'height' of the line to be painted in 'dst'
     if ((y == 0) && (first_box_h > 0))
       line_h = first_box_h;
@@ -273,6 +305,7 @@ done_with_line:;
 
 done_with_blit:;
   delete[] scanline;
+  delete[] back;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -283,10 +316,18 @@ static bool checked_bg_zoom;
 static app::Color checked_bg_color1;
 static app::Color checked_bg_color2;
 
-static int global_opacity = 255;
+static bool multithreaded_render;
+
 static const Layer* selected_layer = NULL;
 static Image* rastering_image = NULL;
 
+// Size of each tile (in zoomed pixels) when the sprite is rendered
+// with several threads.
+static const int kRenderTileSize = 128;
+
+// Worker threads used to render tiles (created on demand).
+static UniquePtr<base::thread_pool> render_pool;
+
 // static
 void RenderEngine::loadConfig()
 {
@@ -295,6 +336,7 @@ void RenderEngine::loadConfig()
   checked_bg_zoom = get_config_bool("Options", "CheckedBgZoom", true);
   checked_bg_color1 = get_config_color("Options", "CheckedBgColor1", app::Color::fromRgb(128, 128, 128));
   checked_bg_color2 = get_config_color("Options", "CheckedBgColor2", app::Color::fromRgb(192, 192, 192));
+  multithreaded_render = get_config_bool("Options", "MultithreadedRender", true);
 }
 
 // static
@@ -349,16 +391,258 @@ void RenderEngine::setCheckedBgColor2(const app::Color& color)
   set_config_color("Options", "CheckedBgColor2", color);
 }
 
+// static
+bool RenderEngine::getMultithreadedRender()
+{
+  return multithreaded_render;
+}
+
+// static
+void RenderEngine::setMultithreadedRender(bool state)
+{
+  multithreaded_render = state;
+  set_config_bool("Options", "MultithreadedRender", state);
+}
+
 //////////////////////////////////////////////////////////////////////
 
+// Returns the size of each tile of the checked background (in
+// zoomed pixels).
+static void get_checked_bg_tile_size(int zoom, int* tile_w, int* tile_h)
+{
+  switch (checked_bg_type) {
+
+    case RenderEngine::CHECKED_BG_16X16:
+      *tile_w = 16;
+      *tile_h = 16;
+      break;
+
+    case RenderEngine::CHECKED_BG_8X8:
+      *tile_w = 8;
+      *tile_h = 8;
+      break;
+
+    case RenderEngine::CHECKED_BG_4X4:
+      *tile_w = 4;
+      *tile_h = 4;
+      break;
+
+    case RenderEngine::CHECKED_BG_2X2:
+      *tile_w = 2;
+      *tile_h = 2;
+      break;
+
+    default:
+      *tile_w = 16;
+      *tile_h = 16;
+      break;
+  }
+
+  if (checked_bg_zoom) {
+    *tile_w <<= zoom;
+    *tile_h <<= zoom;
+  }
+
+  // Tile size
+  if (*tile_w < (1<<zoom)) *tile_w = (1<<zoom);
+  if (*tile_h < (1<<zoom)) *tile_h = (1<<zoom);
+}
+
+static void draw_checked_bg(Image* image, int source_x, int source_y,
+                            int tile_w, int tile_h, int c1, int c2)
+{
+  int x, y, u, v;
+
+  // Tile position (u,v) is the number of tile we start in (source_x,source_y) coordinate
+  u = (source_x / tile_w);
+  v = (source_y / tile_h);
+
+  // Position where we start drawing the first tile in "image"
+  int x_start = -(source_x % tile_w);
+  int y_start = -(source_y % tile_h);
+
+  // Draw checked background (tile by tile)
+  int u_start = u;
+  for (y=y_start-tile_h; y<image->h+tile_h; y+=tile_h) {
+    for (x=x_start-tile_w; x<image->w+tile_w; x+=tile_w) {
+      image_rectfill(image, x, y, x+tile_w-1, y+tile_h-1,
+                     (((u+v))&1)? c1: c2);
+      ++u;
+    }
+    u = u_start;
+    ++v;
+  }
+}
+
+// Copies "src" in "dst" with the given zoom. "src" is placed at
+// -source_x, -source_y (zoomed coordinates) and must cover "dst".
+static void copy_zoomed_image(Image* dst, const Image* src,
+                              int source_x, int source_y, int zoom)
+{
+  for (int y=0; y<dst->h; ++y) {
+    RgbTraits::address_t dst_address = image_address_fast<RgbTraits>(dst, 0, y);
+    RgbTraits::address_t src_address = image_address_fast<RgbTraits>(src, 0, (source_y+y) >> zoom);
+
+    if (zoom == 0) {
+      memcpy(dst_address, src_address+source_x, RgbTraits::scanline_size(dst->w));
+    }
+    else {
+      for (int x=0; x<dst->w; ++x)
+        *(dst_address++) = src_address[(source_x+x) >> zoom];
+    }
+  }
+}
+
+// Copies the pixels of the cached layers above the current one
+// ("above") which are opaque in "mask" (see RenderCache). Returns
+// false (without modifying "dst") if some pixel of the region needs
+// the layers above blended one by one.
+static bool copy_zoomed_above(Image* dst, const Image* above, const std::vector<uint8_t>& mask,
+                              int source_x, int source_y, int zoom)
+{
+  int x1 = source_x >> zoom;
+  int y1 = source_y >> zoom;
+  int x2 = (source_x+dst->w-1) >> zoom;
+  int y2 = (source_y+dst->h-1) >> zoom;
+
+  for (int y=y1; y<=y2; ++y) {
+    const uint8_t* m = &mask[y*above->w];
+    for (int x=x1; x<=x2; ++x)
+      if (m[x] == RenderCache::AboveMixed)
+        return false;
+  }
+
+  for (int y=0; y<dst->h; ++y) {
+    int v = (source_y+y) >> zoom;
+    RgbTraits::address_t dst_address = image_address_fast<RgbTraits>(dst, 0, y);
+    RgbTraits::const_address_t src_address = image_address_fast<RgbTraits>(above, 0, v);
+    const uint8_t* m = &mask[v*above->w];
+
+    for (int x=0; x<dst->w; ++x, ++dst_address) {
+      int u = (source_x+x) >> zoom;
+      if (m[u] == RenderCache::AboveOpaque)
+        *dst_address = src_address[u];
+    }
+  }
+  return true;
+}
+
+// Adds to "layers" all the readable image layers inside "layer" in
+// the same order they are rendered.
+static void collect_readable_layers(const Layer* layer, std::vector<const Layer*>& layers)
+{
+  if (!layer->isReadable())
+    return;
+
+  switch (layer->getType()) {
+
+    case GFXOBJ_LAYER_IMAGE:
+      layers.push_back(layer);
+      break;
+
+    case GFXOBJ_LAYER_FOLDER: {
+      LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
+      LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
+
+      for (; it != end; ++it)
+        collect_readable_layers(*it, layers);
+      break;
+    }
+
+  }
+}
+
+// Sets the mask color of the cel images used to render the given
+// range of frames. Images loaded on demand (see Stock::getImage())
+// are decoded here too, so the workers don't need to decode them.
+static void prepare_cel_images(const Sprite* sprite, FrameNumber first, FrameNumber last)
+{
+  std::vector<const Layer*> layers;
+  collect_readable_layers(sprite->getFolder(), layers);
+
+  int mask_color = sprite->getTransparentColor();
+  Stock* stock = sprite->getStock();
+
+  for (size_t i=0; i<layers.size(); ++i) {
+    const LayerImage* layer = static_cast<const LayerImage*>(layers[i]);
+
+    for (FrameNumber frame=first; frame<=last; ++frame) {
+      const Cel* cel = layer->getCel(frame);
+      if (cel &&
+          cel->getImage() >= 0 &&
+          cel->getImage() < stock->size()) {
+        Image* image = stock->getImage(cel->getImage());
+        if (image)
+          image->mask_color = mask_color;
+      }
+    }
+  }
+}
+
+// Renders one tile of the sprite in a worker thread and copies the
+// result to its position in the final image.
+class RenderEngine::TileTask
+{
+public:
+  TileTask(RenderEngine* engine, Image* image,
+           int x, int y, int w, int h,
+           int source_x, int source_y,
+           FrameNumber frame, int zoom,
+           char* failed)
+    : m_engine(engine), m_image(image)
+    , m_x(x), m_y(y), m_w(w), m_h(h)
+    , m_source_x(source_x), m_source_y(source_y)
+    , m_frame(frame), m_zoom(zoom)
+    , m_failed(failed) {
+  }
+
+  void operator()() {
+    try {
+      render();
+    }
+    catch (const std::bad_alloc&) {
+      // Exceptions cannot leave a worker thread, so the tile is
+      // rendered again in the calling thread (see renderSprite()).
+      *m_failed = true;
+    }
+  }
+
+  void render() {
+    UniquePtr<Image> tile(Image::create(IMAGE_RGB, m_w, m_h));
+    m_engine->renderRegion(tile, m_source_x+m_x, m_source_y+m_y, m_frame, m_zoom);
+
+    // Scanlines are copied directly (instead of using image_copy())
+    // because Image::copy() increments the modifications counter of
+    // the shared image, which is not thread-safe. renderSprite()
+    // increments it once when all tiles are finished.
+    for (int v=0; v<m_h; ++v)
+      memcpy(image_address_fast<RgbTraits>(m_image, m_x, m_y+v),
+             image_address_fast<RgbTraits>(tile, 0, v),
+             RgbTraits::scanline_size(m_w));
+  }
+
+private:
+  RenderEngine* m_engine;
+  Image* m_image;
+  int m_x, m_y, m_w, m_h;
+  int m_source_x, m_source_y;
+  FrameNumber m_frame;
+  int m_zoom;
+  char* m_failed;
+};
+
 RenderEngine::RenderEngine(const Document* document,
                            const Sprite* sprite,
                            const Layer* currentLayer,
-                           FrameNumber currentFrame)
+                           FrameNumber currentFrame,
+                           RenderCache* cache)
   : m_document(document)
   , m_sprite(sprite)
   , m_currentLayer(currentLayer)
   , m_currentFrame(currentFrame)
+  , m_cache(cache)
+  , m_useCache(false)
+  , m_useAboveCache(false)
 {
 }
 
@@ -381,162 +665,377 @@ Image* RenderEngine::renderSprite(int source_x, int source_y,
                                   FrameNumber frame, int zoom,
                                   bool draw_tiled_bg)
 {
-  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int);
   const LayerImage* background = m_sprite->getBackgroundLayer();
   bool need_checked_bg = (background != NULL ? !background->isReadable(): true);
-  uint32_t bg_color = 0;
   Image *image;
 
+  m_bgColor = 0;
+
   switch (m_sprite->getPixelFormat()) {
 
     case IMAGE_RGB:
-      zoomed_func = merge_zoomed_image<RgbTraits, RgbTraits>;
+      m_zoomedFunc = merge_zoomed_image<RgbTraits, RgbTraits>;
       break;
 
     case IMAGE_GRAYSCALE:
-      zoomed_func = merge_zoomed_image<RgbTraits, GrayscaleTraits>;
+      m_zoomedFunc = merge_zoomed_image<RgbTraits, GrayscaleTraits>;
       break;
 
     case IMAGE_INDEXED:
-      zoomed_func = merge_zoomed_image<RgbTraits, IndexedTraits>;
+      m_zoomedFunc = merge_zoomed_image<RgbTraits, IndexedTraits>;
       if (!need_checked_bg)
-        bg_color = m_sprite->getPalette(frame)->getEntry(m_sprite->getTransparentColor());
+        m_bgColor = m_sprite->getPalette(frame)->getEntry(m_sprite->getTransparentColor());
       break;
 
     default:
       return NULL;
   }
 
+  m_drawCheckedBg = (need_checked_bg && draw_tiled_bg);
+
+  // Onion-skin feature: draw the previous/next frames
+  IDocumentSettings* docSettings = UIContext::instance()
+    ->getSettings()->getDocumentSettings(m_document);
+
+  m_onionskin = docSettings->getUseOnionskin();
+  if (m_onionskin) {
+    m_onionskinPrevs = docSettings->getOnionskinPrevFrames();
+    m_onionskinNexts = docSettings->getOnionskinNextFrames();
+    m_onionskinOpacityBase = docSettings->getOnionskinOpacityBase();
+    m_onionskinOpacityStep = docSettings->getOnionskinOpacityStep();
+  }
+
+  // Use the composition of the layers below the current one if the
+  // region is inside the sprite bounds
+  m_useCache =
+    (m_cache != NULL && !m_onionskin &&
+     source_x >= 0 && source_y >= 0 &&
+     source_x+width <= (m_sprite->getWidth() << zoom) &&
+     source_y+height <= (m_sprite->getHeight() << zoom) &&
+     updateCache(frame, zoom));
+
   // Create a temporary RGB bitmap to draw all to it
   image = Image::create(IMAGE_RGB, width, height);
   if (!image)
     return NULL;
 
+  // Small regions (or single-threaded mode) are rendered directly in
+  // the calling thread.
+  if (!multithreaded_render ||
+      (width <= kRenderTileSize && height <= kRenderTileSize)) {
+    renderRegion(image, source_x, source_y, frame, zoom);
+    return image;
+  }
+
+  if (!render_pool)
+    render_pool.reset(new base::thread_pool);
+
+  // Images are shared by all tiles, so their mask color must be set
+  // before the workers start reading them (see renderLayer()).
+  if (m_onionskin)
+    prepare_cel_images(m_sprite,
+                       frame.previous(m_onionskinPrevs),
+                       frame.next(m_onionskinNexts));
+  else
+    prepare_cel_images(m_sprite, frame, frame);
+
+  if (rastering_image)
+    rastering_image->mask_color = m_sprite->getTransparentColor();
+
+  // Each tile composites all layers in its own image, as every pixel
+  // depends only on the pixels of the same position in each layer
+  // the result is the same as rendering the whole region at once.
+  std::vector<TileTask> tiles;
+  std::vector<char> failed;
+  for (int y=0; y<height; y+=kRenderTileSize)
+    for (int x=0; x<width; x+=kRenderTileSize)
+      failed.push_back(false);
+
+  for (int y=0; y<height; y+=kRenderTileSize) {
+    for (int x=0; x<width; x+=kRenderTileSize) {
+      tiles.push_back(TileTask(this, image, x, y,
+                               MIN(kRenderTileSize, width-x),
+                               MIN(kRenderTileSize, height-y),
+                               source_x, source_y, frame, zoom,
+                               &failed[tiles.size()]));
+      render_pool->execute(tiles.back());
+    }
+  }
+  render_pool->wait_all();
+
+  // Tiles that couldn't be rendered in a worker (out of memory) are
+  // rendered here, so the exception (if any) reaches the caller.
+  try {
+    for (size_t i=0; i<tiles.size(); ++i)
+      if (failed[i])
+        tiles[i].render();
+  }
+  catch (...) {
+    delete image;
+    throw;
+  }
+
+  image->incrementModifications();
+  return image;
+}
+
+// Renders the given region of the sprite (source_x, source_y,
+// image->w, image->h) in "image" using the parameters of the current
+// renderSprite() call.
+void RenderEngine::renderRegion(Image* image,
+                                int source_x, int source_y,
+                                FrameNumber frame, int zoom)
+{
+  // Start from the cached layers below the current one, and draw the
+  // rest of layers over it
+  if (m_useCache) {
+    copy_zoomed_image(image, m_cache->m_below, source_x, source_y, zoom);
+
+    renderLayer(m_currentLayer, image,
+                source_x, source_y, frame, zoom, 255,
+                true, true);
+
+    if (!m_useAboveCache ||
+        !copy_zoomed_above(image, m_cache->m_above, m_cache->m_aboveMask,
+                           source_x, source_y, zoom)) {
+      for (size_t i=m_currentLayerIndex+1; i<m_layers.size(); ++i)
+        renderLayer(m_layers[i], image,
+                    source_x, source_y, frame, zoom, 255,
+                    true, true);
+    }
+    return;
+  }
+
   // Draw checked background
-  if (need_checked_bg && draw_tiled_bg)
+  if (m_drawCheckedBg)
     renderCheckedBackground(image, source_x, source_y, zoom);
   else
-    image_clear(image, bg_color);
+    image_clear(image, m_bgColor);
 
-  // Onion-skin feature: draw the previous frame
-  IDocumentSettings* docSettings = UIContext::instance()
-    ->getSettings()->getDocumentSettings(m_document);
-
-  if (docSettings->getUseOnionskin()) {
+  if (m_onionskin) {
     // Draw background layer of the current frame with opacity=255
-    global_opacity = 255;
     renderLayer(m_sprite->getFolder(), image,
-                source_x, source_y, frame, zoom, zoomed_func,
+                source_x, source_y, frame, zoom, 255,
                 true, false);
 
     // Draw transparent layers of the previous/next frames with different opacity (<255) (it is the onion-skinning)
-    {
-      int prevs = docSettings->getOnionskinPrevFrames();
-      int nexts = docSettings->getOnionskinNextFrames();
-      int opacity_base = docSettings->getOnionskinOpacityBase();
-      int opacity_step = docSettings->getOnionskinOpacityStep();
-
-      for (FrameNumber f=frame.previous(prevs); f <= frame.next(nexts); ++f) {
-        if (f == frame || f < 0 || f > m_sprite->getLastFrame())
-          continue;
-        else if (f < frame)
-          global_opacity = opacity_base - opacity_step * ((frame - f)-1);
-        else
-          global_opacity = opacity_base - opacity_step * ((f - frame)-1);
+    for (FrameNumber f=frame.previous(m_onionskinPrevs); f <= frame.next(m_onionskinNexts); ++f) {
+      int global_opacity;
 
-        if (global_opacity > 0)
-          renderLayer(m_sprite->getFolder(), image,
-                      source_x, source_y, f, zoom, zoomed_func,
-                      false, true);
-      }
+      if (f == frame || f < 0 || f > m_sprite->getLastFrame())
+        continue;
+      else if (f < frame)
+        global_opacity = m_onionskinOpacityBase - m_onionskinOpacityStep * ((frame - f)-1);
+      else
+        global_opacity = m_onionskinOpacityBase - m_onionskinOpacityStep * ((f - frame)-1);
+
+      if (global_opacity > 0)
+        renderLayer(m_sprite->getFolder(), image,
+                    source_x, source_y, f, zoom, global_opacity,
+                    false, true);
     }
 
     // Draw transparent layers of the current frame with opacity=255
-    global_opacity = 255;
     renderLayer(m_sprite->getFolder(), image,
-                source_x, source_y, frame, zoom, zoomed_func,
+                source_x, source_y, frame, zoom, 255,
                 false, true);
   }
   // Onion-skin is disabled: just draw the current frame
   else {
     renderLayer(m_sprite->getFolder(), image,
-                source_x, source_y, frame, zoom, zoomed_func,
+                source_x, source_y, frame, zoom, 255,
                 true, true);
   }
-
-  return image;
 }
 
-// static
-void RenderEngine::renderCheckedBackground(Image* image,
-                                           int source_x, int source_y,
-                                           int zoom)
+// Re-creates the images of the cache if the layers below or above
+// the current one were modified. Returns false if the cache cannot
+// be used.
+bool RenderEngine::updateCache(FrameNumber frame, int zoom)
 {
-  int x, y, u, v;
-  int tile_w = 16;
-  int tile_h = 16;
-  int c1 = color_utils::color_for_image(checked_bg_color1, image->getPixelFormat());
-  int c2 = color_utils::color_for_image(checked_bg_color2, image->getPixelFormat());
-
-  switch (checked_bg_type) {
-
-    case CHECKED_BG_16X16:
-      tile_w = 16;
-      tile_h = 16;
-      break;
-
-    case CHECKED_BG_8X8:
-      tile_w = 8;
-      tile_h = 8;
-      break;
-
-    case CHECKED_BG_4X4:
-      tile_w = 4;
-      tile_h = 4;
-      break;
+  // Discard the images if there was some document event since the
+  // last render.
+  {
+    ScopedLock lock(m_cache->m_mutex);
+    if (!m_cache->m_valid) {
+      m_cache->m_below.reset(NULL);
+      m_cache->m_above.reset(NULL);
+      m_cache->m_valid = true;
+    }
+  }
 
-    case CHECKED_BG_2X2:
-      tile_w = 2;
-      tile_h = 2;
-      break;
+  m_layers.clear();
+  collect_readable_layers(m_sprite->getFolder(), m_layers);
+
+  m_currentLayerIndex = std::find(m_layers.begin(), m_layers.end(), m_currentLayer) - m_layers.begin();
+  if (m_currentLayerIndex == m_layers.size())
+    return false;
+
+  RenderCache::Key key;
+  key.currentLayer = m_currentLayer;
+  key.frame = frame;
+  key.zoom = zoom;
+  key.checkedBg = m_drawCheckedBg;
+  key.bgColor = m_bgColor;
+  get_checked_bg_tile_size(zoom, &key.checkedBgTileW, &key.checkedBgTileH);
+  key.checkedBgColor1 = color_utils::color_for_image(checked_bg_color1, IMAGE_RGB);
+  key.checkedBgColor2 = color_utils::color_for_image(checked_bg_color2, IMAGE_RGB);
+  key.paletteModifications = m_sprite->getPalette(frame)->getModifications();
+  key.transparentColor = m_sprite->getTransparentColor();
+
+  // The background doesn't affect the layers above
+  RenderCache::Key aboveKey = key;
+  aboveKey.checkedBg = false;
+  aboveKey.bgColor = 0;
+  aboveKey.checkedBgTileW = aboveKey.checkedBgTileH = 0;
+  aboveKey.checkedBgColor1 = aboveKey.checkedBgColor2 = 0;
+
+  // The preview image of a layer changes all the time
+  bool canCacheBelow = true;
+  bool canCacheAbove = true;
+
+  for (size_t i=0; i<m_layers.size(); ++i) {
+    if (i == m_currentLayerIndex)
+      continue;
+
+    const LayerImage* layer = static_cast<const LayerImage*>(m_layers[i]);
+    bool isBelow = (i < m_currentLayerIndex);
+
+    if (layer == selected_layer && rastering_image != NULL) {
+      if (isBelow)
+        canCacheBelow = false;
+      else
+        canCacheAbove = false;
+    }
 
+    RenderCache::LayerState state;
+    state.layer = layer;
+    state.cel = layer->getCel(frame);
+    state.image = (state.cel &&
+                   state.cel->getImage() >= 0 &&
+                   state.cel->getImage() < m_sprite->getStock()->size() ?
+                   m_sprite->getStock()->getImage(state.cel->getImage()): NULL);
+    state.imageModifications = (state.image ? state.image->getModifications(): 0);
+    state.flags = layer->getFlags();
+    state.blendMode = layer->getBlendMode();
+    state.x = (state.cel ? state.cel->getX(): 0);
+    state.y = (state.cel ? state.cel->getY(): 0);
+    state.opacity = (state.cel ? state.cel->getOpacity(): 0);
+
+    // Only layers with the normal blend mode are cached above (see
+    // the mask of opaque pixels below).
+    if (!isBelow && state.blendMode != BLEND_MODE_NORMAL)
+      canCacheAbove = false;
+
+    if (isBelow)
+      key.layers.push_back(state);
+    else
+      aboveKey.layers.push_back(state);
   }
 
-  if (checked_bg_zoom) {
-    tile_w <<= zoom;
-    tile_h <<= zoom;
+  if (!canCacheBelow)
+    return false;
+
+  // Render the layers below at sprite resolution. Each sprite pixel
+  // is a "zoom x zoom" box of the same color in the editor, so the
+  // zoomed image is the same as rendering with the given zoom.
+  if (m_cache->m_below == NULL || !(m_cache->m_belowKey == key)) {
+    m_cache->m_belowKey = key;
+    m_cache->m_below.reset(Image::create(IMAGE_RGB, m_sprite->getWidth(), m_sprite->getHeight()));
+
+    Image* below = m_cache->m_below;
+    if (m_drawCheckedBg)
+      draw_checked_bg(below, 0, 0,
+                      key.checkedBgTileW >> zoom,
+                      key.checkedBgTileH >> zoom,
+                      key.checkedBgColor1,
+                      key.checkedBgColor2);
+    else
+      image_clear(below, m_bgColor);
+
+    for (size_t i=0; i<m_currentLayerIndex; ++i)
+      renderLayer(m_layers[i], below, 0, 0, frame, 0, 255, true, true);
+
+    m_cache->m_belowOpaque = true;
+    for (int y=0; y<below->h && m_cache->m_belowOpaque; ++y) {
+      RgbTraits::const_address_t address = image_address_fast<RgbTraits>(below, 0, y);
+      for (int x=0; x<below->w; ++x, ++address)
+        if (_rgba_geta(*address) != 255) {
+          m_cache->m_belowOpaque = false;
+          break;
+        }
+    }
   }
 
-  // Tile size
-  if (tile_w < (1<<zoom)) tile_w = (1<<zoom);
-  if (tile_h < (1<<zoom)) tile_h = (1<<zoom);
+  // The same for the layers above. Over an opaque pixel, a layer
+  // pixel with alpha 255 (after the cel opacity) gives its own color,
+  // and a pixel with alpha 0 keeps the color below. So if a layer
+  // above is opaque in a pixel, the final color doesn't depend on
+  // the layers below it, and it's the same color we get blending
+  // them in a transparent image (m_above). Each layer is rendered
+  // alone to know where it's opaque or transparent.
+  m_useAboveCache = (canCacheAbove &&
+                     m_cache->m_belowOpaque &&
+                     m_currentLayerIndex+1 < m_layers.size());
+  if (m_useAboveCache) {
+    if (m_cache->m_above == NULL || !(m_cache->m_aboveKey == aboveKey)) {
+      int w = m_sprite->getWidth();
+      int h = m_sprite->getHeight();
+
+      m_cache->m_aboveKey = aboveKey;
+      m_cache->m_above.reset(Image::create(IMAGE_RGB, w, h));
+      m_cache->m_aboveMask.assign(w*h, RenderCache::AboveTransparent);
+
+      Image* above = m_cache->m_above;
+      UniquePtr<Image> layerImage(Image::create(IMAGE_RGB, w, h));
+      image_clear(above, 0);
+
+      for (size_t i=m_currentLayerIndex+1; i<m_layers.size(); ++i) {
+        renderLayer(m_layers[i], above, 0, 0, frame, 0, 255, true, true);
+
+        image_clear(layerImage, 0);
+        renderLayer(m_layers[i], layerImage, 0, 0, frame, 0, 255, true, true);
+
+        uint8_t* mask = &m_cache->m_aboveMask[0];
+        for (int y=0; y<h; ++y) {
+          RgbTraits::const_address_t address = image_address_fast<RgbTraits>(layerImage, 0, y);
+          for (int x=0; x<w; ++x, ++address, ++mask) {
+            int alpha = _rgba_geta(*address);
+            if (alpha == 255)
+              *mask = RenderCache::AboveOpaque;
+            else if (alpha > 0 && *mask == RenderCache::AboveTransparent)
+              *mask = RenderCache::AboveMixed;
+          }
+        }
+      }
+    }
+  }
+  else {
+    m_cache->m_above.reset(NULL);
+    m_cache->m_aboveMask.clear();
+  }
 
-  // Tile position (u,v) is the number of tile we start in (source_x,source_y) coordinate
-  u = (source_x / tile_w);
-  v = (source_y / tile_h);
+  return true;
+}
 
-  // Position where we start drawing the first tile in "image"
-  int x_start = -(source_x % tile_w);
-  int y_start = -(source_y % tile_h);
+// static
+void RenderEngine::renderCheckedBackground(Image* image,
+                                           int source_x, int source_y,
+                                           int zoom)
+{
+  int tile_w, tile_h;
+  get_checked_bg_tile_size(zoom, &tile_w, &tile_h);
 
-  // Draw checked background (tile by tile)
-  int u_start = u;
-  for (y=y_start-tile_h; y<image->h+tile_h; y+=tile_h) {
-    for (x=x_start-tile_w; x<image->w+tile_w; x+=tile_w) {
-      image_rectfill(image, x, y, x+tile_w-1, y+tile_h-1,
-                     (((u+v))&1)? c1: c2);
-      ++u;
-    }
-    u = u_start;
-    ++v;
-  }
+  draw_checked_bg(image, source_x, source_y, tile_w, tile_h,
+                  color_utils::color_for_image(checked_bg_color1, image->getPixelFormat()),
+                  color_utils::color_for_image(checked_bg_color2, image->getPixelFormat()));
 }
 
 // static
 void RenderEngine::renderImage(Image* rgb_image, Image* src_image, const Palette* pal,
                                int x, int y, int zoom)
 {
-  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int);
+  ZoomedFunc zoomed_func;
 
   ASSERT(rgb_image->getPixelFormat() == IMAGE_RGB && "renderImage accepts RGB destination images only");
 
@@ -565,7 +1064,7 @@ void RenderEngine::renderLayer(const Layer* layer,
                                Image *image,
                                int source_x, int source_y,
                                FrameNumber frame, int zoom,
-                               void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int),
+                               int global_opacity,
                                bool render_background,
                                bool render_transparent)
 {
@@ -604,9 +1103,12 @@ void RenderEngine::renderLayer(const Layer* layer,
           output_opacity = MID(0, cel->getOpacity(), 255);
           output_opacity = INT_MULT(output_opacity, global_opacity, t);
 
-          src_image->mask_color = m_sprite->getTransparentColor();
+          // Avoid writing the image if it's not needed, because in
+          // multithreaded mode it's being read by other threads.
+          if (src_image->mask_color != m_sprite->getTransparentColor())
+            src_image->mask_color = m_sprite->getTransparentColor();
 
-          (*zoomed_func)(image, src_image, m_sprite->getPalette(frame),
+          (*m_zoomedFunc)(image, src_image, m_sprite->getPalette(frame),
                          (cel->getX() << zoom) - source_x,
                          (cel->getY() << zoom) - source_y,
                          output_opacity,
@@ -623,7 +1125,7 @@ void RenderEngine::renderLayer(const Layer* layer,
       for (; it != end; ++it) {
         renderLayer(*it, image,
                     source_x, source_y,
-                    frame, zoom, zoomed_func,
+                    frame, zoom, global_opacity,
                     render_background,
                     render_transparent);
       }
@@ -639,7 +1141,7 @@ void RenderEngine::renderLayer(const Layer* layer,
     if (extraCel->getOpacity() > 0) {
       Image* extraImage = m_document->getExtraCelImage();
 
-      (*zoomed_func)(image, extraImage, m_sprite->getPalette(frame),
+      (*m_zoomedFunc)(image, extraImage, m_sprite->getPalette(frame),
                      (extraCel->getX() << zoom) - source_x,
                      (extraCel->getY() << zoom) - source_y,
                      extraCel->getOpacity(), BLEND_MODE_NORMAL, zoom);
@@ -22,10 +22,13 @@
 #include "app/color.h"
 #include "raster/frame_number.h"
 
+#include <vector>
+
 class Document;
 class Image;
 class Layer;
 class Palette;
+class RenderCache;
 class Sprite;
 
 class RenderEngine
@@ -34,8 +37,9 @@ public:
   RenderEngine(const Document* document,
                const Sprite* sprite,
                const Layer* currentLayer,
-               FrameNumber currentFrame);
-  
+               FrameNumber currentFrame,
+               RenderCache* cache = NULL);
+
   //////////////////////////////////////////////////////////////////////
   // Checked background configuration
 
@@ -54,6 +58,14 @@ public:
   static app::Color getCheckedBgColor2();
   static void setCheckedBgColor2(const app::Color& color);
 
+  //////////////////////////////////////////////////////////////////////
+  // Multithreaded rendering
+
+  // When it's enabled, renderSprite() splits big regions in tiles
+  // which are composited in parallel by a pool of worker threads.
+  static bool getMultithreadedRender();
+  static void setMultithreadedRender(bool state);
+
   //////////////////////////////////////////////////////////////////////
   // Preview image
 
@@ -78,11 +90,21 @@ public:
                           int x, int y, int zoom);
 
 private:
+  typedef void (*ZoomedFunc)(Image*, const Image*, const Palette*, int, int, int, int, int);
+
+  class TileTask;
+
+  void renderRegion(Image* image,
+                    int source_x, int source_y,
+                    FrameNumber frame, int zoom);
+
+  bool updateCache(FrameNumber frame, int zoom);
+
   void renderLayer(const Layer* layer,
                    Image* image,
                    int source_x, int source_y,
                    FrameNumber frame, int zoom,
-                   void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int),
+                   int global_opacity,
                    bool render_background,
                    bool render_transparent);
 
@@ -90,6 +112,25 @@ private:
   const Sprite* m_sprite;
   const Layer* m_currentLayer;
   FrameNumber m_currentFrame;
+  RenderCache* m_cache;
+
+  // Parameters of the current renderSprite() call, shared by all
+  // tiles (they are read-only while the tiles are being rendered).
+  ZoomedFunc m_zoomedFunc;
+  bool m_drawCheckedBg;
+  int m_bgColor;
+  bool m_onionskin;
+  int m_onionskinPrevs;
+  int m_onionskinNexts;
+  int m_onionskinOpacityBase;
+  int m_onionskinOpacityStep;
+
+  // Readable image layers in render order, and index of the current
+  // layer in it (used when the cache is available).
+  bool m_useCache;
+  bool m_useAboveCache;
+  std::vector<const Layer*> m_layers;
+  size_t m_currentLayerIndex;
 };
 
 #endif
@@ -0,0 +1,61 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include "util/render_cache.h"
+
+#include "base/scoped_lock.h"
+#include "document.h"
+#include "raster/image.h"
+
+RenderCache::RenderCache(Document* document)
+  : m_document(document)
+  , m_belowOpaque(false)
+  , m_valid(false)
+{
+  m_document->addObserver(this);
+}
+
+RenderCache::~RenderCache()
+{
+  m_document->removeObserver(this);
+}
+
+void RenderCache::invalidate()
+{
+  ScopedLock lock(m_mutex);
+  m_valid = false;
+}
+
+void RenderCache::onGeneralUpdate(DocumentEvent& ev)          { invalidate(); }
+void RenderCache::onAddLayer(DocumentEvent& ev)               { invalidate(); }
+void RenderCache::onAddFrame(DocumentEvent& ev)               { invalidate(); }
+void RenderCache::onAddCel(DocumentEvent& ev)                 { invalidate(); }
+void RenderCache::onRemoveLayer(DocumentEvent& ev)            { invalidate(); }
+void RenderCache::onRemoveFrame(DocumentEvent& ev)            { invalidate(); }
+void RenderCache::onRemoveCel(DocumentEvent& ev)              { invalidate(); }
+void RenderCache::onSpriteSizeChanged(DocumentEvent& ev)      { invalidate(); }
+void RenderCache::onLayerRestacked(DocumentEvent& ev)         { invalidate(); }
+void RenderCache::onLayerMergedDown(DocumentEvent& ev)        { invalidate(); }
+void RenderCache::onCelMoved(DocumentEvent& ev)               { invalidate(); }
+void RenderCache::onCelCopied(DocumentEvent& ev)              { invalidate(); }
+void RenderCache::onCelFrameChanged(DocumentEvent& ev)        { invalidate(); }
+void RenderCache::onCelPositionChanged(DocumentEvent& ev)     { invalidate(); }
+void RenderCache::onCelOpacityChanged(DocumentEvent& ev)      { invalidate(); }
+void RenderCache::onTotalFramesChanged(DocumentEvent& ev)     { invalidate(); }
@@ -0,0 +1,161 @@
+/* ASEPRITE
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef UTIL_RENDER_CACHE_H_INCLUDED
+#define UTIL_RENDER_CACHE_H_INCLUDED
+
+#include "base/compiler_specific.h"
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+#include "base/unique_ptr.h"
+#include "document_observer.h"
+#include "raster/frame_number.h"
+
+#include <vector>
+
+class Cel;
+class Document;
+class Image;
+class Layer;
+
+// Keeps the composition of all layers below the active layer (with
+// the background) of one frame, and the layers above it (in a
+// transparent RGB image), so RenderEngine only has to blend the
+// active layer between these two images while the user paints or
+// scrolls the editor.
+//
+// The cached images are re-created when RenderEngine detects a
+// change in the layers (flags, cels, positions, opacity, palette,
+// images or their pixels through Image::getModifications()). They
+// are also discarded with any document event that changes the
+// structure of the sprite (e.g. if a layer is deleted and a new one
+// is created in the same address). Pixel modification events are
+// ignored: they are notified in each step of the tool loop for the
+// active layer (which is never cached), and changes in other layers
+// are detected with Image::getModifications().
+class RenderCache : public DocumentObserver
+{
+public:
+  // Values of m_aboveMask for each pixel of the sprite.
+  enum {
+    AboveTransparent,           // No layer above changes the pixel
+    AboveOpaque,                // m_above has the final pixel
+    AboveMixed                  // Layers above must be blended one by one
+  };
+
+  RenderCache(Document* document);
+  ~RenderCache();
+
+  // Discards the cached images. It's safe to call this from any
+  // thread, the images are re-created by the next render in the GUI
+  // thread.
+  void invalidate();
+
+  // DocumentObserver implementation
+  void onGeneralUpdate(DocumentEvent& ev) OVERRIDE;
+  void onAddLayer(DocumentEvent& ev) OVERRIDE;
+  void onAddFrame(DocumentEvent& ev) OVERRIDE;
+  void onAddCel(DocumentEvent& ev) OVERRIDE;
+  void onRemoveLayer(DocumentEvent& ev) OVERRIDE;
+  void onRemoveFrame(DocumentEvent& ev) OVERRIDE;
+  void onRemoveCel(DocumentEvent& ev) OVERRIDE;
+  void onSpriteSizeChanged(DocumentEvent& ev) OVERRIDE;
+  void onLayerRestacked(DocumentEvent& ev) OVERRIDE;
+  void onLayerMergedDown(DocumentEvent& ev) OVERRIDE;
+  void onCelMoved(DocumentEvent& ev) OVERRIDE;
+  void onCelCopied(DocumentEvent& ev) OVERRIDE;
+  void onCelFrameChanged(DocumentEvent& ev) OVERRIDE;
+  void onCelPositionChanged(DocumentEvent& ev) OVERRIDE;
+  void onCelOpacityChanged(DocumentEvent& ev) OVERRIDE;
+  void onTotalFramesChanged(DocumentEvent& ev) OVERRIDE;
+
+private:
+  friend class RenderEngine;
+
+  // State of everything that affects the cached image.
+  struct LayerState {
+    const Layer* layer;
+    const Cel* cel;
+    const Image* image;
+    int imageModifications;
+    int flags, blendMode;
+    int x, y, opacity;
+
+    bool operator==(const LayerState& other) const {
+      return (layer == other.layer && cel == other.cel && image == other.image &&
+              imageModifications == other.imageModifications &&
+              flags == other.flags && blendMode == other.blendMode &&
+              x == other.x && y == other.y && opacity == other.opacity);
+    }
+  };
+
+  struct Key {
+    const Layer* currentLayer;
+    FrameNumber frame;
+    int zoom;
+    bool checkedBg;
+    int bgColor;
+    int checkedBgTileW, checkedBgTileH;
+    int checkedBgColor1, checkedBgColor2;
+    int paletteModifications;
+    int transparentColor;
+    std::vector<LayerState> layers;
+
+    Key() : currentLayer(NULL) { }
+
+    bool operator==(const Key& other) const {
+      return (currentLayer == other.currentLayer && frame == other.frame &&
+              zoom == other.zoom && checkedBg == other.checkedBg &&
+              bgColor == other.bgColor &&
+              checkedBgTileW == other.checkedBgTileW &&
+              checkedBgTileH == other.checkedBgTileH &&
+              checkedBgColor1 == other.checkedBgColor1 &&
+              checkedBgColor2 == other.checkedBgColor2 &&
+              paletteModifications == other.paletteModifications &&
+              transparentColor == other.transparentColor &&
+              layers == other.layers);
+    }
+  };
+
+  Document* m_document;
+
+  // Layers below the active layer composited in a RGB image of the
+  // sprite size (without zoom). m_belowOpaque is true if all its
+  // pixels are opaque.
+  UniquePtr<Image> m_below;
+  Key m_belowKey;
+  bool m_belowOpaque;
+
+  // Layers above the active layer composited in a transparent RGB
+  // image of the sprite size. Blending them one by one over
+  // different pixels gives different roundings, so m_above is used
+  // only in opaque pixels (where some layer above hides the rest),
+  // see m_aboveMask. It's NULL if the layers above cannot be cached.
+  UniquePtr<Image> m_above;
+  std::vector<uint8_t> m_aboveMask;
+  Key m_aboveKey;
+
+  // Set to false by document events (from any thread), checked in
+  // the GUI thread.
+  Mutex m_mutex;
+  bool m_valid;
+
+  DISABLE_COPYING(RenderCache);
+};
+
+#endif
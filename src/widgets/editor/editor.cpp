@@ -131,6 +131,7 @@ Editor::Editor(Document* document)
   , m_layer(m_sprite->getFolder()->getFirstLayer())
   , m_frame(FrameNumber(0))
   , m_zoom(0)
+  , m_renderCache(document)
   , m_mask_timer(100, this)
   , m_customizationDelegate(NULL)
   , m_docView(NULL)
@@ -401,7 +402,8 @@ void Editor::drawSpriteUnclippedRect(const gfx::Rect& rc)
   // Draw the sprite
 
   if ((width > 0) && (height > 0)) {
-    RenderEngine renderEngine(m_document, m_sprite, m_layer, m_frame);
+    RenderEngine renderEngine(m_document, m_sprite, m_layer, m_frame,
+                              &m_renderCache);
 
     // Generate the rendered image
     Image* rendered = renderEngine.renderSprite(source_x, source_y, width, height,
@@ -881,8 +883,9 @@ bool Editor::onProcessMessage(Message* msg)
       // Editor with sprite
       else {
         try {
-          // Lock the sprite to read/render it.
-          DocumentReader documentReader(m_document);
+          // Lock the sprite to read/render it (without waiting, if
+          // other thread is writing it we paint an empty background).
+          DocumentReader documentReader(m_document, 0);
           int x1, y1, x2, y2;
 
           // Draw the background outside of sprite's bounds
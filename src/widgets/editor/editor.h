@@ -28,6 +28,7 @@
 #include "ui/base.h"
 #include "ui/timer.h"
 #include "ui/widget.h"
+#include "util/render_cache.h"
 #include "widgets/editor/editor_observers.h"
 #include "widgets/editor/editor_state.h"
 #include "widgets/editor/editor_states_history.h"
@@ -199,6 +200,10 @@ private:
   FrameNumber m_frame;          // Active frame in the editor
   int m_zoom;                   // Zoom in the editor
 
+  // Layers below the active layer already composited (so we can
+  // paint fast in sprites with a lot of layers).
+  RenderCache m_renderCache;
+
   // Drawing cursor
   int m_cursor_thick;
   int m_cursor_screen_x; // Position in the screen (view)
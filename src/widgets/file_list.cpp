@@ -48,6 +48,7 @@ FileList::FileList()
   m_isearchClock = 0;
 
   m_itemToGenerateThumbnail = NULL;
+  m_firstVisibleItem = NULL;
 
   m_generateThumbnailTimer.Tick.connect(&FileList::onGenerateThumbnailTick, this);
   m_monitoringTimer.Tick.connect(&FileList::onMonitoringTick, this);
@@ -121,6 +122,7 @@ bool FileList::onProcessMessage(Message* msg)
       ui::Color fgcolor;
       BITMAP *thumbnail = NULL;
       int thumbnail_y = 0;
+      IFileItem* firstVisibleItem = NULL;
 
       // rows
       for (FileItemList::iterator
@@ -128,6 +130,9 @@ bool FileList::onProcessMessage(Message* msg)
         IFileItem* fi = *it;
         gfx::Size itemSize = getFileItemSize(fi);
 
+        if (!firstVisibleItem && y+itemSize.h > vp.y)
+          firstVisibleItem = fi;
+
         if (fi == m_selected) {
           fgcolor = theme->getColor(ThemeColor::FileListSelectedRowText);
           bgcolor = theme->getColor(ThemeColor::FileListSelectedRowFace);
@@ -236,6 +241,13 @@ bool FileList::onProcessMessage(Message* msg)
       // is the current folder empty?
       if (m_list.empty())
         draw_emptyset_symbol(ji_screen, vp, ui::rgba(194, 194, 194));
+
+      // The list was scrolled, generate thumbnails of the new visible
+      // items.
+      if (firstVisibleItem != m_firstVisibleItem) {
+        m_firstVisibleItem = firstVisibleItem;
+        m_generateThumbnailTimer.start();
+      }
       return true;
     }
 
@@ -462,9 +474,29 @@ void FileList::onGenerateThumbnailTick()
 {
   m_generateThumbnailTimer.stop();
 
+  ThumbnailGenerator* generator = ThumbnailGenerator::instance();
+
+  // Items that are not visible anymore don't need a thumbnail.
+  generator->cancelPendingThumbnails();
+
   IFileItem* fileitem = m_itemToGenerateThumbnail;
   if (fileitem)
-    ThumbnailGenerator::instance()->addWorkerToGenerateThumbnail(fileitem);
+    generator->addWorkerToGenerateThumbnail(fileitem, ThumbnailGenerator::SelectedItem);
+
+  // Generate thumbnails of visible items
+  gfx::Rect vp = View::getView(this)->getViewportBounds();
+  int y = this->rc->y1;
+
+  for (FileItemList::iterator
+         it=m_list.begin(), end=m_list.end(); it!=end && y < vp.y+vp.h; ++it) {
+    IFileItem* fi = *it;
+    gfx::Size itemSize = getFileItemSize(fi);
+
+    if (y+itemSize.h > vp.y && !fi->isFolder())
+      generator->addWorkerToGenerateThumbnail(fi, ThumbnailGenerator::VisibleItem);
+
+    y += itemSize.h;
+  }
 }
 
 gfx::Size FileList::getFileItemSize(IFileItem* fi) const
@@ -87,6 +87,10 @@ namespace widgets {
     // thumbnail to generate when the m_generateThumbnailTimer ticks.
     IFileItem* m_itemToGenerateThumbnail;
 
+    // First visible item in the viewport (to know when the list is
+    // scrolled and new thumbnails must be generated).
+    IFileItem* m_firstVisibleItem;
+
   };
 
 } // namespace widgets